@@ -0,0 +1,528 @@
+#define _GNU_SOURCE     /* sendmmsg(), recvmmsg() */
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "net/sock/udp.h"
+#include "net/sock/util.h"
+
+#include "sock_dns.h"
+#include "sock_dns_servers.h"
+#include "sock_dns_tcp.h"
+
+/* queries in flight are looked up by ID, which must stay sparse enough to
+ * find a free random one quickly */
+#define INFLIGHT_MAX        (16384U)
+#define BATCH_MAX           (1024U)
+#define ADDRS_MAX           (16U)
+#define SOCKBUF_SIZE        (4 * 1024 * 1024)
+
+typedef struct {
+    unsigned inflight;
+    unsigned batch;
+    unsigned timeout_ms;
+    unsigned tries;
+    int family;
+} _config_t;
+
+typedef struct {
+    char name[SOCK_DNS_MAX_NAME_LEN + 1];
+    uint16_t id;
+    uint8_t tries;
+    uint8_t tcp;                        /* asked again over TCP */
+    uint8_t len;
+    uint8_t qlen;                       /* header and question */
+    uint64_t sent;                      /* ms */
+    unsigned prev, next;                /* in flight, oldest first */
+    uint8_t query[SOCK_DNS_QUERYBUF_LEN];
+} _slot_t;
+
+typedef struct {
+    uint64_t names, answered, failed, retries, truncated;
+} _stats_t;
+
+sock_udp_ep_t sock_dns_server = { .family=AF_INET, .port=SOCK_DNS_PORT,
+                                  .addr.ipv4={127,0,0,1}
+                                };
+
+static _config_t _cfg = {
+    .inflight = 4096, .batch = 64, .timeout_ms = 1000, .tries = 3, .family = AF_INET,
+};
+static _stats_t _stats;
+
+/* slot _cfg.inflight is the head of the in-flight list */
+static _slot_t *_slots;
+static unsigned *_free;
+static unsigned _free_numof;
+static uint16_t _by_id[UINT16_MAX + 1];     /* slot + 1, 0 if unused */
+
+static sock_udp_t _sock;
+static sock_udp_ep_t _server;
+static sock_dns_tcp_conn_t _tcp;            /* open while replies are due */
+static unsigned _tcp_numof;
+
+static struct mmsghdr _tx[BATCH_MAX];
+static struct iovec _tx_iov[BATCH_MAX];
+static unsigned _tx_numof;
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U;
+}
+
+static void _unlink(unsigned i)
+{
+    _slots[_slots[i].prev].next = _slots[i].next;
+    _slots[_slots[i].next].prev = _slots[i].prev;
+}
+
+static void _append(unsigned i)
+{
+    unsigned head = _cfg.inflight;
+
+    _slots[i].prev = _slots[head].prev;
+    _slots[i].next = head;
+    _slots[_slots[head].prev].next = i;
+    _slots[head].prev = i;
+}
+
+static void _flush(void)
+{
+    for (unsigned sent = 0; sent < _tx_numof;) {
+        int res = sendmmsg(_sock.fd, &_tx[sent], _tx_numof - sent, 0);
+        if (res < 0) {
+            /* e.g. ECONNREFUSED from an earlier query, these time out
+             * and are sent again */
+            if (errno != EINTR) {
+                break;
+            }
+            continue;
+        }
+        sent += res;
+    }
+    _tx_numof = 0;
+}
+
+static void _send(unsigned i)
+{
+    _slot_t *slot = &_slots[i];
+
+    /* a fresh ID per try, a late reply to an earlier one is dropped */
+    do {
+        slot->id = sock_dns_random_id();
+    } while (_by_id[slot->id]);
+    _by_id[slot->id] = i + 1;
+    slot->query[0] = slot->id >> 8;
+    slot->query[1] = slot->id & 0xff;
+    slot->tries++;
+    slot->sent = _now();
+    _append(i);
+
+    _tx_iov[_tx_numof].iov_base = slot->query;
+    _tx_iov[_tx_numof].iov_len = slot->len;
+    _tx[_tx_numof].msg_hdr.msg_iov = &_tx_iov[_tx_numof];
+    _tx[_tx_numof].msg_hdr.msg_iovlen = 1;
+    if (++_tx_numof == _cfg.batch) {
+        _flush();
+    }
+}
+
+static void _done(unsigned i, int res, const sock_dns_addr_t *addrs)
+{
+    _slot_t *slot = &_slots[i];
+    char addrstr[INET6_ADDRSTRLEN];
+
+    if (res > 0) {
+        fputs(slot->name, stdout);
+        for (int n = 0; n < res; n++) {
+            inet_ntop(addrs[n].len == 4 ? AF_INET : AF_INET6, addrs[n].addr, addrstr,
+                    sizeof(addrstr));
+            printf(" %s", addrstr);
+        }
+        putchar('\n');
+        _stats.answered++;
+    }
+    else {
+        printf("%s error %i\n", slot->name, res);
+        _stats.failed++;
+    }
+
+    _free[_free_numof++] = i;
+}
+
+/* length of header and question of the query in @p slot */
+static uint8_t _question_len(const _slot_t *slot)
+{
+    size_t pos = sizeof(sock_dns_hdr_t);
+
+    while (slot->query[pos]) {
+        pos += slot->query[pos] + 1;
+    }
+    return pos + 1 + 4;
+}
+
+static void _start(const char *name)
+{
+    _stats.names++;
+    if (strlen(name) > SOCK_DNS_MAX_NAME_LEN) {
+        printf("%s error %i\n", name, -ENOSPC);
+        _stats.failed++;
+        return;
+    }
+
+    unsigned i = _free[--_free_numof];
+    _slot_t *slot = &_slots[i];
+    strcpy(slot->name, name);
+    slot->tries = 0;
+    slot->tcp = 0;
+
+    ssize_t len = sock_dns_build_query(slot->query, sizeof(slot->query), name, 0,
+            _cfg.family);
+    if (len < 0) {
+        _done(i, len, NULL);
+        return;
+    }
+    slot->len = len;
+    slot->qlen = _question_len(slot);
+
+    _send(i);
+}
+
+static void _expire(uint64_t now)
+{
+    unsigned head = _cfg.inflight;
+
+    while (_slots[head].next != head) {
+        unsigned i = _slots[head].next;
+        _slot_t *slot = &_slots[i];
+        if (now < slot->sent + _cfg.timeout_ms) {
+            break;
+        }
+        _unlink(i);
+        _by_id[slot->id] = 0;
+        if (slot->tcp) {
+            /* TCP retransmits by itself */
+            _tcp_numof--;
+            _done(i, -ETIMEDOUT, NULL);
+        }
+        else if (slot->tries < _cfg.tries) {
+            _stats.retries++;
+            _send(i);
+        }
+        else {
+            _done(i, -ETIMEDOUT, NULL);
+        }
+    }
+}
+
+/* the slot a reply is for, or UINT_MAX if none waits for it */
+static unsigned _match(const uint8_t *msg, size_t len)
+{
+    if ((len < sizeof(sock_dns_hdr_t)) || !(msg[2] & 0x80)) {
+        return UINT_MAX;
+    }
+
+    unsigned i = _by_id[(msg[0] << 8) | msg[1]];
+    if (!i--) {
+        return UINT_MAX;
+    }
+    _slot_t *slot = &_slots[i];
+    /* also the question, a stray reply could reuse the ID */
+    if ((len < slot->qlen) ||
+            memcmp(msg + 4, slot->query + 4, 2) ||
+            memcmp(msg + sizeof(sock_dns_hdr_t), slot->query + sizeof(sock_dns_hdr_t),
+                   slot->qlen - sizeof(sock_dns_hdr_t))) {
+        return UINT_MAX;
+    }
+    return i;
+}
+
+static void _resolved(unsigned i, const uint8_t *msg, size_t len)
+{
+    sock_dns_addr_t addrs[ADDRS_MAX];
+    uint32_t neg_ttl;
+
+    _unlink(i);
+    _by_id[_slots[i].id] = 0;
+    if (_slots[i].tcp) {
+        _tcp_numof--;
+    }
+
+    int res = sock_dns_parse_addrs(msg, len, _cfg.family, addrs, ADDRS_MAX, &neg_ttl);
+    _done(i, res, addrs);
+}
+
+static void _tcp_reply(void *arg, const uint8_t *msg, size_t len)
+{
+    (void)arg;
+
+    unsigned i = _match(msg, len);
+    if ((i != UINT_MAX) && _slots[i].tcp) {
+        _resolved(i, msg, len);
+    }
+}
+
+/* fails all queries waiting for a reply over TCP */
+static void _tcp_failed(int res)
+{
+    unsigned head = _cfg.inflight;
+
+    sock_dns_tcp_conn_close(&_tcp);
+    for (unsigned i = _slots[head].next; _tcp_numof && (i != head);) {
+        unsigned next = _slots[i].next;
+        if (_slots[i].tcp) {
+            _unlink(i);
+            _by_id[_slots[i].id] = 0;
+            _tcp_numof--;
+            _done(i, res, NULL);
+        }
+        i = next;
+    }
+}
+
+/* truncated replies are asked again over one pipelined TCP connection,
+ * which the main loop drives along with the UDP socket */
+static void _retry_tcp(unsigned i)
+{
+    _slot_t *slot = &_slots[i];
+    int res = 0;
+
+    _stats.truncated++;
+    if (!_tcp.fd) {
+        res = sock_dns_tcp_conn_open(&_tcp, &_server);
+    }
+    if (!res) {
+        res = sock_dns_tcp_conn_send(&_tcp, slot->query, slot->len);
+    }
+    if (res) {
+        _unlink(i);
+        _by_id[slot->id] = 0;
+        _done(i, res, NULL);
+        _tcp_failed(res);
+        return;
+    }
+
+    /* waits for its reply as long as for one over UDP */
+    slot->tcp = 1;
+    _tcp_numof++;
+    slot->sent = _now();
+    _unlink(i);
+    _append(i);
+}
+
+static void _tcp_recv(void)
+{
+    int res = sock_dns_tcp_conn_recv(&_tcp, _tcp_reply, NULL);
+    if (res < 0) {
+        _tcp_failed(res);
+    }
+}
+
+static void _recv(void)
+{
+    static uint8_t bufs[BATCH_MAX][SOCK_DNS_EDNS_PAYLOAD ? SOCK_DNS_EDNS_PAYLOAD : 512];
+    static struct mmsghdr rx[BATCH_MAX];
+    static struct iovec rx_iov[BATCH_MAX];
+
+    int numof = 0;
+    do {
+        for (unsigned n = 0; n < _cfg.batch; n++) {
+            rx_iov[n].iov_base = bufs[n];
+            rx_iov[n].iov_len = sizeof(bufs[n]);
+            rx[n].msg_hdr.msg_iov = &rx_iov[n];
+            rx[n].msg_hdr.msg_iovlen = 1;
+        }
+
+        numof = recvmmsg(_sock.fd, rx, _cfg.batch, MSG_DONTWAIT, NULL);
+        for (int n = 0; n < numof; n++) {
+            const uint8_t *msg = bufs[n];
+            size_t len = rx[n].msg_len;
+            unsigned i = _match(msg, len);
+            if (i == UINT_MAX) {
+                continue;
+            }
+
+            if (msg[2] & 0x02) {
+                if (!_slots[i].tcp) {
+                    _retry_tcp(i);
+                }
+                continue;
+            }
+            _resolved(i, msg, len);
+        }
+    } while (numof == (int)_cfg.batch);
+}
+
+/* strips whitespace and comments, returns NULL for empty lines */
+static char *_trim(char *line)
+{
+    line += strspn(line, " \t");
+    line[strcspn(line, " \t\r\n#")] = '\0';
+    return *line ? line : NULL;
+}
+
+static void _usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [options] [file]\n"
+            "  -c <n>       queries in flight, default 4096\n"
+            "  -b <n>       queries per sendmmsg/recvmmsg, default 64\n"
+            "  -t <ms>      reply timeout, default 1000\n"
+            "  -r <n>       tries per name, default 3\n"
+            "  -s <addr>    server, default from /etc/resolv.conf\n"
+            "  -6           query AAAA instead of A\n"
+            "Names are read from file, or from stdin if none or \"-\".\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    char *server = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:b:t:r:s:6")) != -1) {
+        switch (opt) {
+            case 'c': _cfg.inflight = atoi(optarg); break;
+            case 'b': _cfg.batch = atoi(optarg); break;
+            case 't': _cfg.timeout_ms = atoi(optarg); break;
+            case 'r': _cfg.tries = atoi(optarg); break;
+            case 's': server = optarg; break;
+            case '6': _cfg.family = AF_INET6; break;
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (!_cfg.inflight || (_cfg.inflight > INFLIGHT_MAX) || !_cfg.batch ||
+            (_cfg.batch > BATCH_MAX) || !_cfg.tries || (_cfg.tries > UINT8_MAX) ||
+            (optind + 1 < argc)) {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    FILE *in = stdin;
+    if ((optind < argc) && strcmp(argv[optind], "-")) {
+        in = fopen(argv[optind], "r");
+        if (!in) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+
+    _server = sock_dns_server;
+    if (server) {
+        if (sock_str2ep(&_server, server)) {
+            fprintf(stderr, "invalid server \"%s\"\n", server);
+            return 1;
+        }
+        if (!_server.port) {
+            _server.port = SOCK_DNS_PORT;
+        }
+    }
+    else {
+        sock_dns_servers_load("/etc/resolv.conf");
+        sock_dns_servers_pick(0, &_server);
+    }
+
+    if (sock_udp_create(&_sock, NULL, &_server, 0) < 0) {
+        fprintf(stderr, "error creating socket\n");
+        return 1;
+    }
+    /* absorbs bursts of replies while a batch is being sent */
+    const int bufsize = SOCKBUF_SIZE;
+    setsockopt(_sock.fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(_sock.fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+    _slots = calloc(_cfg.inflight + 1, sizeof(_slot_t));
+    _free = calloc(_cfg.inflight, sizeof(unsigned));
+    if (!_slots || !_free) {
+        return 1;
+    }
+    for (unsigned i = 0; i < _cfg.inflight; i++) {
+        _free[i] = _cfg.inflight - 1 - i;
+    }
+    _free_numof = _cfg.inflight;
+    _slots[_cfg.inflight].prev = _slots[_cfg.inflight].next = _cfg.inflight;
+
+    /* results are written as they come, but not line by line */
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+    uint64_t start = _now();
+    char line[256];
+    int eof = 0;
+
+    while (!eof || (_free_numof < _cfg.inflight)) {
+        while (!eof && _free_numof) {
+            if (!fgets(line, sizeof(line), in)) {
+                eof = 1;
+                break;
+            }
+            char *name = _trim(line);
+            if (name) {
+                _start(name);
+            }
+        }
+        _flush();
+
+        uint64_t now = _now();
+        _expire(now);
+        _flush();
+
+        int timeout = -1;
+        unsigned oldest = _slots[_cfg.inflight].next;
+        if (oldest != _cfg.inflight) {
+            uint64_t deadline = _slots[oldest].sent + _cfg.timeout_ms;
+            timeout = (deadline > now) ? deadline - now : 0;
+        }
+        else if (eof) {
+            break;
+        }
+
+        /* the connection is only kept while replies are due, as servers
+         * close idle ones after a few seconds (RFC 7766, 6.2.3) */
+        if (!_tcp_numof && _tcp.fd) {
+            sock_dns_tcp_conn_close(&_tcp);
+        }
+
+        struct pollfd pfds[] = {
+            { .fd = _sock.fd, .events = POLLIN },
+            { .fd = _tcp.fd, .events = sock_dns_tcp_conn_events(&_tcp) },
+        };
+        if (poll(pfds, _tcp.fd ? 2 : 1, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return 1;
+        }
+        if (pfds[0].revents) {
+            _recv();
+        }
+        if (_tcp.fd && pfds[1].revents) {
+            _tcp_recv();
+        }
+    }
+
+    fflush(stdout);
+    double elapsed = (_now() - start) / 1e3;
+    sock_udp_close(&_sock);
+    sock_dns_tcp_conn_close(&_tcp);
+
+    fprintf(stderr, "names: %llu, %llu answered, %llu failed, %llu retries, %llu over TCP\n",
+            (unsigned long long)_stats.names, (unsigned long long)_stats.answered,
+            (unsigned long long)_stats.failed, (unsigned long long)_stats.retries,
+            (unsigned long long)_stats.truncated);
+    fprintf(stderr, "throughput: %.1f names/s\n", elapsed ? _stats.names / elapsed : 0);
+
+    return 0;
+}
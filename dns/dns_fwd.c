@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "net/sock/udp.h"
+#include "net/sock/util.h"
+
+#include "sock_dns.h"
+#include "sock_dns_fwd.h"
+#include "sock_dns_servers.h"
+
+sock_udp_ep_t sock_dns_server = { .family=AF_INET, .port=SOCK_DNS_PORT,
+                                  .addr.ipv4={8,8,8,8}
+                                };
+
+int main(int argc, char *argv[])
+{
+    sock_udp_ep_t local = { .port=SOCK_DNS_PORT };
+    sock_udp_ep_t upstream = sock_dns_server;
+
+    if (argc > 1) {
+        local.port = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        if (sock_str2ep(&upstream, argv[2])) {
+            fprintf(stderr, "usage: %s [port] [upstream]\n", argv[0]);
+            return 1;
+        }
+        if (!upstream.port) {
+            upstream.port = SOCK_DNS_PORT;
+        }
+    }
+    else if (sock_dns_servers_load("/etc/resolv.conf") > 0) {
+        sock_dns_servers_pick(0, &upstream);
+    }
+
+    int res = sock_dns_fwd_server(&local, &upstream);
+    fprintf(stderr, "error %i\n", res);
+
+    return 1;
+}
@@ -2,25 +2,70 @@
 #include <stdio.h>
 
 #include "sock_dns.h"
+#include "sock_dns_he.h"
+#include "sock_dns_resolver.h"
+#include "sock_dns_servers.h"
+
+/* names resolved in parallel, each takes two resolver slots */
+#define NAMES_MAX   (64U)
 
 sock_udp_ep_t sock_dns_server = { .family=AF_INET, .port=SOCK_DNS_PORT,
                                   .addr.ipv4={8,8,8,8}
                                 };
 
+static void _print(const char *name, int res, const void *addr)
+{
+    char addrstr[INET6_ADDRSTRLEN];
+
+    if (res > 0) {
+        inet_ntop(res == 4 ? AF_INET : AF_INET6, addr, addrstr, sizeof(addrstr));
+        printf("%s %s\n", name, addrstr);
+    }
+    else {
+        printf("%s error %i\n", name, res);
+    }
+}
+
+static void _resolved(void *arg, int family, int res, const void *addr)
+{
+    (void)family;
+    _print(arg, res, addr);
+}
+
 int main(int argc, char *argv[]) {
     uint8_t addr[16] = {0};
-    char addrstr[INET6_ADDRSTRLEN];
 
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s <hostname>\n", argv[0]);
+    if ((argc < 2) || ((unsigned)argc - 1 > NAMES_MAX)) {
+        fprintf(stderr, "usage: %s <hostname>... (at most %u)\n", argv[0], NAMES_MAX);
         return 1;
     }
 
-    int res = sock_dns_query(argv[1], addr, AF_UNSPEC);
-    if (res > 0) {
-        inet_ntop(res == 4 ? AF_INET : AF_INET6, addr, addrstr, sizeof(addrstr));
-        printf("%s\n", addrstr);
+    /* falls back on sock_dns_server without nameserver entries */
+    sock_dns_servers_load("/etc/resolv.conf");
+
+    if (argc == 2) {
+        int res = sock_dns_query(argv[1], addr, AF_UNSPEC);
+        _print(argv[1], res, addr);
+        return 0;
+    }
+
+    /* several names are resolved in parallel, A and AAAA separately */
+    sock_dns_resolver_t resolver;
+    sock_udp_ep_t server = sock_dns_server;
+    sock_dns_servers_pick(0, &server);
+    int res = sock_dns_resolver_init(&resolver, &server);
+    if (res) {
+        fprintf(stderr, "error %i\n", res);
+        return 1;
+    }
+    static sock_dns_he_t he[NAMES_MAX];
+    for (int i = 1; i < argc; i++) {
+        if ((res = sock_dns_he_query(&resolver, &he[i - 1], argv[i], _resolved, argv[i]))) {
+            _print(argv[i], res, NULL);
+        }
     }
+    sock_dns_resolver_run(&resolver);
+    sock_dns_resolver_close(&resolver);
 
     return 0;
 }
@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+"""Loopback test of dns_fwd against a scripted mock upstream.
+
+usage: fwd_test.py [path to dns_fwd]
+
+The mock answers over UDP and TCP on one port and counts the queries it
+sees, so coalescing and caching can be checked from its side. Names select
+its behaviour:
+
+    slow.*      answered after 200 ms
+    fail.*      SERVFAIL
+    nodata.*    NOERROR without answers, SOA with a 60 s negative TTL
+    nx.*        NXDOMAIN, SOA with a 60 s negative TTL
+    big.*       A over UDP is truncated, over TCP answered after 300 ms
+    zero.*      A over UDP is truncated, over TCP a zero-length message
+    TXT         "hello"
+    other       A 192.0.2.1, AAAA 2001:db8::1, TTL 300
+"""
+
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+TYPE_A, TYPE_SOA, TYPE_TXT, TYPE_AAAA = 1, 6, 16, 28
+
+
+def encode_name(name):
+    return b''.join(bytes([len(l)]) + l.encode() for l in name.split('.') if l) + b'\0'
+
+
+def parse_question(msg):
+    pos, labels = 12, []
+    while msg[pos]:
+        labels.append(msg[pos + 1:pos + 1 + msg[pos]].decode())
+        pos += msg[pos] + 1
+    qtype, = struct.unpack('!H', msg[pos + 1:pos + 3])
+    return '.'.join(labels).lower(), qtype, msg[12:pos + 5]
+
+
+class Upstream:
+    def __init__(self):
+        self.udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.udp.bind(('127.0.0.1', 0))
+        self.port = self.udp.getsockname()[1]
+        self.tcp = socket.socket()
+        self.tcp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.tcp.bind(('127.0.0.1', self.port))
+        self.tcp.listen(4)
+        self.lock = threading.Lock()
+        self.seen = []
+        for target in (self._serve_udp, self._serve_tcp):
+            threading.Thread(target=target, daemon=True).start()
+
+    def count(self, name, qtype, tcp=False):
+        with self.lock:
+            return self.seen.count((name, qtype, tcp))
+
+    def _reply(self, msg, tcp):
+        name, qtype, question = parse_question(msg)
+        with self.lock:
+            self.seen.append((name, qtype, tcp))
+
+        rcode, flags, delay, answers, authority = 0, 0x8180, 0, [], []
+        rr = lambda t, ttl, rdata: (b'\xc0\x0c' + struct.pack('!HHIH', t, 1, ttl, len(rdata))
+                                    + rdata)
+        if name.startswith('fail'):
+            rcode = 2
+        elif name.startswith(('nodata', 'nx')):
+            rcode = 3 if name.startswith('nx') else 0
+            soa = (encode_name('ns.test') + encode_name('host.test') +
+                   struct.pack('!5I', 1, 2, 3, 4, 60))
+            authority.append(encode_name('test') + struct.pack('!HHIH', TYPE_SOA, 1, 60, len(soa))
+                             + soa)
+        elif name.startswith(('big', 'zero')) and (qtype == TYPE_A) and not tcp:
+            flags |= 0x0200
+        elif qtype == TYPE_TXT:
+            answers.append(rr(TYPE_TXT, 300, b'\x05hello'))
+        elif qtype == TYPE_A:
+            answers.append(rr(TYPE_A, 300, bytes([192, 0, 2, 1])))
+        elif qtype == TYPE_AAAA:
+            answers.append(rr(TYPE_AAAA, 300, b'\x20\x01\x0d\xb8' + bytes(11) + b'\x01'))
+
+        if name.startswith('slow'):
+            delay = 0.2
+        elif name.startswith('big') and tcp:
+            delay = 0.3
+
+        hdr = msg[:2] + struct.pack('!5H', flags | rcode, 1, len(answers), len(authority), 0)
+        return delay, hdr + question + b''.join(answers) + b''.join(authority)
+
+    def _serve_udp(self):
+        while True:
+            msg, remote = self.udp.recvfrom(4096)
+            delay, reply = self._reply(msg, False)
+            threading.Timer(delay, self.udp.sendto, (reply, remote)).start()
+
+    def _serve_tcp(self):
+        while True:
+            conn, _ = self.tcp.accept()
+            threading.Thread(target=self._serve_conn, args=(conn,), daemon=True).start()
+
+    def _serve_conn(self, conn):
+        buf = b''
+        while True:
+            data = conn.recv(4096)
+            if not data:
+                break
+            buf += data
+            while (len(buf) >= 2) and (len(buf) >= 2 + struct.unpack('!H', buf[:2])[0]):
+                length, = struct.unpack('!H', buf[:2])
+                delay, reply = self._reply(buf[2:2 + length], True)
+                if parse_question(buf[2:2 + length])[0].startswith('zero'):
+                    reply = b''
+                buf = buf[2 + length:]
+                time.sleep(delay)
+                conn.sendall(struct.pack('!H', len(reply)) + reply)
+        conn.close()
+
+
+class Client:
+    def __init__(self, port):
+        self.addr = ('127.0.0.1', port)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(2)
+
+    def send(self, name, qtype, qid):
+        msg = (struct.pack('!6H', qid, 0x0100, 1, 0, 0, 0) + encode_name(name) +
+               struct.pack('!HH', qtype, 1))
+        self.sock.sendto(msg, self.addr)
+
+    def recv(self):
+        msg = self.sock.recv(4096)
+        qid, flags, _, ancount, _, _ = struct.unpack('!6H', msg[:12])
+        return qid, flags & 0xf, ancount, msg
+
+    def query(self, name, qtype, qid=0x1234):
+        self.send(name, qtype, qid)
+        return self.recv()
+
+
+def free_port():
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.bind(('127.0.0.1', 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else 'bin/dns_fwd'
+    upstream = Upstream()
+    port = free_port()
+    fwd = subprocess.Popen([binary, str(port), '127.0.0.1:%u' % upstream.port])
+    failed = 0
+
+    def check(what, cond):
+        nonlocal failed
+        print('%s %s' % ('ok' if cond else 'FAIL', what))
+        failed += not cond
+
+    try:
+        client = Client(port)
+        for _ in range(20):
+            try:
+                client.query('probe.test', TYPE_A)
+                break
+            except socket.timeout:
+                pass
+
+        _, rcode, ancount, msg = client.query('a.test', TYPE_A)
+        check('A answered', (rcode == 0) and (ancount == 1) and
+              msg.endswith(bytes([192, 0, 2, 1])))
+        _, rcode, ancount, _ = client.query('A.Test', TYPE_A)
+        check('cache hit', (rcode == 0) and (ancount == 1) and
+              (upstream.count('a.test', TYPE_A) == 1))
+
+        clients = [Client(port) for _ in range(5)]
+        for i, c in enumerate(clients):
+            c.send('slow.test', TYPE_A, 100 + i)
+        replies = [c.recv() for c in clients]
+        check('coalesced replies',
+              all((r[0] == 100 + i) and (r[2] == 1) for i, r in enumerate(replies)))
+        check('coalesced upstream query', upstream.count('slow.test', TYPE_A) == 1)
+
+        _, rcode, ancount, _ = client.query('fail.test', TYPE_A)
+        check('SERVFAIL', (rcode == 2) and (ancount == 0))
+
+        _, rcode, ancount, _ = client.query('nodata.test', TYPE_AAAA)
+        check('NODATA', (rcode == 0) and (ancount == 0))
+        client.query('nodata.test', TYPE_AAAA)
+        check('NODATA cached', upstream.count('nodata.test', TYPE_AAAA) == 1)
+
+        _, rcode, ancount, _ = client.query('nx.test', TYPE_A)
+        check('NXDOMAIN', (rcode == 3) and (ancount == 0))
+        _, rcode, _, _ = client.query('nx.test', TYPE_A)
+        check('NXDOMAIN cached', (rcode == 3) and (upstream.count('nx.test', TYPE_A) == 1))
+
+        qid, rcode, ancount, msg = client.query('txt.test', TYPE_TXT, 0x4321)
+        check('relayed TXT', (qid == 0x4321) and (rcode == 0) and (ancount == 1) and
+              msg.endswith(b'\x05hello') and (upstream.count('txt.test', TYPE_TXT) == 1))
+
+        # the TCP fallback must not hold up other queries
+        client.send('big.test', TYPE_A, 1)
+        time.sleep(0.05)
+        start = time.monotonic()
+        client.send('other.test', TYPE_A, 2)
+        first = client.recv()
+        elapsed = time.monotonic() - start
+        second = client.recv()
+        check('served during TCP fallback', (first[0] == 2) and (elapsed < 0.2))
+        check('truncated answer over TCP', (second[0] == 1) and (second[2] == 1) and
+              (upstream.count('big.test', TYPE_A, True) == 1))
+
+        # a zero-length message over TCP fails the query, not the forwarder
+        start = time.monotonic()
+        _, rcode, ancount, _ = client.query('zero.test', TYPE_A)
+        check('zero-length TCP message', (rcode == 2) and (ancount == 0) and
+              (time.monotonic() - start < 1))
+        _, rcode, ancount, _ = client.query('after-zero.test', TYPE_A)
+        check('served after zero-length message', (rcode == 0) and (ancount == 1))
+    except socket.timeout:
+        check('reply before timeout', False)
+    finally:
+        fwd.kill()
+        fwd.wait()
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,152 @@
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include "sock_dns.h"
+#include "sock_dns_mdns.h"
+
+sock_udp_ep_t sock_dns_server = { .family=AF_INET, .port=SOCK_DNS_PORT,
+                                  .addr.ipv4={8,8,8,8}
+                                };
+
+static sock_dns_mdns_t _mdns;
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U;
+}
+
+static void _print(const char *name, int res, const void *addr)
+{
+    char addrstr[INET6_ADDRSTRLEN];
+
+    if (res > 0) {
+        inet_ntop(res == 4 ? AF_INET : AF_INET6, addr, addrstr, sizeof(addrstr));
+        printf("%s %s\n", name, addrstr);
+    }
+    else if (!res) {
+        printf("%s expired\n", name);
+    }
+    else {
+        printf("%s error %i\n", name, res);
+    }
+    fflush(stdout);
+}
+
+/* prints the cached address of each name whenever it changes, including
+ * those only announced or sent along with other answers */
+static int _watch(char **names, unsigned numof, unsigned seconds)
+{
+    uint8_t addrs[SOCK_DNS_MDNS_WATCH_MAX][16];
+    int lens[SOCK_DNS_MDNS_WATCH_MAX] = { 0 };
+
+    for (unsigned i = 0; i < numof; i++) {
+        int res = sock_dns_mdns_watch(&_mdns, names[i], AF_UNSPEC);
+        if (res) {
+            _print(names[i], res, NULL);
+            return 1;
+        }
+    }
+
+    uint64_t deadline = _now() + seconds * 1000ULL;
+    for (uint64_t now = _now(); now < deadline; now = _now()) {
+        int timeout = sock_dns_mdns_timeouts(&_mdns);
+        if ((timeout < 0) || ((uint64_t)timeout > deadline - now)) {
+            timeout = deadline - now;
+        }
+
+        struct pollfd pfd = { .fd = _mdns.sock.fd, .events = POLLIN };
+        if (poll(&pfd, 1, timeout) < 0) {
+            perror("poll");
+            return 1;
+        }
+        if (pfd.revents) {
+            sock_dns_mdns_recv(&_mdns);
+        }
+
+        /* expired entries go without a packet */
+        for (unsigned i = 0; i < numof; i++) {
+            uint8_t addr[16];
+            int res = sock_dns_mdns_get(&_mdns, names[i], AF_UNSPEC, addr);
+            if ((res != lens[i]) || memcmp(addr, addrs[i], res)) {
+                lens[i] = res;
+                memcpy(addrs[i], addr, res);
+                _print(names[i], res, addr);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void _usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [options] <name>...\n"
+            "  -i <iface>   interface, default the one multicast is routed to\n"
+            "  -6           query ff02::fb instead of 224.0.0.251\n"
+            "  -t <ms>      one-shot query timeout, default 3000\n"
+            "  -w <s>       query continuously for s seconds and print each\n"
+            "               address as it is cached, expired or replaced\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    uint16_t netif = 0;
+    int family = AF_INET;
+    unsigned timeout_ms = 3000;
+    unsigned watch = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:6t:w:")) != -1) {
+        switch (opt) {
+            case 'i':
+                netif = if_nametoindex(optarg);
+                if (!netif) {
+                    fprintf(stderr, "unknown interface \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+            case '6': family = AF_INET6; break;
+            case 't': timeout_ms = atoi(optarg); break;
+            case 'w': watch = atoi(optarg); break;
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+    }
+
+    unsigned numof = argc - optind;
+    if (!numof || (watch && (numof > SOCK_DNS_MDNS_WATCH_MAX))) {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    int res = sock_dns_mdns_init(&_mdns, family, netif);
+    if (res) {
+        fprintf(stderr, "error %i\n", res);
+        return 1;
+    }
+
+    if (watch) {
+        res = _watch(&argv[optind], numof, watch);
+    }
+    else {
+        /* names answered along with earlier ones come from the cache */
+        for (unsigned i = 0; i < numof; i++) {
+            uint8_t addr[16];
+            int len = sock_dns_mdns_query(&_mdns, argv[optind + i], addr, AF_UNSPEC,
+                    timeout_ms);
+            _print(argv[optind + i], len, addr);
+        }
+    }
+
+    sock_dns_mdns_close(&_mdns);
+    return res;
+}
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""Multicast test of mdns_test against a scripted responder on this host.
+
+usage: mdns_test.py [path to mdns_test] [interface]
+
+The responder joins 224.0.0.251 next to the querier, multicast loops back
+to both. It answers dev1.local with 10.1.1.1 and sends other.local along
+unasked, and it announces printer.local unsolicited and later says goodbye.
+"""
+
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+GROUP = ('224.0.0.251', 5353)
+TYPE_A = 1
+
+
+def encode_name(name):
+    return b''.join(bytes([len(l)]) + l.encode() for l in name.split('.') if l) + b'\0'
+
+
+def record(name, addr, ttl, flush=True):
+    return (encode_name(name) + struct.pack('!HHIH', TYPE_A, 0x8001 if flush else 1, ttl, 4) +
+            socket.inet_aton(addr))
+
+
+def response(records):
+    return struct.pack('!6H', 0, 0x8400, 0, len(records), 0, 0) + b''.join(records)
+
+
+class Responder:
+    def __init__(self, ifindex):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+        self.sock.bind(('', GROUP[1]))
+        mreqn = (socket.inet_aton(GROUP[0]) + socket.inet_aton('0.0.0.0') +
+                 struct.pack('i', ifindex))
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreqn)
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, mreqn)
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+        self.lock = threading.Lock()
+        self.queried = []
+        threading.Thread(target=self._serve, daemon=True).start()
+
+    def count(self, name):
+        with self.lock:
+            return self.queried.count(name)
+
+    def send(self, records):
+        self.sock.sendto(response(records), GROUP)
+
+    def _serve(self):
+        while True:
+            msg, _ = self.sock.recvfrom(1500)
+            flags, = struct.unpack('!H', msg[2:4])
+            if flags & 0x8000:
+                continue
+
+            # all questions are for the same name, see sock_dns_mdns.c
+            pos, labels = 12, []
+            while msg[pos] and (msg[pos] < 192):
+                labels.append(msg[pos + 1:pos + 1 + msg[pos]].decode())
+                pos += msg[pos] + 1
+            name = '.'.join(labels).lower()
+            with self.lock:
+                self.queried.append(name)
+
+            if name == 'dev1.local':
+                self.send([record('Dev1.local', '10.1.1.1', 120),
+                           record('other.local', '10.9.9.9', 120, False)])
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else 'bin/mdns_test'
+    iface = sys.argv[2] if len(sys.argv) > 2 else None
+    ifindex = socket.if_nametoindex(iface) if iface else 0
+    options = ['-i', iface] if iface else []
+    responder = Responder(ifindex)
+    failed = 0
+
+    def check(what, cond):
+        nonlocal failed
+        print('%s %s' % ('ok' if cond else 'FAIL', what))
+        failed += not cond
+
+    out = subprocess.run([binary, '-t', '2000'] + options + ['dev1.local', 'other.local'],
+                         capture_output=True, text=True, timeout=10).stdout.splitlines()
+    check('one-shot query', 'dev1.local 10.1.1.1' in out)
+    check('record sent along is cached', ('other.local 10.9.9.9' in out) and
+          (responder.count('other.local') == 0))
+
+    watcher = subprocess.Popen([binary, '-w', '4'] + options + ['printer.local'],
+                               stdout=subprocess.PIPE, text=True)
+    time.sleep(0.5)
+    responder.send([record('printer.local', '10.5.5.5', 120)])
+    time.sleep(1.5)
+    responder.send([record('printer.local', '10.5.5.5', 0)])
+    out = watcher.communicate(timeout=10)[0].splitlines()
+    check('announcement cached', out[:1] == ['printer.local 10.5.5.5'])
+    check('goodbye expires it', out[1:] == ['printer.local expired'])
+    check('continuous queries', responder.count('printer.local') >= 1)
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
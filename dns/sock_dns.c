@@ -1,13 +1,28 @@
+#include <pthread.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/random.h>
 
 #include "net/sock/udp.h"
+#include "net/sock/pktbuf.h"
+#include "net/sock/posix.h"
 #include "sock_dns.h"
+#include "sock_dns_cache.h"
+#include "sock_dns_hosts.h"
+#include "sock_dns_parse.h"
+#include "sock_dns_servers.h"
+#include "sock_dns_tcp.h"
+
+#if SOCK_DNS_EDNS_PAYLOAD > SOCK_PKTBUF_SIZE
+#error "SOCK_DNS_EDNS_PAYLOAD exceeds the receive buffers (SOCK_PKTBUF_SIZE)"
+#endif
 
 /* min domain name length is 1, so minimum record length is 7 */
 #define DNS_MIN_REPLY_LEN   (unsigned)(sizeof(sock_dns_hdr_t ) + 7)
 
-ssize_t _enc_domain_name(uint8_t *out, const char *domain_name)
+static ssize_t _enc_domain_name(uint8_t *out, const char *domain_name)
 {
     uint8_t *part_start = out;
     uint8_t *out_pos = ++out;
@@ -15,6 +30,10 @@ ssize_t _enc_domain_name(uint8_t *out, const char *domain_name)
     char c;
 
     while ((c = *domain_name)) {
+        if ((c == '.') && !domain_name[1]) {
+            /* trailing dot of a fully qualified name */
+            break;
+        }
         if (c == '.') {
             *part_start = (out_pos - part_start - 1);
             part_start = out_pos++;
@@ -37,125 +56,643 @@ static unsigned _put_short(uint8_t *out, uint16_t val)
     return 2;
 }
 
-static unsigned _get_short(uint8_t *buf)
+int _parse_dns_reply(uint8_t *buf, size_t len, void* addr_out, int family, uint32_t *ttl_out)
 {
-    uint16_t _tmp;
-    memcpy(&_tmp, buf, 2);
-    return _tmp;
+    sock_dns_addr_t addr;
+
+    int res = sock_dns_parse_addrs(buf, len, family, &addr, 1, ttl_out);
+    if (res > 0) {
+        memcpy(addr_out, addr.addr, addr.len);
+        *ttl_out = addr.ttl;
+        return addr.len;
+    }
+    return res;
 }
 
-size_t _skip_hostname(uint8_t *buf)
+static ssize_t _build_query(uint8_t *buf, size_t len, const char *domain_name,
+        uint16_t id, const uint16_t *types, unsigned types_numof)
 {
-    uint8_t *bufpos = buf;
+    /* header, name with length byte and root label, type and class, further
+     * questions point at the first name */
+    size_t name_len = strlen(domain_name);
+    size_t needed = sizeof(sock_dns_hdr_t) + name_len + 2 + 4 + (types_numof - 1) * 6 +
+        (SOCK_DNS_EDNS_PAYLOAD ? SOCK_DNS_OPT_LEN : 0);
+    if ((name_len > SOCK_DNS_MAX_NAME_LEN) || (needed > len)) {
+        return -ENOSPC;
+    }
 
-    /* handle DNS Message Compression */
-    if (*bufpos >= 192) {
-        return 2;
+    sock_dns_hdr_t *hdr = (sock_dns_hdr_t*) buf;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->id = htons(id);
+    hdr->flags = htons(0x0120);
+    hdr->qdcount = htons(types_numof);
+
+    uint8_t *bufpos = buf + sizeof(*hdr);
+    unsigned _name_ptr = (bufpos - buf);
+
+    for (unsigned i = 0; i < types_numof; i++) {
+        if (i) {
+            bufpos += _put_short(bufpos, htons((0xc000) | (_name_ptr)));
+        }
+        else {
+            bufpos += _enc_domain_name(bufpos, domain_name);
+        }
+        bufpos += _put_short(bufpos, htons(types[i]));
+        bufpos += _put_short(bufpos, htons(DNS_CLASS_IN));
     }
 
-    while(*bufpos) {
-        bufpos += *bufpos + 1;
+    if (SOCK_DNS_EDNS_PAYLOAD) {
+        /* root name, type, payload size as class, no extended flags and
+         * no options */
+        hdr->arcount = htons(1);
+        *bufpos++ = 0;
+        bufpos += _put_short(bufpos, htons(DNS_TYPE_OPT));
+        bufpos += _put_short(bufpos, htons(SOCK_DNS_EDNS_PAYLOAD));
+        memset(bufpos, 0, 6);
+        bufpos += 6;
     }
-    return (bufpos - buf + 1);
+
+    return bufpos - buf;
 }
 
-int _parse_dns_reply(uint8_t *buf, size_t len, void* addr_out, int family)
+ssize_t sock_dns_build_query(uint8_t *buf, size_t len, const char *domain_name,
+        uint16_t id, int family)
 {
-    sock_dns_hdr_t *hdr = (sock_dns_hdr_t*) buf;
-    uint8_t *bufpos = buf + sizeof(*hdr);
+    static const uint16_t types[] = { DNS_TYPE_AAAA, DNS_TYPE_A };
 
-    /* skip all queries that are part of the reply */
-    for (unsigned n = 0; n < ntohs(hdr->qdcount); n++) {
-        bufpos += _skip_hostname(bufpos);
-        bufpos += 4;    /* skip type and class of query */
-    }
-
-    for (unsigned n = 0; n < ntohs(hdr->ancount); n++) {
-        bufpos += _skip_hostname(bufpos);
-        uint16_t _type = ntohs(_get_short(bufpos));
-        bufpos += 2;
-        uint16_t class = ntohs(_get_short(bufpos));
-        bufpos += 2;
-        bufpos += 4; /* skip ttl */
-
-        unsigned addrlen = ntohs(_get_short(bufpos));
-        bufpos += 2;
-        if ((bufpos + addrlen) > (buf + len)) {
-            return -EBADMSG;
-        }
-
-        /* skip unwanted answers */
-        if ((class != DNS_CLASS_IN) ||
-                ((_type == DNS_TYPE_A) && (family == AF_INET6)) ||
-                ((_type == DNS_TYPE_AAAA) && (family == AF_INET)) ||
-                ! ((_type == DNS_TYPE_A) || ((_type == DNS_TYPE_AAAA))
-                    )) {
-            bufpos += addrlen;
-            continue;
+    switch (family) {
+        case AF_INET:
+            return _build_query(buf, len, domain_name, id, &types[1], 1);
+        case AF_INET6:
+            return _build_query(buf, len, domain_name, id, &types[0], 1);
+        default:
+            /* two questions in one message are rejected by many servers */
+            return -EAFNOSUPPORT;
+    }
+}
+
+ssize_t sock_dns_build_query_type(uint8_t *buf, size_t len, const char *domain_name,
+        uint16_t id, uint16_t type)
+{
+    return _build_query(buf, len, domain_name, id, &type, 1);
+}
+
+uint16_t sock_dns_random_id(void)
+{
+    static _Thread_local uint16_t pool[32];
+    static _Thread_local unsigned avail;
+
+    if (!avail) {
+        if (getrandom(pool, sizeof(pool), 0) != sizeof(pool)) {
+            /* not seeded yet, still better than a constant */
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            for (unsigned i = 0; i < 32; i++) {
+                pool[i] ^= (ts.tv_nsec >> (i % 16)) ^ (uintptr_t)&ts;
+            }
         }
+        avail = 32;
+    }
+    return pool[--avail];
+}
 
-        memcpy(addr_out, bufpos, addrlen);
-        return addrlen;
+/* queries sent together, AAAA and A for AF_UNSPEC */
+typedef struct _batch _batch_t;
+struct _batch {
+    unsigned numof;
+    unsigned answered;          /* bit per query */
+    const uint8_t *msg[2];
+    size_t len[2];
+    /* handles the reply to query @p q, returns 1 if no further replies are
+     * needed. May set linger to wait at most that long (us) for them. */
+    int (*reply)(_batch_t *b, unsigned q, const uint8_t *msg, size_t len);
+    void *arg;
+    uint32_t linger;
+};
+
+typedef struct {
+    sock_udp_t sock;
+    sock_udp_ep_t ep;
+    int server;                 /* index in the server list, -1 for sock_dns_server */
+    uint64_t sent;
+    uint8_t replied;
+    int err;                    /* socket error, e.g. ICMP port unreachable */
+} _upstream_t;
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000U + ts.tv_nsec / 1000U;
+}
+
+static void _load_system_config(void)
+{
+    if (!sock_dns_servers_numof()) {
+        sock_dns_servers_load(SOCK_DNS_RESOLV_CONF);
     }
+}
+
+/* the system's configuration, unless the application set up its own.
+ * Other threads wait until it is loaded. */
+static void _load_config(void)
+{
+    static pthread_once_t loaded = PTHREAD_ONCE_INIT;
 
-    return -1;
+    pthread_once(&loaded, _load_system_config);
 }
 
-int sock_dns_query(const char *domain_name, void *addr_out, int family)
+static int _upstream_open(_upstream_t *u, unsigned exclude)
 {
-    uint8_t buf[SOCK_DNS_QUERYBUF_LEN];
-    uint8_t reply_buf[512];
+    _load_config();
 
-    sock_dns_hdr_t *hdr = (sock_dns_hdr_t*) buf;
-    memset(hdr, 0, sizeof(*hdr));
-    hdr->id = 0; /* random? */
-    hdr->flags = htons(0x0120);
-    hdr->qdcount = htons(1 + (family == AF_UNSPEC));
+    memset(u, 0, sizeof(*u));
+    u->server = sock_dns_servers_pick(exclude, &u->ep);
+    if (u->server < 0) {
+        if (sock_dns_servers_numof()) {
+            return -ENOENT;
+        }
+        u->ep = sock_dns_server;
+    }
 
-    uint8_t *bufpos = buf + sizeof(*hdr);
+    int res = sock_udp_create(&u->sock, NULL, &u->ep, 0);
+    if (res) {
+        return res;
+    }
 
-    unsigned _name_ptr;
-    if ((family == AF_INET6) || (family == AF_UNSPEC)) {
-        _name_ptr = (bufpos - buf);
-        bufpos += _enc_domain_name(bufpos, domain_name);
-        bufpos += _put_short(bufpos, htons(DNS_TYPE_AAAA));
-        bufpos += _put_short(bufpos, htons(DNS_CLASS_IN));
+    /* best effort, without it junk is dropped by the parser */
+    static const struct sock_filter filter[] = SOCK_FILTER_DNS_RESPONSE;
+    sock_udp_attach_filter(&u->sock, filter, sizeof(filter) / sizeof(filter[0]));
+
+    return 0;
+}
+
+static void _upstream_send(_upstream_t *u, const _batch_t *b)
+{
+    u->sent = _now();
+    for (unsigned q = 0; q < b->numof; q++) {
+        if (!(b->answered & (1U << q)) && (sock_udp_send(&u->sock, b->msg[q], b->len[q], NULL) <= 0)) {
+            u->err = -errno;
+        }
     }
+}
 
-    if ((family == AF_INET) || (family == AF_UNSPEC)) {
-        if (family == AF_UNSPEC) {
-            bufpos += _put_short(bufpos, htons((0xc000) | (_name_ptr)));
+typedef struct {
+    _batch_t *b;
+    unsigned q;
+    int done;
+} _tcp_ctx_t;
+
+static int _tcp_reply(void *arg, unsigned idx, const uint8_t *msg, size_t len)
+{
+    _tcp_ctx_t *ctx = arg;
+
+    (void)idx;
+    ctx->done = ctx->b->reply(ctx->b, ctx->q, msg, len);
+    return 1;
+}
+
+/* asks again over TCP after a truncated reply @p msg (RFC 7766, 5) */
+static int _retry_tcp(_upstream_t *u, _batch_t *b, unsigned q, const uint8_t *msg, size_t len)
+{
+    _tcp_ctx_t ctx = { .b = b, .q = q };
+
+    if (sock_dns_tcp_exchange(&u->ep, &b->msg[q], &b->len[q], 1, _tcp_reply, &ctx) < 0) {
+        /* what did fit is better than nothing */
+        return b->reply(b, q, msg, len);
+    }
+    return ctx.done;
+}
+
+/* returns 0 once the batch is complete, -ETIMEDOUT if no more replies are
+ * queued, or the error of the socket */
+static int _upstream_recv(_upstream_t *u, _batch_t *b)
+{
+    sock_pktbuf_t *reply;
+    ssize_t len;
+
+    while ((len = sock_udp_recv_pktbuf(&u->sock, &reply, 0, NULL)) >= 0) {
+        const uint8_t *msg = reply->data;
+        int done = 0;
+
+        for (unsigned q = 0; q < b->numof; q++) {
+            /* a reply with the ID of a query still waiting for one */
+            if ((b->answered & (1U << q)) || (len <= (ssize_t)DNS_MIN_REPLY_LEN) ||
+                    memcmp(msg, b->msg[q], 2) || !(msg[2] & 0x80)) {
+                continue;
+            }
+            if (!u->replied && (u->server >= 0)) {
+                sock_dns_servers_reply(u->server, _now() - u->sent);
+            }
+            u->replied = 1;
+            b->answered |= 1U << q;
+            if (msg[2] & 0x02) {
+                done = _retry_tcp(u, b, q, msg, len);
+            }
+            else {
+                done = b->reply(b, q, msg, len);
+            }
+            done = done || (b->answered == (1U << b->numof) - 1);
+            break;
         }
-        else {
-            bufpos += _enc_domain_name(bufpos, domain_name);
+        sock_pktbuf_release(reply);
+
+        if (done) {
+            return 0;
         }
-        bufpos += _put_short(bufpos, htons(DNS_TYPE_A));
-        bufpos += _put_short(bufpos, htons(DNS_CLASS_IN));
     }
 
-    sock_udp_t sock_dns;
+    return (len == -1) ? -errno : len;
+}
+
+/* sends the queries of @p b to the fastest server, duplicated to the next
+ * one if no reply came after the hedging delay of the first, and passes
+ * replies to b->reply */
+static int _exchange(_batch_t *b)
+{
+    _upstream_t up[2];
+    int res = -ETIMEDOUT;
+    int err = 0;
 
-    ssize_t res = sock_udp_create(&sock_dns, NULL, &sock_dns_server, 0);
+    for (int i = 0; (i < SOCK_DNS_RETRIES) && (res == -ETIMEDOUT); i++) {
+        unsigned numof = 1;
+
+        res = _upstream_open(&up[0], 0);
+        if (res) {
+            break;
+        }
+        _upstream_send(&up[0], b);
+
+        uint64_t now = _now();
+        uint64_t deadline = now + 1000000LU;
+        uint64_t hedge_at = UINT64_MAX;
+        if ((up[0].server >= 0) && (sock_dns_servers_numof() > 1)) {
+            hedge_at = now + sock_dns_servers_hedge_delay(up[0].server);
+        }
+
+        res = -ETIMEDOUT;
+        while (1) {
+            if (now >= hedge_at) {
+                hedge_at = UINT64_MAX;
+                if (!_upstream_open(&up[1], 1U << up[0].server)) {
+                    _upstream_send(&up[1], b);
+                    numof = 2;
+                }
+            }
+
+            struct pollfd pfds[2];
+            unsigned alive = 0;
+            for (unsigned n = 0; n < numof; n++) {
+                pfds[n].fd = up[n].err ? -1 : up[n].sock.fd;
+                pfds[n].events = POLLIN;
+                alive += !up[n].err;
+            }
+            if (!alive) {
+                if (hedge_at == UINT64_MAX) {
+                    break;
+                }
+                /* the first server is unreachable, go on with the next one */
+                hedge_at = now;
+                continue;
+            }
+            if (now >= deadline) {
+                /* only lingering for further replies is not a failure */
+                if (b->linger) {
+                    res = 0;
+                }
+                break;
+            }
+
+            uint64_t wake = (hedge_at < deadline) ? hedge_at : deadline;
+            if (poll(pfds, numof, (wake - now + 999) / 1000) < 0) {
+                res = -errno;
+                break;
+            }
+
+            for (unsigned n = 0; (n < numof) && (res == -ETIMEDOUT); n++) {
+                if (pfds[n].fd < 0 || !pfds[n].revents) {
+                    continue;
+                }
+                int tmp = _upstream_recv(&up[n], b);
+                if (!tmp) {
+                    res = 0;
+                }
+                else if (tmp != -ETIMEDOUT) {
+                    up[n].err = tmp;
+                }
+            }
+            if (res != -ETIMEDOUT) {
+                break;
+            }
+
+            now = _now();
+            if (b->linger && (now + b->linger < deadline)) {
+                deadline = now + b->linger;
+            }
+        }
+
+        for (unsigned n = 0; n < numof; n++) {
+            if (!up[n].replied && (up[n].server >= 0)) {
+                if ((res == -ETIMEDOUT) || up[n].err) {
+                    sock_dns_servers_failed(up[n].server);
+                }
+                else {
+                    sock_dns_servers_outpaced(up[n].server, _now() - up[n].sent);
+                }
+            }
+            if (up[n].err) {
+                err = up[n].err;
+            }
+            sock_udp_close(&up[n].sock);
+        }
+    }
+
+    return ((res == -ETIMEDOUT) && err) ? err : res;
+}
+
+typedef struct {
+    int family[2];
+    int res[2];
+    uint32_t ttl[2];
+    uint8_t addr[2][16];
+} _lookup_t;
+
+/* the negative answer for a name both queries found no address for: it does
+ * not exist if either says so */
+static int _negative(const int *res, unsigned numof)
+{
+    for (unsigned q = 0; q < numof; q++) {
+        if (res[q] == -ENXIO) {
+            return -ENXIO;
+        }
+    }
+    return -ENOMSG;
+}
+
+static int _lookup_reply(_batch_t *b, unsigned q, const uint8_t *msg, size_t len)
+{
+    _lookup_t *l = b->arg;
+
+    l->res[q] = _parse_dns_reply((uint8_t *)msg, len, l->addr[q], l->family[q], &l->ttl[q]);
+    if ((q == 0) && (l->res[0] > 0)) {
+        return 1;
+    }
+    if ((q == 1) && (l->res[1] > 0)) {
+        /* RFC 8305, 3: an A answer waits a little for the AAAA one */
+        b->linger = SOCK_DNS_RESOLUTION_DELAY_MS * 1000U;
+    }
+    return 0;
+}
+
+/* for AF_UNSPEC, sends separate AAAA and A queries in parallel, as many
+ * servers reject two questions in one message */
+static int _lookup(const char *domain_name, int family, void *addr_out, uint32_t *ttl_out)
+{
+    uint8_t query[2][SOCK_DNS_QUERYBUF_LEN];
+    _lookup_t l = {
+        .family = { family, AF_INET },
+        .res = { -ETIMEDOUT, -ETIMEDOUT },
+    };
+    _batch_t b = { .numof = 1, .reply = _lookup_reply, .arg = &l };
+
+    if (family == AF_UNSPEC) {
+        l.family[0] = AF_INET6;
+        b.numof = 2;
+    }
+
+    for (unsigned q = 0; q < b.numof; q++) {
+        ssize_t len = sock_dns_build_query(query[q], sizeof(query[q]), domain_name,
+                sock_dns_random_id(), l.family[q]);
+        if (len < 0) {
+            return len;
+        }
+        b.msg[q] = query[q];
+        b.len[q] = len;
+    }
+
+    int res = _exchange(&b);
+    if (res < 0) {
+        return res;
+    }
+
+    if (b.numof == 2) {
+        for (unsigned q = 0; q < 2; q++) {
+            sock_dns_cache_add(domain_name, l.family[q], l.res[q], l.addr[q], l.ttl[q]);
+        }
+    }
+
+    for (unsigned q = 0; q < b.numof; q++) {
+        if (l.res[q] > 0) {
+            memcpy(addr_out, l.addr[q], l.res[q]);
+            *ttl_out = l.ttl[q];
+            return l.res[q];
+        }
+    }
+    /* the name has no address only if both families say so */
+    for (unsigned q = 0; q < b.numof; q++) {
+        if ((l.res[q] != -ENOMSG) && (l.res[q] != -ENXIO)) {
+            return l.res[q];
+        }
+    }
+    *ttl_out = (l.ttl[0] < l.ttl[b.numof - 1]) ? l.ttl[0] : l.ttl[b.numof - 1];
+    return _negative(l.res, b.numof);
+}
+
+static int _query_name(const char *domain_name, void *addr_out, int family)
+{
+    uint32_t ttl = 0;
+
+    int cached = sock_dns_cache_get(domain_name, family, addr_out);
+    if (cached) {
+        return cached;
+    }
+
+    int res = _lookup(domain_name, family, addr_out, &ttl);
+    sock_dns_cache_add(domain_name, family, res, addr_out, ttl);
+    return res;
+}
+
+int sock_dns_query(const char *domain_name, void *addr_out, int family)
+{
+    int res = sock_dns_hosts_get(domain_name, family, addr_out);
     if (res) {
-        goto out;
+        return res;
+    }
+
+    _load_config();
+
+    /* a fully qualified name is never extended */
+    size_t len = strlen(domain_name);
+    if (!len || (domain_name[len - 1] == '.')) {
+        return _query_name(domain_name, addr_out, family);
     }
 
-    for (int i = 0; i < SOCK_DNS_RETRIES; i++) {
-        res = sock_udp_send(&sock_dns, buf, (bufpos-buf), NULL);
-        if (res <= 0) {
-            goto out;
+    unsigned dots = 0;
+    for (size_t i = 0; i < len; i++) {
+        dots += (domain_name[i] == '.');
+    }
+
+    /* the next candidate is only tried if a name does not exist
+     * (resolv.conf(5), "search") */
+    int as_is_first = (dots >= sock_dns_servers_ndots());
+    res = -ENOMSG;
+    if (as_is_first) {
+        res = _query_name(domain_name, addr_out, family);
+        if ((res != -ENOMSG) && (res != -ENXIO)) {
+            return res;
         }
-        res = sock_udp_recv(&sock_dns, reply_buf, sizeof(reply_buf), 1000000LU, NULL);
-        if (res > DNS_MIN_REPLY_LEN) {
-            if ((res = _parse_dns_reply(reply_buf, res, addr_out, family)) > 0) {
-                goto out;
-            }
+    }
+
+    char name[SOCK_DNS_MAX_NAME_LEN + 1];
+    char domain[SOCK_DNS_MAX_NAME_LEN + 1];
+    int domain_len;
+    for (unsigned i = 0; (domain_len = sock_dns_servers_search(i, domain)) >= 0; i++) {
+        if (len + 1 + domain_len > SOCK_DNS_MAX_NAME_LEN) {
+            continue;
+        }
+        memcpy(name, domain_name, len);
+        name[len] = '.';
+        memcpy(name + len + 1, domain, domain_len + 1);
+
+        res = _query_name(name, addr_out, family);
+        if ((res != -ENOMSG) && (res != -ENXIO)) {
+            return res;
+        }
+    }
+
+    if (!as_is_first) {
+        res = _query_name(domain_name, addr_out, family);
+    }
+    return res;
+}
+
+typedef struct {
+    int family[2];
+    sock_dns_addr_t *addrs;
+    size_t numof;
+    size_t found[2];
+    unsigned first;             /* query whose addresses come first in addrs */
+    uint32_t ttl[2];
+    int res[2];
+} _lookup_all_t;
+
+static int _lookup_all_reply(_batch_t *b, unsigned q, const uint8_t *msg, size_t len)
+{
+    _lookup_all_t *l = b->arg;
+
+    /* replies are stored in the order they come in, after the other one */
+    size_t offset = l->found[!q];
+    if (!offset) {
+        l->first = q;
+    }
+    l->res[q] = sock_dns_parse_addrs(msg, len, l->family[q], l->addrs + offset,
+            l->numof - offset, &l->ttl[q]);
+    if (l->res[q] > 0) {
+        l->found[q] = l->res[q];
+    }
+    return b->numof == 1;
+}
+
+static void _reverse(sock_dns_addr_t *addrs, size_t numof)
+{
+    for (size_t i = 0; i < numof / 2; i++) {
+        sock_dns_addr_t tmp = addrs[i];
+        addrs[i] = addrs[numof - 1 - i];
+        addrs[numof - 1 - i] = tmp;
+    }
+}
+
+int sock_dns_query_all(const char *domain_name, int family, sock_dns_addr_t *addrs,
+        size_t numof)
+{
+    uint8_t query[2][SOCK_DNS_QUERYBUF_LEN];
+    _lookup_all_t l = {
+        .family = { family, AF_INET }, .addrs = addrs, .numof = numof,
+        .res = { -ETIMEDOUT, -ETIMEDOUT },
+    };
+    _batch_t b = { .numof = 1, .reply = _lookup_all_reply, .arg = &l };
+
+    /* separate AAAA and A queries, as for sock_dns_query() */
+    if (family == AF_UNSPEC) {
+        l.family[0] = AF_INET6;
+        b.numof = 2;
+    }
+
+    for (unsigned q = 0; q < b.numof; q++) {
+        ssize_t len = sock_dns_build_query(query[q], sizeof(query[q]), domain_name,
+                sock_dns_random_id(), l.family[q]);
+        if (len < 0) {
+            return len;
         }
-        break;
+        b.msg[q] = query[q];
+        b.len[q] = len;
+    }
+
+    int res = _exchange(&b);
+    if (res < 0) {
+        return res;
     }
 
-out:
-    sock_udp_close(&sock_dns);
+    size_t total = l.found[0] + l.found[1];
+    if (l.first && l.found[0] && l.found[1]) {
+        /* rotate the AAAA addresses to the front */
+        _reverse(addrs, l.found[1]);
+        _reverse(addrs + l.found[1], l.found[0]);
+        _reverse(addrs, total);
+    }
+
+    if (total) {
+        sock_dns_cache_add(domain_name, family, addrs[0].len, addrs[0].addr, addrs[0].ttl);
+        return total;
+    }
+
+    /* the name has no address only if all families say so */
+    for (unsigned q = 0; q < b.numof; q++) {
+        if ((l.res[q] != -ENOMSG) && (l.res[q] != -ENXIO)) {
+            return l.res[q];
+        }
+    }
+    uint32_t ttl = (l.ttl[0] < l.ttl[b.numof - 1]) ? l.ttl[0] : l.ttl[b.numof - 1];
+    res = _negative(l.res, b.numof);
+    sock_dns_cache_add(domain_name, family, res, NULL, ttl);
     return res;
 }
 
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    ssize_t res;
+} _copy_t;
+
+static int _copy_reply(_batch_t *b, unsigned q, const uint8_t *msg, size_t len)
+{
+    _copy_t *c = b->arg;
+
+    (void)q;
+    if (len > c->len) {
+        c->res = -ENOSPC;
+    }
+    else {
+        memcpy(c->buf, msg, len);
+        c->res = len;
+    }
+    return 1;
+}
+
+ssize_t sock_dns_query_type(const char *domain_name, uint16_t type, uint8_t *buf, size_t len)
+{
+    uint8_t query[SOCK_DNS_QUERYBUF_LEN];
+    _copy_t c = { .buf = buf, .len = len };
+
+    ssize_t qlen = sock_dns_build_query_type(query, sizeof(query), domain_name,
+            sock_dns_random_id(), type);
+    if (qlen < 0) {
+        return qlen;
+    }
+
+    _batch_t b = {
+        .numof = 1, .msg = { query }, .len = { qlen }, .reply = _copy_reply, .arg = &c,
+    };
+    int res = _exchange(&b);
+    return (res < 0) ? res : c.res;
+}
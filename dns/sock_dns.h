@@ -8,6 +8,8 @@
 
 #include "net/sock/udp.h"
 
+#include "sock_dns_parse.h"
+
 typedef struct {
     uint16_t id;
     uint16_t flags;
@@ -19,17 +21,104 @@ typedef struct {
 } sock_dns_hdr_t;
 
 #define DNS_TYPE_A              (1)
+#define DNS_TYPE_CNAME          (5)
+#define DNS_TYPE_SOA            (6)
+#define DNS_TYPE_TXT            (16)
 #define DNS_TYPE_AAAA           (28)
+#define DNS_TYPE_SRV            (33)
+#define DNS_TYPE_OPT            (41)
 #define DNS_CLASS_IN            (1)
 
+#define DNS_RCODE_NOERROR       (0)
+#define DNS_RCODE_NXDOMAIN      (3)
+
 #define SOCK_DNS_PORT           (53)
 #define SOCK_DNS_RETRIES        (2)
 
+/* how long an A answer waits for the AAAA one (ms, RFC 8305, 3) */
+#define SOCK_DNS_RESOLUTION_DELAY_MS    (50U)
+
+/**
+ * @brief   UDP payload size advertised in an EDNS(0) OPT record (RFC 6891),
+ *          0 to send none
+ *
+ * Larger replies come with TC set and are fetched over TCP. The default
+ * avoids IP fragmentation on common paths.
+ */
+#ifndef SOCK_DNS_EDNS_PAYLOAD
+#define SOCK_DNS_EDNS_PAYLOAD   (1232U)
+#endif
+
+#define SOCK_DNS_OPT_LEN        (11U)
 #define SOCK_DNS_MAX_NAME_LEN   (64U)       /* we're in embedded context. */
-#define SOCK_DNS_QUERYBUF_LEN   (sizeof(sock_dns_hdr_t) + 4 + SOCK_DNS_MAX_NAME_LEN)
+#define SOCK_DNS_QUERYBUF_LEN   (sizeof(sock_dns_hdr_t) + 2 + 4 + 6 + SOCK_DNS_MAX_NAME_LEN + \
+                                 SOCK_DNS_OPT_LEN)
 
+/**
+ * @brief   Resolve @p domain_name to an address of @p family
+ *
+ * The hosts file is consulted first, see sock_dns_hosts.h. Unless servers
+ * were added before, the first query loads SOCK_DNS_RESOLV_CONF, whose
+ * search domains are appended to names that do not end with a dot, as
+ * resolv.conf(5) describes for "search" and "ndots".
+ *
+ * Answers, including negative ones, are cached for their TTL (see
+ * sock_dns_cache.h), so only the first lookup of a name goes upstream. The
+ * upstream server is picked by sock_dns_servers_pick(), see
+ * sock_dns_servers.h. For AF_UNSPEC, separate AAAA and A queries are sent in
+ * parallel and the AAAA answer is preferred, see sock_dns_he.h for
+ * delivering both as they arrive.
+ *
+ * @returns address length, -ENOMSG if the name has no such address, -ENXIO
+ *          if it does not exist (NXDOMAIN), or another negative errno
+ */
 int sock_dns_query(const char *domain_name, void *addr_out, int family);
 
+/**
+ * @brief   Resolve @p domain_name to all its addresses of @p family
+ *
+ * Unlike sock_dns_query(), this always asks upstream, the cache only
+ * holds one address per name. CNAME chains in the reply are followed. For
+ * AF_UNSPEC, the AAAA addresses come before the A ones.
+ *
+ * @returns number of addresses in @p addrs, see sock_dns_parse_addrs()
+ */
+int sock_dns_query_all(const char *domain_name, int family, sock_dns_addr_t *addrs,
+        size_t numof);
+
+/**
+ * @brief   Query the records of @p type (e.g. DNS_TYPE_SRV) for @p domain_name
+ *
+ * The reply is copied to @p buf, to be read with sock_dns_parser_init().
+ *
+ * @returns length of the reply, or negative errno
+ */
+ssize_t sock_dns_query_type(const char *domain_name, uint16_t type, uint8_t *buf, size_t len);
+
+/**
+ * @brief   Build a recursive query for the A (AF_INET) or AAAA (AF_INET6)
+ *          record of @p domain_name into @p buf
+ *
+ * @returns length of the query, -ENOSPC if the name is too long, or
+ *          -EAFNOSUPPORT for another family
+ */
+ssize_t sock_dns_build_query(uint8_t *buf, size_t len, const char *domain_name,
+        uint16_t id, int family);
+
+/**
+ * @brief   Build a recursive query for the records of @p type
+ */
+ssize_t sock_dns_build_query_type(uint8_t *buf, size_t len, const char *domain_name,
+        uint16_t id, uint16_t type);
+
+/**
+ * @brief   Unpredictable query ID (RFC 5452)
+ */
+uint16_t sock_dns_random_id(void);
+
+/* reply parser shared with sock_dns_resolver.c */
+int _parse_dns_reply(uint8_t *buf, size_t len, void* addr_out, int family, uint32_t *ttl_out);
+
 extern sock_udp_ep_t sock_dns_server;
 
 #endif /* SOCK_DNS_H */
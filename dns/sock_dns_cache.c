@@ -0,0 +1,193 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include "sock_dns.h"
+#include "sock_dns_cache.h"
+
+/* Entries are written under one lock and read without it: each carries a
+ * sequence number that is odd while a writer changes the entry, readers copy
+ * the entry and retry if the number changed meanwhile. */
+typedef struct {
+    atomic_uint seq;
+    uint32_t hash;
+    uint32_t expires;           /* seconds, 0 if unused */
+    int8_t family;
+    int8_t res;
+    uint8_t name_len;
+    uint8_t addr[16];
+    char name[SOCK_DNS_MAX_NAME_LEN];
+} _entry_t;
+
+static _entry_t _cache[SOCK_DNS_CACHE_SIZE];
+static atomic_flag _lock = ATOMIC_FLAG_INIT;
+
+static uint32_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    /* never 0, which marks unused entries */
+    return ts.tv_sec + 1;
+}
+
+static int _lower(int c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+/* returns the key length of @p name, or 0 if it is too long to be cached */
+static size_t _key(const char *name, int family, uint32_t *hash)
+{
+    size_t len = strlen(name);
+
+    /* "example.com." and "example.com" are the same name */
+    if (len && (name[len - 1] == '.')) {
+        len--;
+    }
+    if (len > SOCK_DNS_MAX_NAME_LEN) {
+        return 0;
+    }
+
+    uint32_t h = 2166136261U ^ (uint32_t)family;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ _lower(name[i])) * 16777619U;
+    }
+
+    *hash = h;
+    return len;
+}
+
+static int _name_eq(const _entry_t *e, const char *name, size_t len)
+{
+    if (e->name_len != len) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (e->name[i] != _lower(name[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void _read(_entry_t *e, _entry_t *copy)
+{
+    unsigned seq;
+    do {
+        while ((seq = atomic_load_explicit(&e->seq, memory_order_acquire)) & 1) {}
+        memcpy((char *)copy + offsetof(_entry_t, hash), (char *)e + offsetof(_entry_t, hash),
+                sizeof(*e) - offsetof(_entry_t, hash));
+        atomic_thread_fence(memory_order_acquire);
+    } while (atomic_load_explicit(&e->seq, memory_order_relaxed) != seq);
+}
+
+int sock_dns_cache_get(const char *name, int family, void *addr_out)
+{
+    uint32_t ttl;
+    return sock_dns_cache_get_ttl(name, family, addr_out, &ttl);
+}
+
+int sock_dns_cache_get_ttl(const char *name, int family, void *addr_out, uint32_t *ttl)
+{
+    uint32_t hash;
+    size_t len = _key(name, family, &hash);
+    if (!len) {
+        return 0;
+    }
+
+    uint32_t now = _now();
+    for (unsigned i = 0; i < SOCK_DNS_CACHE_PROBES; i++) {
+        _entry_t *e = &_cache[(hash + i) & (SOCK_DNS_CACHE_SIZE - 1)];
+        if (e->hash != hash) {
+            /* racy hint only, a match is confirmed on the copy */
+            continue;
+        }
+
+        _entry_t copy;
+        _read(e, &copy);
+        if ((copy.hash != hash) || (copy.family != family) || !_name_eq(&copy, name, len)) {
+            continue;
+        }
+        if (copy.expires <= now) {
+            return 0;
+        }
+        if (copy.res > 0) {
+            memcpy(addr_out, copy.addr, copy.res);
+        }
+        *ttl = copy.expires - now;
+        return copy.res;
+    }
+
+    return 0;
+}
+
+void sock_dns_cache_add(const char *name, int family, int res, const void *addr, uint32_t ttl)
+{
+    uint32_t hash;
+    size_t len = _key(name, family, &hash);
+    if (!len || ((res <= 0) && (((res != -ENOMSG) && (res != -ENXIO)) || !ttl)) ||
+            (res > 16)) {
+        return;
+    }
+
+    uint32_t max = (res > 0) ? SOCK_DNS_CACHE_TTL_MAX : SOCK_DNS_CACHE_NEG_TTL_MAX;
+    if (ttl < SOCK_DNS_CACHE_TTL_MIN) {
+        ttl = SOCK_DNS_CACHE_TTL_MIN;
+    }
+    else if (ttl > max) {
+        ttl = max;
+    }
+
+    uint32_t now = _now();
+    while (atomic_flag_test_and_set_explicit(&_lock, memory_order_acquire)) {}
+
+    /* the entry for this name, else a free or expired one, else the one
+     * that expires first */
+    _entry_t *victim = NULL;
+    for (unsigned i = 0; i < SOCK_DNS_CACHE_PROBES; i++) {
+        _entry_t *e = &_cache[(hash + i) & (SOCK_DNS_CACHE_SIZE - 1)];
+        if ((e->hash == hash) && (e->family == family) && _name_eq(e, name, len)) {
+            victim = e;
+            break;
+        }
+        if (!victim || (victim->expires > now && e->expires < victim->expires)) {
+            victim = e;
+        }
+    }
+
+    unsigned seq = atomic_load_explicit(&victim->seq, memory_order_relaxed);
+    atomic_store_explicit(&victim->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    victim->hash = hash;
+    victim->expires = now + ttl;
+    victim->family = family;
+    victim->res = res;
+    victim->name_len = len;
+    for (size_t i = 0; i < len; i++) {
+        victim->name[i] = _lower(name[i]);
+    }
+    if (res > 0) {
+        memcpy(victim->addr, addr, res);
+    }
+
+    atomic_store_explicit(&victim->seq, seq + 2, memory_order_release);
+    atomic_flag_clear_explicit(&_lock, memory_order_release);
+}
+
+void sock_dns_cache_flush(void)
+{
+    while (atomic_flag_test_and_set_explicit(&_lock, memory_order_acquire)) {}
+    for (unsigned i = 0; i < SOCK_DNS_CACHE_SIZE; i++) {
+        _entry_t *e = &_cache[i];
+        unsigned seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+        atomic_store_explicit(&e->seq, seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        e->expires = 0;
+        e->hash = 0;
+        atomic_store_explicit(&e->seq, seq + 2, memory_order_release);
+    }
+    atomic_flag_clear_explicit(&_lock, memory_order_release);
+}
@@ -0,0 +1,69 @@
+#ifndef SOCK_DNS_CACHE_H
+#define SOCK_DNS_CACHE_H
+
+#include <stdint.h>
+
+/**
+ * @brief   Number of cache entries, must be a power of two
+ */
+#ifndef SOCK_DNS_CACHE_SIZE
+#define SOCK_DNS_CACHE_SIZE         (256U)
+#endif
+
+/**
+ * @brief   Number of slots a name may occupy, starting at its hash
+ */
+#ifndef SOCK_DNS_CACHE_PROBES
+#define SOCK_DNS_CACHE_PROBES       (4U)
+#endif
+
+/**
+ * @name    TTL clamps in seconds
+ * @{
+ */
+#ifndef SOCK_DNS_CACHE_TTL_MIN
+#define SOCK_DNS_CACHE_TTL_MIN      (5U)
+#endif
+#ifndef SOCK_DNS_CACHE_TTL_MAX
+#define SOCK_DNS_CACHE_TTL_MAX      (86400U)
+#endif
+/** @brief  Upper bound for negative answers (RFC 2308, 5) */
+#ifndef SOCK_DNS_CACHE_NEG_TTL_MAX
+#define SOCK_DNS_CACHE_NEG_TTL_MAX  (900U)
+#endif
+/** @} */
+
+/**
+ * @brief   Look up @p name for @p family (AF_INET, AF_INET6 or AF_UNSPEC)
+ *
+ * Lookups take no lock, they retry only while the entry is being written.
+ * Names are compared case-insensitively.
+ *
+ * @returns address length, with the address written to @p addr_out
+ * @returns -ENOMSG or -ENXIO for a cached negative answer, see
+ *          sock_dns_query()
+ * @returns 0 if there is no unexpired entry
+ */
+int sock_dns_cache_get(const char *name, int family, void *addr_out);
+
+/**
+ * @brief   Like sock_dns_cache_get(), also getting the seconds left until the
+ *          entry expires
+ */
+int sock_dns_cache_get_ttl(const char *name, int family, void *addr_out, uint32_t *ttl);
+
+/**
+ * @brief   Store the result of a query for @p name and @p family
+ *
+ * @p res is the address length or -ENOMSG or -ENXIO for a negative answer,
+ * other errors are not cached. @p ttl is clamped to the limits above, a negative
+ * answer with @p ttl 0 (no SOA record) is not cached.
+ */
+void sock_dns_cache_add(const char *name, int family, int res, const void *addr, uint32_t ttl);
+
+/**
+ * @brief   Drop all entries
+ */
+void sock_dns_cache_flush(void);
+
+#endif /* SOCK_DNS_CACHE_H */
@@ -0,0 +1,364 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "net/sock/udp.h"
+#include "net/sock/posix.h"
+
+#include "sock_dns.h"
+#include "sock_dns_cache.h"
+#include "sock_dns_fwd.h"
+#include "sock_dns_resolver.h"
+
+#define QUESTION_MAX        (SOCK_DNS_MAX_NAME_LEN + 2 + 4)
+#define RCODE_SERVFAIL      (2)
+
+/* a client query waiting for the upstream answer */
+typedef struct _waiter {
+    struct _waiter *next;
+    sock_udp_ep_t remote;
+    uint16_t id;
+    uint8_t rd;
+    uint8_t qlen;
+    uint8_t question[QUESTION_MAX];     /* as sent, with the client's case */
+} _waiter_t;
+
+/* an A or AAAA query the resolver is working on */
+typedef struct _lookup {
+    struct _lookup *chain;
+    _waiter_t *waiters;
+    uint32_t hash;
+    int8_t family;
+    char name[SOCK_DNS_MAX_NAME_LEN + 1];   /* lower case */
+} _lookup_t;
+
+/* a query of another type passed on to the upstream server */
+typedef struct {
+    sock_udp_ep_t remote;
+    uint64_t expires;                   /* ms, 0 if unused */
+    uint16_t id;
+    uint16_t upstream_id;
+} _relay_t;
+
+static sock_udp_t _sock;
+static sock_udp_t _upstream;
+static sock_dns_resolver_t _resolver;
+
+static _lookup_t *_lookups[SOCK_DNS_FWD_BUCKETS];
+static _relay_t _relays[SOCK_DNS_FWD_RELAY_MAX];
+
+static uint8_t _buf[UINT16_MAX];
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U;
+}
+
+static int _lower(int c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+/* lower-cases @p name in place and returns its hash */
+static uint32_t _hash(char *name, int family)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261U ^ (uint32_t)family;
+    for (; *name; name++) {
+        *name = _lower(*name);
+        hash = (hash ^ (uint8_t)*name) * 16777619U;
+    }
+    return hash;
+}
+
+static _lookup_t **_find(const char *name, int family, uint32_t hash)
+{
+    _lookup_t **l = &_lookups[hash & (SOCK_DNS_FWD_BUCKETS - 1)];
+    for (; *l; l = &(*l)->chain) {
+        if (((*l)->hash == hash) && ((*l)->family == family) && !strcmp((*l)->name, name)) {
+            break;
+        }
+    }
+    return l;
+}
+
+/* answers @p w with @p res as returned by sock_dns_query() */
+static void _reply(const _waiter_t *w, int family, int res, const void *addr, uint32_t ttl)
+{
+    uint8_t buf[sizeof(sock_dns_hdr_t) + QUESTION_MAX + 12 + 16];
+    sock_dns_hdr_t *hdr = (sock_dns_hdr_t *)buf;
+    unsigned rcode = RCODE_SERVFAIL;
+    if ((res > 0) || (res == -ENOMSG)) {
+        rcode = DNS_RCODE_NOERROR;
+    }
+    else if (res == -ENXIO) {
+        rcode = DNS_RCODE_NXDOMAIN;
+    }
+
+    hdr->id = htons(w->id);
+    /* QR, RD as asked, RA */
+    hdr->flags = htons(0x8000 | (w->rd ? 0x0100 : 0) | 0x0080 | rcode);
+    hdr->qdcount = htons(1);
+    hdr->ancount = htons(res > 0);
+    hdr->nscount = 0;
+    hdr->arcount = 0;
+
+    uint8_t *pos = buf + sizeof(sock_dns_hdr_t);
+    memcpy(pos, w->question, w->qlen);
+    pos += w->qlen;
+
+    if (res > 0) {
+        uint16_t type = (family == AF_INET) ? DNS_TYPE_A : DNS_TYPE_AAAA;
+        /* the name is the question's */
+        *pos++ = 0xc0;
+        *pos++ = sizeof(sock_dns_hdr_t);
+        *pos++ = type >> 8;
+        *pos++ = type & 0xff;
+        *pos++ = 0;
+        *pos++ = DNS_CLASS_IN;
+        *pos++ = ttl >> 24;
+        *pos++ = (ttl >> 16) & 0xff;
+        *pos++ = (ttl >> 8) & 0xff;
+        *pos++ = ttl & 0xff;
+        *pos++ = 0;
+        *pos++ = res;
+        memcpy(pos, addr, res);
+        pos += res;
+    }
+
+    sock_udp_send(&_sock, buf, pos - buf, &w->remote);
+}
+
+static void _resolved(void *arg, int res, const void *addr)
+{
+    _lookup_t *l = arg;
+    uint32_t ttl = 0;
+
+    /* the resolver has just cached the answer, with its TTL */
+    if ((res > 0) || (res == -ENOMSG) || (res == -ENXIO)) {
+        uint8_t cached[16];
+        if (sock_dns_cache_get_ttl(l->name, l->family, cached, &ttl) != res) {
+            ttl = 0;
+        }
+    }
+
+    _lookup_t **pos = _find(l->name, l->family, l->hash);
+    if (*pos == l) {
+        *pos = l->chain;
+    }
+
+    while (l->waiters) {
+        _waiter_t *w = l->waiters;
+        l->waiters = w->next;
+        _reply(w, l->family, res, addr, ttl);
+        free(w);
+    }
+    free(l);
+}
+
+static int _add_waiter(_lookup_t *l, const _waiter_t *waiter)
+{
+    _waiter_t *w;
+    for (w = l->waiters; w; w = w->next) {
+        if ((w->id == waiter->id) && (w->remote.port == waiter->remote.port) &&
+                !memcmp(&w->remote.addr, &waiter->remote.addr, sizeof(w->remote.addr))) {
+            /* retransmission */
+            return 0;
+        }
+    }
+
+    w = malloc(sizeof(_waiter_t));
+    if (!w) {
+        return -ENOMEM;
+    }
+    *w = *waiter;
+    w->next = l->waiters;
+    l->waiters = w;
+    return 0;
+}
+
+static void _lookup(const _waiter_t *w, char *name, int family)
+{
+    uint8_t addr[16];
+    uint32_t ttl;
+
+    int res = sock_dns_cache_get_ttl(name, family, addr, &ttl);
+    if (res) {
+        _reply(w, family, res, addr, ttl);
+        return;
+    }
+
+    uint32_t hash = _hash(name, family);
+    _lookup_t **pos = _find(name, family, hash);
+    if (*pos) {
+        if (_add_waiter(*pos, w)) {
+            _reply(w, family, -ENOMEM, NULL, 0);
+        }
+        return;
+    }
+
+    _lookup_t *l = calloc(1, sizeof(_lookup_t));
+    if (!l || _add_waiter(l, w)) {
+        free(l);
+        _reply(w, family, -ENOMEM, NULL, 0);
+        return;
+    }
+    l->hash = hash;
+    l->family = family;
+    strcpy(l->name, name);
+    *pos = l;
+
+    res = sock_dns_resolver_query(&_resolver, name, family, _resolved, l);
+    if (res < 0) {
+        _resolved(l, res, NULL);
+    }
+}
+
+static void _relay(uint8_t *buf, size_t len, const sock_udp_ep_t *remote)
+{
+    uint64_t now = _now();
+    _relay_t *r = NULL;
+
+    for (unsigned i = 0; i < SOCK_DNS_FWD_RELAY_MAX; i++) {
+        if (_relays[i].expires <= now) {
+            r = &_relays[i];
+            break;
+        }
+    }
+    if (!r) {
+        /* the client will retry */
+        return;
+    }
+
+    r->remote = *remote;
+    r->id = (buf[0] << 8) | buf[1];
+    r->upstream_id = sock_dns_random_id();
+    r->expires = now + SOCK_DNS_FWD_RELAY_TIMEOUT_MS;
+
+    buf[0] = r->upstream_id >> 8;
+    buf[1] = r->upstream_id & 0xff;
+    if (sock_udp_send(&_upstream, buf, len, NULL) < 0) {
+        r->expires = 0;
+    }
+}
+
+static void _relay_recv(void)
+{
+    ssize_t res;
+
+    while ((res = sock_udp_recv(&_upstream, _buf, sizeof(_buf), 0, NULL)) > 0) {
+        uint16_t id = (_buf[0] << 8) | _buf[1];
+        uint64_t now = _now();
+
+        for (unsigned i = 0; i < SOCK_DNS_FWD_RELAY_MAX; i++) {
+            _relay_t *r = &_relays[i];
+            if ((r->upstream_id != id) || (r->expires <= now)) {
+                continue;
+            }
+            _buf[0] = r->id >> 8;
+            _buf[1] = r->id & 0xff;
+            sock_udp_send(&_sock, _buf, res, &r->remote);
+            r->expires = 0;
+            break;
+        }
+    }
+}
+
+static void _query(uint8_t *buf, size_t len, const sock_udp_ep_t *remote)
+{
+    sock_dns_parser_t p;
+    char name[SOCK_DNS_MAX_NAME_LEN + 1];
+
+    if (sock_dns_parser_init(&p, buf, len)) {
+        return;
+    }
+
+    /* only plain recursive A and AAAA queries go through the cache */
+    const sock_dns_hdr_t *hdr = (const sock_dns_hdr_t *)buf;
+    size_t qlen = p.pos - sizeof(sock_dns_hdr_t);
+    const uint8_t *qtail = buf + p.pos - 4;
+    uint16_t type = (qtail[0] << 8) | qtail[1];
+    uint16_t class = (qtail[2] << 8) | qtail[3];
+
+    if ((ntohs(hdr->qdcount) != 1) || (buf[2] & 0x78) || (class != DNS_CLASS_IN) ||
+            ((type != DNS_TYPE_A) && (type != DNS_TYPE_AAAA)) || (qlen > QUESTION_MAX) ||
+            (sock_dns_name_str(&p, p.qname, name, sizeof(name)) <= 0)) {
+        _relay(buf, len, remote);
+        return;
+    }
+
+    _waiter_t w = {
+        .remote = *remote,
+        .id = ntohs(hdr->id),
+        .rd = buf[2] & 0x01,
+        .qlen = qlen,
+    };
+    memcpy(w.question, buf + sizeof(sock_dns_hdr_t), qlen);
+
+    _lookup(&w, name, (type == DNS_TYPE_A) ? AF_INET : AF_INET6);
+}
+
+static void _serve(void)
+{
+    sock_udp_ep_t remote;
+    ssize_t res;
+
+    while ((res = sock_udp_recv(&_sock, _buf, sizeof(_buf), 0, &remote)) > 0) {
+        _query(_buf, res, &remote);
+    }
+}
+
+int sock_dns_fwd_server(sock_udp_ep_t *local, const sock_udp_ep_t *upstream)
+{
+    if (!local->port) {
+        local->port = SOCK_DNS_PORT;
+    }
+
+    int res = sock_dns_resolver_init(&_resolver, upstream);
+    if (res) {
+        return res;
+    }
+    if (sock_udp_create(&_upstream, NULL, upstream, 0) < 0) {
+        return -1;
+    }
+    if (sock_udp_create(&_sock, local, NULL, 0) < 0) {
+        return -1;
+    }
+
+    static const struct sock_filter queries[] = SOCK_FILTER_DNS_QUERY;
+    sock_udp_attach_filter(&_sock, queries, sizeof(queries) / sizeof(queries[0]));
+    static const struct sock_filter responses[] = SOCK_FILTER_DNS_RESPONSE;
+    sock_udp_attach_filter(&_upstream, responses, sizeof(responses) / sizeof(responses[0]));
+
+    while (1) {
+        struct pollfd fds[2 + SOCK_DNS_RESOLVER_POLLFDS] = {
+            { .fd = _sock.fd, .events = POLLIN },
+            { .fd = _upstream.fd, .events = POLLIN },
+        };
+        int timeout = sock_dns_resolver_timeouts(&_resolver);
+        unsigned numof = 2 + sock_dns_resolver_pollfds(&_resolver, &fds[2]);
+
+        if (poll(fds, numof, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+
+        if (fds[2].revents || ((numof > 3) && fds[3].revents)) {
+            sock_dns_resolver_recv(&_resolver);
+        }
+        if (fds[1].revents) {
+            _relay_recv();
+        }
+        if (fds[0].revents) {
+            _serve();
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef SOCK_DNS_FWD_H
+#define SOCK_DNS_FWD_H
+
+#include "net/sock/udp.h"
+
+/**
+ * @brief   Number of hash buckets for lookups in progress, must be a power
+ *          of two
+ */
+#ifndef SOCK_DNS_FWD_BUCKETS
+#define SOCK_DNS_FWD_BUCKETS        (1024U)
+#endif
+
+/**
+ * @brief   Maximum number of relayed queries (other than A and AAAA) in
+ *          flight
+ */
+#ifndef SOCK_DNS_FWD_RELAY_MAX
+#define SOCK_DNS_FWD_RELAY_MAX      (256U)
+#endif
+
+/**
+ * @brief   Time (ms) after which a relayed query is given up, the client will
+ *          have retried by then
+ */
+#ifndef SOCK_DNS_FWD_RELAY_TIMEOUT_MS
+#define SOCK_DNS_FWD_RELAY_TIMEOUT_MS   (5000U)
+#endif
+
+/**
+ * @brief   Answer DNS queries on @p local through the cache and @p upstream
+ *
+ * A and AAAA queries are answered from sock_dns_cache.h, misses are resolved
+ * through a sock_dns_resolver_t. Identical queries arriving while one is
+ * being resolved wait for its answer, so the upstream server only sees a
+ * single query; names are compared case-insensitively. The cache holds one
+ * address per name, so answers carry a single A or AAAA record with the
+ * remaining TTL, even if the upstream RRset has more. Negative answers keep
+ * the upstream rcode, NXDOMAIN or NOERROR without answers (NODATA), and
+ * failures are given as SERVFAIL.
+ *
+ * Queries of other types are relayed to @p upstream as they are, with a new
+ * ID, and not cached.
+ *
+ * Only returns on error.
+ */
+int sock_dns_fwd_server(sock_udp_ep_t *local, const sock_udp_ep_t *upstream);
+
+#endif /* SOCK_DNS_FWD_H */
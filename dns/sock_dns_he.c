@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+
+#include "net/sock/udp.h"
+
+#include "sock_dns.h"
+#include "sock_dns_he.h"
+#include "sock_dns_resolver.h"
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U;
+}
+
+static void _resolved(void *arg, int res, const void *addr)
+{
+    sock_dns_he_query_t *q = arg;
+
+    q->done = 1;
+    q->he->cb(q->he->arg, q->family, res, addr);
+}
+
+static int _query(sock_dns_resolver_t *resolver, sock_dns_he_t *he, const char *name,
+        sock_dns_he_cb_t cb, void *arg, int all)
+{
+    static const int8_t families[] = { AF_INET6, AF_INET };
+    int res[2];
+
+    he->cb = cb;
+    he->arg = arg;
+    for (unsigned i = 0; i < 2; i++) {
+        he->queries[i].he = he;
+        he->queries[i].family = families[i];
+        he->queries[i].done = 0;
+    }
+
+    /* AAAA first (RFC 8305, 3), a cached answer calls back right away */
+    for (unsigned i = 0; i < 2; i++) {
+        res[i] = all ? sock_dns_resolver_query_all(resolver, name, families[i], _resolved,
+                               &he->queries[i])
+                     : sock_dns_resolver_query(resolver, name, families[i], _resolved,
+                               &he->queries[i]);
+        if (res[i] < 0) {
+            he->queries[i].done = 1;
+        }
+    }
+
+    if ((res[0] < 0) && (res[1] < 0)) {
+        return res[0];
+    }
+    /* only one query went out, report the other one as failed */
+    for (unsigned i = 0; i < 2; i++) {
+        if (res[i] < 0) {
+            cb(arg, families[i], res[i], NULL);
+        }
+    }
+    return 0;
+}
+
+int sock_dns_he_query(sock_dns_resolver_t *resolver, sock_dns_he_t *he, const char *name,
+        sock_dns_he_cb_t cb, void *arg)
+{
+    return _query(resolver, he, name, cb, arg, 0);
+}
+
+int sock_dns_he_query_all(sock_dns_resolver_t *resolver, sock_dns_he_t *he, const char *name,
+        sock_dns_he_cb_t cb, void *arg)
+{
+    return _query(resolver, he, name, cb, arg, 1);
+}
+
+void sock_dns_he_cancel(sock_dns_resolver_t *resolver, sock_dns_he_t *he)
+{
+    for (unsigned i = 0; i < 2; i++) {
+        if (!he->queries[i].done) {
+            sock_dns_resolver_cancel(resolver, &he->queries[i]);
+            he->queries[i].done = 1;
+        }
+    }
+}
+
+/* connection attempts to candidates that may still be added while it runs */
+typedef struct {
+    const sock_udp_ep_t *candidates;
+    size_t numof;                   /* candidates known so far */
+    int first_family;
+    const void *probe;
+    size_t probe_len;
+    uint8_t order[SOCK_DNS_HE_CANDIDATES_MAX];  /* candidate of each attempt */
+    sock_udp_t socks[SOCK_DNS_HE_CANDIDATES_MAX];
+    struct pollfd pfds[SOCK_DNS_HE_CANDIDATES_MAX + SOCK_DNS_RESOLVER_POLLFDS];
+    size_t started;
+    unsigned attempts;              /* probes waiting for a reply */
+    uint64_t next_attempt;
+    int winner;                     /* attempt, -1 while there is none */
+} _race_t;
+
+/* the candidate for the next attempt: families take turns, starting with
+ * first_family, a family that is used up just passes (RFC 8305, 4) */
+static unsigned _race_next(const _race_t *r)
+{
+    int family = r->first_family;
+    if (r->started) {
+        family = (r->candidates[r->order[r->started - 1]].family == AF_INET6) ? AF_INET
+                                                                             : AF_INET6;
+    }
+
+    unsigned any = r->numof;
+    for (unsigned i = 0; i < r->numof; i++) {
+        unsigned n;
+        for (n = 0; (n < r->started) && (r->order[n] != i); n++) {}
+        if (n < r->started) {
+            continue;
+        }
+        if (r->candidates[i].family == family) {
+            return i;
+        }
+        if (any == r->numof) {
+            any = i;
+        }
+    }
+    return any;
+}
+
+/* starts the attempts that are due, then waits for replies until the next
+ * one is due or @p deadline, and for @p resolver if given. Returns 1 once
+ * there is a winner, 0 to go on, or negative errno */
+static int _race_step(_race_t *r, uint64_t deadline, sock_dns_resolver_t *resolver)
+{
+    uint8_t buf[64];
+    uint64_t now = _now();
+
+    while ((r->started < r->numof) && (now >= r->next_attempt)) {
+        size_t n = r->started++;
+        r->order[n] = _race_next(r);
+        r->pfds[n].fd = -1;
+        r->pfds[n].events = POLLIN;
+        if (sock_udp_create(&r->socks[n], NULL, &r->candidates[r->order[n]], 0) < 0) {
+            /* no route for this family, try the next one right away */
+            continue;
+        }
+        if (!r->probe) {
+            r->winner = n;
+            return 1;
+        }
+        if (sock_udp_send(&r->socks[n], r->probe, r->probe_len, NULL) < 0) {
+            sock_udp_close(&r->socks[n]);
+            continue;
+        }
+        r->pfds[n].fd = r->socks[n].fd;
+        r->attempts++;
+        r->next_attempt = now + SOCK_DNS_HE_ATTEMPT_DELAY_MS;
+    }
+
+    if (!r->attempts && (r->started == r->numof) && !resolver) {
+        return -EHOSTUNREACH;
+    }
+    if (now >= deadline) {
+        return -ETIMEDOUT;
+    }
+
+    uint64_t wake = deadline;
+    if ((r->started < r->numof) && (r->next_attempt < wake)) {
+        wake = r->next_attempt;
+    }
+    unsigned numof = r->started;
+    if (resolver) {
+        int timeout = sock_dns_resolver_timeouts(resolver);
+        if ((timeout >= 0) && (now + timeout < wake)) {
+            wake = now + timeout;
+        }
+        numof += sock_dns_resolver_pollfds(resolver, &r->pfds[r->started]);
+    }
+    if (poll(r->pfds, numof, wake - now) < 0) {
+        return -errno;
+    }
+
+    for (size_t n = 0; n < r->started; n++) {
+        if ((r->pfds[n].fd < 0) || !r->pfds[n].revents) {
+            continue;
+        }
+        if (sock_udp_recv(&r->socks[n], buf, sizeof(buf), 0, NULL) >= 0) {
+            r->winner = n;
+            return 1;
+        }
+        /* e.g. ICMP unreachable, the next attempt starts right away
+         * (RFC 8305, 5) */
+        sock_udp_close(&r->socks[n]);
+        r->pfds[n].fd = -1;
+        r->attempts--;
+        r->next_attempt = now;
+    }
+
+    /* answers coming in add candidates */
+    for (unsigned i = r->started; i < numof; i++) {
+        if (r->pfds[i].revents) {
+            sock_dns_resolver_recv(resolver);
+            break;
+        }
+    }
+    return 0;
+}
+
+/* closes all attempts but the winner's, which goes to @p sock, and returns
+ * its candidate */
+static int _race_finish(_race_t *r, sock_udp_t *sock)
+{
+    for (size_t n = 0; n < r->started; n++) {
+        if ((int)n == r->winner) {
+            *sock = r->socks[n];
+        }
+        else if (r->pfds[n].fd >= 0) {
+            sock_udp_close(&r->socks[n]);
+        }
+    }
+    return (r->winner < 0) ? -1 : r->order[r->winner];
+}
+
+int sock_dns_he_race(const sock_udp_ep_t *candidates, size_t numof, const void *probe,
+        size_t probe_len, uint32_t timeout_ms, sock_udp_t *sock)
+{
+    _race_t r = {
+        .candidates = candidates, .numof = numof, .probe = probe, .probe_len = probe_len,
+        .winner = -1,
+    };
+
+    if (!numof || (numof > SOCK_DNS_HE_CANDIDATES_MAX)) {
+        return -EINVAL;
+    }
+    r.first_family = candidates[0].family;
+
+    uint64_t deadline = _now() + timeout_ms;
+    int res;
+    while (!(res = _race_step(&r, deadline, NULL))) {}
+
+    int winner = _race_finish(&r, sock);
+    return (res < 0) ? res : winner;
+}
+
+typedef struct {
+    sock_dns_he_t he;
+    _race_t race;
+    sock_udp_ep_t candidates[SOCK_DNS_HE_CANDIDATES_MAX];
+    uint16_t port;
+    int res;
+} _connect_t;
+
+static void _collect(void *arg, int family, int res, const void *addr)
+{
+    _connect_t *c = arg;
+    _race_t *r = &c->race;
+
+    if (res <= 0) {
+        /* a failure says more than a missing address */
+        if (!c->res || (c->res == -ENOMSG) || (c->res == -ENXIO)) {
+            c->res = res;
+        }
+        /* A addresses need not wait for AAAA ones that will not come */
+        if ((family == AF_INET6) && !r->started) {
+            r->next_attempt = 0;
+        }
+        return;
+    }
+
+    /* while the other query is outstanding, half the slots are kept for it */
+    unsigned other = (family == AF_INET6);
+    size_t room = SOCK_DNS_HE_CANDIDATES_MAX - r->numof;
+    if (!c->he.queries[other].done && (room > SOCK_DNS_HE_CANDIDATES_MAX / 2)) {
+        room = SOCK_DNS_HE_CANDIDATES_MAX / 2;
+    }
+
+    const sock_dns_addr_t *addrs = addr;
+    for (int i = 0; (i < res) && room; i++, room--) {
+        sock_udp_ep_t *ep = &c->candidates[r->numof++];
+        memset(ep, 0, sizeof(*ep));
+        ep->family = family;
+        ep->port = c->port;
+        memcpy(&ep->addr, addrs[i].addr, addrs[i].len);
+    }
+
+    /* RFC 8305, 3: A addresses wait a little for the AAAA answer, which
+     * starts the race right away */
+    if ((family == AF_INET) && !c->he.queries[0].done) {
+        r->next_attempt = _now() + SOCK_DNS_RESOLUTION_DELAY_MS;
+    }
+    else if ((family == AF_INET6) && !r->started) {
+        r->next_attempt = 0;
+    }
+}
+
+int sock_dns_he_connect(sock_dns_resolver_t *resolver, const char *name, uint16_t port,
+        const void *probe, size_t probe_len, uint32_t timeout_ms, sock_udp_t *sock,
+        sock_udp_ep_t *remote)
+{
+    _connect_t c = { .port = port };
+    uint64_t deadline = _now() + timeout_ms;
+
+    c.race.candidates = c.candidates;
+    c.race.first_family = AF_INET6;
+    c.race.probe = probe;
+    c.race.probe_len = probe_len;
+    c.race.winner = -1;
+
+    int res = sock_dns_he_query_all(resolver, &c.he, name, _collect, &c);
+    if (res < 0) {
+        return res;
+    }
+
+    /* attempts start as addresses come in, resolving goes on meanwhile */
+    do {
+        if (sock_dns_he_done(&c.he) && !c.race.numof) {
+            res = c.res ? c.res : -EHOSTUNREACH;
+            break;
+        }
+        res = _race_step(&c.race, deadline, sock_dns_he_done(&c.he) ? NULL : resolver);
+    } while (!res);
+    sock_dns_he_cancel(resolver, &c.he);
+
+    int winner = _race_finish(&c.race, sock);
+    if (res < 0) {
+        return res;
+    }
+    *remote = c.candidates[winner];
+    return 0;
+}
@@ -0,0 +1,120 @@
+#ifndef SOCK_DNS_HE_H
+#define SOCK_DNS_HE_H
+
+#include <stdint.h>
+
+#include "net/sock/udp.h"
+
+#include "sock_dns.h"
+#include "sock_dns_resolver.h"
+
+/**
+ * @brief   Time between two connection attempts (ms, RFC 8305, 5)
+ */
+#ifndef SOCK_DNS_HE_ATTEMPT_DELAY_MS
+#define SOCK_DNS_HE_ATTEMPT_DELAY_MS    (250U)
+#endif
+
+/**
+ * @brief   Maximum number of candidates sock_dns_he_race() accepts
+ */
+#ifndef SOCK_DNS_HE_CANDIDATES_MAX
+#define SOCK_DNS_HE_CANDIDATES_MAX      (8U)
+#endif
+
+/**
+ * @brief   CoAP ping probe: an empty confirmable message, answered with RST
+ */
+#define SOCK_DNS_HE_COAP_PING           { 0x40, 0x00, 0x00, 0x01 }
+
+/**
+ * @brief   Called once per address family with the result of the query for
+ *          it, AAAA and A answers are delivered as they arrive
+ */
+typedef void (*sock_dns_he_cb_t)(void *arg, int family, int res, const void *addr);
+
+typedef struct sock_dns_he sock_dns_he_t;
+
+typedef struct {
+    sock_dns_he_t *he;
+    int8_t family;
+    uint8_t done;
+} sock_dns_he_query_t;
+
+/**
+ * @brief   Parallel AAAA and A lookup of one name (RFC 8305, 3)
+ *
+ * Must stay valid until both queries are done or sock_dns_he_cancel().
+ */
+struct sock_dns_he {
+    sock_dns_he_cb_t cb;
+    void *arg;
+    sock_dns_he_query_t queries[2];     /**< AAAA, A */
+};
+
+/**
+ * @brief   Send separate AAAA and A queries for @p name through @p resolver
+ *
+ * @returns 0 if @p cb will be called twice, or negative errno if no query
+ *          could be sent
+ */
+int sock_dns_he_query(sock_dns_resolver_t *resolver, sock_dns_he_t *he, const char *name,
+        sock_dns_he_cb_t cb, void *arg);
+
+/**
+ * @brief   Like sock_dns_he_query(), but with sock_dns_resolver_query_all(),
+ *          so @p cb gets all addresses of each family
+ */
+int sock_dns_he_query_all(sock_dns_resolver_t *resolver, sock_dns_he_t *he, const char *name,
+        sock_dns_he_cb_t cb, void *arg);
+
+/**
+ * @brief   Check whether both queries of @p he are answered
+ */
+static inline int sock_dns_he_done(const sock_dns_he_t *he)
+{
+    return he->queries[0].done && he->queries[1].done;
+}
+
+/**
+ * @brief   Drop the outstanding queries of @p he without calling back
+ */
+void sock_dns_he_cancel(sock_dns_resolver_t *resolver, sock_dns_he_t *he);
+
+/**
+ * @brief   Race connection attempts to @p candidates, the first usable one wins
+ *
+ * Candidates are tried in the given order with the families interleaved
+ * (RFC 8305, 4), a new attempt starting every SOCK_DNS_HE_ATTEMPT_DELAY_MS
+ * or as soon as the previous one failed. Without @p probe, a candidate is
+ * usable once sock_udp_create() can connect to it, i.e. there is a route.
+ * With @p probe (e.g. SOCK_DNS_HE_COAP_PING), it is usable once it replied
+ * to the probe.
+ *
+ * @param[out] sock     connected to the winner
+ *
+ * @returns index of the winner in @p candidates, -ETIMEDOUT after
+ *          @p timeout_ms, -EHOSTUNREACH if all attempts failed
+ */
+int sock_dns_he_race(const sock_udp_ep_t *candidates, size_t numof, const void *probe,
+        size_t probe_len, uint32_t timeout_ms, sock_udp_t *sock);
+
+/**
+ * @brief   Resolve @p name and connect to the fastest usable address
+ *
+ * Attempts as by sock_dns_he_race() start once the AAAA answer is in, or
+ * the A answer plus SOCK_DNS_RESOLUTION_DELAY_MS, IPv6 first. The other
+ * query keeps running, its addresses join the race as they arrive (RFC
+ * 8305, 3). Up to SOCK_DNS_HE_CANDIDATES_MAX addresses are tried, half of
+ * them kept for the family answering second.
+ *
+ * @param[out] remote   address of the winner, with @p port
+ *
+ * @returns 0 on success, -ENOMSG or -ENXIO if @p name has no address (see
+ *          sock_dns_query()), or another negative errno
+ */
+int sock_dns_he_connect(sock_dns_resolver_t *resolver, const char *name, uint16_t port,
+        const void *probe, size_t probe_len, uint32_t timeout_ms, sock_udp_t *sock,
+        sock_udp_ep_t *remote);
+
+#endif /* SOCK_DNS_HE_H */
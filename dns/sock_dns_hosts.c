@@ -0,0 +1,342 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sock_dns.h"
+#include "sock_dns_hosts.h"
+
+/* Entries refer to the names in a copy of the file by offset, the index is
+ * open addressing with linear probing and at most half full. The file is
+ * read rather than mapped, truncating a mapped file would fault lookups. */
+typedef struct {
+    uint32_t hash;
+    uint32_t name;              /* offset in text */
+    uint8_t name_len;
+    uint8_t len;                /* address length, 0 if unused */
+    uint8_t addr[16];
+} _entry_t;
+
+/* a file read and indexed, not changed once lookups see it */
+typedef struct {
+    char *text;
+    size_t text_len;
+    _entry_t *index;
+    size_t index_size;
+} _hosts_t;
+
+/* Lookups only hold _lock for reading while they probe. A new table is built
+ * without it, under _build_lock, and swapped in under it for writing. */
+static pthread_rwlock_t _lock = PTHREAD_RWLOCK_INITIALIZER;
+static _hosts_t *_hosts;
+static pthread_mutex_t _build_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *_path = SOCK_DNS_HOSTS_PATH;
+static struct stat _stat;       /* of the indexed file */
+static _Atomic uint64_t _next_check;    /* ms, 0 before the first check */
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U;
+}
+
+static int _lower(int c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+static uint32_t _hash(const char *name, size_t len, int family)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261U ^ (uint32_t)family;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ _lower(name[i])) * 16777619U;
+    }
+    return h;
+}
+
+static int _name_eq(const _hosts_t *h, const _entry_t *e, const char *name, size_t len)
+{
+    if (e->name_len != len) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (_lower(h->text[e->name + i]) != _lower(name[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* returns the entry for @p name, or the unused one where it would go */
+static _entry_t *_slot(const _hosts_t *h, const char *name, size_t len, int family,
+        uint32_t hash)
+{
+    size_t i = hash & (h->index_size - 1);
+
+    while (h->index[i].len) {
+        _entry_t *e = &h->index[i];
+        if ((e->hash == hash) && ((e->len == 4) == (family == AF_INET)) &&
+                _name_eq(h, e, name, len)) {
+            break;
+        }
+        i = (i + 1) & (h->index_size - 1);
+    }
+    return &h->index[i];
+}
+
+static int _is_space(char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+/* counts the names in the file, and adds them to the index if there
+ * is one */
+static size_t _walk(_hosts_t *h)
+{
+    const char *pos = h->text;
+    const char *end = h->text + h->text_len;
+    size_t numof = 0;
+
+    while (pos < end) {
+        const char *eol = memchr(pos, '\n', end - pos);
+        const char *comment = memchr(pos, '#', (eol ? eol : end) - pos);
+        const char *line_end = comment ? comment : (eol ? eol : end);
+
+        /* the address, then its names */
+        uint8_t addr[16];
+        int len = 0;
+        for (int field = 0; pos < line_end; field++) {
+            while ((pos < line_end) && _is_space(*pos)) {
+                pos++;
+            }
+            const char *token = pos;
+            while ((pos < line_end) && !_is_space(*pos)) {
+                pos++;
+            }
+            size_t token_len = pos - token;
+            if (!token_len) {
+                break;
+            }
+
+            if (!field) {
+                char str[INET6_ADDRSTRLEN];
+                if (token_len >= sizeof(str)) {
+                    break;
+                }
+                memcpy(str, token, token_len);
+                str[token_len] = '\0';
+                len = (inet_pton(AF_INET, str, addr) == 1) ? 4 :
+                      (inet_pton(AF_INET6, str, addr) == 1) ? 16 : 0;
+                if (!len) {
+                    break;
+                }
+                continue;
+            }
+
+            if (token_len > UINT8_MAX) {
+                continue;
+            }
+            numof++;
+            if (!h->index) {
+                continue;
+            }
+            int family = (len == 4) ? AF_INET : AF_INET6;
+            uint32_t hash = _hash(token, token_len, family);
+            _entry_t *e = _slot(h, token, token_len, family, hash);
+            if (!e->len) {
+                e->hash = hash;
+                e->name = token - h->text;
+                e->name_len = token_len;
+                e->len = len;
+                memcpy(e->addr, addr, len);
+            }
+        }
+
+        pos = eol ? eol + 1 : end;
+    }
+
+    return numof;
+}
+
+static void _free(_hosts_t *h)
+{
+    if (h) {
+        free(h->text);
+        free(h->index);
+        free(h);
+    }
+}
+
+/* replaces the table lookups see with @p h, NULL for none */
+static void _swap(_hosts_t *h)
+{
+    pthread_rwlock_wrlock(&_lock);
+    _hosts_t *old = _hosts;
+    _hosts = h;
+    pthread_rwlock_unlock(&_lock);
+
+    _free(old);
+}
+
+/* reads and indexes the file into a new table, with _build_lock held */
+static int _build(_hosts_t **out)
+{
+    int fd = open(_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        memset(&_stat, 0, sizeof(_stat));
+        return -errno;
+    }
+    if (fstat(fd, &_stat)) {
+        int res = -errno;
+        close(fd);
+        return res;
+    }
+
+    _hosts_t *h = calloc(1, sizeof(_hosts_t));
+    if (!h) {
+        close(fd);
+        return -ENOMEM;
+    }
+
+    /* the file may change while it is read, what was read is indexed */
+    h->text = malloc(_stat.st_size ? _stat.st_size : 1);
+    if (!h->text) {
+        close(fd);
+        _free(h);
+        return -ENOMEM;
+    }
+    while (h->text_len < (size_t)_stat.st_size) {
+        ssize_t n = read(fd, h->text + h->text_len, _stat.st_size - h->text_len);
+        if (n < 0) {
+            int res = -errno;
+            close(fd);
+            _free(h);
+            return res;
+        }
+        if (!n) {
+            break;
+        }
+        h->text_len += n;
+    }
+    close(fd);
+
+    size_t numof = _walk(h);
+    h->index_size = 16;
+    while (h->index_size < 2 * numof) {
+        h->index_size *= 2;
+    }
+    h->index = calloc(h->index_size, sizeof(_entry_t));
+    if (!h->index) {
+        _free(h);
+        return -ENOMEM;
+    }
+    _walk(h);
+
+    *out = h;
+    return numof;
+}
+
+/* rebuilds the table if the file changed, at most every
+ * SOCK_DNS_HOSTS_CHECK_MS, with _build_lock held */
+static void _check(void)
+{
+    uint64_t now = _now();
+    if (now < atomic_load_explicit(&_next_check, memory_order_relaxed)) {
+        return;
+    }
+
+    struct stat st;
+    if (stat(_path, &st)) {
+        memset(&st, 0, sizeof(st));
+    }
+    if ((st.st_ino == _stat.st_ino) && (st.st_size == _stat.st_size) &&
+            (st.st_mtim.tv_sec == _stat.st_mtim.tv_sec) &&
+            (st.st_mtim.tv_nsec == _stat.st_mtim.tv_nsec) && (_hosts || !st.st_ino)) {
+        atomic_store_explicit(&_next_check, now + SOCK_DNS_HOSTS_CHECK_MS,
+                memory_order_release);
+        return;
+    }
+
+    _hosts_t *h = NULL;
+    if (st.st_ino) {
+        _build(&h);
+    }
+    else {
+        memset(&_stat, 0, sizeof(_stat));
+    }
+    _swap(h);
+    atomic_store_explicit(&_next_check, now + SOCK_DNS_HOSTS_CHECK_MS, memory_order_release);
+}
+
+static int _get(const char *name, size_t len, int family, void *addr_out)
+{
+    if (!_hosts) {
+        return 0;
+    }
+
+    _entry_t *e = _slot(_hosts, name, len, family, _hash(name, len, family));
+    if (e->len) {
+        memcpy(addr_out, e->addr, e->len);
+    }
+    return e->len;
+}
+
+int sock_dns_hosts_get(const char *name, int family, void *addr_out)
+{
+    size_t len = strlen(name);
+    int res = 0;
+
+    /* "localhost." and "localhost" are the same name */
+    if (len && (name[len - 1] == '.')) {
+        len--;
+    }
+    if (!len || (len > UINT8_MAX)) {
+        return 0;
+    }
+
+    /* only the first lookup waits for the file to be read, later ones use
+     * the current table while another thread checks for changes */
+    uint64_t next_check = atomic_load_explicit(&_next_check, memory_order_acquire);
+    if (!next_check) {
+        pthread_mutex_lock(&_build_lock);
+        _check();
+        pthread_mutex_unlock(&_build_lock);
+    }
+    else if ((_now() >= next_check) && !pthread_mutex_trylock(&_build_lock)) {
+        _check();
+        pthread_mutex_unlock(&_build_lock);
+    }
+
+    pthread_rwlock_rdlock(&_lock);
+    if (family != AF_INET) {
+        res = _get(name, len, AF_INET6, addr_out);
+    }
+    if (!res && (family != AF_INET6)) {
+        res = _get(name, len, AF_INET, addr_out);
+    }
+    pthread_rwlock_unlock(&_lock);
+
+    return res;
+}
+
+int sock_dns_hosts_load(const char *path)
+{
+    _hosts_t *h = NULL;
+
+    pthread_mutex_lock(&_build_lock);
+    _path = path;
+    int res = _build(&h);
+    _swap(h);
+    atomic_store_explicit(&_next_check, _now() + SOCK_DNS_HOSTS_CHECK_MS, memory_order_release);
+    pthread_mutex_unlock(&_build_lock);
+
+    return res;
+}
@@ -0,0 +1,43 @@
+#ifndef SOCK_DNS_HOSTS_H
+#define SOCK_DNS_HOSTS_H
+
+#include <stdint.h>
+
+/**
+ * @brief   Hosts file consulted by sock_dns_query() before any query
+ */
+#ifndef SOCK_DNS_HOSTS_PATH
+#define SOCK_DNS_HOSTS_PATH         "/etc/hosts"
+#endif
+
+/**
+ * @brief   How often (ms) the hosts file is checked for changes
+ *
+ * Lookups in between make no system calls.
+ */
+#ifndef SOCK_DNS_HOSTS_CHECK_MS
+#define SOCK_DNS_HOSTS_CHECK_MS     (1000U)
+#endif
+
+/**
+ * @brief   Look up @p name for @p family (AF_INET, AF_INET6 or AF_UNSPEC) in
+ *          the hosts file
+ *
+ * The file is read and indexed by a hash table on first use, and
+ * indexed again once its modification time, size or inode changes. Names and
+ * aliases are compared case-insensitively, the first line listing a name
+ * wins. For AF_UNSPEC, an IPv6 address is preferred as by sock_dns_query().
+ *
+ * @returns address length, with the address written to @p addr_out
+ * @returns 0 if the name is not listed for @p family
+ */
+int sock_dns_hosts_get(const char *name, int family, void *addr_out);
+
+/**
+ * @brief   Use @p path instead of SOCK_DNS_HOSTS_PATH and index it now
+ *
+ * @returns number of names indexed, or negative errno
+ */
+int sock_dns_hosts_load(const char *path);
+
+#endif /* SOCK_DNS_HOSTS_H */
@@ -0,0 +1,452 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "net/sock/udp.h"
+#include "net/sock/posix.h"
+
+#include "sock_dns.h"
+#include "sock_dns_mdns.h"
+
+#define CLASS_CACHE_FLUSH   (0x8000)
+#define MDNS_BUF_LEN        (1500U)
+
+/* goodbye records and flushed ones go after a second (RFC 6762, 10.1) */
+#define EXPIRE_DELAY_MS     (1000U)
+
+/* one-shot queries are repeated at this interval */
+#define RETRY_MS            (1000U)
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U;
+}
+
+static int _lower(int c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+/* copies @p name lower-cased and without a trailing dot */
+static int _name_copy(char *dst, const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len && (name[len - 1] == '.')) {
+        len--;
+    }
+    if (!len || (len > SOCK_DNS_MAX_NAME_LEN)) {
+        return -ENOSPC;
+    }
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = _lower(name[i]);
+    }
+    dst[len] = '\0';
+    return 0;
+}
+
+static unsigned _addr_len(int family)
+{
+    return (family == AF_INET) ? 4 : 16;
+}
+
+int sock_dns_mdns_init(sock_dns_mdns_t *mdns, int family, uint16_t netif)
+{
+    static const uint8_t group_ipv4[] = SOCK_DNS_MDNS_GROUP_IPV4;
+    static const uint8_t group_ipv6[] = SOCK_DNS_MDNS_GROUP_IPV6;
+
+    if ((family != AF_INET) && (family != AF_INET6)) {
+        return -EINVAL;
+    }
+
+    memset(mdns, 0, sizeof(*mdns));
+    sock_udp_ep_t local = { .family = family, .port = SOCK_DNS_MDNS_PORT, .netif = netif };
+    if (sock_udp_create(&mdns->sock, &local, NULL, SOCK_FLAGS_REUSE_EP) < 0) {
+        return -errno;
+    }
+
+    mdns->group.family = family;
+    mdns->group.port = SOCK_DNS_MDNS_PORT;
+    mdns->group.netif = netif;
+    memcpy(&mdns->group.addr, (family == AF_INET) ? group_ipv4 : group_ipv6,
+            _addr_len(family));
+
+    int res = sock_udp_join_group(&mdns->sock, &mdns->group);
+    if (res) {
+        sock_udp_close(&mdns->sock);
+        return res;
+    }
+
+    /* responders check for 255 to reject off-link packets (RFC 6762, 11) */
+    const int hops = 255;
+    if (family == AF_INET) {
+        struct ip_mreqn mreq = { .imr_ifindex = netif };
+        setsockopt(mdns->sock.fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+        setsockopt(mdns->sock.fd, IPPROTO_IP, IP_MULTICAST_TTL, &hops, sizeof(hops));
+    }
+    else {
+        const int ifindex = netif;
+        setsockopt(mdns->sock.fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex));
+        setsockopt(mdns->sock.fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+    }
+
+    /* queries of other hosts are of no interest */
+    static const struct sock_filter filter[] = SOCK_FILTER_DNS_RESPONSE;
+    sock_udp_attach_filter(&mdns->sock, filter, sizeof(filter) / sizeof(filter[0]));
+
+    return 0;
+}
+
+void sock_dns_mdns_close(sock_dns_mdns_t *mdns)
+{
+    sock_udp_leave_group(&mdns->sock, &mdns->group);
+    sock_udp_close(&mdns->sock);
+}
+
+static void _cache_add(sock_dns_mdns_t *mdns, const char *name, const uint8_t *addr,
+        unsigned len, uint32_t ttl, int flush, uint64_t now)
+{
+    sock_dns_mdns_entry_t *match = NULL;
+    sock_dns_mdns_entry_t *victim = NULL;
+
+    for (unsigned i = 0; i < SOCK_DNS_MDNS_CACHE_SIZE; i++) {
+        sock_dns_mdns_entry_t *e = &mdns->cache[i];
+        int same = (e->expires > now) && (e->len == len) && !strcmp(e->name, name);
+
+        if (same && !memcmp(e->addr, addr, len)) {
+            match = e;
+            continue;
+        }
+        /* the sender owns the name, other addresses are outdated unless
+         * they came along with this one (RFC 6762, 10.2) */
+        if (same && flush && (e->received + EXPIRE_DELAY_MS < now) &&
+                (e->expires > now + EXPIRE_DELAY_MS)) {
+            e->expires = now + EXPIRE_DELAY_MS;
+        }
+        /* unused and expired entries first */
+        if (!victim || (e->expires < victim->expires)) {
+            victim = e;
+        }
+    }
+    if (match) {
+        victim = match;
+    }
+
+    victim->len = len;
+    memcpy(victim->addr, addr, len);
+    strcpy(victim->name, name);
+    victim->ttl = ttl;
+    victim->received = now;
+    victim->expires = now + (ttl ? ttl * 1000ULL : EXPIRE_DELAY_MS);
+}
+
+static void _parse(sock_dns_mdns_t *mdns, const uint8_t *msg, size_t len)
+{
+    sock_dns_parser_t p;
+    sock_dns_rr_t rr;
+    char name[SOCK_DNS_MAX_NAME_LEN + 1];
+    uint64_t now = _now();
+
+    /* standard query responses without error only (RFC 6762, 18.3, 18.11) */
+    if (sock_dns_parser_init(&p, msg, len) || (msg[2] & 0x78) || (msg[3] & 0x0f)) {
+        return;
+    }
+
+    while (sock_dns_parser_next(&p, &rr) == 1) {
+        unsigned addr_len = (rr.type == DNS_TYPE_A) ? 4 : (rr.type == DNS_TYPE_AAAA) ? 16 : 0;
+        if (!addr_len || (rr.rdlen != addr_len) ||
+                ((rr.class & ~CLASS_CACHE_FLUSH) != DNS_CLASS_IN)) {
+            continue;
+        }
+        if ((sock_dns_name_str(&p, rr.name, name, sizeof(name)) <= 0) ||
+                _name_copy(name, name)) {
+            continue;
+        }
+        _cache_add(mdns, name, msg + rr.rdata, addr_len, rr.ttl,
+                rr.class & CLASS_CACHE_FLUSH, now);
+    }
+}
+
+void sock_dns_mdns_recv(sock_dns_mdns_t *mdns)
+{
+    uint8_t buf[MDNS_BUF_LEN];
+    sock_udp_ep_t remote;
+    ssize_t res;
+
+    while ((res = sock_udp_recv(&mdns->sock, buf, sizeof(buf), 0, &remote)) > 0) {
+        /* anything else is not a multicast DNS response (RFC 6762, 6) */
+        if (remote.port != SOCK_DNS_MDNS_PORT) {
+            continue;
+        }
+        _parse(mdns, buf, res);
+    }
+}
+
+static int _get(sock_dns_mdns_t *mdns, const char *name, unsigned len, void *addr_out)
+{
+    const sock_dns_mdns_entry_t *best = NULL;
+    uint64_t now = _now();
+
+    /* the most recently announced address */
+    for (unsigned i = 0; i < SOCK_DNS_MDNS_CACHE_SIZE; i++) {
+        const sock_dns_mdns_entry_t *e = &mdns->cache[i];
+        if ((e->expires > now) && (e->len == len) && !strcmp(e->name, name) &&
+                (!best || (e->received > best->received))) {
+            best = e;
+        }
+    }
+
+    if (!best) {
+        return 0;
+    }
+    memcpy(addr_out, best->addr, len);
+    return len;
+}
+
+int sock_dns_mdns_get(sock_dns_mdns_t *mdns, const char *name, int family, void *addr_out)
+{
+    char key[SOCK_DNS_MAX_NAME_LEN + 1];
+    int res = 0;
+
+    if (_name_copy(key, name)) {
+        return 0;
+    }
+    if (family != AF_INET) {
+        res = _get(mdns, key, 16, addr_out);
+    }
+    if (!res && (family != AF_INET6)) {
+        res = _get(mdns, key, 4, addr_out);
+    }
+    return res;
+}
+
+static uint8_t *_put_u16(uint8_t *pos, uint16_t val)
+{
+    *pos++ = val >> 8;
+    *pos++ = val & 0xff;
+    return pos;
+}
+
+/* sends a query for @p name (lower case), listing the cached answers whose
+ * TTL is not yet half over (RFC 6762, 7.1) */
+static int _send_query(sock_dns_mdns_t *mdns, const char *name, int family, int known)
+{
+    uint8_t buf[MDNS_BUF_LEN];
+    uint8_t *end = buf + sizeof(buf);
+    uint8_t *pos = buf + sizeof(sock_dns_hdr_t);
+    static const int families[] = { AF_INET6, AF_INET };
+    uint16_t qdcount = 0;
+    uint16_t ancount = 0;
+
+    /* ID 0 and no flags (RFC 6762, 18) */
+    memset(buf, 0, sizeof(sock_dns_hdr_t));
+
+    uint8_t *qname = pos;
+    for (unsigned f = 0; f < 2; f++) {
+        if ((family != AF_UNSPEC) && (family != families[f])) {
+            continue;
+        }
+        if (qdcount) {
+            pos = _put_u16(pos, 0xc000 | (qname - buf));
+        }
+        else {
+            const char *label = name;
+            while (*label) {
+                size_t label_len = strcspn(label, ".");
+                if (!label_len || (label_len > 63)) {
+                    return -EINVAL;
+                }
+                *pos++ = label_len;
+                memcpy(pos, label, label_len);
+                pos += label_len;
+                label += label_len + (label[label_len] == '.');
+            }
+            *pos++ = 0;
+        }
+        pos = _put_u16(pos, (families[f] == AF_INET) ? DNS_TYPE_A : DNS_TYPE_AAAA);
+        pos = _put_u16(pos, DNS_CLASS_IN);
+        qdcount++;
+    }
+
+    uint64_t now = _now();
+    for (unsigned i = 0; known && (i < SOCK_DNS_MDNS_CACHE_SIZE); i++) {
+        const sock_dns_mdns_entry_t *e = &mdns->cache[i];
+        if ((e->expires <= now) || strcmp(e->name, name) ||
+                ((family != AF_UNSPEC) && (e->len != _addr_len(family)))) {
+            continue;
+        }
+        uint32_t remaining = (e->expires - now) / 1000U;
+        if ((remaining <= e->ttl / 2) || (end - pos < 12 + e->len)) {
+            continue;
+        }
+        pos = _put_u16(pos, 0xc000 | (qname - buf));
+        pos = _put_u16(pos, (e->len == 4) ? DNS_TYPE_A : DNS_TYPE_AAAA);
+        pos = _put_u16(pos, DNS_CLASS_IN);
+        pos = _put_u16(pos, remaining >> 16);
+        pos = _put_u16(pos, remaining & 0xffff);
+        pos = _put_u16(pos, e->len);
+        memcpy(pos, e->addr, e->len);
+        pos += e->len;
+        ancount++;
+    }
+
+    sock_dns_hdr_t *hdr = (sock_dns_hdr_t *)buf;
+    hdr->qdcount = htons(qdcount);
+    hdr->ancount = htons(ancount);
+
+    ssize_t res = sock_udp_send(&mdns->sock, buf, pos - buf, &mdns->group);
+    return (res < 0) ? -errno : 0;
+}
+
+int sock_dns_mdns_query(sock_dns_mdns_t *mdns, const char *name, void *addr_out, int family,
+        uint32_t timeout_ms)
+{
+    char key[SOCK_DNS_MAX_NAME_LEN + 1];
+
+    int res = sock_dns_mdns_get(mdns, name, family, addr_out);
+    if (res) {
+        return res;
+    }
+    if (_name_copy(key, name)) {
+        return -ENOSPC;
+    }
+
+    uint64_t now = _now();
+    uint64_t deadline = now + timeout_ms;
+    uint64_t retry = now;
+
+    while (now < deadline) {
+        if (now >= retry) {
+            if ((res = _send_query(mdns, key, family, 0))) {
+                return res;
+            }
+            retry = now + RETRY_MS;
+        }
+
+        uint64_t wake = (retry < deadline) ? retry : deadline;
+        struct pollfd pfd = { .fd = mdns->sock.fd, .events = POLLIN };
+        if (poll(&pfd, 1, wake - now) < 0) {
+            return -errno;
+        }
+        if (pfd.revents) {
+            sock_dns_mdns_recv(mdns);
+            if ((res = sock_dns_mdns_get(mdns, key, family, addr_out))) {
+                return res;
+            }
+        }
+        now = _now();
+    }
+
+    return -ETIMEDOUT;
+}
+
+int sock_dns_mdns_watch(sock_dns_mdns_t *mdns, const char *name, int family)
+{
+    sock_dns_mdns_watch_t *slot = NULL;
+    char key[SOCK_DNS_MAX_NAME_LEN + 1];
+
+    if (_name_copy(key, name)) {
+        return -ENOSPC;
+    }
+
+    for (unsigned i = 0; i < SOCK_DNS_MDNS_WATCH_MAX; i++) {
+        sock_dns_mdns_watch_t *w = &mdns->watch[i];
+        if (!w->next) {
+            slot = slot ? slot : w;
+        }
+        else if ((w->family == family) && !strcmp(w->name, key)) {
+            return 0;
+        }
+    }
+    if (!slot) {
+        return -ENOSPC;
+    }
+
+    /* the first query is delayed by 20-120 ms (RFC 6762, 5.2) */
+    strcpy(slot->name, key);
+    slot->family = family;
+    slot->interval = 1000;
+    slot->queried = 0;
+    slot->next = _now() + 20 + sock_dns_random_id() % 101;
+    return 0;
+}
+
+void sock_dns_mdns_unwatch(sock_dns_mdns_t *mdns, const char *name, int family)
+{
+    char key[SOCK_DNS_MAX_NAME_LEN + 1];
+
+    if (_name_copy(key, name)) {
+        return;
+    }
+    for (unsigned i = 0; i < SOCK_DNS_MDNS_WATCH_MAX; i++) {
+        sock_dns_mdns_watch_t *w = &mdns->watch[i];
+        if (w->next && (w->family == family) && !strcmp(w->name, key)) {
+            w->next = 0;
+        }
+    }
+}
+
+/* the first of 80, 85, 90 and 95% of the TTL of an answer to @p w
+ * (RFC 6762, 5.2) after @p after, or UINT64_MAX */
+static uint64_t _refresh_at(const sock_dns_mdns_t *mdns, const sock_dns_mdns_watch_t *w,
+        uint64_t after)
+{
+    uint64_t next = UINT64_MAX;
+
+    for (unsigned i = 0; i < SOCK_DNS_MDNS_CACHE_SIZE; i++) {
+        const sock_dns_mdns_entry_t *e = &mdns->cache[i];
+        if ((e->expires <= after) || !e->ttl || strcmp(e->name, w->name) ||
+                ((w->family != AF_UNSPEC) && (e->len != _addr_len(w->family)))) {
+            continue;
+        }
+        for (unsigned pct = 80; pct < 100; pct += 5) {
+            uint64_t at = e->received + e->ttl * 10ULL * pct;
+            if (at > after) {
+                if (at < next) {
+                    next = at;
+                }
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+int sock_dns_mdns_timeouts(sock_dns_mdns_t *mdns)
+{
+    uint64_t now = _now();
+    uint64_t wake = UINT64_MAX;
+
+    for (unsigned i = 0; i < SOCK_DNS_MDNS_WATCH_MAX; i++) {
+        sock_dns_mdns_watch_t *w = &mdns->watch[i];
+        if (!w->next) {
+            continue;
+        }
+
+        uint64_t refresh = _refresh_at(mdns, w, w->queried);
+        if ((now >= w->next) || (refresh <= now)) {
+            _send_query(mdns, w->name, w->family, 1);
+            w->queried = now;
+            if (now >= w->next) {
+                w->next = now + w->interval;
+                w->interval = (w->interval * 2 > SOCK_DNS_MDNS_INTERVAL_MAX_MS) ?
+                    SOCK_DNS_MDNS_INTERVAL_MAX_MS : w->interval * 2;
+            }
+            refresh = _refresh_at(mdns, w, now);
+        }
+
+        if (w->next < wake) {
+            wake = w->next;
+        }
+        if (refresh < wake) {
+            wake = refresh;
+        }
+    }
+
+    return (wake == UINT64_MAX) ? -1 : (int)(wake - now);
+}
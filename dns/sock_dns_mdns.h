@@ -0,0 +1,128 @@
+#ifndef SOCK_DNS_MDNS_H
+#define SOCK_DNS_MDNS_H
+
+#include <stdint.h>
+
+#include "net/sock/udp.h"
+
+#include "sock_dns.h"
+
+#define SOCK_DNS_MDNS_PORT          (5353U)
+#define SOCK_DNS_MDNS_GROUP_IPV4    { 224, 0, 0, 251 }
+#define SOCK_DNS_MDNS_GROUP_IPV6    { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xfb }
+
+/**
+ * @brief   Number of address records cached per querier
+ */
+#ifndef SOCK_DNS_MDNS_CACHE_SIZE
+#define SOCK_DNS_MDNS_CACHE_SIZE    (64U)
+#endif
+
+/**
+ * @brief   Number of names queried continuously per querier
+ */
+#ifndef SOCK_DNS_MDNS_WATCH_MAX
+#define SOCK_DNS_MDNS_WATCH_MAX     (8U)
+#endif
+
+/**
+ * @brief   Longest interval (ms) between continuous queries (RFC 6762, 5.2)
+ */
+#ifndef SOCK_DNS_MDNS_INTERVAL_MAX_MS
+#define SOCK_DNS_MDNS_INTERVAL_MAX_MS   (3600U * 1000U)
+#endif
+
+typedef struct {
+    uint64_t expires;                       /**< ms, 0 if unused */
+    uint64_t received;                      /**< ms */
+    uint32_t ttl;                           /**< s, as received */
+    uint8_t len;                            /**< 4 or 16 */
+    uint8_t addr[16];
+    char name[SOCK_DNS_MAX_NAME_LEN + 1];   /**< lower case */
+} sock_dns_mdns_entry_t;
+
+typedef struct {
+    uint64_t next;                          /**< ms, 0 if unused */
+    uint64_t queried;                       /**< ms, last query */
+    uint32_t interval;                      /**< ms */
+    int8_t family;
+    char name[SOCK_DNS_MAX_NAME_LEN + 1];
+} sock_dns_mdns_watch_t;
+
+/**
+ * @brief   Multicast DNS (RFC 6762) querier with a cache of address records
+ *
+ * All A and AAAA records in responses on the group are cached, whether
+ * asked for or not, so announcements and other hosts' answers keep the
+ * cache populated. Like sock_dns_resolver_t, it is driven by the caller:
+ * poll sock.fd for reading and call sock_dns_mdns_recv(), and call
+ * sock_dns_mdns_timeouts() when its last return value has elapsed.
+ */
+typedef struct {
+    sock_udp_t sock;
+    sock_udp_ep_t group;
+    sock_dns_mdns_entry_t cache[SOCK_DNS_MDNS_CACHE_SIZE];
+    sock_dns_mdns_watch_t watch[SOCK_DNS_MDNS_WATCH_MAX];
+} sock_dns_mdns_t;
+
+/**
+ * @brief   Join the mDNS group of @p family (AF_INET or AF_INET6) on
+ *          interface @p netif, 0 for the default one
+ *
+ * The socket is bound to port 5353, shared with other responders and
+ * queriers on the host.
+ */
+int sock_dns_mdns_init(sock_dns_mdns_t *mdns, int family, uint16_t netif);
+
+void sock_dns_mdns_close(sock_dns_mdns_t *mdns);
+
+/**
+ * @brief   Look up @p name for @p family in the cache
+ *
+ * @returns address length, or 0 if none is cached
+ */
+int sock_dns_mdns_get(sock_dns_mdns_t *mdns, const char *name, int family, void *addr_out);
+
+/**
+ * @brief   One-shot query for @p name (RFC 6762, 5.1)
+ *
+ * A cached address is returned right away, else the query is sent to the
+ * group and responses are processed until one answers it.
+ *
+ * @returns address length, -ETIMEDOUT after @p timeout_ms, or another
+ *          negative errno
+ */
+int sock_dns_mdns_query(sock_dns_mdns_t *mdns, const char *name, void *addr_out, int family,
+        uint32_t timeout_ms);
+
+/**
+ * @brief   Keep querying for @p name (RFC 6762, 5.2)
+ *
+ * The first query goes out after 20-120 ms, the next ones at intervals
+ * starting at 1 s and doubling up to SOCK_DNS_MDNS_INTERVAL_MAX_MS, and at
+ * 80, 85, 90 and 95% of a cached answer's TTL.
+ * They list the cached answers (known-answer suppression, 7.1), so
+ * responders only send what is missing or about to expire.
+ *
+ * @returns 0, or -ENOSPC
+ */
+int sock_dns_mdns_watch(sock_dns_mdns_t *mdns, const char *name, int family);
+
+/**
+ * @brief   Stop querying for @p name
+ */
+void sock_dns_mdns_unwatch(sock_dns_mdns_t *mdns, const char *name, int family);
+
+/**
+ * @brief   Receive and cache all pending responses
+ */
+void sock_dns_mdns_recv(sock_dns_mdns_t *mdns);
+
+/**
+ * @brief   Send the continuous queries that are due
+ *
+ * @returns ms until the next one is due, or -1 if no name is watched
+ */
+int sock_dns_mdns_timeouts(sock_dns_mdns_t *mdns);
+
+#endif /* SOCK_DNS_MDNS_H */
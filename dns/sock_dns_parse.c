@@ -0,0 +1,331 @@
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "sock_dns.h"
+#include "sock_dns_parse.h"
+
+/* compression pointers followed per name, also stops pointer loops */
+#define POINTERS_MAX    (32U)
+
+static uint16_t _u16(const uint8_t *buf)
+{
+    uint16_t tmp;
+    memcpy(&tmp, buf, 2);
+    return ntohs(tmp);
+}
+
+static uint32_t _u32(const uint8_t *buf)
+{
+    uint32_t tmp;
+    memcpy(&tmp, buf, 4);
+    return ntohl(tmp);
+}
+
+static int _lower(int c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+/* returns the offset after the name at @p pos in place (a pointer ends it),
+ * or 0 if it runs past the message */
+static size_t _skip_name(const uint8_t *msg, size_t len, size_t pos)
+{
+    while (pos < len) {
+        uint8_t c = msg[pos];
+        if (!c) {
+            return pos + 1;
+        }
+        if ((c & 0xc0) == 0xc0) {
+            return (pos + 2 <= len) ? pos + 2 : 0;
+        }
+        if (c & 0xc0) {
+            return 0;
+        }
+        pos += c + 1;
+    }
+    return 0;
+}
+
+/* returns the label at *pos following compression pointers and advances
+ * *pos past it, or NULL if the name is malformed. The root label has
+ * length 0. */
+static const uint8_t *_label(const uint8_t *msg, size_t len, size_t *pos, unsigned *pointers)
+{
+    while (*pos < len) {
+        uint8_t c = msg[*pos];
+        if ((c & 0xc0) == 0xc0) {
+            if ((*pos + 2 > len) || (++*pointers > POINTERS_MAX)) {
+                return NULL;
+            }
+            *pos = ((c & 0x3f) << 8) | msg[*pos + 1];
+            continue;
+        }
+        if ((c & 0xc0) || (*pos + 1 + c > len)) {
+            return NULL;
+        }
+        const uint8_t *label = &msg[*pos];
+        *pos += 1 + c;
+        return label;
+    }
+    return NULL;
+}
+
+int sock_dns_parser_init(sock_dns_parser_t *p, const uint8_t *msg, size_t len)
+{
+    if ((len < sizeof(sock_dns_hdr_t)) || (len > UINT16_MAX)) {
+        return -EBADMSG;
+    }
+
+    memset(p, 0, sizeof(*p));
+    p->msg = msg;
+    p->len = len;
+    p->remaining[SOCK_DNS_SECTION_ANSWER] = _u16(msg + 6);
+    p->remaining[SOCK_DNS_SECTION_AUTHORITY] = _u16(msg + 8);
+    p->remaining[SOCK_DNS_SECTION_ADDITIONAL] = _u16(msg + 10);
+
+    size_t pos = sizeof(sock_dns_hdr_t);
+    unsigned qdcount = _u16(msg + 4);
+    if (qdcount) {
+        p->qname = pos;
+    }
+    for (unsigned n = 0; n < qdcount; n++) {
+        pos = _skip_name(msg, len, pos);
+        if (!pos || (pos + 4 > len)) {
+            return -EBADMSG;
+        }
+        pos += 4;
+    }
+    p->pos = pos;
+
+    return 0;
+}
+
+int sock_dns_parser_next(sock_dns_parser_t *p, sock_dns_rr_t *rr)
+{
+    while (!p->remaining[p->section]) {
+        if (p->section == SOCK_DNS_SECTION_ADDITIONAL) {
+            return 0;
+        }
+        p->section++;
+    }
+
+    size_t pos = _skip_name(p->msg, p->len, p->pos);
+    if (!pos || (pos + 10 > p->len)) {
+        return -EBADMSG;
+    }
+
+    rr->name = p->pos;
+    rr->type = _u16(p->msg + pos);
+    rr->class = _u16(p->msg + pos + 2);
+    rr->ttl = _u32(p->msg + pos + 4);
+    rr->rdlen = _u16(p->msg + pos + 8);
+    rr->rdata = pos + 10;
+    rr->section = p->section;
+    if (rr->rdata + rr->rdlen > p->len) {
+        return -EBADMSG;
+    }
+
+    /* a TTL with the top bit set is treated as 0 (RFC 2181, 8) */
+    if (rr->ttl & 0x80000000) {
+        rr->ttl = 0;
+    }
+
+    p->pos = rr->rdata + rr->rdlen;
+    p->remaining[p->section]--;
+    return 1;
+}
+
+int sock_dns_name_eq(const sock_dns_parser_t *p, uint16_t a, uint16_t b)
+{
+    size_t pos_a = a, pos_b = b;
+    unsigned ptr_a = 0, ptr_b = 0;
+
+    while (1) {
+        const uint8_t *la = _label(p->msg, p->len, &pos_a, &ptr_a);
+        const uint8_t *lb = _label(p->msg, p->len, &pos_b, &ptr_b);
+        if (!la || !lb || (*la != *lb)) {
+            return 0;
+        }
+        if (!*la) {
+            return 1;
+        }
+        for (unsigned i = 1; i <= *la; i++) {
+            if (_lower(la[i]) != _lower(lb[i])) {
+                return 0;
+            }
+        }
+    }
+}
+
+ssize_t sock_dns_name_str(const sock_dns_parser_t *p, uint16_t name, char *out, size_t outlen)
+{
+    size_t pos = name;
+    unsigned pointers = 0;
+    size_t used = 0;
+
+    while (1) {
+        const uint8_t *label = _label(p->msg, p->len, &pos, &pointers);
+        if (!label) {
+            return -EBADMSG;
+        }
+        if (!*label) {
+            break;
+        }
+        /* separating dot and terminating zero */
+        if (used + (used ? 1 : 0) + *label + 1 > outlen) {
+            return -ENOSPC;
+        }
+        if (used) {
+            out[used++] = '.';
+        }
+        memcpy(out + used, label + 1, *label);
+        used += *label;
+    }
+
+    if (!outlen) {
+        return -ENOSPC;
+    }
+    out[used] = '\0';
+    return used;
+}
+
+int sock_dns_rr_srv(const sock_dns_parser_t *p, const sock_dns_rr_t *rr, sock_dns_srv_t *srv)
+{
+    if ((rr->type != DNS_TYPE_SRV) || (rr->rdlen < 7)) {
+        return -EBADMSG;
+    }
+
+    const uint8_t *rdata = p->msg + rr->rdata;
+    srv->priority = _u16(rdata);
+    srv->weight = _u16(rdata + 2);
+    srv->port = _u16(rdata + 4);
+    srv->target = rr->rdata + 6;
+
+    size_t end = _skip_name(p->msg, rr->rdata + rr->rdlen, srv->target);
+    return end ? 0 : -EBADMSG;
+}
+
+int sock_dns_rr_txt_next(const sock_dns_parser_t *p, const sock_dns_rr_t *rr, size_t *pos,
+        const char **str, size_t *len)
+{
+    if (*pos >= rr->rdlen) {
+        return 0;
+    }
+
+    const uint8_t *rdata = p->msg + rr->rdata;
+    size_t slen = rdata[*pos];
+    if (*pos + 1 + slen > rr->rdlen) {
+        return -EBADMSG;
+    }
+
+    *str = (const char *)rdata + *pos + 1;
+    *len = slen;
+    *pos += 1 + slen;
+    return 1;
+}
+
+/* restart @p p at the first answer, which is at @p answers */
+static void _rewind(sock_dns_parser_t *p, size_t answers)
+{
+    p->pos = answers;
+    p->section = SOCK_DNS_SECTION_ANSWER;
+    p->remaining[SOCK_DNS_SECTION_ANSWER] = _u16(p->msg + 6);
+    p->remaining[SOCK_DNS_SECTION_AUTHORITY] = _u16(p->msg + 8);
+    p->remaining[SOCK_DNS_SECTION_ADDITIONAL] = _u16(p->msg + 10);
+}
+
+/* negative caching TTL: of the SOA record in the authority section, capped
+ * by its MINIMUM field (RFC 2308, 5), or 0 if there is none */
+static uint32_t _negative_ttl(sock_dns_parser_t *p)
+{
+    sock_dns_rr_t rr;
+    while (sock_dns_parser_next(p, &rr) == 1) {
+        if ((rr.section == SOCK_DNS_SECTION_AUTHORITY) && (rr.type == DNS_TYPE_SOA) &&
+                (rr.rdlen >= 22)) {
+            uint32_t minimum = _u32(p->msg + rr.rdata + rr.rdlen - 4);
+            return (minimum < rr.ttl) ? minimum : rr.ttl;
+        }
+    }
+    return 0;
+}
+
+int sock_dns_parse_addrs(const uint8_t *msg, size_t len, int family,
+        sock_dns_addr_t *addrs, size_t numof, uint32_t *neg_ttl)
+{
+    sock_dns_parser_t p;
+    sock_dns_rr_t rr;
+    int res;
+
+    if (sock_dns_parser_init(&p, msg, len) || !p.qname) {
+        return -EBADMSG;
+    }
+    size_t answers = p.pos;
+
+    /* follow the CNAME chain from the question name, each pass over the
+     * answers moves one link forward */
+    uint16_t target = p.qname;
+    uint32_t chain_ttl = UINT32_MAX;
+    for (unsigned hops = 0; hops <= SOCK_DNS_CNAME_MAX; hops++) {
+        int found = 0;
+
+        _rewind(&p, answers);
+        while ((res = sock_dns_parser_next(&p, &rr)) == 1) {
+            if (rr.section != SOCK_DNS_SECTION_ANSWER) {
+                break;
+            }
+            if ((rr.type == DNS_TYPE_CNAME) && (rr.class == DNS_CLASS_IN) &&
+                    sock_dns_name_eq(&p, rr.name, target)) {
+                if (!_skip_name(msg, rr.rdata + rr.rdlen, rr.rdata)) {
+                    return -EBADMSG;
+                }
+                target = rr.rdata;
+                chain_ttl = (rr.ttl < chain_ttl) ? rr.ttl : chain_ttl;
+                found = 1;
+                break;
+            }
+        }
+        if (res < 0) {
+            return res;
+        }
+        if (!found) {
+            break;
+        }
+    }
+
+    size_t numof_found = 0;
+    _rewind(&p, answers);
+    while ((numof_found < numof) && ((res = sock_dns_parser_next(&p, &rr)) == 1)) {
+        if (rr.section != SOCK_DNS_SECTION_ANSWER) {
+            break;
+        }
+        if ((rr.class != DNS_CLASS_IN) || !sock_dns_name_eq(&p, rr.name, target)) {
+            continue;
+        }
+        if (!(((rr.type == DNS_TYPE_A) && (rr.rdlen == 4) && (family != AF_INET6)) ||
+              ((rr.type == DNS_TYPE_AAAA) && (rr.rdlen == 16) && (family != AF_INET)))) {
+            continue;
+        }
+
+        sock_dns_addr_t *addr = &addrs[numof_found++];
+        addr->ttl = (rr.ttl < chain_ttl) ? rr.ttl : chain_ttl;
+        addr->len = rr.rdlen;
+        memcpy(addr->addr, msg + rr.rdata, rr.rdlen);
+    }
+    if (res < 0) {
+        return res;
+    }
+    if (numof_found) {
+        return numof_found;
+    }
+
+    /* NXDOMAIN, or NODATA: no error but no matching record */
+    unsigned rcode = _u16(msg + 2) & 0xf;
+    if ((rcode == DNS_RCODE_NXDOMAIN) || (rcode == DNS_RCODE_NOERROR)) {
+        _rewind(&p, answers);
+        *neg_ttl = _negative_ttl(&p);
+        return (rcode == DNS_RCODE_NXDOMAIN) ? -ENXIO : -ENOMSG;
+    }
+
+    return -EBADMSG;
+}
@@ -0,0 +1,120 @@
+#ifndef SOCK_DNS_PARSE_H
+#define SOCK_DNS_PARSE_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+/**
+ * @brief   Maximum number of CNAME records followed from the question name
+ */
+#ifndef SOCK_DNS_CNAME_MAX
+#define SOCK_DNS_CNAME_MAX      (8U)
+#endif
+
+enum {
+    SOCK_DNS_SECTION_ANSWER,
+    SOCK_DNS_SECTION_AUTHORITY,
+    SOCK_DNS_SECTION_ADDITIONAL,
+};
+
+/**
+ * @brief   Iterator over the resource records of a DNS message
+ *
+ * Nothing is copied, records refer to the message by offset. Every access is
+ * bounds checked, so any input is safe to parse.
+ */
+typedef struct {
+    const uint8_t *msg;
+    size_t len;
+    size_t pos;                 /**< offset of the next record */
+    uint16_t qname;             /**< offset of the first question's name, or 0 */
+    uint8_t section;
+    uint16_t remaining[3];      /**< records left per section */
+} sock_dns_parser_t;
+
+typedef struct {
+    uint16_t name;              /**< offset of the owner name */
+    uint16_t type;
+    uint16_t class;
+    uint32_t ttl;
+    uint16_t rdata;             /**< offset of the record data */
+    uint16_t rdlen;
+    uint8_t section;
+} sock_dns_rr_t;
+
+/**
+ * @brief   An address record, for sock_dns_parse_addrs()
+ */
+typedef struct {
+    uint32_t ttl;               /**< smallest TTL along the CNAME chain */
+    uint8_t len;                /**< 4 or 16 */
+    uint8_t addr[16];
+} sock_dns_addr_t;
+
+typedef struct {
+    uint16_t priority;
+    uint16_t weight;
+    uint16_t port;
+    uint16_t target;            /**< offset of the target name */
+} sock_dns_srv_t;
+
+/**
+ * @brief   Check the header of @p msg and skip its questions
+ *
+ * @returns 0 on success, -EBADMSG if @p msg is malformed
+ */
+int sock_dns_parser_init(sock_dns_parser_t *p, const uint8_t *msg, size_t len);
+
+/**
+ * @brief   Get the next record of the answer, authority and additional
+ *          sections, in that order
+ *
+ * @returns 1 if @p rr was filled, 0 after the last record, -EBADMSG
+ */
+int sock_dns_parser_next(sock_dns_parser_t *p, sock_dns_rr_t *rr);
+
+/**
+ * @brief   Compare two (possibly compressed) names in the message
+ *          case-insensitively
+ */
+int sock_dns_name_eq(const sock_dns_parser_t *p, uint16_t a, uint16_t b);
+
+/**
+ * @brief   Write the name at offset @p name as a dotted string
+ *
+ * @returns length of the string, -ENOSPC or -EBADMSG
+ */
+ssize_t sock_dns_name_str(const sock_dns_parser_t *p, uint16_t name, char *out, size_t outlen);
+
+/**
+ * @brief   Decode the data of a SRV record (RFC 2782)
+ *
+ * @returns 0 on success, -EBADMSG
+ */
+int sock_dns_rr_srv(const sock_dns_parser_t *p, const sock_dns_rr_t *rr, sock_dns_srv_t *srv);
+
+/**
+ * @brief   Get the next character string of a TXT record
+ *
+ * @p pos must be 0 for the first string.
+ *
+ * @returns 1 if @p str and @p len were set, 0 after the last string, -EBADMSG
+ */
+int sock_dns_rr_txt_next(const sock_dns_parser_t *p, const sock_dns_rr_t *rr, size_t *pos,
+        const char **str, size_t *len);
+
+/**
+ * @brief   Get all addresses of @p family (AF_INET, AF_INET6 or AF_UNSPEC)
+ *          for the question name of a reply
+ *
+ * CNAME chains within the reply are followed, in any record order.
+ *
+ * @returns number of addresses written to @p addrs (at most @p numof)
+ * @returns -ENXIO for NXDOMAIN and -ENOMSG for NODATA, with @p neg_ttl set
+ *          to the negative caching TTL (RFC 2308) or 0 if the reply has no SOA
+ * @returns -EBADMSG for malformed or failed (e.g. SERVFAIL) replies
+ */
+int sock_dns_parse_addrs(const uint8_t *msg, size_t len, int family,
+        sock_dns_addr_t *addrs, size_t numof, uint32_t *neg_ttl);
+
+#endif /* SOCK_DNS_PARSE_H */
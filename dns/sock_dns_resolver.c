@@ -0,0 +1,543 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "net/sock/udp.h"
+#include "net/sock/pktbuf.h"
+#include "net/sock/posix.h"
+
+#include "sock_dns.h"
+#include "sock_dns_cache.h"
+#include "sock_dns_parse.h"
+#include "sock_dns_resolver.h"
+#include "sock_dns_tcp.h"
+
+/* min domain name length is 1, so minimum record length is 7 */
+#define DNS_MIN_REPLY_LEN   (unsigned)(sizeof(sock_dns_hdr_t) + 7)
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U;
+}
+
+int sock_dns_resolver_init(sock_dns_resolver_t *resolver, const sock_udp_ep_t *server)
+{
+    memset(resolver, 0, sizeof(*resolver));
+
+    resolver->pending = calloc(SOCK_DNS_RESOLVER_PENDING_MAX, sizeof(sock_dns_pending_t));
+    resolver->by_id = calloc(UINT16_MAX + 1, sizeof(uint16_t));
+    resolver->free = malloc(SOCK_DNS_RESOLVER_PENDING_MAX * sizeof(uint16_t));
+    resolver->rx = sock_pktbuf_alloc();
+    if (!resolver->pending || !resolver->by_id || !resolver->free || !resolver->rx) {
+        sock_dns_resolver_close(resolver);
+        return -ENOMEM;
+    }
+
+    for (unsigned i = 0; i < SOCK_DNS_RESOLVER_PENDING_MAX; i++) {
+        resolver->free[i] = SOCK_DNS_RESOLVER_PENDING_MAX - 1 - i;
+    }
+    resolver->free_numof = SOCK_DNS_RESOLVER_PENDING_MAX;
+    resolver->next_deadline = UINT64_MAX;
+
+    resolver->server = *server;
+    int res = sock_udp_create(&resolver->sock, NULL, server, 0);
+    if (res < 0) {
+        sock_dns_resolver_close(resolver);
+        return res;
+    }
+
+    static const struct sock_filter filter[] = SOCK_FILTER_DNS_RESPONSE;
+    sock_udp_attach_filter(&resolver->sock, filter, sizeof(filter) / sizeof(filter[0]));
+
+    return 0;
+}
+
+static void _release(sock_dns_resolver_t *resolver, sock_dns_pending_t *q)
+{
+    if (q->tcp) {
+        q->tcp = 0;
+        resolver->tcp_numof--;
+    }
+    resolver->by_id[q->id] = 0;
+    q->cb = NULL;
+    resolver->free[resolver->free_numof++] = q - resolver->pending;
+    resolver->pending_numof--;
+}
+
+/* the connection is only kept while replies are due, as servers close idle
+ * ones after a few seconds (RFC 7766, 6.2.3) */
+static void _tcp_idle(sock_dns_resolver_t *resolver)
+{
+    if (!resolver->tcp_numof && resolver->tcp.fd) {
+        sock_dns_tcp_conn_close(&resolver->tcp);
+    }
+}
+
+static void _finish(sock_dns_resolver_t *resolver, sock_dns_pending_t *q, int res,
+        const void *addr)
+{
+    sock_dns_cb_t cb = q->cb;
+    void *arg = q->arg;
+
+    _release(resolver, q);
+
+    /* last, the callback may send new queries */
+    cb(arg, res, addr);
+}
+
+/* delivers the result of @p q, for a half of an AF_UNSPEC query once the
+ * other half is done as well, unless an AAAA answer makes it moot */
+static void _complete(sock_dns_resolver_t *resolver, sock_dns_pending_t *q, int res,
+        const void *addr, uint32_t ttl)
+{
+    if (q->pair) {
+        sock_dns_pending_t *other = &resolver->pending[q->pair - 1];
+
+        other->pair = 0;
+        if ((q->family == AF_INET6) && (res > 0)) {
+            _release(resolver, other);
+        }
+        else {
+            other->held_res = res;
+            other->held_ttl = ttl;
+            if (res > 0) {
+                memcpy(other->held, addr, res);
+                /* RFC 8305, 3: an A answer waits a little for the AAAA one */
+                uint64_t linger = _now() + SOCK_DNS_RESOLUTION_DELAY_MS;
+                if (linger < other->deadline) {
+                    other->deadline = linger;
+                }
+                if (linger < resolver->next_deadline) {
+                    resolver->next_deadline = linger;
+                }
+            }
+            _release(resolver, q);
+            return;
+        }
+    }
+
+    if (q->unspec) {
+        if ((res <= 0) && (q->held_res > 0)) {
+            res = q->held_res;
+            addr = q->held;
+            ttl = q->held_ttl;
+        }
+        else if ((res == -ENOMSG) || (res == -ENXIO)) {
+            /* the name has no address only if both families say so, and
+             * does not exist if either says so */
+            if (q->held_res != -ENOMSG) {
+                res = q->held_res;
+            }
+            ttl = (q->held_ttl < ttl) ? q->held_ttl : ttl;
+        }
+        sock_dns_cache_add(q->name, AF_UNSPEC, res, addr, ttl);
+    }
+
+    _finish(resolver, q, res, (res > 0) ? addr : NULL);
+}
+
+void sock_dns_resolver_close(sock_dns_resolver_t *resolver)
+{
+    if (resolver->pending) {
+        for (unsigned i = 0; i < SOCK_DNS_RESOLVER_PENDING_MAX; i++) {
+            if (resolver->pending[i].cb) {
+                _complete(resolver, &resolver->pending[i], -ECANCELED, NULL, 0);
+            }
+        }
+    }
+    if (resolver->sock.fd) {
+        sock_udp_close(&resolver->sock);
+    }
+    sock_dns_tcp_conn_close(&resolver->tcp);
+    if (resolver->rx) {
+        sock_pktbuf_release(resolver->rx);
+    }
+    free(resolver->pending);
+    free(resolver->by_id);
+    free(resolver->free);
+    memset(resolver, 0, sizeof(*resolver));
+}
+
+void sock_dns_resolver_cancel(sock_dns_resolver_t *resolver, void *arg)
+{
+    for (unsigned i = 0; i < SOCK_DNS_RESOLVER_PENDING_MAX; i++) {
+        sock_dns_pending_t *q = &resolver->pending[i];
+        if (q->cb && (q->arg == arg)) {
+            _release(resolver, q);
+        }
+    }
+    _tcp_idle(resolver);
+}
+
+static int _send(sock_dns_resolver_t *resolver, const char *name, int family,
+        sock_dns_cb_t cb, void *arg)
+{
+    uint16_t id;
+    do {
+        id = sock_dns_random_id();
+    } while (resolver->by_id[id]);
+
+    unsigned slot = resolver->free[resolver->free_numof - 1];
+    sock_dns_pending_t *q = &resolver->pending[slot];
+
+    ssize_t len = sock_dns_build_query(q->msg, sizeof(q->msg), name, id, family);
+    if (len < 0) {
+        return len;
+    }
+    int res = sock_udp_send(&resolver->sock, q->msg, len, NULL);
+    if (res < 0) {
+        return (res == -1) ? -errno : res;
+    }
+
+    resolver->free_numof--;
+    resolver->pending_numof++;
+    resolver->by_id[id] = slot + 1;
+
+    strcpy(q->name, name);
+    q->len = len;
+    q->id = id;
+    q->family = family;
+    q->unspec = 0;
+    q->pair = 0;
+    q->held_res = -ENOMSG;
+    q->tcp = 0;
+    q->all = 0;
+    q->retries = 0;
+    q->timeout = SOCK_DNS_RESOLVER_TIMEOUT_MS;
+    q->deadline = _now() + q->timeout;
+    q->cb = cb;
+    q->arg = arg;
+
+    if (q->deadline < resolver->next_deadline) {
+        resolver->next_deadline = q->deadline;
+    }
+
+    return slot;
+}
+
+int sock_dns_resolver_query(sock_dns_resolver_t *resolver, const char *name, int family,
+        sock_dns_cb_t cb, void *arg)
+{
+    uint8_t addr[16];
+    int res = sock_dns_cache_get(name, family, addr);
+    if (res) {
+        cb(arg, res, (res > 0) ? addr : NULL);
+        return 0;
+    }
+
+    if (resolver->free_numof < ((family == AF_UNSPEC) ? 2 : 1)) {
+        return -EAGAIN;
+    }
+    if (strlen(name) > SOCK_DNS_MAX_NAME_LEN) {
+        return -ENOSPC;
+    }
+
+    if (family != AF_UNSPEC) {
+        res = _send(resolver, name, family, cb, arg);
+        return (res < 0) ? res : 0;
+    }
+
+    /* many servers reject two questions in one message */
+    int aaaa = _send(resolver, name, AF_INET6, cb, arg);
+    if (aaaa < 0) {
+        return aaaa;
+    }
+    int a = _send(resolver, name, AF_INET, cb, arg);
+    if (a < 0) {
+        _release(resolver, &resolver->pending[aaaa]);
+        return a;
+    }
+    resolver->pending[aaaa].unspec = 1;
+    resolver->pending[aaaa].pair = a + 1;
+    resolver->pending[a].unspec = 1;
+    resolver->pending[a].pair = aaaa + 1;
+
+    return 0;
+}
+
+int sock_dns_resolver_query_all(sock_dns_resolver_t *resolver, const char *name, int family,
+        sock_dns_cb_t cb, void *arg)
+{
+    if (family == AF_UNSPEC) {
+        return -EINVAL;
+    }
+    if (!resolver->free_numof) {
+        return -EAGAIN;
+    }
+    if (strlen(name) > SOCK_DNS_MAX_NAME_LEN) {
+        return -ENOSPC;
+    }
+
+    int res = _send(resolver, name, family, cb, arg);
+    if (res < 0) {
+        return res;
+    }
+    resolver->pending[res].all = 1;
+    return 0;
+}
+
+/* returns the end of the question section of @p msg, or NULL if it is
+ * malformed, for comparing the question of a reply with the query */
+static const uint8_t *_question_end(const uint8_t *msg, size_t len)
+{
+    const uint8_t *pos = msg + sizeof(sock_dns_hdr_t);
+    const uint8_t *end = msg + len;
+    unsigned qdcount = ntohs(((const sock_dns_hdr_t *)msg)->qdcount);
+
+    for (unsigned n = 0; n < qdcount; n++) {
+        while ((pos < end) && *pos && (*pos < 192)) {
+            pos += *pos + 1;
+        }
+        pos += (pos < end && *pos) ? 2 : 1;
+        pos += 4;
+        if (pos > end) {
+            return NULL;
+        }
+    }
+    return pos;
+}
+
+static int _lower(int c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+static int _question_matches(const sock_dns_pending_t *q, const uint8_t *reply, size_t len)
+{
+    const uint8_t *end = _question_end(reply, len);
+    /* the query may end with an OPT record the reply does not echo */
+    size_t qlen = _question_end(q->msg, q->len) - q->msg - sizeof(sock_dns_hdr_t);
+
+    if (!end || ((size_t)(end - reply) - sizeof(sock_dns_hdr_t) != qlen)) {
+        return 0;
+    }
+    if (((const sock_dns_hdr_t *)reply)->qdcount != ((const sock_dns_hdr_t *)q->msg)->qdcount) {
+        return 0;
+    }
+
+    /* names are case-insensitive, label lengths are below 'A' */
+    const uint8_t *a = reply + sizeof(sock_dns_hdr_t);
+    const uint8_t *b = q->msg + sizeof(sock_dns_hdr_t);
+    for (size_t i = 0; i < qlen; i++) {
+        if (_lower(a[i]) != _lower(b[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void _resolved(sock_dns_resolver_t *resolver, sock_dns_pending_t *q,
+        const uint8_t *msg, size_t len)
+{
+    uint8_t addr[16];
+    uint32_t ttl = 0;
+
+    if (q->all) {
+        sock_dns_addr_t addrs[SOCK_DNS_RESOLVER_ADDRS_MAX];
+        int res = sock_dns_parse_addrs(msg, len, q->family, addrs,
+                SOCK_DNS_RESOLVER_ADDRS_MAX, &ttl);
+        if (res > 0) {
+            sock_dns_cache_add(q->name, q->family, addrs[0].len, addrs[0].addr, addrs[0].ttl);
+        }
+        else {
+            sock_dns_cache_add(q->name, q->family, res, NULL, ttl);
+        }
+        _complete(resolver, q, res, addrs, ttl);
+        return;
+    }
+
+    int res = _parse_dns_reply((uint8_t *)msg, len, addr, q->family, &ttl);
+    sock_dns_cache_add(q->name, q->family, res, addr, ttl);
+    _complete(resolver, q, res, addr, ttl);
+}
+
+/* a reply over TCP, for a query sent there after a truncated one */
+static void _tcp_reply(void *arg, const uint8_t *msg, size_t len)
+{
+    sock_dns_resolver_t *resolver = arg;
+
+    if (len <= DNS_MIN_REPLY_LEN) {
+        return;
+    }
+    unsigned slot = resolver->by_id[ntohs(((const sock_dns_hdr_t *)msg)->id)];
+    if (!slot) {
+        return;
+    }
+    sock_dns_pending_t *q = &resolver->pending[slot - 1];
+    if (q->tcp && _question_matches(q, msg, len)) {
+        _resolved(resolver, q, msg, len);
+    }
+}
+
+/* fails the queries waiting for TCP replies */
+static void _tcp_failed(sock_dns_resolver_t *resolver, int res)
+{
+    sock_dns_tcp_conn_close(&resolver->tcp);
+    for (unsigned i = 0; (i < SOCK_DNS_RESOLVER_PENDING_MAX) && resolver->tcp_numof; i++) {
+        if (resolver->pending[i].cb && resolver->pending[i].tcp) {
+            _complete(resolver, &resolver->pending[i], res, NULL, 0);
+        }
+    }
+}
+
+/* asks again over TCP after a truncated reply (RFC 7766, 5), without
+ * waiting for the connection */
+static void _retry_tcp(sock_dns_resolver_t *resolver, sock_dns_pending_t *q)
+{
+    int res = 0;
+
+    if (!resolver->tcp.fd) {
+        res = sock_dns_tcp_conn_open(&resolver->tcp, &resolver->server);
+    }
+    if (!res) {
+        res = sock_dns_tcp_conn_send(&resolver->tcp, q->msg, q->len);
+    }
+    if (res) {
+        _complete(resolver, q, res, NULL, 0);
+        _tcp_failed(resolver, res);
+        return;
+    }
+
+    q->tcp = 1;
+    resolver->tcp_numof++;
+    q->deadline = _now() + SOCK_DNS_TCP_TIMEOUT_MS;
+    if (q->deadline < resolver->next_deadline) {
+        resolver->next_deadline = q->deadline;
+    }
+}
+
+void sock_dns_resolver_recv(sock_dns_resolver_t *resolver)
+{
+    uint8_t *buf = resolver->rx->data;
+    ssize_t res;
+
+    while ((res = sock_udp_recv(&resolver->sock, buf, SOCK_PKTBUF_SIZE, 0, NULL)) > 0) {
+        if ((size_t)res <= DNS_MIN_REPLY_LEN) {
+            continue;
+        }
+
+        sock_dns_hdr_t *hdr = (sock_dns_hdr_t *)buf;
+        unsigned slot = resolver->by_id[ntohs(hdr->id)];
+        if (!slot) {
+            continue;
+        }
+        sock_dns_pending_t *q = &resolver->pending[slot - 1];
+        if (!_question_matches(q, buf, res)) {
+            continue;
+        }
+
+        if (buf[2] & 0x02) {
+            /* TC, its question is queried again over TCP */
+            if (!q->tcp) {
+                _retry_tcp(resolver, q);
+            }
+            continue;
+        }
+        _resolved(resolver, q, buf, res);
+    }
+
+    int err = (res == -1) ? errno : 0;
+    if (resolver->tcp.fd) {
+        res = sock_dns_tcp_conn_recv(&resolver->tcp, _tcp_reply, resolver);
+        if (res < 0) {
+            _tcp_failed(resolver, res);
+        }
+        _tcp_idle(resolver);
+    }
+
+    if (err == ECONNREFUSED) {
+        /* ICMP port unreachable, no server listens */
+        for (unsigned i = 0; i < SOCK_DNS_RESOLVER_PENDING_MAX; i++) {
+            if (resolver->pending[i].cb) {
+                _complete(resolver, &resolver->pending[i], -ECONNREFUSED, NULL, 0);
+            }
+        }
+    }
+}
+
+int sock_dns_resolver_timeouts(sock_dns_resolver_t *resolver)
+{
+    uint64_t now = _now();
+
+    if (!resolver->pending_numof) {
+        resolver->next_deadline = UINT64_MAX;
+        return -1;
+    }
+
+    /* all queries are only scanned once one of them is due */
+    if (now < resolver->next_deadline) {
+        return resolver->next_deadline - now;
+    }
+
+    /* callbacks may add queries, which lower next_deadline */
+    uint64_t next = UINT64_MAX;
+    resolver->next_deadline = UINT64_MAX;
+    for (unsigned i = 0; i < SOCK_DNS_RESOLVER_PENDING_MAX; i++) {
+        sock_dns_pending_t *q = &resolver->pending[i];
+        if (!q->cb) {
+            continue;
+        }
+
+        if (q->deadline <= now) {
+            /* a held A answer is not waited on for longer, and TCP
+             * retransmits by itself */
+            if ((q->retries + 1 >= SOCK_DNS_RETRIES) || (q->held_res > 0) || q->tcp) {
+                _complete(resolver, q, -ETIMEDOUT, NULL, 0);
+                continue;
+            }
+            q->retries++;
+            q->timeout *= 2;
+            q->deadline = now + q->timeout;
+            sock_udp_send(&resolver->sock, q->msg, q->len, NULL);
+        }
+
+        if (q->cb && (q->deadline < next)) {
+            next = q->deadline;
+        }
+    }
+
+    _tcp_idle(resolver);
+
+    if (next < resolver->next_deadline) {
+        resolver->next_deadline = next;
+    }
+    next = resolver->next_deadline;
+    return (next == UINT64_MAX) ? -1 : (int)(next - now);
+}
+
+unsigned sock_dns_resolver_pollfds(const sock_dns_resolver_t *resolver, struct pollfd *pfds)
+{
+    pfds[0].fd = resolver->sock.fd;
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    if (!resolver->tcp.fd) {
+        return 1;
+    }
+    pfds[1].fd = resolver->tcp.fd;
+    pfds[1].events = sock_dns_tcp_conn_events(&resolver->tcp);
+    pfds[1].revents = 0;
+    return 2;
+}
+
+int sock_dns_resolver_run(sock_dns_resolver_t *resolver)
+{
+    while (resolver->pending_numof) {
+        struct pollfd pfds[SOCK_DNS_RESOLVER_POLLFDS];
+        int timeout = sock_dns_resolver_timeouts(resolver);
+        if (!resolver->pending_numof) {
+            break;
+        }
+        unsigned numof = sock_dns_resolver_pollfds(resolver, pfds);
+        if (poll(pfds, numof, timeout) < 0) {
+            return -errno;
+        }
+        if (pfds[0].revents || ((numof > 1) && pfds[1].revents)) {
+            sock_dns_resolver_recv(resolver);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+#ifndef SOCK_DNS_RESOLVER_H
+#define SOCK_DNS_RESOLVER_H
+
+#include <poll.h>
+#include <stdint.h>
+
+#include "net/sock/udp.h"
+#include "net/sock/pktbuf.h"
+
+#include "sock_dns.h"
+#include "sock_dns_tcp.h"
+
+/**
+ * @brief   Maximum number of outstanding queries per resolver
+ */
+#ifndef SOCK_DNS_RESOLVER_PENDING_MAX
+#define SOCK_DNS_RESOLVER_PENDING_MAX   (4096U)
+#endif
+
+/**
+ * @brief   Time to wait for the first reply (ms), doubled per retry
+ */
+#ifndef SOCK_DNS_RESOLVER_TIMEOUT_MS
+#define SOCK_DNS_RESOLVER_TIMEOUT_MS    (1000U)
+#endif
+
+/**
+ * @brief   Maximum number of addresses sock_dns_resolver_query_all() delivers
+ */
+#ifndef SOCK_DNS_RESOLVER_ADDRS_MAX
+#define SOCK_DNS_RESOLVER_ADDRS_MAX     (8U)
+#endif
+
+/**
+ * @brief   Called once per query with the result of sock_dns_query() and,
+ *          if res > 0, the address
+ *
+ * For sock_dns_resolver_query_all(), res > 0 is the number of addresses and
+ * @p addr points to as many sock_dns_addr_t.
+ */
+typedef void (*sock_dns_cb_t)(void *arg, int res, const void *addr);
+
+typedef struct {
+    sock_dns_cb_t cb;               /**< NULL if the slot is free */
+    void *arg;
+    uint64_t deadline;
+    uint32_t timeout;
+    uint16_t id;
+    uint8_t retries;
+    int8_t family;
+    uint8_t unspec;                 /**< AAAA or A half of an AF_UNSPEC query */
+    uint8_t tcp;                    /**< sent again over TCP after a truncated reply */
+    uint8_t all;                    /**< by sock_dns_resolver_query_all() */
+    uint16_t pair;                  /**< slot + 1 of the other half, 0 once it is done */
+    uint16_t len;
+    int held_res;                   /**< result of the other half once it is done */
+    uint32_t held_ttl;
+    uint8_t held[4];                /**< address of an A answer waiting for AAAA */
+    uint8_t msg[SOCK_DNS_QUERYBUF_LEN];
+    char name[SOCK_DNS_MAX_NAME_LEN + 1];
+} sock_dns_pending_t;
+
+/**
+ * @brief   Asynchronous resolver with many outstanding queries on one socket
+ *
+ * Each query gets a random ID. Replies are matched by ID and question, so a
+ * reply to an earlier, abandoned query with the same ID is ignored. The
+ * resolver is driven by the caller: poll the descriptors from
+ * sock_dns_resolver_pollfds() and call sock_dns_resolver_recv() when one is
+ * ready, and call sock_dns_resolver_timeouts() when its last return value
+ * has elapsed.
+ */
+typedef struct {
+    sock_udp_t sock;
+    sock_dns_tcp_conn_t tcp;        /**< for truncated replies, open while needed */
+    unsigned tcp_numof;             /**< queries waiting for a reply over tcp */
+    sock_udp_ep_t server;
+    sock_pktbuf_t *rx;
+    sock_dns_pending_t *pending;
+    uint16_t *by_id;                /**< slot + 1 for every ID in use */
+    uint16_t *free;                 /**< stack of free slots */
+    unsigned free_numof;
+    unsigned pending_numof;
+    uint64_t next_deadline;
+} sock_dns_resolver_t;
+
+/**
+ * @brief   Open a resolver sending to @p server
+ *
+ * The socket is bound to an ephemeral port, which Linux picks at random.
+ */
+int sock_dns_resolver_init(sock_dns_resolver_t *resolver, const sock_udp_ep_t *server);
+
+/**
+ * @brief   Close @p resolver, failing all outstanding queries with -ECANCELED
+ */
+void sock_dns_resolver_close(sock_dns_resolver_t *resolver);
+
+/**
+ * @brief   Resolve @p name to an address of @p family
+ *
+ * Answers from the cache call @p cb before returning. For AF_UNSPEC,
+ * separate AAAA and A queries are sent, taking two slots, and the AAAA answer
+ * is preferred as by sock_dns_query().
+ *
+ * @returns 0 if @p cb will be called, -EAGAIN if too many queries are
+ *          outstanding, or another negative errno
+ */
+int sock_dns_resolver_query(sock_dns_resolver_t *resolver, const char *name, int family,
+        sock_dns_cb_t cb, void *arg);
+
+/**
+ * @brief   Resolve @p name to all its addresses of @p family, AF_INET or
+ *          AF_INET6
+ *
+ * Unlike sock_dns_resolver_query(), this always asks upstream, as
+ * sock_dns_query_all() does. The first address is cached.
+ *
+ * @returns 0 if @p cb will be called, -EINVAL for AF_UNSPEC, -EAGAIN if too
+ *          many queries are outstanding, or another negative errno
+ */
+int sock_dns_resolver_query_all(sock_dns_resolver_t *resolver, const char *name, int family,
+        sock_dns_cb_t cb, void *arg);
+
+/**
+ * @brief   Drop all outstanding queries of @p arg without calling back
+ */
+void sock_dns_resolver_cancel(sock_dns_resolver_t *resolver, void *arg);
+
+/**
+ * @brief   Maximum number of descriptors from sock_dns_resolver_pollfds()
+ */
+#define SOCK_DNS_RESOLVER_POLLFDS       (2U)
+
+/**
+ * @brief   Fill @p pfds with the descriptors to poll for @p resolver, the
+ *          UDP socket and, while truncated replies are fetched, the TCP one
+ *
+ * @returns number of entries filled
+ */
+unsigned sock_dns_resolver_pollfds(const sock_dns_resolver_t *resolver, struct pollfd *pfds);
+
+/**
+ * @brief   Receive and dispatch all pending replies
+ *
+ * Queries whose replies came truncated are sent again over one pipelined TCP
+ * connection, which is driven from here without blocking. Each gets
+ * SOCK_DNS_TCP_TIMEOUT_MS for its reply.
+ */
+void sock_dns_resolver_recv(sock_dns_resolver_t *resolver);
+
+/**
+ * @brief   Retransmit or fail queries that are due
+ *
+ * @returns ms until the next query is due, or -1 if none is outstanding
+ */
+int sock_dns_resolver_timeouts(sock_dns_resolver_t *resolver);
+
+/**
+ * @brief   Drive @p resolver until no query is outstanding
+ */
+int sock_dns_resolver_run(sock_dns_resolver_t *resolver);
+
+#endif /* SOCK_DNS_RESOLVER_H */
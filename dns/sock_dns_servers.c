@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include "sock_dns.h"
+#include "sock_dns_servers.h"
+
+static sock_dns_server_t _servers[SOCK_DNS_SERVERS_MAX];
+static unsigned _servers_numof;
+static char _search[SOCK_DNS_SEARCH_MAX][SOCK_DNS_MAX_NAME_LEN + 1];
+static unsigned _search_numof;
+static unsigned _ndots = 1;
+static atomic_flag _lock = ATOMIC_FLAG_INIT;
+
+static void _acquire(void)
+{
+    while (atomic_flag_test_and_set_explicit(&_lock, memory_order_acquire)) {}
+}
+
+static void _release(void)
+{
+    atomic_flag_clear_explicit(&_lock, memory_order_release);
+}
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000U + ts.tv_nsec / 1000U;
+}
+
+int sock_dns_servers_add(const sock_udp_ep_t *ep)
+{
+    int res = -ENOSPC;
+
+    _acquire();
+    if (_servers_numof < SOCK_DNS_SERVERS_MAX) {
+        sock_dns_server_t *server = &_servers[_servers_numof];
+        memset(server, 0, sizeof(*server));
+        server->ep = *ep;
+        res = _servers_numof++;
+    }
+    _release();
+
+    return res;
+}
+
+void sock_dns_servers_clear(void)
+{
+    _acquire();
+    _servers_numof = 0;
+    _release();
+}
+
+unsigned sock_dns_servers_numof(void)
+{
+    _acquire();
+    unsigned numof = _servers_numof;
+    _release();
+
+    return numof;
+}
+
+static int _parse_addr(char *str, sock_udp_ep_t *ep)
+{
+    memset(ep, 0, sizeof(*ep));
+    ep->port = SOCK_DNS_PORT;
+
+    if (inet_pton(AF_INET, str, ep->addr.ipv4) == 1) {
+        ep->family = AF_INET;
+        return 0;
+    }
+
+    char *scope = strchr(str, '%');
+    if (scope) {
+        *scope++ = '\0';
+        ep->netif = if_nametoindex(scope);
+        if (!ep->netif) {
+            return -ENODEV;
+        }
+    }
+    if (inet_pton(AF_INET6, str, ep->addr.ipv6) == 1) {
+        ep->family = AF_INET6;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+/* @p domain is the first of the line, the others follow in strtok() */
+static void _load_search(char *domain)
+{
+    _acquire();
+    _search_numof = 0;
+    for (; domain && (_search_numof < SOCK_DNS_SEARCH_MAX); domain = strtok(NULL, " \t\r\n")) {
+        size_t len = strlen(domain);
+        if (len && (domain[len - 1] == '.')) {
+            domain[--len] = '\0';
+        }
+        if (len && (len <= SOCK_DNS_MAX_NAME_LEN)) {
+            strcpy(_search[_search_numof++], domain);
+        }
+    }
+    _release();
+}
+
+static void _load_options(char *option)
+{
+    for (; option; option = strtok(NULL, " \t\r\n")) {
+        if (!strncmp(option, "ndots:", 6)) {
+            /* capped as by glibc */
+            unsigned ndots = strtoul(option + 6, NULL, 10);
+            _acquire();
+            _ndots = (ndots > 15) ? 15 : ndots;
+            _release();
+        }
+    }
+}
+
+int sock_dns_servers_load(const char *path)
+{
+    char line[256];
+    int added = 0;
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -errno;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char *keyword = strtok(line, " \t\r\n");
+        char *addr = strtok(NULL, " \t\r\n");
+        if (!keyword || !addr) {
+            continue;
+        }
+        if (!strcmp(keyword, "search") || !strcmp(keyword, "domain")) {
+            _load_search(addr);
+            continue;
+        }
+        if (!strcmp(keyword, "options")) {
+            _load_options(addr);
+            continue;
+        }
+        if (strcmp(keyword, "nameserver")) {
+            continue;
+        }
+
+        sock_udp_ep_t ep;
+        if (_parse_addr(addr, &ep)) {
+            continue;
+        }
+        if (sock_dns_servers_add(&ep) < 0) {
+            break;
+        }
+        added++;
+    }
+
+    fclose(f);
+    return added;
+}
+
+int sock_dns_servers_search(unsigned idx, char *domain)
+{
+    int res = -ENOENT;
+
+    _acquire();
+    if (idx < _search_numof) {
+        strcpy(domain, _search[idx]);
+        res = strlen(domain);
+    }
+    _release();
+
+    return res;
+}
+
+unsigned sock_dns_servers_ndots(void)
+{
+    _acquire();
+    unsigned ndots = _ndots;
+    _release();
+
+    return ndots;
+}
+
+int sock_dns_servers_pick(unsigned exclude, sock_udp_ep_t *ep)
+{
+    uint64_t now = _now();
+    int best = -ENOENT;
+    int held = -ENOENT;
+
+    _acquire();
+    for (unsigned i = 0; i < _servers_numof; i++) {
+        sock_dns_server_t *server = &_servers[i];
+        if (exclude & (1U << i)) {
+            continue;
+        }
+        if (server->retry_at > now) {
+            if ((held < 0) || (server->retry_at < _servers[held].retry_at)) {
+                held = i;
+            }
+            continue;
+        }
+        if ((best < 0) || (server->srtt < _servers[best].srtt)) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        best = held;
+    }
+    if (best >= 0) {
+        *ep = _servers[best].ep;
+    }
+    _release();
+
+    return best;
+}
+
+/* insertion sort, there are few samples */
+static uint32_t _p95(const sock_dns_server_t *server)
+{
+    uint32_t sorted[SOCK_DNS_SERVER_SAMPLES];
+    unsigned numof = server->samples_numof;
+
+    for (unsigned i = 0; i < numof; i++) {
+        uint32_t sample = server->samples[i];
+        unsigned j = i;
+        for (; j && (sorted[j - 1] > sample); j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = sample;
+    }
+
+    return sorted[(numof * 95) / 100];
+}
+
+void sock_dns_servers_reply(int idx, uint32_t rtt)
+{
+    _acquire();
+    sock_dns_server_t *server = &_servers[idx];
+
+    /* as TCP does (RFC 6298), alpha = 1/8 */
+    server->srtt = server->srtt ? server->srtt - (server->srtt >> 3) + (rtt >> 3) : rtt;
+    server->failures = 0;
+    server->retry_at = 0;
+
+    server->samples[server->samples_pos] = rtt;
+    server->samples_pos = (server->samples_pos + 1) % SOCK_DNS_SERVER_SAMPLES;
+    if (server->samples_numof < SOCK_DNS_SERVER_SAMPLES) {
+        server->samples_numof++;
+    }
+    server->p95 = _p95(server);
+    _release();
+}
+
+void sock_dns_servers_failed(int idx)
+{
+    _acquire();
+    sock_dns_server_t *server = &_servers[idx];
+
+    /* a server that times out falls behind the others */
+    if (!server->srtt) {
+        server->srtt = SOCK_DNS_HEDGE_DELAY_US;
+    }
+    else if (server->srtt < UINT32_MAX / 2) {
+        server->srtt *= 2;
+    }
+    if (++server->failures >= SOCK_DNS_SERVER_FAILURES_MAX) {
+        server->retry_at = _now() + SOCK_DNS_SERVER_HOLDDOWN_MS * 1000U;
+    }
+    _release();
+}
+
+void sock_dns_servers_outpaced(int idx, uint32_t elapsed)
+{
+    _acquire();
+    sock_dns_server_t *server = &_servers[idx];
+    if (server->srtt < elapsed) {
+        server->srtt = elapsed;
+    }
+    _release();
+}
+
+uint32_t sock_dns_servers_hedge_delay(int idx)
+{
+    _acquire();
+    uint32_t delay = _servers[idx].p95;
+    unsigned samples_numof = _servers[idx].samples_numof;
+    _release();
+
+    if (!samples_numof) {
+        return SOCK_DNS_HEDGE_DELAY_US;
+    }
+    return (delay < SOCK_DNS_HEDGE_DELAY_MIN_US) ? SOCK_DNS_HEDGE_DELAY_MIN_US : delay;
+}
+
+int sock_dns_servers_get(int idx, sock_dns_server_t *server)
+{
+    int res = -ENOENT;
+
+    _acquire();
+    if ((idx >= 0) && ((unsigned)idx < _servers_numof)) {
+        *server = _servers[idx];
+        res = 0;
+    }
+    _release();
+
+    return res;
+}
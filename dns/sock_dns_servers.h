@@ -0,0 +1,163 @@
+#ifndef SOCK_DNS_SERVERS_H
+#define SOCK_DNS_SERVERS_H
+
+#include <stdint.h>
+
+#include "net/sock/udp.h"
+
+/**
+ * @brief   Maximum number of upstream servers
+ */
+#ifndef SOCK_DNS_SERVERS_MAX
+#define SOCK_DNS_SERVERS_MAX            (4U)
+#endif
+
+/**
+ * @brief   Maximum number of search domains
+ */
+#ifndef SOCK_DNS_SEARCH_MAX
+#define SOCK_DNS_SEARCH_MAX             (6U)
+#endif
+
+/**
+ * @brief   Configuration read by sock_dns_query() on first use, unless
+ *          servers were added before
+ */
+#ifndef SOCK_DNS_RESOLV_CONF
+#define SOCK_DNS_RESOLV_CONF            "/etc/resolv.conf"
+#endif
+
+/**
+ * @brief   Number of recent RTTs per server the hedging delay is taken from
+ */
+#ifndef SOCK_DNS_SERVER_SAMPLES
+#define SOCK_DNS_SERVER_SAMPLES         (32U)
+#endif
+
+/**
+ * @brief   Consecutive timeouts after which a server is skipped
+ */
+#ifndef SOCK_DNS_SERVER_FAILURES_MAX
+#define SOCK_DNS_SERVER_FAILURES_MAX    (3U)
+#endif
+
+/**
+ * @brief   How long a failed server is skipped (ms) before it is tried again
+ */
+#ifndef SOCK_DNS_SERVER_HOLDDOWN_MS
+#define SOCK_DNS_SERVER_HOLDDOWN_MS     (30000U)
+#endif
+
+/**
+ * @brief   Hedging delay (us) while a server has no RTT samples, and the
+ *          lower bound otherwise
+ */
+#ifndef SOCK_DNS_HEDGE_DELAY_US
+#define SOCK_DNS_HEDGE_DELAY_US         (100000U)
+#endif
+#ifndef SOCK_DNS_HEDGE_DELAY_MIN_US
+#define SOCK_DNS_HEDGE_DELAY_MIN_US     (2000U)
+#endif
+
+typedef struct {
+    sock_udp_ep_t ep;
+    uint32_t srtt;                      /**< smoothed RTT (us), 0 before the first reply */
+    uint32_t p95;                       /**< 95th percentile of samples (us) */
+    uint32_t samples[SOCK_DNS_SERVER_SAMPLES];
+    uint8_t samples_numof;
+    uint8_t samples_pos;
+    uint16_t failures;                  /**< consecutive timeouts */
+    uint64_t retry_at;                  /**< skipped until then (us) after too many failures */
+} sock_dns_server_t;
+
+/**
+ * @brief   Add @p ep to the upstream servers
+ *
+ * While the list is empty, sock_dns_server is used.
+ *
+ * @returns index of the server, or -ENOSPC
+ */
+int sock_dns_servers_add(const sock_udp_ep_t *ep);
+
+/**
+ * @brief   Remove all upstream servers
+ */
+void sock_dns_servers_clear(void);
+
+/**
+ * @brief   Add the nameserver entries of a resolv.conf file, e.g.
+ *          "/etc/resolv.conf"
+ *
+ * IPv6 addresses may have a "%interface" suffix. The search list
+ * ("search" or "domain", the last one wins) and "options ndots:n" replace
+ * the ones loaded before.
+ *
+ * @returns number of servers added, or negative errno
+ */
+int sock_dns_servers_load(const char *path);
+
+/**
+ * @brief   Copy search domain @p idx to @p domain, which has room for
+ *          SOCK_DNS_MAX_NAME_LEN + 1 characters
+ *
+ * @returns length of the domain, or -ENOENT past the last one
+ */
+int sock_dns_servers_search(unsigned idx, char *domain);
+
+/**
+ * @brief   Get the number of dots from which a name is first tried as it is,
+ *          before the search domains are appended (resolv.conf(5), default 1)
+ */
+unsigned sock_dns_servers_ndots(void);
+
+/**
+ * @brief   Get the number of upstream servers
+ */
+unsigned sock_dns_servers_numof(void);
+
+/**
+ * @brief   Pick the server with the lowest RTT that is not held down
+ *
+ * If all are held down, the one whose hold-down ends first is picked.
+ * Servers without RTT samples go first, so each gets measured.
+ *
+ * @param[in] exclude   bit mask of server indices to skip
+ * @param[out] ep       endpoint of the server
+ *
+ * @returns index of the server, or -ENOENT
+ */
+int sock_dns_servers_pick(unsigned exclude, sock_udp_ep_t *ep);
+
+/**
+ * @brief   Record a reply from server @p idx after @p rtt us
+ */
+void sock_dns_servers_reply(int idx, uint32_t rtt);
+
+/**
+ * @brief   Record a query to server @p idx that timed out or was refused
+ */
+void sock_dns_servers_failed(int idx);
+
+/**
+ * @brief   Record a query to server @p idx that another server answered
+ *          first, @p elapsed us after it was sent
+ *
+ * Its RTT is at least @p elapsed, without this a server that always loses
+ * the race would never be measured.
+ */
+void sock_dns_servers_outpaced(int idx, uint32_t elapsed);
+
+/**
+ * @brief   Time (us) after which a query to @p idx is duplicated to a second
+ *          server: the 95th percentile of its recent RTTs
+ */
+uint32_t sock_dns_servers_hedge_delay(int idx);
+
+/**
+ * @brief   Copy the state of server @p idx, for diagnostics
+ *
+ * @returns 0, or -ENOENT
+ */
+int sock_dns_servers_get(int idx, sock_dns_server_t *server);
+
+#endif /* SOCK_DNS_SERVERS_H */
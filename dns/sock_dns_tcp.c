@@ -0,0 +1,433 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include "net/sock/posix.h"
+
+#include "sock_dns.h"
+#include "sock_dns_tcp.h"
+
+typedef struct {
+    sock_udp_ep_t ep;
+    int fd;                     /* 0 if unused */
+    uint8_t busy;
+    uint64_t last_used;         /* ms */
+} _conn_t;
+
+static _conn_t _pool[SOCK_DNS_TCP_POOL_SIZE];
+static atomic_flag _lock = ATOMIC_FLAG_INIT;
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U;
+}
+
+static int _ep_eq(const sock_udp_ep_t *a, const sock_udp_ep_t *b)
+{
+    return (a->family == b->family) && (a->port == b->port) && (a->netif == b->netif) &&
+        !memcmp(&a->addr, &b->addr, (a->family == AF_INET) ? 4 : 16);
+}
+
+static int _connect(const sock_udp_ep_t *server)
+{
+    struct sockaddr_storage addr;
+
+    int addr_len = sock_ep2sockaddr(&addr, server);
+    if (addr_len < 0) {
+        return addr_len;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -errno;
+    }
+
+    /* queries are written in one go and wait for nothing */
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    struct timeval timeout = {
+        .tv_sec = SOCK_DNS_TCP_TIMEOUT_MS / 1000U,
+        .tv_usec = (SOCK_DNS_TCP_TIMEOUT_MS % 1000U) * 1000U,
+    };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (connect(fd, (struct sockaddr *)&addr, addr_len) == -1) {
+        int res = (errno == EINPROGRESS) ? -ETIMEDOUT : -errno;
+        close(fd);
+        return res;
+    }
+
+    return fd;
+}
+
+/* returns a pooled connection to @p server marked busy, else a free or the
+ * least recently used slot with fd 0, else NULL if all are busy */
+static _conn_t *_take(const sock_udp_ep_t *server, int fresh)
+{
+    uint64_t now = _now();
+    _conn_t *conn = NULL;
+
+    while (atomic_flag_test_and_set_explicit(&_lock, memory_order_acquire)) {}
+    for (unsigned i = 0; i < SOCK_DNS_TCP_POOL_SIZE; i++) {
+        _conn_t *c = &_pool[i];
+        if (c->busy) {
+            continue;
+        }
+        if (c->fd && (now - c->last_used > SOCK_DNS_TCP_IDLE_MS)) {
+            close(c->fd);
+            c->fd = 0;
+        }
+        if (!fresh && c->fd && _ep_eq(&c->ep, server)) {
+            conn = c;
+            break;
+        }
+        if (!conn || !c->fd || (conn->fd && (c->last_used < conn->last_used))) {
+            conn = c;
+        }
+    }
+    if (conn) {
+        if (conn->fd && (fresh || !_ep_eq(&conn->ep, server))) {
+            close(conn->fd);
+            conn->fd = 0;
+        }
+        conn->busy = 1;
+    }
+    atomic_flag_clear_explicit(&_lock, memory_order_release);
+
+    return conn;
+}
+
+static void _give(_conn_t *conn, int fd, int reusable)
+{
+    if (!conn) {
+        close(fd);
+        return;
+    }
+
+    while (atomic_flag_test_and_set_explicit(&_lock, memory_order_acquire)) {}
+    if (!reusable) {
+        if (fd > 0) {
+            close(fd);
+        }
+        fd = 0;
+    }
+    conn->fd = fd;
+    conn->last_used = _now();
+    conn->busy = 0;
+    atomic_flag_clear_explicit(&_lock, memory_order_release);
+}
+
+static int _recv_all(int fd, uint8_t *buf, size_t len)
+{
+    while (len) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int res = poll(&pfd, 1, SOCK_DNS_TCP_TIMEOUT_MS);
+        if (res <= 0) {
+            return res ? -errno : -ETIMEDOUT;
+        }
+
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n <= 0) {
+            return n ? -errno : -ECONNRESET;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* sends the queries not yet in @p answered and reads their replies,
+ * returns 1 once done, 0 if all replies are read, or negative errno */
+static int _pipeline(int fd, const uint8_t *const *queries, const size_t *lens,
+        unsigned numof, sock_dns_tcp_cb_t cb, void *arg, unsigned *answered)
+{
+    size_t total = 0;
+    unsigned pending = 0;
+    for (unsigned i = 0; i < numof; i++) {
+        if (!(*answered & (1U << i))) {
+            total += 2 + lens[i];
+            pending++;
+        }
+    }
+
+    /* each message with its two byte length (RFC 1035, 4.2.2) */
+    uint8_t *tx = malloc(total);
+    if (!tx) {
+        return -ENOMEM;
+    }
+    uint8_t *pos = tx;
+    for (unsigned i = 0; i < numof; i++) {
+        if (*answered & (1U << i)) {
+            continue;
+        }
+        *pos++ = lens[i] >> 8;
+        *pos++ = lens[i] & 0xff;
+        memcpy(pos, queries[i], lens[i]);
+        pos += lens[i];
+    }
+
+    int res = 0;
+    for (size_t sent = 0; sent < total;) {
+        ssize_t n = send(fd, tx + sent, total - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            res = -errno;
+            break;
+        }
+        sent += n;
+    }
+    free(tx);
+    if (res) {
+        return res;
+    }
+
+    while (pending) {
+        uint8_t prefix[2];
+        if ((res = _recv_all(fd, prefix, 2))) {
+            return res;
+        }
+
+        size_t len = (prefix[0] << 8) | prefix[1];
+        uint8_t *msg = malloc(len ? len : 1);
+        if (!msg) {
+            return -ENOMEM;
+        }
+        if ((res = _recv_all(fd, msg, len))) {
+            free(msg);
+            return res;
+        }
+
+        int done = 0;
+        for (unsigned i = 0; (len >= sizeof(sock_dns_hdr_t)) && (i < numof); i++) {
+            if ((*answered & (1U << i)) || memcmp(msg, queries[i], 2) || !(msg[2] & 0x80)) {
+                continue;
+            }
+            *answered |= 1U << i;
+            pending--;
+            done = cb(arg, i, msg, len);
+            break;
+        }
+        free(msg);
+
+        /* the connection stays usable if no reply is still on its way */
+        if (done) {
+            return pending ? 1 : 0;
+        }
+    }
+
+    return 0;
+}
+
+int sock_dns_tcp_exchange(const sock_udp_ep_t *server, const uint8_t *const *queries,
+        const size_t *lens, unsigned numof, sock_dns_tcp_cb_t cb, void *arg)
+{
+    unsigned answered = 0;
+    int res = -ECONNRESET;
+
+    if (!numof || (numof > SOCK_DNS_TCP_QUERIES_MAX)) {
+        return -EINVAL;
+    }
+
+    /* a pooled connection may have been closed by the server meanwhile,
+     * then the rest is sent on a new one */
+    for (int fresh = 0; (fresh < 2) && (res == -ECONNRESET || res == -EPIPE); fresh++) {
+        _conn_t *conn = _take(server, fresh);
+        int fd = conn ? conn->fd : 0;
+        int reused = (fd > 0);
+
+        if (!reused) {
+            fd = _connect(server);
+            if (fd < 0) {
+                if (conn) {
+                    _give(conn, 0, 0);
+                }
+                return fd;
+            }
+            if (conn) {
+                conn->ep = *server;
+            }
+        }
+
+        res = _pipeline(fd, queries, lens, numof, cb, arg, &answered);
+
+        /* stray replies would be left behind after an early end */
+        _give(conn, fd, res == 0);
+        if (!reused) {
+            break;
+        }
+    }
+
+    return (res > 0) ? 0 : res;
+}
+
+void sock_dns_tcp_close_all(void)
+{
+    while (atomic_flag_test_and_set_explicit(&_lock, memory_order_acquire)) {}
+    for (unsigned i = 0; i < SOCK_DNS_TCP_POOL_SIZE; i++) {
+        if (!_pool[i].busy && _pool[i].fd) {
+            close(_pool[i].fd);
+            _pool[i].fd = 0;
+        }
+    }
+    atomic_flag_clear_explicit(&_lock, memory_order_release);
+}
+
+int sock_dns_tcp_conn_open(sock_dns_tcp_conn_t *conn, const sock_udp_ep_t *server)
+{
+    struct sockaddr_storage addr;
+
+    memset(conn, 0, sizeof(*conn));
+
+    int addr_len = sock_ep2sockaddr(&addr, server);
+    if (addr_len < 0) {
+        return addr_len;
+    }
+
+    conn->rx = malloc(2 + UINT16_MAX);
+    if (!conn->rx) {
+        return -ENOMEM;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        int res = -errno;
+        sock_dns_tcp_conn_close(conn);
+        return res;
+    }
+    conn->fd = fd;
+
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (connect(fd, (struct sockaddr *)&addr, addr_len) == -1) {
+        if (errno != EINPROGRESS) {
+            int res = -errno;
+            sock_dns_tcp_conn_close(conn);
+            return res;
+        }
+    }
+    else {
+        conn->connected = 1;
+    }
+
+    return 0;
+}
+
+/* writes as much as the socket takes */
+static int _conn_flush(sock_dns_tcp_conn_t *conn)
+{
+    size_t sent = 0;
+
+    while (conn->connected && (sent < conn->tx_len)) {
+        ssize_t n = send(conn->fd, conn->tx + sent, conn->tx_len - sent,
+                MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
+            }
+            return -errno;
+        }
+        sent += n;
+    }
+
+    memmove(conn->tx, conn->tx + sent, conn->tx_len - sent);
+    conn->tx_len -= sent;
+    return 0;
+}
+
+int sock_dns_tcp_conn_send(sock_dns_tcp_conn_t *conn, const uint8_t *msg, size_t len)
+{
+    if (conn->tx_len + 2 + len > conn->tx_size) {
+        size_t size = (conn->tx_size ? conn->tx_size : 512);
+        while (size < conn->tx_len + 2 + len) {
+            size *= 2;
+        }
+        uint8_t *tx = realloc(conn->tx, size);
+        if (!tx) {
+            return -ENOMEM;
+        }
+        conn->tx = tx;
+        conn->tx_size = size;
+    }
+
+    /* with its two byte length (RFC 1035, 4.2.2) */
+    uint8_t *pos = conn->tx + conn->tx_len;
+    *pos++ = len >> 8;
+    *pos++ = len & 0xff;
+    memcpy(pos, msg, len);
+    conn->tx_len += 2 + len;
+
+    return _conn_flush(conn);
+}
+
+short sock_dns_tcp_conn_events(const sock_dns_tcp_conn_t *conn)
+{
+    return POLLIN | ((!conn->connected || conn->tx_len) ? POLLOUT : 0);
+}
+
+int sock_dns_tcp_conn_recv(sock_dns_tcp_conn_t *conn, sock_dns_tcp_msg_cb_t cb, void *arg)
+{
+    if (!conn->connected) {
+        struct pollfd pfd = { .fd = conn->fd, .events = POLLOUT };
+        if ((poll(&pfd, 1, 0) <= 0) || !pfd.revents) {
+            return 0;
+        }
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+        if (err) {
+            return -err;
+        }
+        conn->connected = 1;
+    }
+
+    int res = _conn_flush(conn);
+    if (res) {
+        return res;
+    }
+
+    while (1) {
+        /* the length first, then the message */
+        size_t want = 2;
+        if (conn->rx_len >= 2) {
+            want += (conn->rx[0] << 8) | conn->rx[1];
+        }
+        if ((conn->rx_len >= 2) && (conn->rx_len == want)) {
+            if (want == 2) {
+                /* an empty message is no reply, the server is broken */
+                return -EBADMSG;
+            }
+            cb(arg, conn->rx + 2, want - 2);
+            conn->rx_len = 0;
+            continue;
+        }
+
+        ssize_t n = recv(conn->fd, conn->rx + conn->rx_len, want - conn->rx_len, MSG_DONTWAIT);
+        if (n < 0) {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -errno;
+        }
+        if (!n) {
+            return -ECONNRESET;
+        }
+        conn->rx_len += n;
+    }
+}
+
+void sock_dns_tcp_conn_close(sock_dns_tcp_conn_t *conn)
+{
+    if (conn->fd > 0) {
+        close(conn->fd);
+    }
+    free(conn->tx);
+    free(conn->rx);
+    memset(conn, 0, sizeof(*conn));
+}
@@ -0,0 +1,119 @@
+#ifndef SOCK_DNS_TCP_H
+#define SOCK_DNS_TCP_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "net/sock/udp.h"
+
+/**
+ * @brief   Number of TCP connections kept open for reuse
+ */
+#ifndef SOCK_DNS_TCP_POOL_SIZE
+#define SOCK_DNS_TCP_POOL_SIZE      (4U)
+#endif
+
+/**
+ * @brief   Idle time (ms) after which a pooled connection is not reused,
+ *          servers close theirs after a few seconds (RFC 7766, 6.2.3)
+ */
+#ifndef SOCK_DNS_TCP_IDLE_MS
+#define SOCK_DNS_TCP_IDLE_MS        (5000U)
+#endif
+
+/**
+ * @brief   Time (ms) to wait for the connection and for each reply
+ */
+#ifndef SOCK_DNS_TCP_TIMEOUT_MS
+#define SOCK_DNS_TCP_TIMEOUT_MS     (2000U)
+#endif
+
+/**
+ * @brief   Maximum number of queries per sock_dns_tcp_exchange()
+ */
+#ifndef SOCK_DNS_TCP_QUERIES_MAX
+#define SOCK_DNS_TCP_QUERIES_MAX    (32U)
+#endif
+
+/**
+ * @brief   Called with the reply to queries[@p idx]
+ *
+ * @returns 1 if no further replies are needed, else 0
+ */
+typedef int (*sock_dns_tcp_cb_t)(void *arg, unsigned idx, const uint8_t *msg, size_t len);
+
+/**
+ * @brief   Send @p queries to @p server over TCP (RFC 7766) and pass the
+ *          replies to @p cb
+ *
+ * All queries are written at once and the replies are matched by ID, in
+ * whatever order the server sends them. The connection is taken from a pool
+ * and returned to it afterwards, a pooled connection the server has closed
+ * meanwhile is replaced transparently.
+ *
+ * @returns 0 once @p cb is done or all queries are answered, -ETIMEDOUT,
+ *          -EINVAL for too many queries, or another negative errno
+ */
+int sock_dns_tcp_exchange(const sock_udp_ep_t *server, const uint8_t *const *queries,
+        const size_t *lens, unsigned numof, sock_dns_tcp_cb_t cb, void *arg);
+
+/**
+ * @brief   Close all pooled connections
+ */
+void sock_dns_tcp_close_all(void);
+
+/**
+ * @brief   Called with each reply read by sock_dns_tcp_conn_recv()
+ */
+typedef void (*sock_dns_tcp_msg_cb_t)(void *arg, const uint8_t *msg, size_t len);
+
+/**
+ * @brief   Non-blocking TCP connection for callers with their own poll loop
+ *
+ * Unlike sock_dns_tcp_exchange(), nothing waits: queries are buffered until
+ * the connection is up and the socket takes them, and replies are read as
+ * they arrive. Poll fd for sock_dns_tcp_conn_events() and call
+ * sock_dns_tcp_conn_recv() when it is ready. Zeroed means closed.
+ */
+typedef struct {
+    int fd;                         /**< 0 if closed */
+    uint8_t connected;
+    uint8_t *tx;                    /**< queries with their length not yet written */
+    size_t tx_len;
+    size_t tx_size;
+    uint8_t *rx;                    /**< reply being read, with its length */
+    size_t rx_len;
+} sock_dns_tcp_conn_t;
+
+/**
+ * @brief   Start connecting @p conn to @p server
+ */
+int sock_dns_tcp_conn_open(sock_dns_tcp_conn_t *conn, const sock_udp_ep_t *server);
+
+/**
+ * @brief   Queue @p msg for sending on @p conn
+ *
+ * @returns 0, or negative errno if the connection failed
+ */
+int sock_dns_tcp_conn_send(sock_dns_tcp_conn_t *conn, const uint8_t *msg, size_t len);
+
+/**
+ * @brief   Events to poll conn->fd for
+ */
+short sock_dns_tcp_conn_events(const sock_dns_tcp_conn_t *conn);
+
+/**
+ * @brief   Write what is queued and pass all complete replies to @p cb
+ *
+ * @returns 0, or negative errno once the connection failed or the server
+ *          closed it, which leaves @p conn to be closed. -EBADMSG if the
+ *          server sent a zero-length message.
+ */
+int sock_dns_tcp_conn_recv(sock_dns_tcp_conn_t *conn, sock_dns_tcp_msg_cb_t cb, void *arg);
+
+/**
+ * @brief   Close @p conn, dropping what is queued
+ */
+void sock_dns_tcp_conn_close(sock_dns_tcp_conn_t *conn);
+
+#endif /* SOCK_DNS_TCP_H */
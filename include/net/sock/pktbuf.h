@@ -0,0 +1,84 @@
+#ifndef SOCK_PKTBUF_H
+#define SOCK_PKTBUF_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "net/sock/udp.h"
+
+/**
+ * @brief   Payload capacity of a packet buffer (IPv6 minimum MTU)
+ */
+#ifndef SOCK_PKTBUF_SIZE
+#define SOCK_PKTBUF_SIZE        (1280U)
+#endif
+
+/**
+ * @brief   Number of buffers in the pool, which bounds the memory used
+ */
+#ifndef SOCK_PKTBUF_NUMOF
+#define SOCK_PKTBUF_NUMOF       (256U)
+#endif
+
+/**
+ * @brief   Free buffers a thread keeps for itself before returning them
+ *
+ * Capped at 1/16 of SOCK_PKTBUF_NUMOF. They are returned when the thread
+ * exits.
+ */
+#ifndef SOCK_PKTBUF_LOCAL_MAX
+#define SOCK_PKTBUF_LOCAL_MAX   (32U)
+#endif
+
+#define SOCK_PKTBUF_ALIGN       (64U)
+
+/**
+ * @brief   Fixed size, reference counted packet buffer
+ *
+ * Buffers come from one static pool. A buffer can be handed from the receive
+ * path to handlers and send paths without copying, every stage that keeps it
+ * beyond its call takes a reference with sock_pktbuf_hold().
+ */
+typedef struct sock_pktbuf {
+    struct sock_pktbuf *next;   /**< free list, or for the holder to queue it */
+    atomic_uint refs;
+    uint16_t len;               /**< bytes used in data */
+    _Alignas(SOCK_PKTBUF_ALIGN) uint8_t data[SOCK_PKTBUF_SIZE];
+} sock_pktbuf_t;
+
+/**
+ * @brief   Take a buffer from the pool, with one reference and len 0
+ *
+ * @returns NULL if all buffers are in use
+ */
+sock_pktbuf_t *sock_pktbuf_alloc(void);
+
+static inline void sock_pktbuf_hold(sock_pktbuf_t *pb)
+{
+    atomic_fetch_add_explicit(&pb->refs, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief   Drop a reference, the last one returns @p pb to the pool
+ */
+void sock_pktbuf_release(sock_pktbuf_t *pb);
+
+/**
+ * @brief   Receive into a buffer taken from the pool
+ *
+ * On success, the caller owns the reference to *@p pb.
+ *
+ * @returns number of bytes received, -ENOBUFS if the pool is empty or the
+ *          error of sock_udp_recv()
+ */
+ssize_t sock_udp_recv_pktbuf(sock_udp_t *sock, sock_pktbuf_t **pb, uint32_t timeout,
+        sock_udp_ep_t *remote);
+
+static inline ssize_t sock_udp_send_pktbuf(sock_udp_t *sock, const sock_pktbuf_t *pb,
+        const sock_udp_ep_t *remote)
+{
+    return sock_udp_send(sock, pb->data, pb->len, remote);
+}
+
+#endif /* SOCK_PKTBUF_H */
@@ -0,0 +1,146 @@
+#ifndef SOCK_POSIX_H
+#define SOCK_POSIX_H
+
+#include <linux/filter.h>
+
+#include "net/sock/udp.h"
+
+/**
+ * @brief   Convert a sock endpoint into a struct sockaddr_in(6)
+ *
+ * @returns length of the resulting sockaddr, or -EINVAL
+ */
+int sock_ep2sockaddr(void *sockaddr, const sock_udp_ep_t *endpoint);
+
+/**
+ * @brief   Convert a struct sockaddr_in(6) into a sock endpoint
+ */
+int sock_sockaddr2ep(sock_udp_ep_t *endpoint, const void *sockaddr);
+
+/**
+ * @brief   Enable counting of packets the kernel dropped on @p sock
+ *
+ * Uses SO_RXQ_OVFL. The counter is updated by every sock_udp_recv().
+ */
+int sock_udp_enable_drop_count(sock_udp_t *sock);
+
+/**
+ * @brief   Get the number of packets dropped on @p sock since it was created
+ */
+static inline uint32_t sock_udp_get_drop_count(sock_udp_t *sock)
+{
+    return sock->drops;
+}
+
+/**
+ * @brief   Have sock_udp_recv() note whether a packet was sent to a multicast
+ *          address
+ *
+ * Uses IP_PKTINFO and IPV6_RECVPKTINFO, see sock_udp_recv_was_multicast().
+ */
+int sock_udp_enable_multicast_info(sock_udp_t *sock);
+
+/**
+ * @brief   Whether the last packet received on @p sock was sent to a group
+ */
+static inline int sock_udp_recv_was_multicast(sock_udp_t *sock)
+{
+    return sock->multicast;
+}
+
+/**
+ * @brief   Receive packets sent to the multicast address of @p group
+ *
+ * @p group->netif selects the interface, 0 lets the kernel choose. The port
+ * of @p group is ignored, @p sock receives on the port it is bound to. A
+ * dual-stack socket can join IPv4 and IPv6 groups.
+ *
+ * @returns 0 on success, -EINVAL for an unknown family or the negative errno
+ *          of setsockopt()
+ */
+int sock_udp_join_group(sock_udp_t *sock, const sock_udp_ep_t *group);
+
+/**
+ * @brief   Leave a group joined with sock_udp_join_group()
+ */
+int sock_udp_leave_group(sock_udp_t *sock, const sock_udp_ep_t *group);
+
+/**
+ * @brief   Attach a classic BPF program that filters packets before they are
+ *          queued on @p sock
+ *
+ * The program sees the 8 byte UDP header followed by the payload, so the
+ * offsets of the programs below are payload offsets plus 8. Packets for which
+ * it returns 0 are dropped by the kernel, so they cost neither a wakeup nor a
+ * copy. Replaces a previously attached program.
+ *
+ * @returns 0 on success or the negative errno of setsockopt()
+ */
+int sock_udp_attach_filter(sock_udp_t *sock, const struct sock_filter *filter, size_t numof);
+
+/**
+ * @brief   Create @p numof sockets on @p local that share its port, one per CPU
+ *
+ * The sockets form a SO_REUSEPORT group with a SO_ATTACH_REUSEPORT_CBPF
+ * program that hands a packet received on CPU @p cpus[i] to socks[i], and one
+ * received on any other CPU to socks[cpu % numof]. Unlike the default hash,
+ * this keeps a flow on the CPU its NIC queue interrupts, as long as the reader
+ * of socks[i] runs on CPU @p cpus[i]. @p cpus may be NULL for CPUs 0 to
+ * @p numof - 1.
+ *
+ * @returns 0 on success, negative errno otherwise
+ */
+int sock_udp_create_cpu_group(sock_udp_t *socks, const unsigned *cpus, unsigned numof,
+        const sock_udp_ep_t *local);
+
+/**
+ * @name    Ready-made filter programs, as initializers for struct sock_filter[]
+ * @{
+ */
+
+/** @brief  CoAP (RFC 7252): at least a header, version 1, TKL <= 8 */
+#define SOCK_FILTER_COAP { \
+    BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0), \
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 8 + 4, 0, 5), \
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8 + 0), \
+    BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xcf), \
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 0x49, 2, 0), \
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 0x40, 0, 1), \
+    BPF_STMT(BPF_RET | BPF_K, 0xffffffff), \
+    BPF_STMT(BPF_RET | BPF_K, 0), \
+}
+
+/** @brief  DNS responses: at least a header, QR set */
+#define SOCK_FILTER_DNS_RESPONSE { \
+    BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0), \
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 8 + 12, 0, 3), \
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8 + 2), \
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 0, 1), \
+    BPF_STMT(BPF_RET | BPF_K, 0xffffffff), \
+    BPF_STMT(BPF_RET | BPF_K, 0), \
+}
+
+/** @brief  DNS queries: at least a header, QR clear */
+#define SOCK_FILTER_DNS_QUERY { \
+    BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0), \
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 8 + 12, 0, 3), \
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8 + 2), \
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 1, 0), \
+    BPF_STMT(BPF_RET | BPF_K, 0xffffffff), \
+    BPF_STMT(BPF_RET | BPF_K, 0), \
+}
+
+/** @brief  DHCP replies: op 2 (BOOTREPLY) and the magic cookie */
+#define SOCK_FILTER_DHCP_REPLY { \
+    BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0), \
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 8 + 240, 0, 5), \
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8 + 0), \
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 2, 0, 3), \
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 8 + 236), \
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x63825363, 0, 1), \
+    BPF_STMT(BPF_RET | BPF_K, 0xffffffff), \
+    BPF_STMT(BPF_RET | BPF_K, 0), \
+}
+/** @} */
+
+#endif /* SOCK_POSIX_H */
@@ -0,0 +1,340 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "net/sock/udp.h"
+#include "net/sock/util.h"
+
+#include "nanocoap.h"
+
+/* requests in flight are tracked in a ring indexed by the request sequence
+ * number, which is also used as token */
+#define INFLIGHT_MAX        (1U << 16)
+
+/* log-linear ("HDR-style") latency histogram: 2^SUB_BITS buckets per power
+ * of two, so every value is recorded with ~3% precision */
+#define SUB_BITS            (5U)
+#define SUB_BUCKETS         (1U << SUB_BITS)
+#define HIST_BUCKETS        ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+#define MAX_SOCKS           (FD_SETSIZE - 8)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} _hist_t;
+
+typedef struct {
+    uint32_t seq;
+    uint8_t pending;
+    uint64_t scheduled;
+} _inflight_t;
+
+typedef struct {
+    unsigned concurrency;
+    unsigned rate;
+    unsigned duration;
+    unsigned timeout_ms;
+    unsigned non_pct;
+    unsigned payload_len;
+    unsigned mix[3];        /* GET, PUT, POST weights */
+} _config_t;
+
+static _hist_t _hist;
+static _inflight_t _inflight[INFLIGHT_MAX];
+static uint8_t _payload[1024];
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t _rand(void)
+{
+    static uint32_t state = 0x12345678;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static unsigned _hist_idx(uint64_t val)
+{
+    if (val < SUB_BUCKETS) {
+        return val;
+    }
+    unsigned exp = 63 - __builtin_clzll(val);
+    unsigned sub = (val >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (exp - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+static uint64_t _hist_val(unsigned idx)
+{
+    if (idx < SUB_BUCKETS) {
+        return idx;
+    }
+    unsigned exp = idx / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t sub = idx % SUB_BUCKETS;
+    /* upper end of the bucket */
+    return ((SUB_BUCKETS + sub + 1) << (exp - SUB_BITS)) - 1;
+}
+
+static void _hist_add(_hist_t *h, uint64_t val)
+{
+    h->counts[_hist_idx(val)]++;
+    h->total++;
+    h->sum += val;
+    if (val > h->max) {
+        h->max = val;
+    }
+}
+
+static uint64_t _hist_percentile(_hist_t *h, double pct)
+{
+    uint64_t want = (uint64_t)(h->total * pct / 100.0 + 0.5);
+    uint64_t seen = 0;
+    if (!want) {
+        want = 1;
+    }
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= want) {
+            uint64_t val = _hist_val(i);
+            return (val < h->max) ? val : h->max;
+        }
+    }
+    return h->max;
+}
+
+static unsigned _pick_method(_config_t *cfg)
+{
+    static const unsigned methods[] = { COAP_METHOD_GET, COAP_METHOD_PUT, COAP_METHOD_POST };
+    unsigned total = cfg->mix[0] + cfg->mix[1] + cfg->mix[2];
+    unsigned r = _rand() % total;
+    for (unsigned i = 0; i < 2; i++) {
+        if (r < cfg->mix[i]) {
+            return methods[i];
+        }
+        r -= cfg->mix[i];
+    }
+    return methods[2];
+}
+
+static ssize_t _build_req(_config_t *cfg, uint8_t *buf, size_t len, const char *path,
+        uint32_t seq, uint16_t id)
+{
+    coap_builder_t b;
+    uint8_t token[4] = { seq >> 24, seq >> 16, seq >> 8, seq };
+    unsigned type = ((_rand() % 100) < cfg->non_pct) ? COAP_TYPE_NON : COAP_TYPE_CON;
+    unsigned method = _pick_method(cfg);
+    size_t payload_len = (method == COAP_METHOD_GET) ? 0 : cfg->payload_len;
+
+    coap_builder_init(&b, buf, len, type, token, sizeof(token), method, id);
+    coap_builder_add_path(&b, path);
+    if (payload_len) {
+        coap_builder_add_ct(&b, COAP_FORMAT_OCTET);
+    }
+    return coap_builder_finish(&b, _payload, payload_len);
+}
+
+static unsigned _handle_reply(uint8_t *buf, size_t len, uint64_t now)
+{
+    coap_pkt_t pkt;
+    if ((coap_parse(&pkt, buf, len) < 0) || (coap_get_token_len(&pkt) != 4)) {
+        return 0;
+    }
+
+    uint32_t seq = ((uint32_t)pkt.token[0] << 24) | (pkt.token[1] << 16) |
+                   (pkt.token[2] << 8) | pkt.token[3];
+    _inflight_t *req = &_inflight[seq % INFLIGHT_MAX];
+    if (!req->pending || (req->seq != seq)) {
+        /* duplicate or timed out */
+        return 0;
+    }
+
+    req->pending = 0;
+    /* latency is measured from the intended send time, so a stalled server
+     * cannot hide queueing delay from the results */
+    _hist_add(&_hist, now - req->scheduled);
+    return 1;
+}
+
+static int _parse_mix(_config_t *cfg, char *arg)
+{
+    if (sscanf(arg, "%u:%u:%u", &cfg->mix[0], &cfg->mix[1], &cfg->mix[2]) != 3) {
+        return -EINVAL;
+    }
+    return (cfg->mix[0] + cfg->mix[1] + cfg->mix[2]) ? 0 : -EINVAL;
+}
+
+static void _usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [options] <url>\n"
+            "  -c <n>       concurrency (sockets), default 16\n"
+            "  -r <n>       request rate (requests/s), default 10000\n"
+            "  -d <s>       duration (seconds), default 10\n"
+            "  -m <g:p:p>   GET:PUT:POST weights, default 1:0:0\n"
+            "  -n <pct>     percentage of NON requests, default 0\n"
+            "  -s <bytes>   PUT/POST payload size, default 64\n"
+            "  -t <ms>      reply timeout, default 1000\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    _config_t cfg = {
+        .concurrency = 16, .rate = 10000, .duration = 10, .timeout_ms = 1000,
+        .non_pct = 0, .payload_len = 64, .mix = { 1, 0, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:d:m:n:s:t:")) != -1) {
+        switch (opt) {
+            case 'c': cfg.concurrency = atoi(optarg); break;
+            case 'r': cfg.rate = atoi(optarg); break;
+            case 'd': cfg.duration = atoi(optarg); break;
+            case 'n': cfg.non_pct = atoi(optarg); break;
+            case 's': cfg.payload_len = atoi(optarg); break;
+            case 't': cfg.timeout_ms = atoi(optarg); break;
+            case 'm':
+                if (_parse_mix(&cfg, optarg)) {
+                    _usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((optind >= argc) || !cfg.concurrency || (cfg.concurrency > MAX_SOCKS) ||
+            !cfg.rate || (cfg.payload_len > sizeof(_payload))) {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    char *url = argv[optind];
+    char hostport[SOCK_HOSTPORT_MAXLEN] = {0};
+    char urlpath[SOCK_URLPATH_MAXLEN] = {0};
+    sock_udp_ep_t remote;
+
+    if (strncmp(url, "coap://", 7) || sock_urlsplit(url, hostport, urlpath) ||
+            sock_str2ep(&remote, hostport)) {
+        fprintf(stderr, "invalid url \"%s\"\n", url);
+        return 1;
+    }
+    if (!remote.port) {
+        remote.port = COAP_PORT;
+    }
+
+    sock_udp_t *socks = calloc(cfg.concurrency, sizeof(sock_udp_t));
+    uint16_t *ids = calloc(cfg.concurrency, sizeof(uint16_t));
+    if (!socks || !ids) {
+        return 1;
+    }
+    for (unsigned i = 0; i < cfg.concurrency; i++) {
+        if (sock_udp_create(&socks[i], NULL, &remote, 0) < 0) {
+            fprintf(stderr, "error creating socket\n");
+            return 1;
+        }
+    }
+
+    uint64_t interval = 1000000000ULL / cfg.rate;
+    uint64_t total = (uint64_t)cfg.rate * cfg.duration;
+    uint64_t timeout = cfg.timeout_ms * 1000000ULL;
+    uint64_t sent = 0, received = 0, late = 0;
+    uint8_t buf[1280];
+
+    uint64_t start = _now();
+    uint64_t last_send = start;
+
+    while (1) {
+        uint64_t now = _now();
+
+        /* open loop: send everything that is due, regardless of replies */
+        while ((sent < total) && (start + sent * interval <= now)) {
+            _inflight_t *req = &_inflight[sent % INFLIGHT_MAX];
+            if (req->pending) {
+                /* ring wrapped before the old request completed */
+                late++;
+            }
+            req->seq = sent;
+            req->pending = 1;
+            req->scheduled = start + sent * interval;
+
+            unsigned s = sent % cfg.concurrency;
+            ssize_t len = _build_req(&cfg, buf, sizeof(buf), urlpath, sent, ids[s]++);
+            if ((len < 0) || (sock_udp_send(&socks[s], buf, len, NULL) < 0)) {
+                fprintf(stderr, "error sending request\n");
+                return 1;
+            }
+            sent++;
+            last_send = now;
+        }
+
+        if ((sent == total) && ((received + late == sent) || (now > last_send + timeout))) {
+            break;
+        }
+
+        uint64_t wait = (sent < total) ? (start + sent * interval - now) : timeout;
+        struct timeval tv = { .tv_sec = wait / 1000000000ULL,
+                              .tv_usec = (wait % 1000000000ULL) / 1000 };
+        fd_set fds;
+        int maxfd = 0;
+        FD_ZERO(&fds);
+        for (unsigned i = 0; i < cfg.concurrency; i++) {
+            FD_SET(socks[i].fd, &fds);
+            if (socks[i].fd > maxfd) {
+                maxfd = socks[i].fd;
+            }
+        }
+
+        if (select(maxfd + 1, &fds, NULL, NULL, &tv) <= 0) {
+            continue;
+        }
+
+        now = _now();
+        for (unsigned i = 0; i < cfg.concurrency; i++) {
+            if (!FD_ISSET(socks[i].fd, &fds)) {
+                continue;
+            }
+            ssize_t res;
+            while ((res = recv(socks[i].fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+                received += _handle_reply(buf, res, now);
+            }
+        }
+    }
+
+    double elapsed = (_now() - start) / 1e9;
+    for (unsigned i = 0; i < cfg.concurrency; i++) {
+        sock_udp_close(&socks[i]);
+    }
+
+    printf("requests: %llu sent, %llu replies, %llu lost\n",
+            (unsigned long long)sent, (unsigned long long)received,
+            (unsigned long long)(sent - received));
+    printf("throughput: %.1f replies/s (target %u req/s, %u sockets)\n",
+            received / elapsed, cfg.rate, cfg.concurrency);
+
+    if (_hist.total) {
+        printf("latency (us): mean %.1f p50 %.1f p90 %.1f p99 %.1f p999 %.1f max %.1f\n",
+                (double)_hist.sum / _hist.total / 1000.0,
+                _hist_percentile(&_hist, 50) / 1000.0,
+                _hist_percentile(&_hist, 90) / 1000.0,
+                _hist_percentile(&_hist, 99) / 1000.0,
+                _hist_percentile(&_hist, 99.9) / 1000.0,
+                _hist.max / 1000.0);
+    }
+
+    return 0;
+}
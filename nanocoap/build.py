@@ -1,5 +1,13 @@
 default.CFLAGS += "-Wall"
+default.defines += "NANOCOAP_STATS=1"
 
-common_srcs = [ "nanocoap.c", "handler.c", "../src/posix/posix.c", "../src/util.c" ]
-Main("nanocoap/nanocoap_server", [ "server.c" ] + common_srcs)
-Main("nanocoap/nanocoap_client", [ "client.c", "nanocoap_sock.c" ] + common_srcs)
+common_srcs = [ "nanocoap.c", "nanocoap_stats.c", "handler.c", "../src/posix/posix.c", "../src/pktbuf.c", "../src/util.c" ]
+Main("nanocoap/nanocoap_server", [ "server.c", "nanocoap_sock.c", "nanocoap_workers.c" ] + common_srcs)
+Main("nanocoap/nanocoap_tcp_server", [ "tcp_server.c", "nanocoap_tcp.c" ] + common_srcs)
+Main("nanocoap/nanocoap_client", [ "client.c", "nanocoap_sock.c", "nanocoap_tcp.c" ] + common_srcs)
+Main("nanocoap/nanocoap_rd_server", [ "rd_server.c", "nanocoap_rd.c", "nanocoap_sock.c", "nanocoap.c", "nanocoap_stats.c", "../src/posix/posix.c", "../src/pktbuf.c", "../src/util.c" ])
+Main("nanocoap/nanocoap_proxy_server", [ "proxy_server.c", "nanocoap_proxy.c", "nanocoap_session.c" ] + common_srcs)
+Main("nanocoap/nanocoap_http_proxy", [ "http_proxy.c", "nanocoap_http.c", "nanocoap_session.c", "nanocoap_tcp.c" ] + common_srcs)
+Main("nanocoap/nanocoap_bench", [ "bench.c" ] + common_srcs)
+Main("nanocoap/nanocoap_microbench", [ "microbench.c", "nanocoap.c", "nanocoap_stats.c" ])
+Main("nanocoap/nanocoap_rd_bench", [ "rd_bench.c", "nanocoap_rd.c", "nanocoap.c", "nanocoap_stats.c" ])
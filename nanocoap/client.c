@@ -11,6 +11,36 @@
 
 #include "nanocoap.h"
 #include "nanocoap_sock.h"
+#include "nanocoap_tcp.h"
+
+static int _is_multicast(const sock_udp_ep_t *ep)
+{
+    if (ep->family == AF_INET) {
+        return (ep->addr.ipv4[0] & 0xf0) == 0xe0;
+    }
+    return ep->addr.ipv6[0] == 0xff;
+}
+
+static int _multicast(sock_udp_ep_t *group, const char *path)
+{
+    static nanocoap_multicast_resp_t resps[256];
+    static uint8_t buf[16384];
+
+    ssize_t res = nanocoap_multicast_get(group, path, resps, 256, buf, sizeof(buf));
+    if (res < 0) {
+        fprintf(stderr, "error %zi\n", res);
+        return 1;
+    }
+
+    for (ssize_t i = 0; i < res; i++) {
+        char addr_str[INET6_ADDRSTRLEN + 8];
+        uint16_t port;
+        sock_udp_fmt_endpoint(&resps[i].remote, addr_str, &port);
+        printf("[%s]:%u %u %.*s\n", addr_str, port, resps[i].code,
+                (int)resps[i].payload_len, resps[i].payload);
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -27,7 +57,11 @@ int main(int argc, char *argv[])
     char hostport[SOCK_HOSTPORT_MAXLEN] = {0};
     char urlpath[SOCK_URLPATH_MAXLEN] = {0};
 
-    if (strncmp(url, "coap://", 7)) {
+    int tcp = 0;
+    if (strncmp(url, "coap+tcp://", 11) == 0) {
+        tcp = 1;
+    }
+    else if (strncmp(url, "coap://", 7)) {
         return 1;
     }
 
@@ -41,7 +75,16 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    res = nanocoap_get(&remote, urlpath, buf, sizeof(buf));
+    if (_is_multicast(&remote)) {
+        return _multicast(&remote, urlpath);
+    }
+
+    if (tcp) {
+        res = nanocoap_tcp_get(&remote, urlpath, buf, sizeof(buf));
+    }
+    else {
+        res = nanocoap_get(&remote, urlpath, buf, sizeof(buf));
+    }
     if (res <= 0) {
         fprintf(stderr, "error %zi\n", res);
         return 1;
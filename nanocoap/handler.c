@@ -2,6 +2,9 @@
 #include <string.h>
 
 #include "nanocoap.h"
+#if NANOCOAP_STATS
+#include "nanocoap_stats.h"
+#endif
 
 ssize_t _test_handler(coap_pkt_t* pkt, uint8_t *buf, size_t len)
 {
@@ -17,7 +20,10 @@ ssize_t _test_handler(coap_pkt_t* pkt, uint8_t *buf, size_t len)
 
 const coap_resource_t coap_resources[] = {
     COAP_WELL_KNOWN_CORE_DEFAULT_HANDLER,
-    { "/test", COAP_GET, _test_handler },
+#if NANOCOAP_STATS
+    COAP_WELL_KNOWN_STATS_HANDLER,
+#endif
+    { "/test", COAP_GET, _test_handler, ";rt=\"test\";ct=0", 0 },
 };
 
 const unsigned coap_resources_numof = sizeof(coap_resources) / sizeof(coap_resources[0]);
@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "nanocoap_http.h"
+#include "net/sock/udp.h"
+
+/* any UDP payload, so large responses are not cut off */
+#define COAP_INBUF_SIZE (65536U)
+
+int main(int argc, char *argv[])
+{
+    static uint8_t buf[COAP_INBUF_SIZE];
+
+    sock_udp_ep_t local = { .port=NANOCOAP_HTTP_PORT };
+    if (argc > 1) {
+        local.port = atoi(argv[1]);
+    }
+
+    nanocoap_http_proxy(&local, buf, sizeof(buf));
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""Loopback test of nanocoap_http_proxy against a scripted CoAP server.
+
+usage: http_test.py [path to nanocoap_http_proxy]
+
+The CoAP server answers GETs with piggybacked responses, paths select the
+payload:
+
+    /hello      "hello", text/plain
+    /big        4000 bytes, more than the proxy sends in one piece with the head
+    /blocks     100 bytes in 32 byte Block2 blocks
+"""
+
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+OPT_URI_PATH, OPT_CONTENT_FORMAT, OPT_BLOCK2 = 11, 12, 23
+
+BIG = bytes(i % 251 for i in range(4000))
+BLOCKS = bytes(range(100))
+
+
+def parse_options(msg, pos):
+    opts, num = [], 0
+    while pos < len(msg) and msg[pos] != 0xff:
+        delta, length = msg[pos] >> 4, msg[pos] & 0xf
+        pos += 1
+        ext = []
+        for nibble in (delta, length):
+            if nibble == 13:
+                ext.append(msg[pos] + 13)
+                pos += 1
+            elif nibble == 14:
+                ext.append(struct.unpack('!H', msg[pos:pos + 2])[0] + 269)
+                pos += 2
+            else:
+                ext.append(nibble)
+        num += ext[0]
+        opts.append((num, msg[pos:pos + ext[1]]))
+        pos += ext[1]
+    return opts
+
+
+def encode_options(opts):
+    out, last = b'', 0
+    for num, val in opts:
+        delta = num - last
+        last = num
+        if delta < 13:
+            out += bytes([(delta << 4) | len(val)]) + val
+        else:
+            out += bytes([(13 << 4) | len(val), delta - 13]) + val
+    return out
+
+
+def uint(val):
+    return val.to_bytes((val.bit_length() + 7) // 8, 'big')
+
+
+class Server:
+    def __init__(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(('127.0.0.1', 0))
+        self.port = self.sock.getsockname()[1]
+        threading.Thread(target=self._serve, daemon=True).start()
+
+    def _serve(self):
+        while True:
+            msg, remote = self.sock.recvfrom(1500)
+            tkl = msg[0] & 0xf
+            opts = parse_options(msg, 4 + tkl)
+            path = '/' + '/'.join(v.decode() for n, v in opts if n == OPT_URI_PATH)
+            block2 = [int.from_bytes(v, 'big') for n, v in opts if n == OPT_BLOCK2]
+
+            resp_opts, payload = [], b''
+            if path == '/hello':
+                resp_opts.append((OPT_CONTENT_FORMAT, b''))
+                payload = b'hello'
+            elif path == '/big':
+                resp_opts.append((OPT_CONTENT_FORMAT, uint(42)))
+                payload = BIG
+            elif path == '/blocks':
+                num = (block2[0] >> 4) if block2 else 0
+                payload = BLOCKS[num * 32:(num + 1) * 32]
+                more = (num + 1) * 32 < len(BLOCKS)
+                resp_opts.append((OPT_BLOCK2, uint((num << 4) | (more << 3) | 1)))
+
+            code = 0x45 if payload else 0x84
+            hdr = bytes([0x60 | tkl, code]) + msg[2:4] + msg[4:4 + tkl]
+            self.sock.sendto(hdr + encode_options(resp_opts) +
+                             (b'\xff' + payload if payload else b''), remote)
+
+
+def read_response(f):
+    """reads one response from file @p f, returns (status, headers, body)"""
+    status = int(f.readline().split()[1])
+    headers = {}
+    while True:
+        line = f.readline().decode().rstrip('\r\n')
+        if not line:
+            break
+        key, value = line.split(':', 1)
+        headers[key.lower()] = value.strip()
+
+    body = b''
+    if headers.get('transfer-encoding') == 'chunked':
+        while True:
+            size = int(f.readline().strip(), 16)
+            chunk = f.read(size + 2)
+            if not size:
+                break
+            body += chunk[:-2]
+    elif 'content-length' in headers:
+        body = f.read(int(headers['content-length']))
+    else:
+        body = f.read()
+    return status, headers, body
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else 'bin/nanocoap_http_proxy'
+    server = Server()
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.bind(('127.0.0.1', 0))
+    port = s.getsockname()[1]
+    s.close()
+    proxy = subprocess.Popen([binary, str(port)])
+    failed = 0
+
+    def check(what, cond):
+        nonlocal failed
+        print('%s %s' % ('ok' if cond else 'FAIL', what))
+        failed += not cond
+
+    def connect():
+        for _ in range(20):
+            try:
+                conn = socket.create_connection(('127.0.0.1', port))
+                conn.settimeout(2)
+                return conn
+            except ConnectionRefusedError:
+                time.sleep(0.05)
+        raise ConnectionRefusedError
+
+    def get(conn, path, version='1.1'):
+        conn.sendall(b'GET /coap/127.0.0.1:%u%s HTTP/%s\r\n\r\n' %
+                     (server.port, path.encode(), version.encode()))
+
+    try:
+        conn = connect()
+        f = conn.makefile('rb')
+        get(conn, '/hello')
+        status, headers, body = read_response(f)
+        check('GET', (status == 200) and (body == b'hello') and
+              headers.get('content-type', '').startswith('text/plain'))
+
+        get(conn, '/big')
+        status, headers, body = read_response(f)
+        check('payload larger than the head buffer', (status == 200) and (body == BIG))
+
+        get(conn, '/blocks')
+        status, headers, body = read_response(f)
+        check('Block2 streamed in chunks', (status == 200) and (body == BLOCKS) and
+              (headers.get('transfer-encoding') == 'chunked'))
+
+        get(conn, '/missing')
+        status, _, _ = read_response(f)
+        check('4.04 mapped', status == 404)
+        conn.close()
+
+        # requests sent before the client closes its side are all answered
+        conn = connect()
+        f = conn.makefile('rb')
+        for path in ('/hello', '/blocks', '/hello'):
+            get(conn, path)
+        conn.shutdown(socket.SHUT_WR)
+        responses = [read_response(f) for _ in range(3)]
+        check('pipelined requests answered after half-close',
+              [(r[0], r[2]) for r in responses] ==
+              [(200, b'hello'), (200, BLOCKS), (200, b'hello')])
+        check('closed after the last response', f.read() == b'')
+        conn.close()
+    except (socket.timeout, ConnectionError, ValueError, IndexError):
+        check('response before timeout', False)
+    finally:
+        proxy.kill()
+        proxy.wait()
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "nanocoap.h"
+
+#define DEFAULT_ITERATIONS  (1000000UL)
+
+static volatile ssize_t _sink;
+
+static inline uint64_t _cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t val;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r" (val));
+    return val;
+#else
+    return 0;
+#endif
+}
+
+static uint64_t _nsecs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static ssize_t _handler(coap_pkt_t *pkt, uint8_t *buf, size_t len)
+{
+    const char payload[] = "1234";
+    return coap_reply_simple(pkt, COAP_CODE_205, buf, len, COAP_FORMAT_TEXT,
+            (uint8_t *)payload, sizeof(payload) - 1);
+}
+
+/* a large resource table: /res/00 ... /res/ff, sorted */
+#define _RES(a, b)  { "/res/" #a #b, COAP_GET | COAP_PUT, _handler, ";rt=\"bench\"", 0 },
+#define _ROW(a)     _RES(a, 0) _RES(a, 1) _RES(a, 2) _RES(a, 3) \
+                    _RES(a, 4) _RES(a, 5) _RES(a, 6) _RES(a, 7) \
+                    _RES(a, 8) _RES(a, 9) _RES(a, a) _RES(a, b) \
+                    _RES(a, c) _RES(a, d) _RES(a, e) _RES(a, f)
+
+const coap_resource_t coap_resources[] = {
+    COAP_WELL_KNOWN_CORE_DEFAULT_HANDLER,
+    { "/dev/*/temp", COAP_GET, _handler, NULL, 0 },
+    { "/fw/**", COAP_GET, _handler, NULL, 0 },
+    _ROW(0) _ROW(1) _ROW(2) _ROW(3) _ROW(4) _ROW(5) _ROW(6) _ROW(7)
+    _ROW(8) _ROW(9) _ROW(a) _ROW(b) _ROW(c) _ROW(d) _ROW(e) _ROW(f)
+    { "/test", COAP_GET, _handler, NULL, 0 },
+};
+
+const unsigned coap_resources_numof = sizeof(coap_resources) / sizeof(coap_resources[0]);
+
+typedef struct {
+    const char *name;
+    uint8_t buf[1024];
+    size_t len;
+} _req_t;
+
+static const uint8_t _token[] = { 0xde, 0xad, 0xbe, 0xef, 0x01, 0x02, 0x03, 0x04 };
+static const uint8_t _etag[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+static const char _host[] = "sensor-0042.example.org";
+static uint8_t _payload[512];
+
+static void _build(_req_t *req, const char *name, unsigned code, const char *path,
+        unsigned many_opts, size_t payload_len)
+{
+    coap_builder_t b;
+
+    req->name = name;
+    coap_builder_init(&b, req->buf, sizeof(req->buf), COAP_TYPE_CON,
+            _token, sizeof(_token), code, 0x1234);
+    coap_builder_add_path(&b, path);
+    if (many_opts) {
+        coap_builder_add_opt(&b, COAP_OPT_URI_HOST, _host, sizeof(_host) - 1);
+        coap_builder_add_opt(&b, 4 /* ETag */, _etag, sizeof(_etag));
+        coap_builder_add_uint(&b, COAP_OPT_OBSERVE, COAP_OBS_REGISTER);
+        coap_builder_add_ct(&b, COAP_FORMAT_CBOR);
+        coap_builder_add_uint(&b, 14 /* Max-Age */, 3600);
+        coap_builder_add_uint(&b, 28 /* Size2 */, 1024);
+        coap_builder_add_uint(&b, 60 /* Size1 */, payload_len);
+    }
+    if (payload_len) {
+        coap_builder_add_ct(&b, COAP_FORMAT_OCTET);
+    }
+
+    ssize_t res = coap_builder_finish(&b, _payload, payload_len);
+    if (res < 0) {
+        fprintf(stderr, "error building %s: %zi\n", name, res);
+        exit(1);
+    }
+    req->len = res;
+
+    /* the parse and handle benchmarks assume it parses */
+    coap_pkt_t pkt;
+    if (*name && (coap_parse(&pkt, req->buf, req->len) < 0)) {
+        fprintf(stderr, "error parsing %s\n", name);
+        exit(1);
+    }
+}
+
+static void _report(const char *what, const char *name, unsigned long n,
+        uint64_t nsecs, uint64_t cycles)
+{
+    double ns_op = (double)nsecs / n;
+    printf("%-10s %-24s %10.1f ns/op %10.1f cycles/op %12.0f pkts/s\n",
+            what, name, ns_op, (double)cycles / n, 1e9 / ns_op);
+}
+
+#define BENCH(what, name, n, expr) \
+    do { \
+        uint64_t _ns = _nsecs(); \
+        uint64_t _cyc = _cycles(); \
+        for (unsigned long _i = 0; _i < (n); _i++) { \
+            _sink = (expr); \
+        } \
+        _cyc = _cycles() - _cyc; \
+        _ns = _nsecs() - _ns; \
+        _report(what, name, n, _ns, _cyc); \
+    } while (0)
+
+static ssize_t _parse(_req_t *req)
+{
+    coap_pkt_t pkt;
+    return coap_parse(&pkt, req->buf, req->len);
+}
+
+static ssize_t _handle(_req_t *req)
+{
+    coap_pkt_t pkt;
+    uint8_t resp[256];
+
+    coap_parse(&pkt, req->buf, req->len);
+    return coap_handle_req(&pkt, resp, sizeof(resp));
+}
+
+static ssize_t _put_options(void)
+{
+    uint8_t buf[128];
+    uint8_t *pos = buf;
+
+    pos += coap_put_option(pos, 0, COAP_OPT_URI_HOST, (uint8_t *)_host, sizeof(_host) - 1);
+    pos += coap_put_option_uint(pos, COAP_OPT_URI_HOST, COAP_OPT_OBSERVE, 0);
+    pos += coap_put_option_url(pos, COAP_OPT_OBSERVE, "/res/ab/cd");
+    pos += coap_put_option_ct(pos, COAP_OPT_URI_PATH, COAP_FORMAT_CBOR);
+    return pos - buf;
+}
+
+static ssize_t _builder(unsigned many_opts)
+{
+    static _req_t req;
+    _build(&req, "", COAP_METHOD_GET, "/res/ab/cd", many_opts, 0);
+    return req.len;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long n = DEFAULT_ITERATIONS;
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 0);
+    }
+
+    static _req_t reqs[8];
+    _build(&reqs[0], "get_short", COAP_METHOD_GET, "/test", 0, 0);
+    _build(&reqs[1], "get_many_options", COAP_METHOD_GET, "/res/80", 1, 0);
+    _build(&reqs[2], "get_long_path", COAP_METHOD_GET,
+            "/building-7/floor-3/room-12/sensors/temp", 0, 0);
+    _build(&reqs[3], "put_payload_512", COAP_METHOD_PUT, "/res/ff", 1, 512);
+    _build(&reqs[4], "get_table_first", COAP_METHOD_GET, "/res/00", 0, 0);
+    _build(&reqs[5], "get_not_found", COAP_METHOD_GET, "/zzz", 0, 0);
+    _build(&reqs[6], "get_wildcard", COAP_METHOD_GET, "/dev/sensor-0042/temp", 0, 0);
+    _build(&reqs[7], "get_wildcard_rest", COAP_METHOD_GET, "/fw/v2/image.bin", 0, 0);
+
+    printf("%u resources, %lu iterations\n", coap_resources_numof, n);
+
+    for (unsigned i = 0; i < sizeof(reqs) / sizeof(reqs[0]); i++) {
+        BENCH("parse", reqs[i].name, n, _parse(&reqs[i]));
+    }
+
+    BENCH("encode", "coap_put_option*", n, _put_options());
+    BENCH("encode", "builder_path", n, _builder(0));
+    BENCH("encode", "builder_many_options", n, _builder(1));
+
+    for (unsigned i = 0; i < sizeof(reqs) / sizeof(reqs[0]); i++) {
+        BENCH("handle", reqs[i].name, n, _handle(&reqs[i]));
+    }
+
+    return 0;
+}
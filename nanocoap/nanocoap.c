@@ -1,10 +1,16 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "nanocoap.h"
 
+#if NANOCOAP_STATS
+#include <time.h>
+#include "nanocoap_stats.h"
+#endif
+
 #if NANOCOAP_DEBUG
 #define ENABLE_DEBUG (1)
 #else
@@ -15,6 +21,15 @@
 static int _decode_value(unsigned val, uint8_t **pkt_pos_ptr, uint8_t *pkt_end);
 static uint32_t _decode_uint(uint8_t *pkt_pos, unsigned nbytes);
 
+#if NANOCOAP_STATS
+static uint64_t _nsecs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
 /* http://tools.ietf.org/html/rfc7252#section-3
  *  0                   1                   2                   3
  *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
@@ -31,6 +46,7 @@ static uint32_t _decode_uint(uint8_t *pkt_pos, unsigned nbytes);
 int coap_parse(coap_pkt_t *pkt, uint8_t *buf, size_t len)
 {
     uint8_t *urlpos = pkt->url;
+    uint8_t *qspos = pkt->qs;
     coap_hdr_t *hdr = (coap_hdr_t *)buf;
     pkt->hdr = hdr;
 
@@ -38,13 +54,31 @@ int coap_parse(coap_pkt_t *pkt, uint8_t *buf, size_t len)
     uint8_t *pkt_end = buf + len;
 
     memset(pkt->url, '\0', NANOCOAP_URL_MAX);
+    pkt->qs[0] = '\0';
+    pkt->params_numof = 0;
+    pkt->arena = NULL;
+    pkt->pktbuf = NULL;
+    pkt->payload = pkt_end;
     pkt->payload_len = 0;
+    pkt->content_type = COAP_FORMAT_NONE;
+    pkt->accept = COAP_FORMAT_NONE;
     pkt->observe_value = UINT32_MAX;
+    pkt->remote = NULL;
+    pkt->proxy = 0;
+
+    if ((len < sizeof(coap_hdr_t)) || (coap_get_token_len(pkt) > 8)) {
+        DEBUG("nanocoap: bad header\n");
+        return -EBADMSG;
+    }
 
     /* token value (tkl bytes) */
     if (coap_get_token_len(pkt)) {
         pkt->token = pkt_pos;
         pkt_pos += coap_get_token_len(pkt);
+        if (pkt_pos > pkt_end) {
+            DEBUG("nanocoap: token exceeds packet\n");
+            return -EBADMSG;
+        }
     } else {
         pkt->token = NULL;
     }
@@ -70,6 +104,10 @@ int coap_parse(coap_pkt_t *pkt, uint8_t *buf, size_t len)
                 DEBUG("bad op len\n");
                 return -EBADMSG;
             }
+            if (option_len > (pkt_end - pkt_pos)) {
+                DEBUG("bad op len\n");
+                return -EBADMSG;
+            }
             option_nr += option_delta;
             DEBUG("option nr=%i len=%i\n", option_nr, option_len);
 
@@ -77,11 +115,37 @@ int coap_parse(coap_pkt_t *pkt, uint8_t *buf, size_t len)
                 case COAP_OPT_URI_HOST:
                     DEBUG("nanocoap: ignoring Uri-Host option!\n");
                     break;
+                case COAP_OPT_URI_PORT:
+                    /* only used for forwarding, see coap_opt_get_uint() */
+                    break;
+                case COAP_OPT_PROXY_URI:
+                case COAP_OPT_PROXY_SCHEME:
+                    pkt->proxy = 1;
+                    break;
                 case COAP_OPT_URI_PATH:
+                    if ((urlpos - pkt->url) + option_len + 1 >= NANOCOAP_URL_MAX) {
+                        DEBUG("nanocoap: url too long\n");
+                        return -EBADMSG;
+                    }
                     *urlpos++ = '/';
                     memcpy(urlpos, pkt_pos, option_len);
                     urlpos += option_len;
                     break;
+                case COAP_OPT_URI_QUERY:
+                    if ((qspos - pkt->qs) + option_len + 1 >= NANOCOAP_QS_MAX) {
+                        DEBUG("nanocoap: query string too long\n");
+                        return -EBADMSG;
+                    }
+                    if (qspos != pkt->qs) {
+                        *qspos++ = '&';
+                    }
+                    memcpy(qspos, pkt_pos, option_len);
+                    qspos += option_len;
+                    *qspos = '\0';
+                    break;
+                case COAP_OPT_BLOCK2:
+                    /* read on demand using coap_get_block2() */
+                    break;
                 case COAP_OPT_CONTENT_FORMAT:
                     if (option_len == 0) {
                         pkt->content_type = 0;
@@ -92,6 +156,13 @@ int coap_parse(coap_pkt_t *pkt, uint8_t *buf, size_t len)
                         pkt->content_type = ntohs(pkt->content_type);
                     }
                     break;
+                case COAP_OPT_ACCEPT:
+                    if (option_len <= 2) {
+                        pkt->accept = _decode_uint(pkt_pos, option_len);
+                    } else {
+                        return -EBADMSG;
+                    }
+                    break;
                 case COAP_OPT_OBSERVE:
                     if (option_len < 4) {
                         pkt->observe_value = _decode_uint(pkt_pos, option_len);
@@ -120,57 +191,368 @@ int coap_parse(coap_pkt_t *pkt, uint8_t *buf, size_t len)
     return 0;
 }
 
-ssize_t coap_handle_req(coap_pkt_t *pkt, uint8_t *resp_buf, unsigned resp_buf_len)
+ssize_t coap_opt_get_opaque(coap_pkt_t *pkt, uint16_t onum, uint8_t **value)
 {
-    if (coap_get_code_class(pkt) != COAP_REQ) {
-        DEBUG("coap_handle_req(): not a request.\n");
+    uint8_t *pkt_pos = pkt->hdr->data + coap_get_token_len(pkt);
+    uint8_t *pkt_end = pkt->payload;
+    unsigned option_nr = 0;
+
+    while (pkt_pos < pkt_end) {
+        uint8_t option_byte = *pkt_pos++;
+        if (option_byte == 0xff) {
+            break;
+        }
+        int option_delta = _decode_value(option_byte >> 4, &pkt_pos, pkt_end);
+        int option_len = _decode_value(option_byte & 0xf, &pkt_pos, pkt_end);
+        if ((option_delta < 0) || (option_len < 0)) {
+            return -EBADMSG;
+        }
+        option_nr += option_delta;
+        if (option_nr == onum) {
+            *value = pkt_pos;
+            return option_len;
+        }
+        else if (option_nr > onum) {
+            break;
+        }
+        pkt_pos += option_len;
+    }
+
+    return -ENOENT;
+}
+
+int coap_opt_get_uint(coap_pkt_t *pkt, uint16_t onum, uint32_t *value)
+{
+    uint8_t *val;
+    ssize_t len = coap_opt_get_opaque(pkt, onum, &val);
+    if (len < 0) {
+        return len;
+    }
+    if (len > 4) {
         return -EBADMSG;
     }
 
-    if (pkt->hdr->code == 0) {
-        return coap_build_reply(pkt, COAP_CODE_EMPTY, resp_buf, resp_buf_len, 0);
+    *value = _decode_uint(val, len);
+    return 0;
+}
+
+int coap_get_block2(coap_pkt_t *pkt, uint32_t *blknum, unsigned *szx)
+{
+    uint32_t val;
+    int res = coap_opt_get_uint(pkt, COAP_OPT_BLOCK2, &val);
+    if (res) {
+        return res;
     }
 
-    unsigned method_flag = coap_method2flag(coap_get_code_detail(pkt));
+    *blknum = val >> 4;
+    *szx = val & 0x7;
+    if (*szx == 7) {
+        /* reserved (BERT over reliable transports, not supported) */
+        *szx = 6;
+    }
+    return 0;
+}
+
+void coap_block_slicer_init(coap_block_slicer_t *slicer, uint32_t blknum, unsigned szx)
+{
+    size_t blksize = 16U << szx;
+    slicer->start = blknum * blksize;
+    slicer->end = slicer->start + blksize;
+    slicer->cur = 0;
+}
+
+size_t coap_blockwise_put_bytes(coap_block_slicer_t *slicer, uint8_t *bufpos,
+        const void *data, size_t len)
+{
+    size_t from = slicer->cur;
+    size_t to = slicer->cur + len;
+    slicer->cur = to;
+
+    if ((to <= slicer->start) || (from >= slicer->end)) {
+        return 0;
+    }
+
+    size_t skip = (from < slicer->start) ? slicer->start - from : 0;
+    if (to > slicer->end) {
+        to = slicer->end;
+    }
+
+    memcpy(bufpos, (const uint8_t *)data + skip, to - from - skip);
+    return to - from - skip;
+}
+
+/* resources by path, exact ones for binary search and the ones with
+ * wildcards (or COAP_MATCH_SUBTREE) in the order they are tried */
+static struct {
+    unsigned *exact;
+    unsigned exact_numof;
+    unsigned *patterns;
+    unsigned patterns_numof;
+} _dispatch;
+
+enum {
+    SEG_LITERAL,
+    SEG_ANY,            /* "*" */
+    SEG_END,            /* before SEG_REST, as "**" may match nothing */
+    SEG_REST,           /* "**", or the end of a COAP_MATCH_SUBTREE path */
+};
+
+/* classifies the path segment at @p pos, which points behind its '/' */
+static int _seg_type(const char *pos, size_t len)
+{
+    if ((len == 1) && (pos[0] == '*')) {
+        return SEG_ANY;
+    }
+    if ((len == 2) && (pos[0] == '*') && (pos[1] == '*') && !pos[2]) {
+        return SEG_REST;
+    }
+    return SEG_LITERAL;
+}
+
+static int _is_pattern(const coap_resource_t *r)
+{
+    if (r->flags & COAP_MATCH_SUBTREE) {
+        return 1;
+    }
+    for (const char *pos = strchr(r->path, '/'); pos; pos = strchr(pos + 1, '/')) {
+        if (_seg_type(pos + 1, strcspn(pos + 1, "/")) != SEG_LITERAL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int _exact_cmp(const void *a, const void *b)
+{
+    unsigned i = *(const unsigned *)a, j = *(const unsigned *)b;
+    int res = strcmp(coap_resources[i].path, coap_resources[j].path);
+    return res ? res : (int)i - (int)j;
+}
+
+/* more specific patterns first */
+static int _pattern_cmp(const void *a, const void *b)
+{
+    unsigned i = *(const unsigned *)a, j = *(const unsigned *)b;
+    const char *p = coap_resources[i].path, *q = coap_resources[j].path;
+
+    while (1) {
+        size_t p_len = *p ? strcspn(p + 1, "/") : 0;
+        size_t q_len = *q ? strcspn(q + 1, "/") : 0;
+        int p_type = *p ? _seg_type(p + 1, p_len) :
+                     (coap_resources[i].flags & COAP_MATCH_SUBTREE) ? SEG_REST : SEG_END;
+        int q_type = *q ? _seg_type(q + 1, q_len) :
+                     (coap_resources[j].flags & COAP_MATCH_SUBTREE) ? SEG_REST : SEG_END;
+
+        if (p_type != q_type) {
+            return p_type - q_type;
+        }
+        if ((p_type == SEG_REST) || (p_type == SEG_END)) {
+            return (int)i - (int)j;
+        }
+        p += 1 + p_len;
+        q += 1 + q_len;
+    }
+}
+
+static int _dispatch_init(void)
+{
+    if (_dispatch.exact) {
+        return 0;
+    }
 
+    unsigned *exact = malloc((coap_resources_numof + 1) * sizeof(unsigned));
+    unsigned *patterns = malloc((coap_resources_numof + 1) * sizeof(unsigned));
+    if (!exact || !patterns) {
+        free(exact);
+        free(patterns);
+        return -ENOMEM;
+    }
+
+    unsigned exact_numof = 0, patterns_numof = 0;
     for (unsigned i = 0; i < coap_resources_numof; i++) {
-        if (! (coap_resources[i].methods & method_flag)) {
-            continue;
+        const coap_resource_t *r = &coap_resources[i];
+        int pattern = _is_pattern(r);
+        if (pattern) {
+            patterns[patterns_numof++] = i;
         }
+        /* a subtree includes its root */
+        if (!pattern || (r->flags & COAP_MATCH_SUBTREE)) {
+            exact[exact_numof++] = i;
+        }
+    }
+    qsort(exact, exact_numof, sizeof(unsigned), _exact_cmp);
+    qsort(patterns, patterns_numof, sizeof(unsigned), _pattern_cmp);
 
-        int res = strcmp((char*)pkt->url, coap_resources[i].path);
-        if (res > 0) {
-            continue;
+    _dispatch.exact_numof = exact_numof;
+    _dispatch.patterns = patterns;
+    _dispatch.patterns_numof = patterns_numof;
+    _dispatch.exact = exact;
+
+    return 0;
+}
+
+static unsigned _find_exact(const char *url, unsigned method_flag)
+{
+    unsigned lo = 0, hi = _dispatch.exact_numof;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (strcmp(coap_resources[_dispatch.exact[mid]].path, url) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
         }
-        else if (res < 0) {
+    }
+
+    for (; lo < _dispatch.exact_numof; lo++) {
+        const coap_resource_t *r = &coap_resources[_dispatch.exact[lo]];
+        if (strcmp(r->path, url)) {
             break;
         }
-        else {
-            return coap_resources[i].handler(pkt, resp_buf, resp_buf_len);
+        if (r->methods & method_flag) {
+            return _dispatch.exact[lo];
+        }
+    }
+
+    return coap_resources_numof;
+}
+
+static void _capture(coap_pkt_t *pkt, const char *str, size_t len)
+{
+    if (pkt->params_numof < NANOCOAP_PARAMS_MAX) {
+        pkt->params[pkt->params_numof].str = str;
+        pkt->params[pkt->params_numof++].len = len;
+    }
+}
+
+/* matches @p url against the path of @p r, capturing wildcard segments */
+static int _match(coap_pkt_t *pkt, const coap_resource_t *r, const char *url)
+{
+    const char *pattern = r->path;
+
+    pkt->params_numof = 0;
+    while (*pattern) {
+        if ((*pattern != '/') || (*url != '/')) {
+            /* a last "**" also matches no segment at all */
+            if (!*url && !strcmp(pattern, "/**")) {
+                _capture(pkt, url, 0);
+                return 1;
+            }
+            return 0;
+        }
+        pattern++;
+        url++;
+
+        size_t p_len = strcspn(pattern, "/");
+        size_t u_len = strcspn(url, "/");
+        switch (_seg_type(pattern, p_len)) {
+            case SEG_REST:
+                _capture(pkt, url, strlen(url));
+                return 1;
+            case SEG_ANY:
+                if (!u_len) {
+                    return 0;
+                }
+                _capture(pkt, url, u_len);
+                break;
+            default:
+                if ((p_len != u_len) || memcmp(pattern, url, p_len)) {
+                    return 0;
+                }
+        }
+        pattern += p_len;
+        url += u_len;
+    }
+
+    if (r->flags & COAP_MATCH_SUBTREE) {
+        return (*url == '/');
+    }
+    return !*url;
+}
+
+ssize_t coap_handle_req(coap_pkt_t *pkt, uint8_t *resp_buf, unsigned resp_buf_len)
+{
+    if (coap_get_code_class(pkt) != COAP_REQ) {
+        DEBUG("coap_handle_req(): not a request.\n");
+        return -EBADMSG;
+    }
+
+    if (pkt->hdr->code == 0) {
+        return coap_build_reply(pkt, COAP_CODE_EMPTY, resp_buf, resp_buf_len, 0);
+    }
+
+    if (pkt->proxy) {
+        /* see nanocoap_proxy_server() */
+        return coap_build_reply(pkt, COAP_CODE_PROXYING_NOT_SUPPORTED,
+                resp_buf, resp_buf_len, 0);
+    }
+
+    if (_dispatch_init()) {
+        return coap_build_reply(pkt, COAP_CODE_INTERNAL_SERVER_ERROR, resp_buf, resp_buf_len, 0);
+    }
+
+    /* methods without a flag cannot match any resource */
+    unsigned method = coap_get_code_detail(pkt);
+    if (method > COAP_METHOD_DELETE) {
+#if NANOCOAP_STATS
+        coap_stats_request(coap_resources_numof, COAP_CODE_METHOD_NOT_ALLOWED, 0);
+#endif
+        return coap_build_reply(pkt, COAP_CODE_METHOD_NOT_ALLOWED, resp_buf, resp_buf_len, 0);
+    }
+
+    unsigned method_flag = coap_method2flag(method);
+    unsigned match = _find_exact((char *)pkt->url, method_flag);
+
+    for (unsigned i = 0; (match == coap_resources_numof) && (i < _dispatch.patterns_numof); i++) {
+        const coap_resource_t *r = &coap_resources[_dispatch.patterns[i]];
+        if ((r->methods & method_flag) && _match(pkt, r, (char *)pkt->url)) {
+            match = _dispatch.patterns[i];
         }
     }
+    if (match == coap_resources_numof) {
+        pkt->params_numof = 0;
+    }
+
+    if (match < coap_resources_numof) {
+#if NANOCOAP_STATS
+        uint64_t start = _nsecs();
+        ssize_t reply_len = coap_resources[match].handler(pkt, resp_buf, resp_buf_len);
+        coap_stats_request(match, (reply_len > 0) ? resp_buf[1] : COAP_CODE_EMPTY,
+                _nsecs() - start);
+        return reply_len;
+#else
+        return coap_resources[match].handler(pkt, resp_buf, resp_buf_len);
+#endif
+    }
 
+#if NANOCOAP_STATS
+    coap_stats_request(coap_resources_numof, COAP_CODE_404, 0);
+#endif
     return coap_build_reply(pkt, COAP_CODE_404, resp_buf, resp_buf_len, 0);
 }
 
+int coap_arena_init(coap_arena_t *arena)
+{
+    arena->buf = malloc(NANOCOAP_ARENA_SIZE);
+    arena->size = arena->buf ? NANOCOAP_ARENA_SIZE : 0;
+    arena->used = 0;
+    return arena->buf ? 0 : -ENOMEM;
+}
+
 ssize_t coap_reply_simple(coap_pkt_t *pkt,
         unsigned code,
         uint8_t *buf, size_t len,
         unsigned ct,
         const uint8_t *payload, uint8_t payload_len)
 {
-    uint8_t *payload_start = buf + coap_get_total_hdr_len(pkt);
-    uint8_t *bufpos = payload_start;
+    coap_builder_t b;
 
+    coap_builder_init_reply(&b, buf, len, pkt, code);
     if (payload_len) {
-        bufpos += coap_put_option_ct(bufpos, 0, ct);
-        *bufpos++ = 0xff;
-
-        memcpy(bufpos, payload, payload_len);
-        bufpos += payload_len;
+        coap_builder_add_uint(&b, COAP_OPT_CONTENT_FORMAT, ct);
     }
 
-    return coap_build_reply(pkt, code, buf, len, bufpos - payload_start);
+    return coap_builder_finish(&b, payload, payload_len);
 }
 
 ssize_t coap_build_reply(coap_pkt_t *pkt, unsigned code,
@@ -269,25 +651,46 @@ static uint32_t _decode_uint(uint8_t *pkt_pos, unsigned nbytes)
     return ntohl(res);
 }
 
-static unsigned _put_odelta(uint8_t *buf, unsigned lastonum, unsigned onum, unsigned olen)
+/* number of bytes needed to encode an option delta or length value */
+static unsigned _ext_len(unsigned val)
 {
-    unsigned delta = onum - lastonum;
-    if (delta < 13) {
-        *buf = (uint8_t) ((delta << 4) | olen);
+    return (val < 13) ? 0 : (val < 269) ? 1 : 2;
+}
+
+static unsigned _put_ext(uint8_t *buf, unsigned val)
+{
+    if (val < 13) {
+        return 0;
+    }
+    else if (val < 269) {
+        *buf = val - 13;
         return 1;
-    } else if (delta == 13) {
-        *buf++ = (uint8_t) ((13 << 4) | olen);
-        *buf = delta - 13;
+    }
+    else {
+        val -= 269;
+        buf[0] = val >> 8;
+        buf[1] = val & 0xff;
         return 2;
-    } else {
-        *buf++ = (uint8_t) ((14 << 4) | olen);
-        uint16_t tmp = delta - 269;
-        tmp = htons(tmp);
-        memcpy(buf, &tmp, 2);
-        return 3;
     }
 }
 
+static unsigned _nibble(unsigned val)
+{
+    return (val < 13) ? val : (val < 269) ? 13 : 14;
+}
+
+static unsigned _put_odelta(uint8_t *buf, unsigned lastonum, unsigned onum, unsigned olen)
+{
+    unsigned delta = onum - lastonum;
+    unsigned n = 1;
+
+    *buf = (uint8_t) ((_nibble(delta) << 4) | _nibble(olen));
+    n += _put_ext(buf + n, delta);
+    n += _put_ext(buf + n, olen);
+
+    return n;
+}
+
 size_t coap_put_option(uint8_t *buf, uint16_t lastonum, uint16_t onum, uint8_t *odata, size_t olen)
 {
     assert(lastonum <= onum);
@@ -301,16 +704,27 @@ size_t coap_put_option(uint8_t *buf, uint16_t lastonum, uint16_t onum, uint8_t *
 
 size_t coap_put_option_ct(uint8_t *buf, uint16_t lastonum, uint16_t content_type)
 {
-    if (content_type == 0) {
-        return coap_put_option(buf, lastonum, COAP_OPT_CONTENT_FORMAT, NULL, 0);
-    }
-    else if (content_type <= 255) {
-        uint8_t tmp = content_type;
-        return coap_put_option(buf, lastonum, COAP_OPT_CONTENT_FORMAT, &tmp, sizeof(tmp));
-    }
-    else {
-        return coap_put_option(buf, lastonum, COAP_OPT_CONTENT_FORMAT, (uint8_t*)&content_type, sizeof(content_type));
+    return coap_put_option_uint(buf, lastonum, COAP_OPT_CONTENT_FORMAT, content_type);
+}
+
+/* uint options are sent without leading zero bytes */
+static unsigned _encode_uint(uint8_t *out, uint32_t value)
+{
+    unsigned len = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (len || (value >> shift)) {
+            out[len++] = value >> shift;
+        }
     }
+    return len;
+}
+
+size_t coap_put_option_uint(uint8_t *buf, uint16_t lastonum, uint16_t onum, uint32_t value)
+{
+    uint8_t tmp[4];
+    unsigned len = _encode_uint(tmp, value);
+
+    return coap_put_option(buf, lastonum, onum, tmp, len);
 }
 
 size_t coap_put_option_url(uint8_t *buf, uint16_t lastonum, const char *url)
@@ -344,28 +758,581 @@ size_t coap_put_option_url(uint8_t *buf, uint16_t lastonum, const char *url)
     return bufpos - buf;
 }
 
-ssize_t coap_well_known_core_default_handler(coap_pkt_t* pkt, uint8_t *buf, \
-                                             size_t len)
+int coap_builder_init(coap_builder_t *b, uint8_t *buf, size_t size, unsigned type,
+        const uint8_t *token, size_t token_len, unsigned code, uint16_t id)
 {
-    uint8_t *payload = buf + coap_get_total_hdr_len(pkt);
+    b->buf = buf;
+    b->size = size;
+    b->opts_numof = 0;
+    b->opts_written = false;
+    b->err = 0;
 
-    uint8_t *bufpos = payload;
+    if (size < sizeof(coap_hdr_t) + token_len) {
+        b->pos = 0;
+        return b->err = -ENOSPC;
+    }
+
+    b->pos = coap_build_hdr((coap_hdr_t *)buf, type, (uint8_t *)token, token_len,
+            code, htons(id));
+    return 0;
+}
+
+int coap_builder_init_reply(coap_builder_t *b, uint8_t *buf, size_t size,
+        coap_pkt_t *pkt, unsigned code)
+{
+    /* if code is COAP_CODE_EMPTY (zero), use RST as type, else RESP */
+    unsigned type = code ? COAP_RESP : COAP_RST;
+    int res = coap_builder_init(b, buf, size, type, pkt->token,
+            coap_get_token_len(pkt), code, 0);
+    if (!res) {
+        ((coap_hdr_t *)buf)->id = pkt->hdr->id;
+    }
+    return res;
+}
+
+static coap_builder_opt_t *_builder_opt(coap_builder_t *b, uint16_t onum, size_t len)
+{
+    if (b->opts_written) {
+        /* they would end up in the payload */
+        b->err = -EINVAL;
+        return NULL;
+    }
+    if (b->opts_numof == NANOCOAP_BUILDER_OPTS_MAX) {
+        b->err = -E2BIG;
+        return NULL;
+    }
+
+    /* insertion sort, so repeated options keep the order they were added in */
+    unsigned i = b->opts_numof++;
+    while (i && (b->opts[i - 1].num > onum)) {
+        b->opts[i] = b->opts[i - 1];
+        i--;
+    }
+
+    coap_builder_opt_t *opt = &b->opts[i];
+    opt->num = onum;
+    opt->len = len;
+    return opt;
+}
+
+int coap_builder_add_opt(coap_builder_t *b, uint16_t onum, const void *val, size_t len)
+{
+    if (len > UINT16_MAX) {
+        return b->err = -EINVAL;
+    }
+
+    coap_builder_opt_t *opt = _builder_opt(b, onum, len);
+    if (!opt) {
+        return b->err;
+    }
+    opt->val = val;
+    return 0;
+}
+
+int coap_builder_add_uint(coap_builder_t *b, uint16_t onum, uint32_t value)
+{
+    uint8_t tmp[4];
+    unsigned len = _encode_uint(tmp, value);
+
+    coap_builder_opt_t *opt = _builder_opt(b, onum, len);
+    if (!opt) {
+        return b->err;
+    }
+    memcpy(opt->inline_val, tmp, len);
+    opt->val = NULL;
+    return 0;
+}
+
+int coap_builder_add_path(coap_builder_t *b, const char *path)
+{
+    while (*path) {
+        if (*path == '/') {
+            path++;
+            continue;
+        }
+
+        const char *part_end = path;
+        while (*part_end && (*part_end != '/')) {
+            part_end++;
+        }
+
+        int res = coap_builder_add_opt(b, COAP_OPT_URI_PATH, path, part_end - path);
+        if (res) {
+            return res;
+        }
+        path = part_end;
+    }
+
+    return 0;
+}
+
+static int _builder_put_opts(coap_builder_t *b)
+{
+    unsigned lastonum = 0;
+    uint8_t *pos = b->buf + b->pos;
+    uint8_t *end = b->buf + b->size;
+
+    if (b->err) {
+        return b->err;
+    }
+
+    for (unsigned i = 0; i < b->opts_numof; i++) {
+        coap_builder_opt_t *opt = &b->opts[i];
+        unsigned delta = opt->num - lastonum;
+        size_t needed = 1 + _ext_len(delta) + _ext_len(opt->len) + opt->len;
+        if (needed > (size_t)(end - pos)) {
+            return b->err = -ENOSPC;
+        }
+
+        pos += _put_odelta(pos, lastonum, opt->num, opt->len);
+        memcpy(pos, opt->val ? opt->val : opt->inline_val, opt->len);
+        pos += opt->len;
+        lastonum = opt->num;
+    }
+
+    /* options are only written once */
+    b->opts_numof = 0;
+    b->opts_written = true;
+    b->pos = pos - b->buf;
+
+    return 0;
+}
+
+uint8_t *coap_builder_payload(coap_builder_t *b, size_t *avail)
+{
+    if (_builder_put_opts(b)) {
+        return NULL;
+    }
+
+    /* leave room for the payload marker */
+    if (b->pos + 1 >= b->size) {
+        b->err = -ENOSPC;
+        return NULL;
+    }
+
+    *avail = b->size - b->pos - 1;
+    return b->buf + b->pos + 1;
+}
+
+ssize_t coap_builder_finish(coap_builder_t *b, const void *payload, size_t payload_len)
+{
+    if (_builder_put_opts(b)) {
+        return b->err;
+    }
+
+    if (payload_len) {
+        if (b->pos + 1 + payload_len > b->size) {
+            return b->err = -ENOSPC;
+        }
+
+        uint8_t *pos = b->buf + b->pos;
+        *pos++ = 0xff;
+        if (payload && (payload != pos)) {
+            memmove(pos, payload, payload_len);
+        }
+        b->pos += 1 + payload_len;
+    }
+
+    return b->pos;
+}
+
+/* https://tools.ietf.org/html/rfc8323#section-3.2
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |  Len  |  TKL  | Extended Length (0, 8, 16 or 32 bits) ...
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |      Code     | Token (if any, TKL bytes) ...
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |   Options (if any) ...
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |1 1 1 1 1 1 1 1|    Payload (if any) ...
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * Len covers options and payload only.
+ */
+static const unsigned _tcp_ext_len[] = { 1, 2, 4 };
+static const uint32_t _tcp_ext_offset[] = { 13, 269, 65805 };
+
+size_t coap_tcp_frame_len(const uint8_t *buf, size_t avail)
+{
+    if (!avail) {
+        return 0;
+    }
+
+    unsigned len_nibble = buf[0] >> 4;
+    unsigned tkl = buf[0] & 0xf;
+    unsigned ext = 0;
+    size_t body_len = len_nibble;
+
+    if (len_nibble >= 13) {
+        ext = _tcp_ext_len[len_nibble - 13];
+        if (avail < 1 + ext) {
+            return 0;
+        }
+        body_len = 0;
+        for (unsigned i = 0; i < ext; i++) {
+            body_len = (body_len << 8) | buf[1 + i];
+        }
+        body_len += _tcp_ext_offset[len_nibble - 13];
+    }
+
+    return 2 + ext + tkl + body_len;
+}
+
+int coap_parse_tcp(coap_pkt_t *pkt, uint8_t *buf, size_t len)
+{
+    if (!len || (coap_tcp_frame_len(buf, len) != len)) {
+        DEBUG("nanocoap: incomplete tcp frame\n");
+        return -EBADMSG;
+    }
+
+    unsigned len_nibble = buf[0] >> 4;
+    unsigned tkl = buf[0] & 0xf;
+    unsigned ext = (len_nibble >= 13) ? _tcp_ext_len[len_nibble - 13] : 0;
+    uint8_t code = buf[1 + ext];
+
+    if (tkl > 8) {
+        return -EBADMSG;
+    }
+
+    /* the classic header is 4 bytes in front of the token, the tcp header
+     * 2 to 6 bytes. */
+    coap_hdr_t *hdr = (coap_hdr_t *)(buf + 2 + ext - sizeof(coap_hdr_t));
+    hdr->ver_t_tkl = (0x1 << 6) | (COAP_TYPE_NON << 4) | tkl;
+    hdr->code = code;
+    hdr->id = 0;
+
+    return coap_parse(pkt, (uint8_t *)hdr, buf + len - (uint8_t *)hdr);
+}
+
+size_t coap_tcp_frame(uint8_t *buf, size_t len, uint8_t **frame)
+{
+    coap_hdr_t *hdr = (coap_hdr_t *)buf;
+    unsigned tkl = hdr->ver_t_tkl & 0xf;
+    uint8_t code = hdr->code;
+    uint32_t body_len = len - sizeof(coap_hdr_t) - tkl;
+
+    unsigned len_nibble;
+    unsigned ext = 0;
+    if (body_len < 13) {
+        len_nibble = body_len;
+    }
+    else {
+        unsigned i = (body_len < 269) ? 0 : (body_len < 65805) ? 1 : 2;
+        len_nibble = 13 + i;
+        ext = _tcp_ext_len[i];
+        body_len -= _tcp_ext_offset[i];
+    }
+
+    uint8_t *pos = buf + sizeof(coap_hdr_t) - 2 - ext;
+    *frame = pos;
+
+    *pos++ = (len_nibble << 4) | tkl;
+    for (unsigned i = ext; i; i--) {
+        *pos++ = body_len >> (8 * (i - 1));
+    }
+    *pos = code;
 
-    bufpos += coap_put_option_ct(bufpos, 0, COAP_CT_LINK_FORMAT);
-    *bufpos++ = 0xff;
+    return buf + len - *frame;
+}
+
+/* precomputed /.well-known/core: the link-format document of all resources,
+ * offsets of its entries and a sorted index of all link attributes */
+typedef struct {
+    const char *key;
+    const char *val;
+    uint16_t key_len;
+    uint16_t val_len;
+    uint16_t res;
+} _wkc_attr_t;
+
+static struct {
+    char *doc;
+    size_t *offsets;        /* entry i: offsets[i] to offsets[i + 1] - 1 */
+    _wkc_attr_t *attrs;
+    unsigned attrs_numof;
+} _wkc;
+
+static int _wkc_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    int res = memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+    return res ? res : (a_len > b_len) - (a_len < b_len);
+}
+
+static int _wkc_attr_cmp(const void *_a, const void *_b)
+{
+    const _wkc_attr_t *a = _a, *b = _b;
+    int res = _wkc_cmp(a->key, a->key_len, b->key, b->key_len);
+    if (!res) {
+        res = _wkc_cmp(a->val, a->val_len, b->val, b->val_len);
+    }
+    return res ? res : (a->res - b->res);
+}
+
+static void _wkc_add_attr(_wkc_attr_t *attr, unsigned res, const char *key,
+        size_t key_len, const char *val, size_t val_len)
+{
+    if (attr) {
+        attr->key = key;
+        attr->key_len = key_len;
+        attr->val = val;
+        attr->val_len = val_len;
+        attr->res = res;
+    }
+}
+
+/* indexes ';key=value;key="v1 v2";flag' of resource @p res (counts only if
+ * @p attrs is NULL) */
+static unsigned _wkc_index(_wkc_attr_t *attrs, unsigned res, const char *pos, const char *end)
+{
+    unsigned n = 0;
+
+    while (pos < end) {
+        if (*pos++ != ';') {
+            continue;
+        }
+
+        const char *key = pos;
+        while ((pos < end) && (*pos != '=') && (*pos != ';')) {
+            pos++;
+        }
+        size_t key_len = pos - key;
+
+        if ((pos == end) || (*pos == ';')) {
+            _wkc_add_attr(attrs ? &attrs[n] : NULL, res, key, key_len, pos, 0);
+            n++;
+            continue;
+        }
+
+        pos++;
+        if ((pos < end) && (*pos == '"')) {
+            /* quoted values are lists of space separated values */
+            pos++;
+            while ((pos < end) && (*pos != '"')) {
+                const char *val = pos;
+                while ((pos < end) && (*pos != '"') && (*pos != ' ')) {
+                    pos++;
+                }
+                if (pos > val) {
+                    _wkc_add_attr(attrs ? &attrs[n] : NULL, res, key, key_len, val, pos - val);
+                    n++;
+                }
+                if ((pos < end) && (*pos == ' ')) {
+                    pos++;
+                }
+            }
+            pos++;
+        }
+        else {
+            const char *val = pos;
+            while ((pos < end) && (*pos != ';')) {
+                pos++;
+            }
+            _wkc_add_attr(attrs ? &attrs[n] : NULL, res, key, key_len, val, pos - val);
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/* indexes href and the attributes of the entry "<path>attrs" of resource
+ * @p res (counts only if @p attrs is NULL). The path is skipped by its
+ * length, it may contain any of the characters the attributes are split at. */
+static unsigned _wkc_index_entry(_wkc_attr_t *attrs, unsigned res, const char *entry,
+        const char *end)
+{
+    size_t path_len = strlen(coap_resources[res].path);
+    _wkc_add_attr(attrs, res, "href", 4, entry + 1, path_len);
+    return 1 + _wkc_index(attrs ? &attrs[1] : NULL, res, entry + 2 + path_len, end);
+}
+
+int coap_well_known_core_init(void)
+{
+    if (_dispatch_init()) {
+        return -ENOMEM;
+    }
+    if (_wkc.doc) {
+        return 0;
+    }
+
+    size_t total = 0;
+    for (unsigned i = 0; i < coap_resources_numof; i++) {
+        const coap_resource_t *r = &coap_resources[i];
+        total += strlen(r->path) + 3 + (r->attrs ? strlen(r->attrs) : 0);
+    }
+
+    char *doc = malloc(total + 1);
+    size_t *offsets = malloc((coap_resources_numof + 1) * sizeof(size_t));
+    if (!doc || !offsets) {
+        goto err;
+    }
 
+    /* "<path>attrs,<path>attrs,..." */
+    char *pos = doc;
+    unsigned attrs_numof = 0;
     for (unsigned i = 0; i < coap_resources_numof; i++) {
+        const coap_resource_t *r = &coap_resources[i];
+        offsets[i] = pos - doc;
+        pos += sprintf(pos, "%s<%s>%s", i ? "," : "", r->path, r->attrs ? r->attrs : "");
         if (i) {
-            *bufpos++ = ',';
+            offsets[i]++;
+        }
+        attrs_numof += _wkc_index_entry(NULL, i, doc + offsets[i], pos);
+    }
+    offsets[coap_resources_numof] = pos - doc + 1;
+
+    _wkc_attr_t *attrs = malloc(attrs_numof * sizeof(_wkc_attr_t));
+    if (!attrs && attrs_numof) {
+        goto err;
+    }
+
+    unsigned n = 0;
+    for (unsigned i = 0; i < coap_resources_numof; i++) {
+        n += _wkc_index_entry(&attrs[n], i, doc + offsets[i], doc + offsets[i + 1] - 1);
+    }
+    qsort(attrs, attrs_numof, sizeof(_wkc_attr_t), _wkc_attr_cmp);
+
+    _wkc.offsets = offsets;
+    _wkc.attrs = attrs;
+    _wkc.attrs_numof = attrs_numof;
+    _wkc.doc = doc;
+
+    return 0;
+
+err:
+    free(doc);
+    free(offsets);
+    return -ENOMEM;
+}
+
+/* marks all resources matching the (first) query parameter of @p pkt.
+ * Returns 0 if there is no filter. */
+static int _wkc_filter(coap_pkt_t *pkt, uint8_t *match)
+{
+    const char *key = (char *)pkt->qs;
+    const char *key_end = strchr(key, '=');
+    if (!*key || !key_end) {
+        return 0;
+    }
+
+    const char *val = key_end + 1;
+    size_t val_len = strcspn(val, "&");
+    int prefix = val_len && (val[val_len - 1] == '*');
+    val_len -= prefix;
+
+    _wkc_attr_t want = { .key = key, .key_len = key_end - key, .val = val,
+                         .val_len = val_len, .res = 0 };
+
+    /* binary search for the first candidate */
+    unsigned lo = 0, hi = _wkc.attrs_numof;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (_wkc_attr_cmp(&_wkc.attrs[mid], &want) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    for (; lo < _wkc.attrs_numof; lo++) {
+        _wkc_attr_t *attr = &_wkc.attrs[lo];
+        if (_wkc_cmp(attr->key, attr->key_len, want.key, want.key_len) ||
+                (attr->val_len < val_len) || memcmp(attr->val, val, val_len) ||
+                (!prefix && (attr->val_len != val_len))) {
+            break;
+        }
+        match[attr->res / 8] |= 1 << (attr->res % 8);
+    }
+
+    return 1;
+}
+
+ssize_t coap_well_known_core_default_handler(coap_pkt_t* pkt, uint8_t *buf, \
+                                             size_t len)
+{
+    if (coap_well_known_core_init()) {
+        return coap_build_reply(pkt, COAP_CODE_INTERNAL_SERVER_ERROR, buf, len, 0);
+    }
+
+    /* one byte more than needed, so it is never empty */
+    uint8_t match[coap_resources_numof / 8 + 1];
+    memset(match, 0, sizeof(match));
+    int filtered = _wkc_filter(pkt, match);
+
+    size_t total = 0;
+    if (filtered) {
+        for (unsigned i = 0; i < coap_resources_numof; i++) {
+            if (match[i / 8] & (1 << (i % 8))) {
+                total += (total ? 1 : 0) + _wkc.offsets[i + 1] - _wkc.offsets[i] - 1;
+            }
+        }
+        if (!total) {
+            return coap_build_reply(pkt, COAP_CODE_404, buf, len, 0);
+        }
+    }
+    else {
+        total = _wkc.offsets[coap_resources_numof] - 1;
+    }
+
+    /* header, token, Content-Format, Block2, Size2, payload marker */
+    size_t overhead = coap_get_total_hdr_len(pkt) + 2 + 4 + 3 + 1;
+    if (len <= overhead + 16) {
+        return -ENOSPC;
+    }
+
+    uint32_t blknum = 0;
+    unsigned szx = 6;
+    int blockwise = (coap_get_block2(pkt, &blknum, &szx) == 0);
+    if (blockwise || (total > len - overhead)) {
+        blockwise = 1;
+        /* a smaller block size than asked for starts at the same offset
+         * (RFC 7959, 2.2) */
+        while ((16U << szx) > len - overhead) {
+            szx--;
+            blknum <<= 1;
         }
-        *bufpos++ = '<';
-        unsigned url_len = strlen(coap_resources[i].path);
-        memcpy(bufpos, coap_resources[i].path, url_len);
-        bufpos += url_len;
-        *bufpos++ = '>';
     }
 
-    unsigned payload_len = bufpos - payload;
+    coap_block_slicer_t slicer = { .start = 0, .end = SIZE_MAX, .cur = 0 };
+    coap_builder_t b;
+    coap_builder_init_reply(&b, buf, len, pkt, COAP_CODE_205);
+    coap_builder_add_ct(&b, COAP_CT_LINK_FORMAT);
+    if (blockwise) {
+        coap_block_slicer_init(&slicer, blknum, szx);
+        if (slicer.start >= total) {
+            return coap_build_reply(pkt, COAP_CODE_BAD_OPTION, buf, len, 0);
+        }
+        coap_builder_add_uint(&b, COAP_OPT_BLOCK2,
+                coap_block_opt_value(blknum, slicer.end < total, szx));
+        if (!blknum) {
+            coap_builder_add_uint(&b, COAP_OPT_SIZE2, total);
+        }
+    }
+
+    size_t avail;
+    uint8_t *payload = coap_builder_payload(&b, &avail);
+    if (!payload) {
+        return b.err;
+    }
+
+    uint8_t *bufpos = payload;
+    if (!filtered) {
+        bufpos += coap_blockwise_put_bytes(&slicer, bufpos, _wkc.doc, total);
+    }
+    else {
+        for (unsigned i = 0; i < coap_resources_numof; i++) {
+            if (!(match[i / 8] & (1 << (i % 8)))) {
+                continue;
+            }
+            if (slicer.cur) {
+                bufpos += coap_blockwise_put_bytes(&slicer, bufpos, ",", 1);
+            }
+            bufpos += coap_blockwise_put_bytes(&slicer, bufpos, _wkc.doc + _wkc.offsets[i],
+                    _wkc.offsets[i + 1] - _wkc.offsets[i] - 1);
+        }
+    }
 
-    return coap_build_reply(pkt, COAP_CODE_205, buf, len, payload_len);
+    return coap_builder_finish(&b, payload, bufpos - payload);
 }
@@ -9,15 +9,40 @@
 
 #define COAP_PORT               (5683)
 #define NANOCOAP_URL_MAX        (64)
+#ifndef NANOCOAP_QS_MAX
+#define NANOCOAP_QS_MAX         (128)
+#endif
+/** @brief  Size of the per-server scratch arena handlers can allocate from */
+#ifndef NANOCOAP_ARENA_SIZE
+#define NANOCOAP_ARENA_SIZE     (4096U)
+#endif
+/** @brief  Maximum number of path segments captured by "*" and "**" */
+#ifndef NANOCOAP_PARAMS_MAX
+#define NANOCOAP_PARAMS_MAX     (4)
+#endif
 
 #define COAP_OPT_URI_HOST       (3)
+#define COAP_OPT_ETAG           (4)
 #define COAP_OPT_OBSERVE        (6)
+#define COAP_OPT_URI_PORT       (7)
+#define COAP_OPT_LOCATION_PATH  (8)
 #define COAP_OPT_URI_PATH       (11)
 #define COAP_OPT_CONTENT_FORMAT (12)
+#define COAP_OPT_MAX_AGE        (14)
+#define COAP_OPT_URI_QUERY      (15)
+#define COAP_OPT_ACCEPT         (17)
+#define COAP_OPT_BLOCK2         (23)
+#define COAP_OPT_SIZE2          (28)
+#define COAP_OPT_PROXY_URI      (35)
+#define COAP_OPT_PROXY_SCHEME   (39)
+
+#define COAP_ETAG_MAX           (8U)
+#define COAP_MAX_AGE_DEFAULT    (60U)
 
 #define COAP_REQ                (0)
 #define COAP_RESP               (2)
 #define COAP_RST                (3)
+#define COAP_SIGNAL             (7)
 
 /**
  * @name Message types -- confirmable, non-confirmable, etc.
@@ -50,6 +75,14 @@
 #define COAP_DELETE             (0x8)
 /** @} */
 
+/**
+ * @name Resource flags used in coap_resource_t.flags
+ * @{
+ */
+/** @brief also match all paths below the resource, e.g. "/reg/12" for "/reg" */
+#define COAP_MATCH_SUBTREE      (0x1)
+/** @} */
+
 #define COAP_CODE_EMPTY         (0)
 
 /**
@@ -94,6 +127,42 @@
 #define COAP_CODE_PROXYING_NOT_SUPPORTED     ((5<<5) | 5)
 /** @} */
 
+/**
+ * @name Signaling codes (RFC 8323, CoAP over reliable transports)
+ * @{
+ */
+#define COAP_CLASS_SIGNAL                     (7)
+#define COAP_CODE_CSM                        ((7<<5) | 1)
+#define COAP_CODE_PING                       ((7<<5) | 2)
+#define COAP_CODE_PONG                       ((7<<5) | 3)
+#define COAP_CODE_RELEASE                    ((7<<5) | 4)
+#define COAP_CODE_ABORT                      ((7<<5) | 5)
+/** @} */
+
+/**
+ * @name Signaling options (RFC 8323)
+ * @{
+ */
+#define COAP_OPT_MAX_MESSAGE_SIZE       (2)
+#define COAP_OPT_BLOCK_WISE_TRANSFER    (4)
+#define COAP_OPT_CUSTODY                (2)
+#define COAP_OPT_BAD_CSM_OPTION         (2)
+/** @} */
+
+/**
+ * @name CoAP over TCP framing
+ *
+ * Messages received or sent over TCP are converted in place from/to the
+ * RFC 7252 header layout, so the parser, handlers and reply builders can be
+ * used unchanged. Up to COAP_TCP_HEADROOM bytes in front of the buffer passed
+ * to coap_parse_tcp() / coap_tcp_frame() are overwritten by this.
+ * @{
+ */
+#define COAP_TCP_HEADROOM               (2U)
+#define COAP_TCP_HDR_MAX                (6U)
+#define COAP_TCP_DEFAULT_MAX_MSG        (1152U)
+/** @} */
+
 #define COAP_CT_LINK_FORMAT     (40)
 #define COAP_CT_XML             (41)
 #define COAP_CT_OCTET_STREAM    (42)
@@ -134,22 +203,103 @@ typedef struct {
     uint8_t data[];
 } coap_hdr_t;
 
+/* sock_udp_ep_t and sock_pktbuf_t, without pulling the sock headers into
+ * every user */
+struct _sock_tl_ep;
+struct sock_pktbuf;
+
+/**
+ * @brief   Part of the request path matched by a wildcard, not terminated
+ */
+typedef struct {
+    const char *str;
+    uint16_t len;
+} coap_param_t;
+
+/**
+ * @brief   Bump allocator for memory that lives as long as one request
+ *
+ * Every server loop owns one and resets it after sending each response, so
+ * handlers can allocate scratch space without calling malloc() or freeing it.
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t used;
+} coap_arena_t;
+
 typedef struct {
     coap_hdr_t *hdr;
     uint8_t url[NANOCOAP_URL_MAX];
+    uint8_t qs[NANOCOAP_QS_MAX];    /**< Uri-Query options, joined by '&' */
+    coap_param_t params[NANOCOAP_PARAMS_MAX];   /**< captured from url by the dispatcher */
+    uint8_t params_numof;
     uint8_t *token;
     uint8_t *payload;
     unsigned payload_len;
     uint16_t content_type;
+    uint16_t accept;
     uint32_t observe_value;
+    const struct _sock_tl_ep *remote;   /**< sender, if set by the transport */
+    uint8_t proxy;                      /**< has Proxy-Uri or Proxy-Scheme */
+    coap_arena_t *arena;                /**< set by the transport, may be NULL */
+    struct sock_pktbuf *pktbuf;         /**< holding the request, if any; see
+                                             sock_pktbuf_hold() to keep it */
 } coap_pkt_t;
 
+/**
+ * @brief   Maximum number of options a coap_builder_t can hold
+ */
+#ifndef NANOCOAP_BUILDER_OPTS_MAX
+#define NANOCOAP_BUILDER_OPTS_MAX   (16U)
+#endif
+
+typedef struct {
+    uint16_t num;
+    uint16_t len;
+    const uint8_t *val;         /**< NULL if the value is in inline_val */
+    uint8_t inline_val[4];
+} coap_builder_opt_t;
+
+/**
+ * @brief   Single-pass message builder
+ *
+ * Options can be added in any order until the payload area is requested or
+ * the message is finished. They are kept sorted as they are added, and only
+ * referenced (not copied) until they are written in one pass. Adding an option
+ * after that fails with -EINVAL. Errors are sticky, so a sequence of calls
+ * only needs to check the result of coap_builder_finish().
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t pos;
+    int err;
+    bool opts_written;
+    unsigned opts_numof;
+    coap_builder_opt_t opts[NANOCOAP_BUILDER_OPTS_MAX];
+} coap_builder_t;
+
 typedef ssize_t (*coap_handler_t)(coap_pkt_t* pkt, uint8_t *buf, size_t len);
 
+/**
+ * @brief   Entry of coap_resources[]
+ *
+ * A path segment "*" matches any one segment, so one entry serves the "temp"
+ * resource of every device below "/dev". A last segment "**" matches the rest
+ * of the path, possibly empty. The matched parts are available to the handler
+ * through coap_get_param(). Exact paths take precedence, then literal segments
+ * over "*" over "**", from left to right. A path that ends wins over the same
+ * path followed by "**", which would match an empty rest. The table is indexed
+ * on first use and need not be sorted; of equally specific entries, the first
+ * one matches.
+ */
 typedef struct {
     const char *path;
     unsigned methods;
     coap_handler_t handler;
+    const char *attrs;      /**< link-format attributes, e.g. ";rt=\"temp\";obs" */
+    unsigned flags;         /**< COAP_MATCH_SUBTREE, or 0 */
 } coap_resource_t;
 
 extern const coap_resource_t coap_resources[];
@@ -170,8 +320,134 @@ ssize_t coap_handle_req(coap_pkt_t *pkt, uint8_t *resp_buf, unsigned resp_buf_le
 ssize_t coap_build_hdr(coap_hdr_t *hdr, unsigned type, uint8_t *token, size_t token_len, unsigned code, uint16_t id);
 size_t coap_put_option(uint8_t *buf, uint16_t lastonum, uint16_t onum, uint8_t *odata, size_t olen);
 size_t coap_put_option_ct(uint8_t *buf, uint16_t lastonum, uint16_t content_type);
+size_t coap_put_option_uint(uint8_t *buf, uint16_t lastonum, uint16_t onum, uint32_t value);
 size_t coap_put_option_url(uint8_t *buf, uint16_t lastonum, const char *url);
 
+/**
+ * @brief   Start building a message into @p buf, @p id in host byte order
+ */
+int coap_builder_init(coap_builder_t *b, uint8_t *buf, size_t size, unsigned type,
+        const uint8_t *token, size_t token_len, unsigned code, uint16_t id);
+
+/**
+ * @brief   Start building a reply to @p pkt
+ */
+int coap_builder_init_reply(coap_builder_t *b, uint8_t *buf, size_t size,
+        coap_pkt_t *pkt, unsigned code);
+
+/**
+ * @brief   Add an option. @p val must stay valid until the message is finished.
+ *
+ * @returns 0, -EINVAL once the options have been written, or the sticky error
+ */
+int coap_builder_add_opt(coap_builder_t *b, uint16_t onum, const void *val, size_t len);
+int coap_builder_add_uint(coap_builder_t *b, uint16_t onum, uint32_t value);
+
+/**
+ * @brief   Add one Uri-Path option per segment of @p path
+ */
+int coap_builder_add_path(coap_builder_t *b, const char *path);
+
+static inline int coap_builder_add_ct(coap_builder_t *b, uint16_t content_type)
+{
+    return coap_builder_add_uint(b, COAP_OPT_CONTENT_FORMAT, content_type);
+}
+
+/**
+ * @brief   Write the options and get the payload area, to build a payload in
+ *          place before calling coap_builder_finish()
+ *
+ * @returns pointer to the payload area (*avail bytes), NULL on error
+ */
+uint8_t *coap_builder_payload(coap_builder_t *b, size_t *avail);
+
+/**
+ * @brief   Write the options and the payload
+ *
+ * @p payload may point into the area returned by coap_builder_payload().
+ *
+ * @returns length of the message, -ENOSPC if it does not fit the buffer,
+ *          -E2BIG if too many options were added, -EINVAL if an option was
+ *          added after the options had been written or was longer than
+ *          UINT16_MAX
+ */
+ssize_t coap_builder_finish(coap_builder_t *b, const void *payload, size_t payload_len);
+
+/**
+ * @brief   Helper to write a payload block-wise
+ *
+ * Everything is written through coap_blockwise_put_bytes(), which only copies
+ * the parts that fall into the requested block.
+ */
+typedef struct {
+    size_t start;
+    size_t end;
+    size_t cur;
+} coap_block_slicer_t;
+
+/**
+ * @brief   Get block number and size exponent of a Block2 option
+ *
+ * @returns 0 on success, -ENOENT if @p pkt has no Block2 option
+ */
+int coap_get_block2(coap_pkt_t *pkt, uint32_t *blknum, unsigned *szx);
+
+static inline uint32_t coap_block_opt_value(uint32_t blknum, unsigned more, unsigned szx)
+{
+    return (blknum << 4) | (more ? 0x8 : 0) | szx;
+}
+
+void coap_block_slicer_init(coap_block_slicer_t *slicer, uint32_t blknum, unsigned szx);
+
+/**
+ * @brief   Write the part of @p data falling into the block to @p bufpos
+ *
+ * @returns number of bytes written to @p bufpos
+ */
+size_t coap_blockwise_put_bytes(coap_block_slicer_t *slicer, uint8_t *bufpos,
+        const void *data, size_t len);
+
+/**
+ * @brief   Get the value of the first option @p onum
+ *
+ * @returns length of the value (stored at *value), -ENOENT if @p pkt does not
+ *          contain the option
+ */
+ssize_t coap_opt_get_opaque(coap_pkt_t *pkt, uint16_t onum, uint8_t **value);
+
+/**
+ * @brief   Get the value of the first option @p onum as unsigned integer
+ *
+ * @returns 0 on success, -ENOENT if @p pkt does not contain the option,
+ *          -EBADMSG if it is longer than 4 bytes
+ */
+int coap_opt_get_uint(coap_pkt_t *pkt, uint16_t onum, uint32_t *value);
+
+/**
+ * @brief   Get the length of the RFC 8323 frame at the start of @p buf
+ *
+ * @returns total length of the frame, 0 if more data is needed to tell
+ */
+size_t coap_tcp_frame_len(const uint8_t *buf, size_t avail);
+
+/**
+ * @brief   Parse a complete RFC 8323 frame
+ *
+ * The frame header is rewritten into a RFC 7252 header (type NON, id 0), which
+ * needs COAP_TCP_HEADROOM writable bytes in front of @p buf.
+ */
+int coap_parse_tcp(coap_pkt_t *pkt, uint8_t *buf, size_t len);
+
+/**
+ * @brief   Turn a message built at @p buf into an RFC 8323 frame
+ *
+ * @p buf must have COAP_TCP_HEADROOM writable bytes in front of it. The frame
+ * starts at *frame and ends where the original message ended.
+ *
+ * @returns length of the frame
+ */
+size_t coap_tcp_frame(uint8_t *buf, size_t len, uint8_t **frame);
+
 static inline unsigned coap_get_ver(coap_pkt_t *pkt)
 {
     return (pkt->hdr->ver_t_tkl & 0x60) >> 6;
@@ -236,6 +512,51 @@ static inline unsigned coap_method2flag(unsigned code)
     return (1<<(code-1));
 }
 
+/**
+ * @brief   Get the part of the path captured by the @p n th wildcard
+ *
+ * @returns pointer into pkt->url, not terminated, or NULL
+ */
+static inline const char *coap_get_param(coap_pkt_t *pkt, unsigned n, size_t *len)
+{
+    if (n >= pkt->params_numof) {
+        return NULL;
+    }
+    *len = pkt->params[n].len;
+    return pkt->params[n].str;
+}
+
+/**
+ * @brief   Allocate @p size bytes that stay valid while @p pkt is handled
+ *
+ * @returns suitably aligned memory, or NULL if the arena of @p pkt is
+ *          exhausted or there is none
+ */
+static inline void *coap_arena_alloc(coap_pkt_t *pkt, size_t size)
+{
+    coap_arena_t *arena = pkt->arena;
+    if (!arena) {
+        return NULL;
+    }
+
+    size_t pos = (arena->used + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+    if ((pos > arena->size) || (size > arena->size - pos)) {
+        return NULL;
+    }
+    arena->used = pos + size;
+    return arena->buf + pos;
+}
+
+/**
+ * @brief   Allocate the slab of @p arena, NANOCOAP_ARENA_SIZE bytes
+ */
+int coap_arena_init(coap_arena_t *arena);
+
+static inline void coap_arena_reset(coap_arena_t *arena)
+{
+    arena->used = 0;
+}
+
 /**
  * @brief  Identifies a packet containing an Observe option.
  */
@@ -260,10 +581,24 @@ static inline uint32_t coap_get_observe(coap_pkt_t *pkt)
     return pkt->observe_value;
 }
 
+/**
+ * @brief   Build the dispatch index and the /.well-known/core document
+ *
+ * Called on the first request otherwise. Servers running more than one
+ * thread need to call this before starting them.
+ */
+int coap_well_known_core_init(void);
+
+/**
+ * @brief   Serves the link-format description of coap_resources[]
+ *
+ * Supports Block2 and filtering by one query parameter (RFC 6690, e.g.
+ * "?rt=temperature", "?rt=temp*" or "?href=/sensors*").
+ */
 extern ssize_t coap_well_known_core_default_handler(coap_pkt_t* pkt, \
                                                     uint8_t *buf, size_t len);
 
 #define COAP_WELL_KNOWN_CORE_DEFAULT_HANDLER \
-    { "/.well-known/core", COAP_GET, coap_well_known_core_default_handler }
+    { "/.well-known/core", COAP_GET, coap_well_known_core_default_handler, ";ct=40", 0 }
 
 #endif /* NANOCOAP_H */
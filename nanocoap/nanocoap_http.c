@@ -0,0 +1,794 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "nanocoap.h"
+#include "nanocoap_http.h"
+#include "nanocoap_session.h"
+#include "nanocoap_tcp.h"
+
+#if NANOCOAP_DEBUG
+#define ENABLE_DEBUG (1)
+#else
+#define ENABLE_DEBUG (0)
+#endif
+#include "debug.h"
+
+#define TXBUF_SIZE          (2048U)
+#define HEADERS_MAX         (256U)
+
+typedef struct _conn {
+    struct _conn *next;         /* list of closed connections to be freed */
+    int fd;                     /* -1 once closed */
+    uint32_t events;
+    uint8_t http10;
+    uint8_t keep_alive;
+    uint8_t closing;            /* close once tx is flushed */
+    uint8_t eof;                /* client is done sending, close once idle */
+    uint8_t active;             /* response in progress */
+    uint8_t pending;            /* CoAP request outstanding */
+    uint8_t streaming;          /* response head sent */
+    uint8_t chunked;
+    uint32_t block2;            /* Block2 option of the next request, 0 for none */
+    sock_udp_ep_t remote;
+    char path[NANOCOAP_URL_MAX];
+    char qs[NANOCOAP_QS_MAX];
+    uint8_t *tx;
+    size_t tx_len;
+    size_t tx_pos;
+    size_t rx_len;
+    char rx[NANOCOAP_HTTP_HEAD_MAX];
+} _conn_t;
+
+static const struct {
+    uint8_t code;
+    uint16_t status;
+    const char *reason;
+} _statuses[] = {
+    { COAP_CODE_CREATED, 201, "Created" },
+    { COAP_CODE_DELETED, 200, "OK" },
+    { COAP_CODE_VALID, 200, "OK" },
+    { COAP_CODE_CHANGED, 200, "OK" },
+    { COAP_CODE_CONTENT, 200, "OK" },
+    { COAP_CODE_BAD_REQUEST, 400, "Bad Request" },
+    { COAP_CODE_UNAUTHORIZED, 401, "Unauthorized" },
+    { COAP_CODE_BAD_OPTION, 400, "Bad Request" },
+    { COAP_CODE_FORBIDDEN, 403, "Forbidden" },
+    { COAP_CODE_PATH_NOT_FOUND, 404, "Not Found" },
+    { COAP_CODE_METHOD_NOT_ALLOWED, 405, "Method Not Allowed" },
+    { COAP_CODE_NOT_ACCEPTABLE, 406, "Not Acceptable" },
+    { COAP_CODE_PRECONDITION_FAILED, 412, "Precondition Failed" },
+    { COAP_CODE_REQUEST_ENTITY_TOO_LARGE, 413, "Payload Too Large" },
+    { COAP_CODE_UNSUPPORTED_CONTENT_FORMAT, 415, "Unsupported Media Type" },
+    { COAP_CODE_INTERNAL_SERVER_ERROR, 500, "Internal Server Error" },
+    { COAP_CODE_NOT_IMPLEMENTED, 501, "Not Implemented" },
+    { COAP_CODE_BAD_GATEWAY, 502, "Bad Gateway" },
+    { COAP_CODE_SERVICE_UNAVAILABLE, 503, "Service Unavailable" },
+    { COAP_CODE_GATEWAY_TIMEOUT, 504, "Gateway Timeout" },
+    { COAP_CODE_PROXYING_NOT_SUPPORTED, 502, "Bad Gateway" },
+};
+
+static const struct {
+    uint16_t format;
+    const char *type;
+} _types[] = {
+    { COAP_FORMAT_TEXT, "text/plain; charset=utf-8" },
+    { COAP_FORMAT_LINK, "application/link-format" },
+    { 41, "application/xml" },
+    { COAP_FORMAT_OCTET, "application/octet-stream" },
+    { 47, "application/exi" },
+    { COAP_FORMAT_JSON, "application/json" },
+    { COAP_FORMAT_CBOR, "application/cbor" },
+};
+
+static int _epfd;
+static char _txbuf[TXBUF_SIZE];
+static nanocoap_session_t _sessions[NANOCOAP_HTTP_SESSIONS_MAX];
+static _conn_t *_closed;
+
+static void _run(_conn_t *conn);
+
+static const char *_reason(unsigned status)
+{
+    for (unsigned i = 0; i < sizeof(_statuses) / sizeof(_statuses[0]); i++) {
+        if (_statuses[i].status == status) {
+            return _statuses[i].reason;
+        }
+    }
+    switch (status) {
+        case 431: return "Request Header Fields Too Large";
+        case 505: return "HTTP Version Not Supported";
+        default: return "Error";
+    }
+}
+
+static unsigned _status(unsigned code)
+{
+    for (unsigned i = 0; i < sizeof(_statuses) / sizeof(_statuses[0]); i++) {
+        if (_statuses[i].code == code) {
+            return _statuses[i].status;
+        }
+    }
+    return (code >> 5) * 100;
+}
+
+static const char *_content_type(unsigned format)
+{
+    for (unsigned i = 0; i < sizeof(_types) / sizeof(_types[0]); i++) {
+        if (_types[i].format == format) {
+            return _types[i].type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+static void _set_events(_conn_t *conn)
+{
+    uint32_t events = conn->tx ? EPOLLOUT : ((conn->active || conn->eof) ? 0 : EPOLLIN);
+    if (events != conn->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = conn };
+        epoll_ctl(_epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->events = events;
+    }
+}
+
+/* the connection is freed once no CoAP request refers to it anymore, and
+ * only after the current batch of epoll events has been handled */
+static void _close(_conn_t *conn)
+{
+    if (conn->fd < 0) {
+        return;
+    }
+    DEBUG("nanocoap_http: closing connection %i\n", conn->fd);
+    epoll_ctl(_epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    free(conn->tx);
+    conn->tx = NULL;
+
+    if (!conn->pending) {
+        conn->next = _closed;
+        _closed = conn;
+    }
+}
+
+/* sends or queues @p len bytes */
+static int _write(_conn_t *conn, const char *data, size_t len)
+{
+    ssize_t res = 0;
+
+    if (!conn->tx) {
+        res = send(conn->fd, data, len, MSG_NOSIGNAL);
+        if (res < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                return -errno;
+            }
+            res = 0;
+        }
+        if ((size_t)res == len) {
+            return 0;
+        }
+        conn->tx_len = 0;
+        conn->tx_pos = 0;
+    }
+
+    uint8_t *tx = realloc(conn->tx, conn->tx_len + len - res);
+    if (!tx) {
+        return -ENOMEM;
+    }
+    memcpy(tx + conn->tx_len, data + res, len - res);
+    conn->tx = tx;
+    conn->tx_len += len - res;
+    return 0;
+}
+
+static int _flush(_conn_t *conn)
+{
+    ssize_t res = send(conn->fd, conn->tx + conn->tx_pos,
+            conn->tx_len - conn->tx_pos, MSG_NOSIGNAL);
+    if (res < 0) {
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -errno;
+    }
+
+    conn->tx_pos += res;
+    if (conn->tx_pos == conn->tx_len) {
+        free(conn->tx);
+        conn->tx = NULL;
+    }
+
+    return 0;
+}
+
+/* answers the current request with an error generated by the proxy */
+static void _error(_conn_t *conn, unsigned status)
+{
+    const char *reason = _reason(status);
+    int len = snprintf(_txbuf, sizeof(_txbuf),
+            "HTTP/1.%u %u %s\r\n"
+            "Content-Type: text/plain; charset=utf-8\r\n"
+            "Content-Length: %u\r\n"
+            "%s%s"
+            "\r\n"
+            "%s\n",
+            !conn->http10, status, reason, (unsigned)strlen(reason) + 1,
+            (status == 405) ? "Allow: GET\r\n" : "",
+            conn->keep_alive ? "" : "Connection: close\r\n",
+            reason);
+
+    conn->active = 0;
+    if (!conn->keep_alive) {
+        conn->closing = 1;
+    }
+    if (_write(conn, _txbuf, len)) {
+        _close(conn);
+    }
+}
+
+/* aborts a response whose head was sent already */
+static void _abort(_conn_t *conn)
+{
+    conn->active = 0;
+    conn->keep_alive = 0;
+    conn->closing = 1;
+    if (conn->chunked) {
+        /* no last chunk, so the client sees the response as incomplete */
+        _close(conn);
+    }
+}
+
+static void _response_cb(void *arg, int res, coap_pkt_t *resp)
+{
+    _conn_t *conn = arg;
+
+    conn->pending = 0;
+    if (conn->fd < 0) {
+        conn->next = _closed;
+        _closed = conn;
+        return;
+    }
+
+    if (res < 0) {
+        DEBUG("nanocoap_http: CoAP request failed: %i\n", res);
+        if (conn->streaming) {
+            _abort(conn);
+        }
+        else {
+            _error(conn, (res == -ETIMEDOUT) ? 504 : 502);
+        }
+        _run(conn);
+        return;
+    }
+
+    uint32_t block2;
+    int more = 0;
+    if (!coap_opt_get_uint(resp, COAP_OPT_BLOCK2, &block2)) {
+        if ((block2 >> 4) != (conn->block2 >> 4)) {
+            DEBUG("nanocoap_http: unexpected block %u\n", (unsigned)(block2 >> 4));
+            if (conn->streaming) {
+                _abort(conn);
+            }
+            else {
+                _error(conn, 502);
+            }
+            _run(conn);
+            return;
+        }
+        more = (block2 & 0x8) && (coap_get_code_class(resp) == 2);
+    }
+
+    size_t len = 0;
+    if (!conn->streaming) {
+        unsigned status = _status(resp->hdr->code);
+        uint32_t max_age;
+
+        len += snprintf(_txbuf, HEADERS_MAX, "HTTP/1.%u %u %s\r\n",
+                !conn->http10, status, _reason(status));
+        if (resp->content_type != COAP_FORMAT_NONE) {
+            len += snprintf(_txbuf + len, HEADERS_MAX - len, "Content-Type: %s\r\n",
+                    _content_type(resp->content_type));
+        }
+        if (!coap_opt_get_uint(resp, COAP_OPT_MAX_AGE, &max_age)) {
+            len += snprintf(_txbuf + len, HEADERS_MAX - len, "Cache-Control: max-age=%lu\r\n",
+                    (unsigned long)max_age);
+        }
+        if (!more) {
+            len += snprintf(_txbuf + len, HEADERS_MAX - len, "Content-Length: %u\r\n",
+                    (unsigned)resp->payload_len);
+        }
+        else if (!conn->http10) {
+            len += snprintf(_txbuf + len, HEADERS_MAX - len, "Transfer-Encoding: chunked\r\n");
+            conn->chunked = 1;
+        }
+        else {
+            /* HTTP/1.0 has no chunks, the end of the body is the end of the
+             * connection */
+            conn->keep_alive = 0;
+        }
+        if (!conn->keep_alive) {
+            len += snprintf(_txbuf + len, HEADERS_MAX - len, "Connection: close\r\n");
+        }
+        len += snprintf(_txbuf + len, HEADERS_MAX - len, "\r\n");
+        conn->streaming = 1;
+    }
+
+    if (conn->chunked && resp->payload_len) {
+        len += sprintf(_txbuf + len, "%x\r\n", (unsigned)resp->payload_len);
+    }
+    if (resp->payload_len <= sizeof(_txbuf) - len - 16) {
+        memcpy(_txbuf + len, resp->payload, resp->payload_len);
+        len += resp->payload_len;
+    }
+    else {
+        /* too large to go out in one piece with the head */
+        if (_write(conn, _txbuf, len) ||
+                _write(conn, (char *)resp->payload, resp->payload_len)) {
+            _close(conn);
+            return;
+        }
+        len = 0;
+    }
+    if (conn->chunked) {
+        if (resp->payload_len) {
+            len += sprintf(_txbuf + len, "\r\n");
+        }
+        if (!more) {
+            len += sprintf(_txbuf + len, "0\r\n\r\n");
+        }
+    }
+
+    if (len && _write(conn, _txbuf, len)) {
+        _close(conn);
+        return;
+    }
+
+    if (more) {
+        /* requested once the block has been written to the socket */
+        conn->block2 = (((block2 >> 4) + 1) << 4) | (block2 & 0x7);
+    }
+    else {
+        conn->active = 0;
+        if (!conn->keep_alive) {
+            conn->closing = 1;
+        }
+    }
+
+    _run(conn);
+}
+
+static int _hex(char c)
+{
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    c |= 0x20;
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/* copies @p len bytes of @p src, decoding percent-encoded characters */
+static int _unescape(char *dst, size_t size, const char *src, size_t len)
+{
+    const char *end = src + len;
+
+    while (src < end) {
+        if (size <= 1) {
+            return -EINVAL;
+        }
+        if (*src == '%') {
+            int hi, lo;
+            if ((end - src < 3) || ((hi = _hex(src[1])) < 0) || ((lo = _hex(src[2])) < 0)) {
+                return -EINVAL;
+            }
+            *dst++ = (hi << 4) | lo;
+            src += 3;
+        }
+        else {
+            *dst++ = *src++;
+        }
+        size--;
+    }
+    *dst = '\0';
+    return 0;
+}
+
+static void _request(_conn_t *conn)
+{
+    nanocoap_session_t *session = nanocoap_session_pool_get(_sessions,
+            NANOCOAP_HTTP_SESSIONS_MAX, &conn->remote);
+    if (!session) {
+        if (conn->streaming) {
+            _abort(conn);
+        }
+        else {
+            _error(conn, 503);
+        }
+        return;
+    }
+
+    /* a no-op if the session is being polled already */
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = session };
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, nanocoap_session_fd(session), &ev);
+
+    coap_builder_t b;
+    nanocoap_session_builder_init(&b, (uint8_t *)_txbuf, sizeof(_txbuf), COAP_TYPE_CON,
+            COAP_METHOD_GET);
+    coap_builder_add_path(&b, conn->path);
+
+    char *pos = conn->qs;
+    while (*pos) {
+        char arg[NANOCOAP_QS_MAX];
+        size_t len = strcspn(pos, "&");
+        if (len && !_unescape(arg, sizeof(arg), pos, len)) {
+            coap_builder_add_opt(&b, COAP_OPT_URI_QUERY, arg, strlen(arg));
+        }
+        pos += len + (pos[len] == '&');
+    }
+
+    if (conn->block2) {
+        coap_builder_add_uint(&b, COAP_OPT_BLOCK2, conn->block2);
+    }
+
+    ssize_t len = coap_builder_finish(&b, NULL, 0);
+    int res = (len < 0) ? len : nanocoap_session_request(session, (uint8_t *)_txbuf, len,
+            _response_cb, conn);
+    if (res) {
+        if (conn->streaming) {
+            _abort(conn);
+        }
+        else {
+            _error(conn, (res == -EAGAIN) ? 503 : 502);
+        }
+        return;
+    }
+
+    conn->pending = 1;
+}
+
+/* "/coap/<host>/<path>[?query]" */
+static int _parse_target(_conn_t *conn, const char *target)
+{
+    char host[64];
+
+    if (strncmp(target, "/coap/", 6)) {
+        return -ENOENT;
+    }
+    target += 6;
+
+    size_t len = strcspn(target, "/?");
+    if (_unescape(host, sizeof(host), target, len)) {
+        return -EINVAL;
+    }
+    int res = nanocoap_session_parse_ep(&conn->remote, host, strlen(host));
+    if (res) {
+        return res;
+    }
+    target += len;
+
+    len = strcspn(target, "?");
+    if (_unescape(conn->path, sizeof(conn->path), target, len)) {
+        return -EINVAL;
+    }
+    target += len;
+
+    if (*target) {
+        target++;
+    }
+    /* kept encoded until split into arguments, "%26" does not separate */
+    len = strlen(target);
+    if ((len >= sizeof(conn->qs)) || _unescape(conn->qs, sizeof(conn->qs), target, len)) {
+        return -EINVAL;
+    }
+    memcpy(conn->qs, target, len + 1);
+    return 0;
+}
+
+/* handles the request head in rx[0..len), with "\r\n\r\n" replaced by '\0' */
+static void _start(_conn_t *conn, char *head)
+{
+    char *line_end = strstr(head, "\r\n");
+    if (line_end) {
+        *line_end = '\0';
+    }
+
+    char *method = head;
+    char *target = strchr(method, ' ');
+    char *version = target ? strchr(target + 1, ' ') : NULL;
+    if (!version) {
+        conn->keep_alive = 0;
+        _error(conn, 400);
+        return;
+    }
+    *target++ = '\0';
+    *version++ = '\0';
+
+    if (!strcmp(version, "HTTP/1.1")) {
+        conn->http10 = 0;
+        conn->keep_alive = 1;
+    }
+    else if (!strcmp(version, "HTTP/1.0")) {
+        conn->http10 = 1;
+        conn->keep_alive = 0;
+    }
+    else {
+        conn->http10 = 1;
+        conn->keep_alive = 0;
+        _error(conn, 505);
+        return;
+    }
+
+    int has_body = 0;
+    char *line = line_end ? line_end + 2 : NULL;
+    while (line && *line) {
+        line_end = strstr(line, "\r\n");
+        if (line_end) {
+            *line_end = '\0';
+        }
+
+        char *value = strchr(line, ':');
+        if (value) {
+            *value++ = '\0';
+            value += strspn(value, " \t");
+
+            if (!strcasecmp(line, "Connection")) {
+                if (!strcasecmp(value, "close")) {
+                    conn->keep_alive = 0;
+                }
+                else if (!strcasecmp(value, "keep-alive")) {
+                    conn->keep_alive = 1;
+                }
+            }
+            else if ((!strcasecmp(line, "Content-Length") && strcmp(value, "0")) ||
+                    !strcasecmp(line, "Transfer-Encoding")) {
+                has_body = 1;
+            }
+        }
+
+        line = line_end ? line_end + 2 : NULL;
+    }
+
+    DEBUG("nanocoap_http: %s %s\n", method, target);
+
+    if (has_body) {
+        /* not read, so the connection cannot be reused */
+        conn->keep_alive = 0;
+        _error(conn, 400);
+        return;
+    }
+    if (strcmp(method, "GET")) {
+        _error(conn, 405);
+        return;
+    }
+
+    int res = _parse_target(conn, target);
+    if (res) {
+        _error(conn, (res == -ENOENT) ? 404 : (res == -EHOSTUNREACH) ? 502 : 400);
+        return;
+    }
+
+    conn->active = 1;
+    conn->streaming = 0;
+    conn->chunked = 0;
+    conn->block2 = 0;
+}
+
+/* takes the next complete request head from rx, returns 0 if there is none */
+static int _next_request(_conn_t *conn)
+{
+    for (size_t i = 3; i < conn->rx_len; i++) {
+        if (!memcmp(conn->rx + i - 3, "\r\n\r\n", 4)) {
+            conn->rx[i - 3] = '\0';
+            _start(conn, conn->rx);
+            conn->rx_len -= i + 1;
+            memmove(conn->rx, conn->rx + i + 1, conn->rx_len);
+            return 1;
+        }
+    }
+
+    if (conn->rx_len == sizeof(conn->rx)) {
+        conn->keep_alive = 0;
+        conn->http10 = 0;
+        _error(conn, 431);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* advances @p conn as far as possible without blocking */
+static void _run(_conn_t *conn)
+{
+    while (conn->fd >= 0) {
+        if (conn->tx) {
+            break;
+        }
+        if (conn->active) {
+            if (!conn->pending) {
+                _request(conn);
+            }
+            if (conn->active) {
+                break;
+            }
+            continue;
+        }
+        if (conn->closing) {
+            _close(conn);
+            return;
+        }
+        if (!_next_request(conn)) {
+            if (conn->eof) {
+                /* all complete requests have been answered */
+                _close(conn);
+                return;
+            }
+            break;
+        }
+    }
+
+    if (conn->fd >= 0) {
+        _set_events(conn);
+    }
+}
+
+static int _read(_conn_t *conn)
+{
+    while (conn->rx_len < sizeof(conn->rx)) {
+        ssize_t res = recv(conn->fd, conn->rx + conn->rx_len, sizeof(conn->rx) - conn->rx_len, 0);
+        if (res == 0) {
+            /* requests received before are still answered */
+            conn->eof = 1;
+            return 0;
+        }
+        else if (res < 0) {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -errno;
+        }
+        conn->rx_len += res;
+    }
+
+    return 0;
+}
+
+static void _accept(int listen_fd)
+{
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                perror("accept");
+            }
+            return;
+        }
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        const int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        _conn_t *conn = calloc(1, sizeof(_conn_t));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);
+            free(conn);
+        }
+    }
+}
+
+static nanocoap_session_t *_session(void *ptr)
+{
+    for (unsigned i = 0; i < NANOCOAP_HTTP_SESSIONS_MAX; i++) {
+        if (ptr == &_sessions[i]) {
+            return &_sessions[i];
+        }
+    }
+    return NULL;
+}
+
+int nanocoap_http_proxy(sock_udp_ep_t *local, uint8_t *buf, size_t bufsize)
+{
+    if (!local->port) {
+        local->port = NANOCOAP_HTTP_PORT;
+    }
+
+    int listen_fd = nanocoap_tcp_listen(local);
+    if (listen_fd < 0) {
+        return -1;
+    }
+
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd == -1) {
+        close(listen_fd);
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    struct epoll_event events[NANOCOAP_HTTP_MAX_EVENTS];
+    while (1) {
+        int timeout = -1;
+        for (unsigned i = 0; i < NANOCOAP_HTTP_SESSIONS_MAX; i++) {
+            if (_sessions[i].open) {
+                int next = nanocoap_session_timeouts(&_sessions[i]);
+                if ((next >= 0) && ((timeout < 0) || (next < timeout))) {
+                    timeout = next;
+                }
+            }
+        }
+
+        int n = epoll_wait(_epfd, events, NANOCOAP_HTTP_MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (!ptr) {
+                _accept(listen_fd);
+                continue;
+            }
+
+            nanocoap_session_t *session = _session(ptr);
+            if (session) {
+                if (session->open) {
+                    nanocoap_session_recv(session, buf, bufsize);
+                }
+                continue;
+            }
+
+            _conn_t *conn = ptr;
+            if (conn->fd < 0) {
+                /* closed while handling an earlier event */
+                continue;
+            }
+
+            int res = 0;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                res = -ECONNRESET;
+            }
+            else if (conn->tx) {
+                res = _flush(conn);
+            }
+            else {
+                res = _read(conn);
+            }
+
+            if (res < 0) {
+                _close(conn);
+            }
+            else {
+                _run(conn);
+            }
+        }
+
+        while (_closed) {
+            _conn_t *conn = _closed;
+            _closed = conn->next;
+            free(conn);
+        }
+    }
+
+    close(_epfd);
+    close(listen_fd);
+
+    return -1;
+}
@@ -0,0 +1,46 @@
+#ifndef NANOCOAP_HTTP_H
+#define NANOCOAP_HTTP_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "net/sock/udp.h"
+
+#define NANOCOAP_HTTP_PORT              (8080U)
+
+/**
+ * @brief   Largest HTTP request head (request line and headers) accepted
+ */
+#ifndef NANOCOAP_HTTP_HEAD_MAX
+#define NANOCOAP_HTTP_HEAD_MAX          (2048U)
+#endif
+
+/**
+ * @brief   Maximum number of CoAP servers with an open session
+ */
+#ifndef NANOCOAP_HTTP_SESSIONS_MAX
+#define NANOCOAP_HTTP_SESSIONS_MAX      (16U)
+#endif
+
+/**
+ * @brief   Number of epoll events handled per epoll_wait() call
+ */
+#ifndef NANOCOAP_HTTP_MAX_EVENTS
+#define NANOCOAP_HTTP_MAX_EVENTS        (64U)
+#endif
+
+/**
+ * @brief   Serve "GET /coap/<host>/<path>[?query]" over HTTP/1.1 by
+ *          forwarding it as CoAP GET to <host> (RFC 8075)
+ *
+ * <host> is an IP literal with optional port, e.g. "[::1]:5683". All HTTP
+ * connections and one CoAP session per server are handled by one epoll loop,
+ * so requests to the same server are multiplexed over one socket. Connections
+ * are kept alive. A Block2 response is streamed back with chunked transfer
+ * encoding while the next block is fetched.
+ *
+ * @p buf is used to receive CoAP responses. Only returns on error.
+ */
+int nanocoap_http_proxy(sock_udp_ep_t *local, uint8_t *buf, size_t bufsize);
+
+#endif /* NANOCOAP_HTTP_H */
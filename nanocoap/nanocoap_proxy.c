@@ -0,0 +1,705 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "net/sock/udp.h"
+#include "net/sock/posix.h"
+
+#include "nanocoap.h"
+#include "nanocoap_proxy.h"
+#include "nanocoap_session.h"
+
+#if NANOCOAP_STATS
+#include "nanocoap_stats.h"
+#endif
+
+#if NANOCOAP_DEBUG
+#define ENABLE_DEBUG (1)
+#else
+#define ENABLE_DEBUG (0)
+#endif
+#include "debug.h"
+
+#define TXBUF_SIZE          (1280U)
+#define KEY_MAX             (INET6_ADDRSTRLEN + NANOCOAP_URL_MAX + NANOCOAP_QS_MAX + 32)
+
+/* a response as received from the origin, without Max-Age */
+typedef struct {
+    uint8_t code;
+    uint8_t etag_len;
+    uint8_t etag[COAP_ETAG_MAX];
+    uint8_t has_block2;
+    uint8_t has_size2;
+    uint16_t ct;
+    uint32_t block2;
+    uint32_t size2;
+    uint32_t max_age;
+    size_t payload_len;
+    uint8_t payload[];
+} _repr_t;
+
+/* a client request waiting for the origin */
+typedef struct _waiter {
+    struct _waiter *next;
+    sock_udp_ep_t remote;
+    uint16_t id;
+    uint8_t type;
+    uint8_t tkl;
+    uint8_t token[8];
+    uint8_t etag_len;
+    uint8_t etag[COAP_ETAG_MAX];
+} _waiter_t;
+
+/* a cache entry, or the state of a forwarded request that is not cached */
+typedef struct _entry {
+    struct _entry *chain;
+    struct _entry *prev;        /* LRU list, most recently used first */
+    struct _entry *next;
+    _waiter_t *waiters;
+    _repr_t *repr;
+    uint64_t expires;           /* ms, 0 if repr must not be reused */
+    uint32_t hash;
+    uint8_t pending;            /* request to the origin outstanding */
+    uint8_t cached;
+    uint16_t key_len;
+    char key[];
+} _entry_t;
+
+typedef struct {
+    sock_udp_ep_t ep;
+    char path[NANOCOAP_URL_MAX];
+    char qs[NANOCOAP_QS_MAX];
+} _target_t;
+
+static sock_udp_t _sock;
+static coap_arena_t _arena;
+static uint8_t _txbuf[TXBUF_SIZE];
+static uint16_t _next_id;
+
+static nanocoap_session_t _upstreams[NANOCOAP_PROXY_SESSIONS_MAX];
+
+static _entry_t **_cache;
+static unsigned _cache_size;
+static unsigned _cache_numof;
+static _entry_t *_lru_head;
+static _entry_t *_lru_tail;
+
+static uint32_t _hash(const char *str, size_t len)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261U;
+    while (len--) {
+        hash = (hash ^ (uint8_t)*str++) * 16777619U;
+    }
+    return hash;
+}
+
+static _entry_t *_cache_find(const char *key, size_t len, uint32_t hash)
+{
+    if (!_cache_size) {
+        return NULL;
+    }
+    for (_entry_t *e = _cache[hash & (_cache_size - 1)]; e; e = e->chain) {
+        if ((e->hash == hash) && (e->key_len == len) && !memcmp(e->key, key, len)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static int _cache_grow(void)
+{
+    unsigned size = _cache_size ? _cache_size * 2 : 256;
+    _entry_t **cache = calloc(size, sizeof(_entry_t *));
+    if (!cache) {
+        return -ENOMEM;
+    }
+
+    for (unsigned i = 0; i < _cache_size; i++) {
+        _entry_t *e = _cache[i];
+        while (e) {
+            _entry_t *next = e->chain;
+            e->chain = cache[e->hash & (size - 1)];
+            cache[e->hash & (size - 1)] = e;
+            e = next;
+        }
+    }
+
+    free(_cache);
+    _cache = cache;
+    _cache_size = size;
+    return 0;
+}
+
+static void _lru_unlink(_entry_t *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    }
+    else {
+        _lru_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    }
+    else {
+        _lru_tail = e->prev;
+    }
+}
+
+static void _lru_push(_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = _lru_head;
+    if (_lru_head) {
+        _lru_head->prev = e;
+    }
+    else {
+        _lru_tail = e;
+    }
+    _lru_head = e;
+}
+
+static void _entry_free(_entry_t *e)
+{
+    if (e->cached) {
+        _entry_t **pos = &_cache[e->hash & (_cache_size - 1)];
+        while (*pos != e) {
+            pos = &(*pos)->chain;
+        }
+        *pos = e->chain;
+        _lru_unlink(e);
+        _cache_numof--;
+    }
+    free(e->repr);
+    free(e);
+}
+
+/* @p key NULL: state of a request that is forwarded, but not cached */
+static _entry_t *_entry_new(const char *key, size_t len, uint32_t hash)
+{
+    if (key) {
+        /* evict the least recently used entries nobody waits for */
+        _entry_t *victim = _lru_tail;
+        while ((_cache_numof >= NANOCOAP_PROXY_CACHE_MAX) && victim) {
+            _entry_t *prev = victim->prev;
+            if (!victim->pending) {
+                _entry_free(victim);
+            }
+            victim = prev;
+        }
+        if (_cache_numof >= NANOCOAP_PROXY_CACHE_MAX) {
+            return NULL;
+        }
+        if ((_cache_numof >= _cache_size) && _cache_grow()) {
+            return NULL;
+        }
+    }
+
+    _entry_t *e = calloc(1, sizeof(_entry_t) + len);
+    if (!e) {
+        return NULL;
+    }
+
+    if (key) {
+        memcpy(e->key, key, len);
+        e->key_len = len;
+        e->hash = hash;
+        e->cached = 1;
+        e->chain = _cache[hash & (_cache_size - 1)];
+        _cache[hash & (_cache_size - 1)] = e;
+        _lru_push(e);
+        _cache_numof++;
+    }
+
+    return e;
+}
+
+static _repr_t *_repr_new(coap_pkt_t *resp, uint32_t max_age)
+{
+    _repr_t *repr = malloc(sizeof(_repr_t) + resp->payload_len);
+    if (!repr) {
+        return NULL;
+    }
+
+    uint8_t *etag;
+    ssize_t etag_len = coap_opt_get_opaque(resp, COAP_OPT_ETAG, &etag);
+    if ((etag_len > 0) && (etag_len <= (ssize_t)COAP_ETAG_MAX)) {
+        memcpy(repr->etag, etag, etag_len);
+        repr->etag_len = etag_len;
+    }
+    else {
+        repr->etag_len = 0;
+    }
+
+    repr->code = resp->hdr->code;
+    repr->ct = resp->content_type;
+    repr->has_block2 = !coap_opt_get_uint(resp, COAP_OPT_BLOCK2, &repr->block2);
+    repr->has_size2 = !coap_opt_get_uint(resp, COAP_OPT_SIZE2, &repr->size2);
+    repr->max_age = max_age;
+    repr->payload_len = resp->payload_len;
+    memcpy(repr->payload, resp->payload, resp->payload_len);
+
+    return repr;
+}
+
+static void _waiter_init(_waiter_t *w, coap_pkt_t *pkt, const sock_udp_ep_t *remote)
+{
+    w->next = NULL;
+    w->remote = *remote;
+    w->id = coap_get_id(pkt);
+    w->type = coap_get_type(pkt);
+    w->tkl = coap_get_token_len(pkt);
+    memcpy(w->token, pkt->token, w->tkl);
+
+    uint8_t *etag;
+    ssize_t etag_len = coap_opt_get_opaque(pkt, COAP_OPT_ETAG, &etag);
+    w->etag_len = 0;
+    if ((etag_len > 0) && (etag_len <= (ssize_t)COAP_ETAG_MAX)) {
+        memcpy(w->etag, etag, etag_len);
+        w->etag_len = etag_len;
+    }
+}
+
+/* answers @p w with @p repr, or with an empty @p code if there is none */
+static void _reply(const _waiter_t *w, unsigned code, const _repr_t *repr, uint32_t max_age)
+{
+    unsigned type = (w->type == COAP_TYPE_CON) ? COAP_TYPE_ACK : COAP_TYPE_NON;
+    uint16_t id = (w->type == COAP_TYPE_CON) ? w->id : _next_id++;
+    const uint8_t *payload = NULL;
+    size_t payload_len = 0;
+    coap_builder_t b;
+
+    if (repr) {
+        code = repr->code;
+        if ((code == COAP_CODE_205) && repr->etag_len && (w->etag_len == repr->etag_len) &&
+                !memcmp(w->etag, repr->etag, repr->etag_len)) {
+            /* the client's copy is still valid */
+            code = COAP_CODE_VALID;
+        }
+    }
+
+    coap_builder_init(&b, _txbuf, sizeof(_txbuf), type, w->token, w->tkl, code, id);
+    if (repr) {
+        if (repr->etag_len) {
+            coap_builder_add_opt(&b, COAP_OPT_ETAG, repr->etag, repr->etag_len);
+        }
+        coap_builder_add_uint(&b, COAP_OPT_MAX_AGE, max_age);
+        if (code != COAP_CODE_VALID) {
+            if (repr->ct != COAP_FORMAT_NONE) {
+                coap_builder_add_ct(&b, repr->ct);
+            }
+            if (repr->has_block2) {
+                coap_builder_add_uint(&b, COAP_OPT_BLOCK2, repr->block2);
+            }
+            if (repr->has_size2) {
+                coap_builder_add_uint(&b, COAP_OPT_SIZE2, repr->size2);
+            }
+            payload = repr->payload;
+            payload_len = repr->payload_len;
+        }
+    }
+
+    ssize_t len = coap_builder_finish(&b, payload, payload_len);
+    if (len > 0) {
+        sock_udp_send(&_sock, _txbuf, len, &w->remote);
+    }
+}
+
+static void _reply_all(_entry_t *e, unsigned code, uint32_t max_age)
+{
+    while (e->waiters) {
+        _waiter_t *w = e->waiters;
+        e->waiters = w->next;
+        _reply(w, code, e->repr, max_age);
+        free(w);
+    }
+}
+
+/* fails all waiters of @p e and drops it, unless it has a usable response */
+static void _fail(_entry_t *e, unsigned code)
+{
+    _repr_t *repr = e->repr;
+    e->repr = NULL;
+    _reply_all(e, code, 0);
+    e->repr = repr;
+
+    if (!e->cached || !e->repr) {
+        _entry_free(e);
+    }
+}
+
+static int _add_waiter(_entry_t *e, coap_pkt_t *pkt, const sock_udp_ep_t *remote)
+{
+    _waiter_t *w;
+    for (w = e->waiters; w; w = w->next) {
+        if ((w->id == coap_get_id(pkt)) && (w->remote.family == remote->family) &&
+                (w->remote.port == remote->port) &&
+                !memcmp(&w->remote.addr, &remote->addr, sizeof(remote->addr))) {
+            /* retransmission */
+            return 0;
+        }
+    }
+
+    w = malloc(sizeof(_waiter_t));
+    if (!w) {
+        return -ENOMEM;
+    }
+    _waiter_init(w, pkt, remote);
+    w->next = e->waiters;
+    e->waiters = w;
+    return 0;
+}
+
+static void _response_cb(void *arg, int res, coap_pkt_t *resp)
+{
+    _entry_t *e = arg;
+    uint64_t now = nanocoap_session_now();
+
+    e->pending = 0;
+
+    if (res < 0) {
+        DEBUG("nanocoap_proxy: origin failed: %i\n", res);
+        _fail(e, (res == -ETIMEDOUT) ? COAP_CODE_GATEWAY_TIMEOUT : COAP_CODE_BAD_GATEWAY);
+        return;
+    }
+
+    uint32_t max_age = COAP_MAX_AGE_DEFAULT;
+    coap_opt_get_uint(resp, COAP_OPT_MAX_AGE, &max_age);
+
+    uint8_t *etag;
+    ssize_t etag_len = coap_opt_get_opaque(resp, COAP_OPT_ETAG, &etag);
+    if ((resp->hdr->code == COAP_CODE_VALID) && e->repr && (etag_len == e->repr->etag_len) &&
+            (etag_len > 0) && !memcmp(etag, e->repr->etag, etag_len)) {
+        /* stale entry revalidated */
+        DEBUG("nanocoap_proxy: %.*s revalidated\n", e->key_len, e->key);
+        e->repr->max_age = max_age;
+    }
+    else {
+        _repr_t *repr = _repr_new(resp, max_age);
+        if (!repr) {
+            _fail(e, COAP_CODE_INTERNAL_SERVER_ERROR);
+            return;
+        }
+        free(e->repr);
+        e->repr = repr;
+    }
+
+    int cacheable = e->cached && (e->repr->code == COAP_CODE_205) && max_age;
+    e->expires = cacheable ? now + max_age * 1000ULL : 0;
+
+    _reply_all(e, 0, max_age);
+
+    if (!cacheable) {
+        _entry_free(e);
+    }
+}
+
+static int _forward(_entry_t *e, nanocoap_session_t *up, coap_pkt_t *pkt, _target_t *t)
+{
+    coap_builder_t b;
+    nanocoap_session_builder_init(&b, _txbuf, sizeof(_txbuf), COAP_TYPE_CON, pkt->hdr->code);
+    coap_builder_add_path(&b, t->path);
+
+    char *pos = t->qs;
+    while (*pos) {
+        size_t len = strcspn(pos, "&");
+        if (len) {
+            coap_builder_add_opt(&b, COAP_OPT_URI_QUERY, pos, len);
+        }
+        pos += len + (pos[len] == '&');
+    }
+
+    if (pkt->accept != COAP_FORMAT_NONE) {
+        coap_builder_add_uint(&b, COAP_OPT_ACCEPT, pkt->accept);
+    }
+
+    uint32_t block2;
+    if (!coap_opt_get_uint(pkt, COAP_OPT_BLOCK2, &block2)) {
+        coap_builder_add_uint(&b, COAP_OPT_BLOCK2, block2);
+    }
+
+    /* revalidate what we have, the client's ETag is answered locally */
+    if (e->repr && e->repr->etag_len) {
+        coap_builder_add_opt(&b, COAP_OPT_ETAG, e->repr->etag, e->repr->etag_len);
+    }
+
+    if (pkt->payload_len && (pkt->content_type != COAP_FORMAT_NONE)) {
+        coap_builder_add_ct(&b, pkt->content_type);
+    }
+
+    ssize_t len = coap_builder_finish(&b, pkt->payload, pkt->payload_len);
+    if (len < 0) {
+        return len;
+    }
+
+    return nanocoap_session_request(up, _txbuf, len, _response_cb, e);
+}
+
+static int _copy(char *dst, size_t size, const char *src, size_t len)
+{
+    if (len >= size) {
+        return -EINVAL;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+    return 0;
+}
+
+/* "coap://host[:port][/path][?query]" */
+static int _parse_proxy_uri(_target_t *t, const char *pos, const char *end)
+{
+    if ((end - pos < 7) || memcmp(pos, "coap://", 7)) {
+        return -ENOTSUP;
+    }
+    pos += 7;
+
+    const char *host = pos;
+    while ((pos < end) && (*pos != '/') && (*pos != '?')) {
+        pos++;
+    }
+
+    int res = nanocoap_session_parse_ep(&t->ep, host, pos - host);
+    if (res) {
+        return res;
+    }
+
+    const char *path = pos;
+    while ((pos < end) && (*pos != '?')) {
+        pos++;
+    }
+    if (_copy(t->path, sizeof(t->path), path, pos - path)) {
+        return -EINVAL;
+    }
+
+    if (pos < end) {
+        pos++;
+    }
+    return _copy(t->qs, sizeof(t->qs), pos, end - pos);
+}
+
+static int _parse_target(_target_t *t, coap_pkt_t *pkt)
+{
+    uint8_t *val;
+    ssize_t len = coap_opt_get_opaque(pkt, COAP_OPT_PROXY_URI, &val);
+    if (len >= 0) {
+        return _parse_proxy_uri(t, (char *)val, (char *)val + len);
+    }
+
+    len = coap_opt_get_opaque(pkt, COAP_OPT_PROXY_SCHEME, &val);
+    if ((len != 4) || memcmp(val, "coap", 4)) {
+        return -ENOTSUP;
+    }
+
+    len = coap_opt_get_opaque(pkt, COAP_OPT_URI_HOST, &val);
+    if (len < 0) {
+        return -EINVAL;
+    }
+    int res = nanocoap_session_parse_ep(&t->ep, (char *)val, len);
+    if (res) {
+        return res;
+    }
+
+    uint32_t port;
+    if (!coap_opt_get_uint(pkt, COAP_OPT_URI_PORT, &port)) {
+        if (!port || (port > UINT16_MAX)) {
+            return -EINVAL;
+        }
+        t->ep.port = port;
+    }
+
+    memcpy(t->path, pkt->url, sizeof(t->path));
+    memcpy(t->qs, pkt->qs, sizeof(t->qs));
+    return 0;
+}
+
+/* origin, resource and the options that select a representation */
+static size_t _cache_key(char *key, const _target_t *t, coap_pkt_t *pkt)
+{
+    char addr[INET6_ADDRSTRLEN];
+    uint32_t block2 = UINT32_MAX;
+
+    inet_ntop(t->ep.family, &t->ep.addr, addr, sizeof(addr));
+    coap_opt_get_uint(pkt, COAP_OPT_BLOCK2, &block2);
+
+    return snprintf(key, KEY_MAX, "%s %u %s?%s %u %lu", addr, t->ep.port, t->path, t->qs,
+            pkt->accept, (unsigned long)block2);
+}
+
+static void _proxy(coap_pkt_t *pkt, const sock_udp_ep_t *remote)
+{
+    uint64_t now = nanocoap_session_now();
+    _target_t t;
+    _waiter_t w;
+    _entry_t *e = NULL;
+
+    _waiter_init(&w, pkt, remote);
+
+    int res = _parse_target(&t, pkt);
+    if (res) {
+        _reply(&w, (res == -ENOTSUP) ? COAP_CODE_PROXYING_NOT_SUPPORTED :
+                   (res == -EHOSTUNREACH) ? COAP_CODE_BAD_GATEWAY : COAP_CODE_BAD_REQUEST,
+               NULL, 0);
+        return;
+    }
+
+    if (pkt->hdr->code == COAP_METHOD_GET) {
+        char key[KEY_MAX];
+        size_t key_len = _cache_key(key, &t, pkt);
+        uint32_t hash = _hash(key, key_len);
+
+        e = _cache_find(key, key_len, hash);
+        if (e) {
+            _lru_unlink(e);
+            _lru_push(e);
+
+            if (e->repr && (e->expires > now)) {
+                DEBUG("nanocoap_proxy: hit %s\n", key);
+                _reply(&w, 0, e->repr, (e->expires - now + 999) / 1000);
+                return;
+            }
+            if (e->pending) {
+                DEBUG("nanocoap_proxy: coalesced %s\n", key);
+                if (_add_waiter(e, pkt, remote)) {
+                    _reply(&w, COAP_CODE_SERVICE_UNAVAILABLE, NULL, 0);
+                }
+                return;
+            }
+        }
+        else {
+            e = _entry_new(key, key_len, hash);
+        }
+        DEBUG("nanocoap_proxy: miss %s\n", key);
+    }
+    else {
+        e = _entry_new(NULL, 0, 0);
+    }
+
+    if (!e) {
+        _reply(&w, COAP_CODE_SERVICE_UNAVAILABLE, NULL, 0);
+        return;
+    }
+    if (_add_waiter(e, pkt, remote)) {
+        _fail(e, COAP_CODE_SERVICE_UNAVAILABLE);
+        return;
+    }
+
+    nanocoap_session_t *up = nanocoap_session_pool_get(_upstreams, NANOCOAP_PROXY_SESSIONS_MAX,
+            &t.ep);
+    if (!up) {
+        _fail(e, COAP_CODE_SERVICE_UNAVAILABLE);
+        return;
+    }
+
+    res = _forward(e, up, pkt, &t);
+    if (res) {
+        _fail(e, (res == -EAGAIN) ? COAP_CODE_SERVICE_UNAVAILABLE : COAP_CODE_BAD_GATEWAY);
+        return;
+    }
+    e->pending = 1;
+}
+
+static void _serve(uint8_t *buf, size_t bufsize)
+{
+    sock_udp_ep_t remote;
+    ssize_t res;
+
+    while ((res = sock_udp_recv(&_sock, buf, bufsize, 0, &remote)) > 0) {
+        coap_pkt_t pkt;
+#if NANOCOAP_STATS
+        coap_stats_rx_drops(sock_udp_get_drop_count(&_sock));
+#endif
+        if (coap_parse(&pkt, buf, res) < 0) {
+            DEBUG("nanocoap_proxy: error parsing packet\n");
+#if NANOCOAP_STATS
+            coap_stats_parse_error();
+#endif
+            continue;
+        }
+        pkt.remote = &remote;
+
+        if (pkt.proxy && (coap_get_code_class(&pkt) == COAP_REQ) &&
+                (pkt.hdr->code != COAP_CODE_EMPTY)) {
+            _proxy(&pkt, &remote);
+        }
+        else {
+            pkt.arena = &_arena;
+            if ((res = coap_handle_req(&pkt, buf, bufsize)) > 0) {
+                sock_udp_send(&_sock, buf, res, &remote);
+            }
+            coap_arena_reset(&_arena);
+        }
+    }
+}
+
+int nanocoap_proxy_server(sock_udp_ep_t *local, uint8_t *buf, size_t bufsize)
+{
+    if (!local->port) {
+        local->port = COAP_PORT;
+    }
+
+    if (coap_arena_init(&_arena)) {
+        return -1;
+    }
+    if (sock_udp_create(&_sock, local, NULL, 0) < 0) {
+        return -1;
+    }
+
+    coap_well_known_core_init();
+
+    static const struct sock_filter filter[] = SOCK_FILTER_COAP;
+    if (sock_udp_attach_filter(&_sock, filter, sizeof(filter) / sizeof(filter[0]))) {
+        DEBUG("nanocoap: error attaching packet filter\n");
+    }
+
+#if NANOCOAP_STATS
+    sock_udp_enable_drop_count(&_sock);
+#endif
+
+    while (1) {
+        struct pollfd fds[1 + NANOCOAP_PROXY_SESSIONS_MAX];
+        nanocoap_session_t *ups[NANOCOAP_PROXY_SESSIONS_MAX];
+        unsigned nfds = 1;
+        int timeout = -1;
+
+        fds[0].fd = _sock.fd;
+        fds[0].events = POLLIN;
+
+        for (unsigned i = 0; i < NANOCOAP_PROXY_SESSIONS_MAX; i++) {
+            nanocoap_session_t *up = &_upstreams[i];
+            if (!up->open) {
+                continue;
+            }
+            int next = nanocoap_session_timeouts(up);
+            if ((next >= 0) && ((timeout < 0) || (next < timeout))) {
+                timeout = next;
+            }
+            fds[nfds].fd = nanocoap_session_fd(up);
+            fds[nfds].events = POLLIN;
+            ups[nfds - 1] = up;
+            nfds++;
+        }
+
+        if (poll(fds, nfds, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        for (unsigned i = 1; i < nfds; i++) {
+            if (fds[i].revents) {
+                nanocoap_session_recv(ups[i - 1], buf, bufsize);
+            }
+        }
+
+        if (fds[0].revents) {
+            _serve(buf, bufsize);
+        }
+    }
+
+    return 0;
+}
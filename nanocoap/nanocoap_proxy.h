@@ -0,0 +1,43 @@
+#ifndef NANOCOAP_PROXY_H
+#define NANOCOAP_PROXY_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "net/sock/udp.h"
+
+/**
+ * @brief   Maximum number of cached responses
+ *
+ * The least recently used entry is evicted when a new one is needed.
+ */
+#ifndef NANOCOAP_PROXY_CACHE_MAX
+#define NANOCOAP_PROXY_CACHE_MAX        (1024U)
+#endif
+
+/**
+ * @brief   Maximum number of origin servers with an open session
+ */
+#ifndef NANOCOAP_PROXY_SESSIONS_MAX
+#define NANOCOAP_PROXY_SESSIONS_MAX     (16U)
+#endif
+
+/**
+ * @brief   Serve coap_resources[] and forward requests carrying a Proxy-Uri or
+ *          Proxy-Scheme option (RFC 7252, 5.7)
+ *
+ * Requests are forwarded through one asynchronous session per origin server,
+ * so a slow origin does not block the proxy. GET responses are kept in a
+ * shared cache for their Max-Age and revalidated with their ETag once stale.
+ * Identical GET requests arriving while one is outstanding are answered by
+ * that one's response, so the origin only sees a single request.
+ *
+ * Responses to forwarded confirmable requests are piggybacked on a (possibly
+ * late) ACK, so a client may retransmit once for a slow origin; retransmitted
+ * requests are coalesced as well. Only IP literals are supported as host.
+ *
+ * Only returns on error.
+ */
+int nanocoap_proxy_server(sock_udp_ep_t *local, uint8_t *buf, size_t bufsize);
+
+#endif /* NANOCOAP_PROXY_H */
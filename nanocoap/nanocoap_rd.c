@@ -0,0 +1,1235 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "net/sock/udp.h"
+
+#include "nanocoap.h"
+#include "nanocoap_rd.h"
+
+#if NANOCOAP_DEBUG
+#define ENABLE_DEBUG (1)
+#else
+#define ENABLE_DEBUG (0)
+#endif
+#include "debug.h"
+
+/* "coap://[" INET6_ADDRSTRLEN "]:65535" */
+#define BASE_MAX            (8 + INET6_ADDRSTRLEN + 7)
+
+/* one key / value pair. Quoted link attribute values are split into one
+ * attribute per space separated value. val is NULL for flags ("obs"). */
+typedef struct {
+    const char *key;
+    const char *val;
+    uint16_t key_len;
+    uint16_t val_len;
+} _attr_t;
+
+struct _ep;
+struct _key;
+
+typedef struct {
+    struct _ep *ep;
+    const char *link;           /* "<href>;attrs" */
+    uint16_t link_len;
+    uint16_t href_len;
+    unsigned attrs;             /* first attribute in ep->attrs */
+    unsigned attrs_numof;
+    uint32_t stamp;
+} _res_t;
+
+/* entry of the posting list of one index key, for attribute attrs[i] of a
+ * registration: ep->nodes[i] */
+typedef struct _node {
+    struct _node *next;
+    struct _node *prev;
+    struct _key *key;
+    struct _ep *ep;
+    _res_t *res;                /* NULL for endpoint attributes */
+} _node_t;
+
+typedef struct _key {
+    struct _key *chain;
+    _node_t *head;
+    _node_t *tail;
+    unsigned count;
+    uint32_t hash;
+    uint16_t len;
+    char str[];                 /* "key=value", "key" or "/reg/<id>" */
+} _key_t;
+
+typedef struct _ep {
+    struct _ep *next;           /* all registrations */
+    struct _ep *prev;
+    struct _ep *tnext;          /* timer wheel slot */
+    struct _ep *tprev;
+    uint32_t id;
+    uint32_t lt;
+    uint64_t expires;
+    uint32_t stamp;
+    char *data;                 /* attrs, res, nodes and text, one allocation */
+    const char *qs;             /* registration parameters */
+    size_t qs_len;
+    const char *links;
+    size_t links_len;
+    const char *base;
+    size_t base_len;
+    _attr_t *attrs;             /* endpoint attributes first */
+    unsigned ep_attrs_numof;
+    unsigned attrs_numof;
+    _res_t *res;
+    unsigned res_numof;
+    _node_t *nodes;
+    _node_t id_node;
+    char location[16];          /* "/reg/<id>" */
+} _ep_t;
+
+typedef struct {
+    const char *key;
+    const char *val;            /* NULL: match presence of key */
+    uint16_t key_len;
+    uint16_t val_len;
+    int prefix;
+} _filter_t;
+
+typedef struct {
+    _filter_t filters[NANOCOAP_RD_FILTERS_MAX];
+    unsigned numof;
+    unsigned page;
+    unsigned count;             /* 0: unlimited */
+} _query_t;
+
+/* writes one block of a response */
+typedef struct {
+    coap_block_slicer_t slicer;
+    uint8_t *pos;
+    unsigned skip;
+    unsigned left;
+} _out_t;
+
+static _key_t **_keys;
+static unsigned _keys_size;
+static unsigned _keys_numof;
+
+static _ep_t *_eps_head;
+static _ep_t *_eps_tail;
+static unsigned _eps_numof;
+static uint32_t _next_id = 1;
+static uint32_t _stamp;
+
+static _ep_t *_wheel[NANOCOAP_RD_WHEEL_SLOTS];
+static uint64_t _wheel_now;
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static uint32_t _fnv(uint32_t hash, const char *str, size_t len)
+{
+    while (len--) {
+        hash = (hash ^ (uint8_t)*str++) * 16777619U;
+    }
+    return hash;
+}
+
+/* index keys are "key=value" or "key" for flags, hashed without copying */
+static uint32_t _hash(const _attr_t *attr)
+{
+    uint32_t hash = _fnv(2166136261U, attr->key, attr->key_len);
+    if (attr->val) {
+        hash = _fnv(_fnv(hash, "=", 1), attr->val, attr->val_len);
+    }
+    return hash;
+}
+
+static size_t _attr_key(char *buf, const _attr_t *attr)
+{
+    memcpy(buf, attr->key, attr->key_len);
+    if (!attr->val) {
+        return attr->key_len;
+    }
+    buf[attr->key_len] = '=';
+    memcpy(buf + attr->key_len + 1, attr->val, attr->val_len);
+    return attr->key_len + 1 + attr->val_len;
+}
+
+static _key_t *_key_find(const _attr_t *attr, uint32_t hash)
+{
+    size_t len = attr->key_len + (attr->val ? 1 + attr->val_len : 0);
+
+    if (!_keys_size) {
+        return NULL;
+    }
+    for (_key_t *key = _keys[hash & (_keys_size - 1)]; key; key = key->chain) {
+        if ((key->hash == hash) && (key->len == len) &&
+                !memcmp(key->str, attr->key, attr->key_len) &&
+                (!attr->val || !memcmp(key->str + attr->key_len + 1, attr->val, attr->val_len))) {
+            return key;
+        }
+    }
+    return NULL;
+}
+
+static int _keys_grow(void)
+{
+    unsigned size = _keys_size ? _keys_size * 2 : 1024;
+    _key_t **keys = calloc(size, sizeof(_key_t *));
+    if (!keys) {
+        return -ENOMEM;
+    }
+
+    for (unsigned i = 0; i < _keys_size; i++) {
+        _key_t *key = _keys[i];
+        while (key) {
+            _key_t *next = key->chain;
+            key->chain = keys[key->hash & (size - 1)];
+            keys[key->hash & (size - 1)] = key;
+            key = next;
+        }
+    }
+
+    free(_keys);
+    _keys = keys;
+    _keys_size = size;
+    return 0;
+}
+
+static int _index_add(_node_t *node, const _attr_t *attr)
+{
+    uint32_t hash = _hash(attr);
+    _key_t *key = _key_find(attr, hash);
+
+    if (!key) {
+        if ((_keys_numof >= _keys_size) && _keys_grow()) {
+            return -ENOMEM;
+        }
+        key = malloc(sizeof(_key_t) + attr->key_len + 1 + attr->val_len);
+        if (!key) {
+            return -ENOMEM;
+        }
+        key->head = key->tail = NULL;
+        key->count = 0;
+        key->hash = hash;
+        key->len = _attr_key(key->str, attr);
+        key->chain = _keys[hash & (_keys_size - 1)];
+        _keys[hash & (_keys_size - 1)] = key;
+        _keys_numof++;
+    }
+
+    /* append, so posting lists are in registration order */
+    node->key = key;
+    node->next = NULL;
+    node->prev = key->tail;
+    if (key->tail) {
+        key->tail->next = node;
+    }
+    else {
+        key->head = node;
+    }
+    key->tail = node;
+    key->count++;
+
+    return 0;
+}
+
+static void _index_remove(_node_t *node)
+{
+    _key_t *key = node->key;
+    if (!key) {
+        return;
+    }
+
+    if (node->prev) {
+        node->prev->next = node->next;
+    }
+    else {
+        key->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    }
+    else {
+        key->tail = node->prev;
+    }
+    node->key = NULL;
+
+    if (--key->count == 0) {
+        _key_t **pos = &_keys[key->hash & (_keys_size - 1)];
+        while (*pos != key) {
+            pos = &(*pos)->chain;
+        }
+        *pos = key->chain;
+        _keys_numof--;
+        free(key);
+    }
+}
+
+static void _unindex(_ep_t *ep)
+{
+    for (unsigned i = 0; i < ep->attrs_numof; i++) {
+        _index_remove(&ep->nodes[i]);
+    }
+}
+
+/* indexes all of @p attrs, or none of them */
+static int _index(_ep_t *ep, const _attr_t *attrs, _node_t *nodes, unsigned numof)
+{
+    for (unsigned i = 0; i < numof; i++) {
+        nodes[i].ep = ep;
+        if (_index_add(&nodes[i], &attrs[i])) {
+            while (i--) {
+                _index_remove(&nodes[i]);
+            }
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static void _attr_set(_attr_t *attr, const char *key, size_t key_len,
+        const char *val, size_t val_len)
+{
+    if (attr) {
+        attr->key = key;
+        attr->key_len = key_len;
+        attr->val = val;
+        attr->val_len = val_len;
+    }
+}
+
+/* splits "k1=v1&k2=v2&flag" (counts only if @p attrs is NULL) */
+static unsigned _parse_qs(_attr_t *attrs, const char *pos, const char *end)
+{
+    unsigned n = 0;
+
+    while (pos < end) {
+        const char *key = pos;
+        const char *param_end = memchr(pos, '&', end - pos);
+        if (!param_end) {
+            param_end = end;
+        }
+        const char *eq = memchr(key, '=', param_end - key);
+        if (param_end > key) {
+            if (eq) {
+                _attr_set(attrs ? &attrs[n] : NULL, key, eq - key, eq + 1, param_end - eq - 1);
+            }
+            else {
+                _attr_set(attrs ? &attrs[n] : NULL, key, param_end - key, NULL, 0);
+            }
+            n++;
+        }
+        pos = param_end + 1;
+    }
+
+    return n;
+}
+
+/* parses a link-format document: "<href>;k=v;k=\"v1 v2\";flag,<href>...".
+ * Counts only if @p attrs is NULL. Returns the number of attributes (href
+ * included) or -EBADMSG. */
+static int _parse_links(_attr_t *attrs, _res_t *res, unsigned *res_numof,
+        const char *pos, const char *end)
+{
+    unsigned n = 0, r = 0;
+
+    while (pos < end) {
+        const char *link = pos;
+        if (*pos++ != '<') {
+            return -EBADMSG;
+        }
+        const char *href_end = memchr(pos, '>', end - pos);
+        if (!href_end) {
+            return -EBADMSG;
+        }
+        if (res) {
+            res[r].link = link;
+            res[r].href_len = href_end - pos;
+            res[r].attrs = n;
+        }
+        _attr_set(attrs ? &attrs[n] : NULL, "href", 4, pos, href_end - pos);
+        n++;
+        pos = href_end + 1;
+
+        while ((pos < end) && (*pos == ';')) {
+            const char *key = ++pos;
+            while ((pos < end) && !strchr("=;,", *pos)) {
+                pos++;
+            }
+            size_t key_len = pos - key;
+            if (!key_len) {
+                return -EBADMSG;
+            }
+
+            if ((pos == end) || (*pos != '=')) {
+                _attr_set(attrs ? &attrs[n] : NULL, key, key_len, NULL, 0);
+                n++;
+                continue;
+            }
+
+            if ((++pos < end) && (*pos == '"')) {
+                pos++;
+                while ((pos < end) && (*pos != '"')) {
+                    const char *val = pos;
+                    while ((pos < end) && (*pos != '"') && (*pos != ' ')) {
+                        pos++;
+                    }
+                    if (pos > val) {
+                        _attr_set(attrs ? &attrs[n] : NULL, key, key_len, val, pos - val);
+                        n++;
+                    }
+                    if ((pos < end) && (*pos == ' ')) {
+                        pos++;
+                    }
+                }
+                if (pos++ == end) {
+                    return -EBADMSG;
+                }
+            }
+            else {
+                const char *val = pos;
+                while ((pos < end) && (*pos != ';') && (*pos != ',')) {
+                    pos++;
+                }
+                _attr_set(attrs ? &attrs[n] : NULL, key, key_len, val, pos - val);
+                n++;
+            }
+        }
+
+        if (res) {
+            res[r].link_len = pos - link;
+            res[r].attrs_numof = n - res[r].attrs;
+        }
+        r++;
+
+        if (pos < end) {
+            if (*pos++ != ',') {
+                return -EBADMSG;
+            }
+        }
+    }
+
+    *res_numof = r;
+    return n;
+}
+
+static const _attr_t *_ep_attr(const _ep_t *ep, const char *key)
+{
+    size_t key_len = strlen(key);
+    for (unsigned i = 0; i < ep->ep_attrs_numof; i++) {
+        const _attr_t *attr = &ep->attrs[i];
+        if ((attr->key_len == key_len) && !memcmp(attr->key, key, key_len)) {
+            return attr;
+        }
+    }
+    return NULL;
+}
+
+static size_t _fmt_base(char *buf, const coap_pkt_t *pkt)
+{
+    const sock_udp_ep_t *remote = pkt->remote;
+    char addr[INET6_ADDRSTRLEN];
+
+    if (!remote || !inet_ntop(remote->family, &remote->addr, addr, sizeof(addr))) {
+        return 0;
+    }
+    if (remote->family == AF_INET6) {
+        return sprintf(buf, "coap://[%s]:%u", addr, remote->port);
+    }
+    return sprintf(buf, "coap://%s:%u", addr, remote->port);
+}
+
+/* builds the attributes of a registration from its parameters and links.
+ * The base URI is taken from the sender if not given explicitly. On error,
+ * the registration is left as it was. */
+static int _ep_set(_ep_t *ep, coap_pkt_t *pkt, const char *qs, size_t qs_len,
+        const char *links, size_t links_len)
+{
+    unsigned ep_attrs_numof = _parse_qs(NULL, qs, qs + qs_len);
+    unsigned res_numof;
+    int links_attrs = _parse_links(NULL, NULL, &res_numof, links, links + links_len);
+    if (links_attrs < 0) {
+        return links_attrs;
+    }
+
+    unsigned attrs_numof = ep_attrs_numof + links_attrs + 1;
+    size_t size = attrs_numof * (sizeof(_attr_t) + sizeof(_node_t)) +
+            res_numof * sizeof(_res_t) + qs_len + 1 + BASE_MAX + links_len;
+    char *data = malloc(size);
+    if (!data) {
+        return -ENOMEM;
+    }
+
+    _attr_t *attrs = (_attr_t *)data;
+    _node_t *nodes = (_node_t *)(attrs + attrs_numof);
+    _res_t *res = (_res_t *)(nodes + attrs_numof);
+    char *text = (char *)(res + res_numof);
+
+    char *new_qs = text;
+    memcpy(new_qs, qs, qs_len);
+    new_qs[qs_len] = '\0';
+    char *new_links = new_qs + qs_len + 1;
+    memcpy(new_links, links, links_len);
+    char *derived_base = new_links + links_len;
+
+    unsigned n = _parse_qs(attrs, new_qs, new_qs + qs_len);
+    _ep_t tmp = { .attrs = attrs, .ep_attrs_numof = n };
+    const _attr_t *base_attr = _ep_attr(&tmp, "base");
+    const char *base = derived_base;
+    size_t base_len;
+    if (base_attr) {
+        if (!base_attr->val) {
+            free(data);
+            return -EINVAL;
+        }
+        base = base_attr->val;
+        base_len = base_attr->val_len;
+    }
+    else {
+        base_len = _fmt_base(derived_base, pkt);
+        if (!base_len) {
+            free(data);
+            return -EINVAL;
+        }
+        _attr_set(&attrs[n++], "base", 4, base, base_len);
+    }
+
+    unsigned res_attrs = n;
+    _parse_links(attrs + res_attrs, res, &res_numof, new_links, new_links + links_len);
+
+    for (unsigned i = 0; i < attrs_numof; i++) {
+        nodes[i].key = NULL;
+        nodes[i].res = NULL;
+    }
+    for (unsigned i = 0; i < res_numof; i++) {
+        res[i].ep = ep;
+        res[i].attrs += res_attrs;
+        res[i].stamp = 0;
+        for (unsigned j = 0; j < res[i].attrs_numof; j++) {
+            nodes[res[i].attrs + j].res = &res[i];
+        }
+    }
+
+    /* the new attributes are indexed before the old ones are dropped */
+    if (_index(ep, attrs, nodes, res_attrs + links_attrs)) {
+        free(data);
+        return -ENOMEM;
+    }
+    _unindex(ep);
+    free(ep->data);
+
+    ep->data = data;
+    ep->base = base;
+    ep->base_len = base_len;
+    ep->qs = new_qs;
+    ep->qs_len = qs_len;
+    ep->links = new_links;
+    ep->links_len = links_len;
+    ep->attrs = attrs;
+    ep->ep_attrs_numof = res_attrs;
+    ep->attrs_numof = res_attrs + links_attrs;
+    ep->res = res;
+    ep->res_numof = res_numof;
+    ep->nodes = nodes;
+
+    return 0;
+}
+
+static void _wheel_remove(_ep_t *ep)
+{
+    if (ep->tprev) {
+        ep->tprev->tnext = ep->tnext;
+    }
+    else if (_wheel[ep->expires % NANOCOAP_RD_WHEEL_SLOTS] == ep) {
+        _wheel[ep->expires % NANOCOAP_RD_WHEEL_SLOTS] = ep->tnext;
+    }
+    if (ep->tnext) {
+        ep->tnext->tprev = ep->tprev;
+    }
+    ep->tnext = ep->tprev = NULL;
+}
+
+static void _schedule(_ep_t *ep, uint64_t now)
+{
+    _wheel_remove(ep);
+
+    ep->expires = now + ep->lt;
+    _ep_t **slot = &_wheel[ep->expires % NANOCOAP_RD_WHEEL_SLOTS];
+    ep->tnext = *slot;
+    if (*slot) {
+        (*slot)->tprev = ep;
+    }
+    *slot = ep;
+}
+
+static void _ep_free(_ep_t *ep)
+{
+    _wheel_remove(ep);
+    _unindex(ep);
+    _index_remove(&ep->id_node);
+
+    if (ep->prev) {
+        ep->prev->next = ep->next;
+    }
+    else {
+        _eps_head = ep->next;
+    }
+    if (ep->next) {
+        ep->next->prev = ep->prev;
+    }
+    else {
+        _eps_tail = ep->prev;
+    }
+    _eps_numof--;
+
+    free(ep->data);
+    free(ep);
+}
+
+/* expires everything due up to @p now, one slot per elapsed second */
+static void _advance(uint64_t now)
+{
+    if (!_wheel_now) {
+        _wheel_now = now;
+        return;
+    }
+
+    unsigned steps = 0;
+    while ((_wheel_now < now) && (steps++ < NANOCOAP_RD_WHEEL_SLOTS)) {
+        _wheel_now++;
+        _ep_t *ep = _wheel[_wheel_now % NANOCOAP_RD_WHEEL_SLOTS];
+        while (ep) {
+            _ep_t *next = ep->tnext;
+            if (ep->expires <= now) {
+                DEBUG("nanocoap_rd: %s expired\n", ep->location);
+                _ep_free(ep);
+            }
+            ep = next;
+        }
+    }
+    _wheel_now = now;
+}
+
+static void _location_attr(_attr_t *attr, const char *location)
+{
+    _attr_set(attr, location, strlen(location), NULL, 0);
+}
+
+static _ep_t *_ep_by_location(const char *location)
+{
+    _attr_t attr;
+    _location_attr(&attr, location);
+    _key_t *key = _key_find(&attr, _hash(&attr));
+
+    /* the same key could be registered as a flag attribute, too */
+    for (_node_t *node = key ? key->head : NULL; node; node = node->next) {
+        if (node == &node->ep->id_node) {
+            return node->ep;
+        }
+    }
+    return NULL;
+}
+
+static int _attr_eq(const _attr_t *a, const _attr_t *b)
+{
+    if (!a || !b) {
+        return a == b;
+    }
+    return (a->val_len == b->val_len) && !memcmp(a->val, b->val, a->val_len);
+}
+
+/* the registration of endpoint name @p name in sector @p d, if any */
+static _ep_t *_ep_by_name(const _attr_t *name, const _attr_t *d)
+{
+    _key_t *key = _key_find(name, _hash(name));
+
+    for (_node_t *node = key ? key->head : NULL; node; node = node->next) {
+        if (!node->res && _attr_eq(_ep_attr(node->ep, "d"), d)) {
+            return node->ep;
+        }
+    }
+    return NULL;
+}
+
+static int _parse_lt(const _attr_t *attr, uint32_t *lt)
+{
+    if (!attr) {
+        *lt = COAP_RD_LT_DEFAULT;
+        return 0;
+    }
+
+    uint64_t val = 0;
+    if (!attr->val || !attr->val_len || (attr->val_len > 10)) {
+        return -EINVAL;
+    }
+    for (unsigned i = 0; i < attr->val_len; i++) {
+        if ((attr->val[i] < '0') || (attr->val[i] > '9')) {
+            return -EINVAL;
+        }
+        val = val * 10 + (attr->val[i] - '0');
+    }
+    if (!val || (val > UINT32_MAX)) {
+        return -EINVAL;
+    }
+
+    *lt = val;
+    return 0;
+}
+
+static int _check_ct(coap_pkt_t *pkt)
+{
+    return !pkt->payload_len || (pkt->content_type == COAP_FORMAT_NONE) ||
+           (pkt->content_type == COAP_CT_LINK_FORMAT);
+}
+
+static ssize_t _reply_error(coap_pkt_t *pkt, int res, uint8_t *buf, size_t len)
+{
+    unsigned code = (res == -ENOMEM) ? COAP_CODE_SERVICE_UNAVAILABLE : COAP_CODE_BAD_REQUEST;
+    return coap_build_reply(pkt, code, buf, len, 0);
+}
+
+ssize_t coap_rd_register_handler(coap_pkt_t *pkt, uint8_t *buf, size_t len)
+{
+    uint64_t now = _now();
+    _advance(now);
+
+    if (!_check_ct(pkt)) {
+        return coap_build_reply(pkt, COAP_CODE_UNSUPPORTED_CONTENT_FORMAT, buf, len, 0);
+    }
+
+    const char *qs = (char *)pkt->qs;
+    _attr_t params[NANOCOAP_QS_MAX / 2];
+    _ep_t tmp = { .attrs = params, .ep_attrs_numof = _parse_qs(params, qs, qs + strlen(qs)) };
+    const _attr_t *name = _ep_attr(&tmp, "ep");
+    uint32_t lt;
+
+    if (!name || !name->val || !name->val_len || _parse_lt(_ep_attr(&tmp, "lt"), &lt)) {
+        return coap_build_reply(pkt, COAP_CODE_BAD_REQUEST, buf, len, 0);
+    }
+
+    /* registering again replaces the previous registration */
+    _ep_t *ep = _ep_by_name(name, _ep_attr(&tmp, "d"));
+    int created = 0;
+    if (!ep) {
+        ep = calloc(1, sizeof(_ep_t));
+        if (!ep) {
+            return _reply_error(pkt, -ENOMEM, buf, len);
+        }
+        ep->id = _next_id++;
+        snprintf(ep->location, sizeof(ep->location), "/reg/%u", (unsigned)ep->id);
+        created = 1;
+    }
+
+    int res = _ep_set(ep, pkt, qs, strlen(qs), (char *)pkt->payload, pkt->payload_len);
+    if (!res && created) {
+        _attr_t location;
+        _location_attr(&location, ep->location);
+        ep->id_node.ep = ep;
+        res = _index_add(&ep->id_node, &location);
+    }
+    if (res) {
+        if (created) {
+            _unindex(ep);
+            free(ep->data);
+            free(ep);
+        }
+        return _reply_error(pkt, res, buf, len);
+    }
+
+    if (created) {
+        ep->prev = _eps_tail;
+        if (_eps_tail) {
+            _eps_tail->next = ep;
+        }
+        else {
+            _eps_head = ep;
+        }
+        _eps_tail = ep;
+        _eps_numof++;
+    }
+
+    ep->lt = lt;
+    _schedule(ep, now);
+    DEBUG("nanocoap_rd: registered %s (%u links)\n", ep->location, ep->res_numof);
+
+    coap_builder_t b;
+    coap_builder_init_reply(&b, buf, len, pkt, COAP_CODE_CREATED);
+    coap_builder_add_opt(&b, COAP_OPT_LOCATION_PATH, "reg", 3);
+    coap_builder_add_opt(&b, COAP_OPT_LOCATION_PATH, ep->location + 5,
+            strlen(ep->location + 5));
+    return coap_builder_finish(&b, NULL, 0);
+}
+
+/* parameters of an update replace those of the same name */
+static ssize_t _update(_ep_t *ep, coap_pkt_t *pkt, uint8_t *buf, size_t len, uint64_t now)
+{
+    const char *qs = (char *)pkt->qs;
+    size_t qs_len = strlen(qs);
+    _attr_t params[NANOCOAP_QS_MAX / 2];
+    _ep_t tmp = { .attrs = params, .ep_attrs_numof = _parse_qs(params, qs, qs + qs_len) };
+    uint32_t lt = ep->lt;
+
+    if (!_check_ct(pkt)) {
+        return coap_build_reply(pkt, COAP_CODE_UNSUPPORTED_CONTENT_FORMAT, buf, len, 0);
+    }
+    if (_ep_attr(&tmp, "lt") && _parse_lt(_ep_attr(&tmp, "lt"), &lt)) {
+        return coap_build_reply(pkt, COAP_CODE_BAD_REQUEST, buf, len, 0);
+    }
+    if (_ep_attr(&tmp, "ep") || _ep_attr(&tmp, "d")) {
+        /* name and sector are fixed for the lifetime of a registration */
+        return coap_build_reply(pkt, COAP_CODE_BAD_REQUEST, buf, len, 0);
+    }
+
+    /* a base taken from the sender follows its address */
+    int rebuild = qs_len || pkt->payload_len;
+    if ((ep->base < ep->qs) || (ep->base >= ep->qs + ep->qs_len)) {
+        char base[BASE_MAX];
+        size_t base_len = _fmt_base(base, pkt);
+        rebuild |= (base_len != ep->base_len) || memcmp(base, ep->base, base_len);
+    }
+
+    if (rebuild) {
+        char *merged = malloc(ep->qs_len + qs_len + 2);
+        if (!merged) {
+            return _reply_error(pkt, -ENOMEM, buf, len);
+        }
+
+        char *pos = merged;
+        for (unsigned i = 0; i < ep->ep_attrs_numof; i++) {
+            const _attr_t *attr = &ep->attrs[i];
+            if ((attr->key < ep->qs) || (attr->key >= ep->qs + ep->qs_len)) {
+                /* derived base */
+                continue;
+            }
+            int replaced = 0;
+            for (unsigned j = 0; j < tmp.ep_attrs_numof; j++) {
+                if ((params[j].key_len == attr->key_len) &&
+                        !memcmp(params[j].key, attr->key, attr->key_len)) {
+                    replaced = 1;
+                }
+            }
+            if (!replaced) {
+                if (pos != merged) {
+                    *pos++ = '&';
+                }
+                pos += _attr_key(pos, attr);
+            }
+        }
+        if (qs_len) {
+            if (pos != merged) {
+                *pos++ = '&';
+            }
+            memcpy(pos, qs, qs_len);
+            pos += qs_len;
+        }
+
+        const char *links = pkt->payload_len ? (char *)pkt->payload : ep->links;
+        size_t links_len = pkt->payload_len ? pkt->payload_len : ep->links_len;
+        char *old_links = NULL;
+        if (!pkt->payload_len && links_len) {
+            /* _ep_set() frees the old links */
+            old_links = malloc(links_len);
+            if (!old_links) {
+                free(merged);
+                return _reply_error(pkt, -ENOMEM, buf, len);
+            }
+            memcpy(old_links, links, links_len);
+            links = old_links;
+        }
+
+        int res = _ep_set(ep, pkt, merged, pos - merged, links, links_len);
+        free(merged);
+        free(old_links);
+        if (res) {
+            return _reply_error(pkt, res, buf, len);
+        }
+    }
+
+    ep->lt = lt;
+    _schedule(ep, now);
+    return coap_build_reply(pkt, COAP_CODE_CHANGED, buf, len, 0);
+}
+
+static unsigned _put(_out_t *out, const void *data, size_t len)
+{
+    out->pos += coap_blockwise_put_bytes(&out->slicer, out->pos, data, len);
+    /* stop once it is known whether there is a next block */
+    return out->slicer.cur > out->slicer.end;
+}
+
+static unsigned _put_str(_out_t *out, const char *str)
+{
+    return _put(out, str, strlen(str));
+}
+
+/* writes one block of a link-format response generated by @p gen */
+static ssize_t _reply_links(coap_pkt_t *pkt, uint8_t *buf, size_t len,
+        void (*gen)(_out_t *out, void *arg), void *arg, unsigned skip, unsigned count)
+{
+    /* header, token, Content-Format, Block2, payload marker */
+    size_t overhead = coap_get_total_hdr_len(pkt) + 2 + 4 + 1;
+    if (len <= overhead + 16) {
+        return -ENOSPC;
+    }
+
+    uint32_t blknum = 0;
+    unsigned szx = 6;
+    int blockwise = (coap_get_block2(pkt, &blknum, &szx) == 0);
+    /* same offset at the smaller size (RFC 7959, 2.2) */
+    while ((16U << szx) > len - overhead) {
+        szx--;
+        blknum <<= 1;
+    }
+
+    uint8_t block[16U << 6];
+    _out_t out = { .pos = block, .skip = skip, .left = count ? count : UINT32_MAX };
+    coap_block_slicer_init(&out.slicer, blknum, szx);
+
+    gen(&out, arg);
+
+    int more = out.slicer.cur > out.slicer.end;
+    if (blknum && (out.slicer.start >= out.slicer.cur)) {
+        return coap_build_reply(pkt, COAP_CODE_BAD_OPTION, buf, len, 0);
+    }
+
+    coap_builder_t b;
+    coap_builder_init_reply(&b, buf, len, pkt, COAP_CODE_205);
+    coap_builder_add_ct(&b, COAP_CT_LINK_FORMAT);
+    if (blockwise || more) {
+        coap_builder_add_uint(&b, COAP_OPT_BLOCK2, coap_block_opt_value(blknum, more, szx));
+    }
+    return coap_builder_finish(&b, block, out.pos - block);
+}
+
+static void _gen_links(_out_t *out, void *arg)
+{
+    _ep_t *ep = arg;
+    _put(out, ep->links, ep->links_len);
+}
+
+ssize_t coap_rd_registration_handler(coap_pkt_t *pkt, uint8_t *buf, size_t len)
+{
+    uint64_t now = _now();
+    _advance(now);
+
+    _ep_t *ep = _ep_by_location((char *)pkt->url);
+    if (!ep) {
+        return coap_build_reply(pkt, COAP_CODE_404, buf, len, 0);
+    }
+
+    switch (coap_get_code_detail(pkt)) {
+        case COAP_METHOD_POST:
+            return _update(ep, pkt, buf, len, now);
+        case COAP_METHOD_DELETE:
+            DEBUG("nanocoap_rd: removed %s\n", ep->location);
+            _ep_free(ep);
+            return coap_build_reply(pkt, COAP_CODE_DELETED, buf, len, 0);
+        default:
+            return _reply_links(pkt, buf, len, _gen_links, ep, 0, 0);
+    }
+}
+
+static int _parse_uint(const char *str, size_t len, unsigned *val)
+{
+    *val = 0;
+    if (!len || (len > 9)) {
+        return -EINVAL;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if ((str[i] < '0') || (str[i] > '9')) {
+            return -EINVAL;
+        }
+        *val = *val * 10 + (str[i] - '0');
+    }
+    return 0;
+}
+
+static int _parse_query(_query_t *query, coap_pkt_t *pkt)
+{
+    const char *qs = (char *)pkt->qs;
+    _attr_t params[NANOCOAP_QS_MAX / 2];
+    unsigned numof = _parse_qs(params, qs, qs + strlen(qs));
+
+    memset(query, 0, sizeof(*query));
+    for (unsigned i = 0; i < numof; i++) {
+        _attr_t *param = &params[i];
+        if ((param->key_len == 4) && !memcmp(param->key, "page", 4)) {
+            if (!param->val || _parse_uint(param->val, param->val_len, &query->page)) {
+                return -EINVAL;
+            }
+            continue;
+        }
+        if ((param->key_len == 5) && !memcmp(param->key, "count", 5)) {
+            if (!param->val || _parse_uint(param->val, param->val_len, &query->count)) {
+                return -EINVAL;
+            }
+            continue;
+        }
+        if ((query->numof == NANOCOAP_RD_FILTERS_MAX) || (*param->key == '/')) {
+            return -EINVAL;
+        }
+
+        _filter_t *filter = &query->filters[query->numof++];
+        filter->key = param->key;
+        filter->key_len = param->key_len;
+        filter->val = param->val;
+        filter->val_len = param->val_len;
+        filter->prefix = param->val && param->val_len && (param->val[param->val_len - 1] == '*');
+        filter->val_len -= filter->prefix;
+    }
+
+    return 0;
+}
+
+static int _attr_match(const _attr_t *attr, const _filter_t *filter)
+{
+    if ((attr->key_len != filter->key_len) || memcmp(attr->key, filter->key, attr->key_len)) {
+        return 0;
+    }
+    if (!filter->val) {
+        return 1;
+    }
+    if (!attr->val || (attr->val_len < filter->val_len) ||
+            (!filter->prefix && (attr->val_len != filter->val_len))) {
+        return 0;
+    }
+    return !memcmp(attr->val, filter->val, filter->val_len);
+}
+
+static int _attrs_match(const _attr_t *attrs, unsigned numof, const _filter_t *filter)
+{
+    for (unsigned i = 0; i < numof; i++) {
+        if (_attr_match(&attrs[i], filter)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* endpoint lookups match filters on the endpoint or any of its links */
+static int _ep_match(const _ep_t *ep, const _query_t *query)
+{
+    for (unsigned i = 0; i < query->numof; i++) {
+        if (!_attrs_match(ep->attrs, ep->attrs_numof, &query->filters[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* resource lookups match filters on the link or its endpoint */
+static int _res_match(const _res_t *res, const _query_t *query)
+{
+    const _ep_t *ep = res->ep;
+    for (unsigned i = 0; i < query->numof; i++) {
+        const _filter_t *filter = &query->filters[i];
+        if (!_attrs_match(ep->attrs, ep->ep_attrs_numof, filter) &&
+                !_attrs_match(ep->attrs + res->attrs, res->attrs_numof, filter)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* the posting list of the most selective exact filter. Returns 0 if there is
+ * no exact filter, so all registrations need to be checked. */
+static int _candidates(const _query_t *query, _node_t **head)
+{
+    unsigned best = UINT32_MAX;
+
+    for (unsigned i = 0; i < query->numof; i++) {
+        const _filter_t *filter = &query->filters[i];
+        if (filter->prefix || !filter->val) {
+            /* only checked on the candidates */
+            continue;
+        }
+        _attr_t attr = { .key = filter->key, .key_len = filter->key_len,
+                         .val = filter->val, .val_len = filter->val_len };
+        _key_t *key = _key_find(&attr, _hash(&attr));
+        if (!key) {
+            *head = NULL;
+            return 1;
+        }
+        if (key->count < best) {
+            best = key->count;
+            *head = key->head;
+        }
+    }
+
+    return best != UINT32_MAX;
+}
+
+/* returns nonzero once the response is complete */
+static int _emit_start(_out_t *out)
+{
+    if (out->skip) {
+        out->skip--;
+        return -1;
+    }
+    if (!out->left) {
+        return 1;
+    }
+    out->left--;
+    return (out->slicer.cur && _put(out, ",", 1));
+}
+
+static int _emit_ep(_out_t *out, _ep_t *ep)
+{
+    int res = _emit_start(out);
+    if (res) {
+        return res > 0;
+    }
+
+    char tmp[24];
+    _put(out, "<", 1);
+    _put_str(out, ep->location);
+    _put(out, ">", 1);
+    for (unsigned i = 0; i < ep->ep_attrs_numof; i++) {
+        const _attr_t *attr = &ep->attrs[i];
+        if ((attr->key_len == 2) && !memcmp(attr->key, "lt", 2)) {
+            continue;
+        }
+        _put(out, ";", 1);
+        _put(out, attr->key, attr->key_len);
+        if (attr->val) {
+            _put(out, "=\"", 2);
+            _put(out, attr->val, attr->val_len);
+            _put(out, "\"", 1);
+        }
+    }
+    snprintf(tmp, sizeof(tmp), ";lt=%u", (unsigned)ep->lt);
+    return _put_str(out, tmp);
+}
+
+static int _emit_res(_out_t *out, _res_t *res)
+{
+    int skip = _emit_start(out);
+    if (skip) {
+        return skip > 0;
+    }
+
+    _ep_t *ep = res->ep;
+    const char *href = res->link + 1;
+    const _filter_t anchor = { .key = "anchor", .key_len = 6 };
+
+    /* relative references are resolved against the base URI */
+    _put(out, "<", 1);
+    if (!memchr(href, ':', res->href_len)) {
+        _put(out, ep->base, ep->base_len);
+        /* "temp" is joined to the base as "/temp" */
+        if (res->href_len && (href[0] != '/') &&
+                (!ep->base_len || (ep->base[ep->base_len - 1] != '/'))) {
+            _put(out, "/", 1);
+        }
+    }
+    _put(out, href, res->href_len);
+    _put(out, ">", 1);
+    _put(out, href + res->href_len + 1, res->link_len - res->href_len - 2);
+    if (!_attrs_match(ep->attrs + res->attrs, res->attrs_numof, &anchor)) {
+        _put(out, ";anchor=\"", 9);
+        _put(out, ep->base, ep->base_len);
+        _put(out, "\"", 1);
+    }
+    return out->slicer.cur > out->slicer.end;
+}
+
+typedef struct {
+    _query_t query;
+    int res;                    /* resource lookup */
+} _lookup_t;
+
+static int _lookup_ep(_out_t *out, _lookup_t *lookup, _ep_t *ep)
+{
+    if (ep->stamp == _stamp) {
+        return 0;
+    }
+    ep->stamp = _stamp;
+    if (!lookup->res) {
+        return _ep_match(ep, &lookup->query) && _emit_ep(out, ep);
+    }
+
+    for (unsigned i = 0; i < ep->res_numof; i++) {
+        _res_t *res = &ep->res[i];
+        if (res->stamp == _stamp) {
+            continue;
+        }
+        res->stamp = _stamp;
+        if (_res_match(res, &lookup->query) && _emit_res(out, res)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void _gen_lookup(_out_t *out, void *arg)
+{
+    _lookup_t *lookup = arg;
+    _node_t *node = NULL;
+
+    /* every registration and link is emitted at most once per lookup */
+    _stamp++;
+
+    if (!_candidates(&lookup->query, &node)) {
+        for (_ep_t *ep = _eps_head; ep; ep = ep->next) {
+            if (_lookup_ep(out, lookup, ep)) {
+                return;
+            }
+        }
+        return;
+    }
+
+    for (; node; node = node->next) {
+        _res_t *res = node->res;
+        if (!res || !lookup->res) {
+            if (_lookup_ep(out, lookup, node->ep)) {
+                return;
+            }
+        }
+        else if (res->stamp != _stamp) {
+            res->stamp = _stamp;
+            if (_res_match(res, &lookup->query) && _emit_res(out, res)) {
+                return;
+            }
+        }
+    }
+}
+
+static ssize_t _lookup(coap_pkt_t *pkt, uint8_t *buf, size_t len, int res)
+{
+    _advance(_now());
+
+    _lookup_t lookup = { .res = res };
+    if (_parse_query(&lookup.query, pkt)) {
+        return coap_build_reply(pkt, COAP_CODE_BAD_REQUEST, buf, len, 0);
+    }
+    unsigned skip = 0;
+    if (lookup.query.count) {
+        /* a page past UINT_MAX results is empty */
+        skip = (lookup.query.page > UINT_MAX / lookup.query.count)
+             ? UINT_MAX : lookup.query.page * lookup.query.count;
+    }
+
+    return _reply_links(pkt, buf, len, _gen_lookup, &lookup, skip, lookup.query.count);
+}
+
+ssize_t coap_rd_lookup_ep_handler(coap_pkt_t *pkt, uint8_t *buf, size_t len)
+{
+    return _lookup(pkt, buf, len, 0);
+}
+
+ssize_t coap_rd_lookup_res_handler(coap_pkt_t *pkt, uint8_t *buf, size_t len)
+{
+    return _lookup(pkt, buf, len, 1);
+}
+
+unsigned coap_rd_numof(void)
+{
+    return _eps_numof;
+}
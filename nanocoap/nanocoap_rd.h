@@ -0,0 +1,64 @@
+#ifndef NANOCOAP_RD_H
+#define NANOCOAP_RD_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "nanocoap.h"
+
+/**
+ * @brief   Registration lifetime if the endpoint does not send "lt" (seconds)
+ */
+#define COAP_RD_LT_DEFAULT          (90000U)
+
+/**
+ * @brief   Number of one second slots of the expiry timer wheel
+ *
+ * Registrations expiring further in the future than this wrap around and are
+ * checked (and skipped) once per turn.
+ */
+#ifndef NANOCOAP_RD_WHEEL_SLOTS
+#define NANOCOAP_RD_WHEEL_SLOTS     (4096U)
+#endif
+
+/**
+ * @brief   Maximum number of filters in one lookup
+ */
+#ifndef NANOCOAP_RD_FILTERS_MAX
+#define NANOCOAP_RD_FILTERS_MAX     (8U)
+#endif
+
+/**
+ * @name    Resource Directory (RFC 9176) interfaces
+ *
+ * All registrations live in memory. Every endpoint and link attribute value
+ * is indexed in a hash map, so lookups only visit the registrations matching
+ * their most selective exact filter ("?ep=node1", "?rt=temp"). Filters ending
+ * in '*' match by prefix and are checked on those candidates (or on all
+ * registrations, if there is no exact filter).
+ *
+ * Expired registrations are removed lazily on the next request. The index is
+ * not locked, so all requests must be handled by the same thread.
+ * @{
+ */
+ssize_t coap_rd_register_handler(coap_pkt_t *pkt, uint8_t *buf, size_t len);
+ssize_t coap_rd_registration_handler(coap_pkt_t *pkt, uint8_t *buf, size_t len);
+ssize_t coap_rd_lookup_ep_handler(coap_pkt_t *pkt, uint8_t *buf, size_t len);
+ssize_t coap_rd_lookup_res_handler(coap_pkt_t *pkt, uint8_t *buf, size_t len);
+
+#define COAP_RD_HANDLERS \
+    { "/rd", COAP_POST, coap_rd_register_handler, ";rt=\"core.rd\";ct=40", 0 }, \
+    { "/rd-lookup/ep", COAP_GET, coap_rd_lookup_ep_handler, \
+      ";rt=\"core.rd-lookup-ep\";ct=40", 0 }, \
+    { "/rd-lookup/res", COAP_GET, coap_rd_lookup_res_handler, \
+      ";rt=\"core.rd-lookup-res\";ct=40", 0 }, \
+    { "/reg", COAP_GET | COAP_POST | COAP_DELETE, \
+      coap_rd_registration_handler, NULL, COAP_MATCH_SUBTREE }
+/** @} */
+
+/**
+ * @brief   Number of active registrations
+ */
+unsigned coap_rd_numof(void);
+
+#endif /* NANOCOAP_RD_H */
@@ -0,0 +1,384 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "net/sock/udp.h"
+
+#include "nanocoap.h"
+#include "nanocoap_session.h"
+
+#if NANOCOAP_DEBUG
+#define ENABLE_DEBUG (1)
+#else
+#define ENABLE_DEBUG (0)
+#endif
+#include "debug.h"
+
+/* MAX_TRANSMIT_WAIT (RFC 7252, 4.8.2), for non-confirmable requests */
+#define MAX_TRANSMIT_WAIT_MS \
+    ((uint32_t)(COAP_ACK_TIMEOUT * 1000U * ((2U << COAP_MAX_RETRANSMIT) - 1) * COAP_RANDOM_FACTOR))
+
+static uint32_t _rand_state;
+
+static uint32_t _rand(void)
+{
+    if (!_rand_state) {
+        _rand_state = (uint32_t)nanocoap_session_now() | 1;
+    }
+    _rand_state ^= _rand_state << 13;
+    _rand_state ^= _rand_state >> 17;
+    _rand_state ^= _rand_state << 5;
+    return _rand_state;
+}
+
+uint64_t nanocoap_session_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U;
+}
+
+int nanocoap_session_init(nanocoap_session_t *session, const sock_udp_ep_t *remote)
+{
+    memset(session, 0, sizeof(*session));
+    session->remote = *remote;
+    if (!session->remote.port) {
+        session->remote.port = COAP_PORT;
+    }
+    session->next_id = _rand();
+    session->next_token = _rand();
+
+    int res = sock_udp_create(&session->sock, NULL, &session->remote, 0);
+    if (res < 0) {
+        return res;
+    }
+    session->open = 1;
+    return 0;
+}
+
+static void _finish(nanocoap_session_t *session, nanocoap_session_req_t *req, int res,
+        coap_pkt_t *resp)
+{
+    nanocoap_session_cb_t cb = req->cb;
+    void *arg = req->arg;
+
+    free(req->msg);
+    req->msg = NULL;
+
+    /* the callback may send new requests, possibly to other servers. Until
+     * it returns, the request still counts, so nanocoap_session_pool_get()
+     * does not replace this session while it is dispatching. */
+    cb(arg, res, resp);
+    session->pending_numof--;
+}
+
+void nanocoap_session_close(nanocoap_session_t *session)
+{
+    /* detach the requests before calling back, so new requests sent from
+     * the callbacks cannot end up on the session being closed */
+    nanocoap_session_req_t pending[NANOCOAP_SESSION_PENDING_MAX];
+    memcpy(pending, session->pending, sizeof(pending));
+    memset(session->pending, 0, sizeof(session->pending));
+    session->pending_numof = 0;
+    sock_udp_close(&session->sock);
+    session->open = 0;
+
+    for (unsigned i = 0; i < NANOCOAP_SESSION_PENDING_MAX; i++) {
+        if (pending[i].msg) {
+            free(pending[i].msg);
+            pending[i].cb(pending[i].arg, -ECONNRESET, NULL);
+        }
+    }
+}
+
+nanocoap_session_t *nanocoap_session_pool_get(nanocoap_session_t *pool, unsigned numof,
+        const sock_udp_ep_t *remote)
+{
+    nanocoap_session_t *unused = NULL, *idle = NULL;
+    uint64_t now = nanocoap_session_now();
+
+    for (unsigned i = 0; i < numof; i++) {
+        nanocoap_session_t *session = &pool[i];
+        if (!session->open) {
+            unused = session;
+            continue;
+        }
+        if ((session->remote.family == remote->family) &&
+                (session->remote.port == remote->port) &&
+                !memcmp(&session->remote.addr, &remote->addr, sizeof(remote->addr))) {
+            session->last_used = now;
+            return session;
+        }
+        if (!session->pending_numof && (!idle || (session->last_used < idle->last_used))) {
+            idle = session;
+        }
+    }
+
+    if (!unused) {
+        if (!idle) {
+            return NULL;
+        }
+        nanocoap_session_close(idle);
+        unused = idle;
+    }
+
+    if (nanocoap_session_init(unused, remote)) {
+        return NULL;
+    }
+    unused->last_used = now;
+    return unused;
+}
+
+int nanocoap_session_parse_ep(sock_udp_ep_t *ep, const char *host, size_t len)
+{
+    const char *end = host + len;
+    const char *port = NULL;
+    char tmp[INET6_ADDRSTRLEN];
+
+    if (len && (host[0] == '[')) {
+        const char *bracket = memchr(host, ']', len);
+        if (!bracket) {
+            return -EINVAL;
+        }
+        if (bracket + 1 < end) {
+            if (bracket[1] != ':') {
+                return -EINVAL;
+            }
+            port = bracket + 2;
+        }
+        host++;
+        len = bracket - host;
+    }
+    else {
+        /* a second colon means an IPv6 address without brackets and port */
+        const char *colon = memchr(host, ':', len);
+        if (colon && !memchr(colon + 1, ':', end - colon - 1)) {
+            port = colon + 1;
+            len = colon - host;
+        }
+    }
+
+    if (len >= sizeof(tmp)) {
+        return -EHOSTUNREACH;
+    }
+    memcpy(tmp, host, len);
+    tmp[len] = '\0';
+
+    memset(ep, 0, sizeof(*ep));
+    ep->port = COAP_PORT;
+    if (inet_pton(AF_INET6, tmp, ep->addr.ipv6) == 1) {
+        ep->family = AF_INET6;
+    }
+    else if (inet_pton(AF_INET, tmp, ep->addr.ipv4) == 1) {
+        ep->family = AF_INET;
+    }
+    else {
+        /* host names would need to be resolved */
+        return -EHOSTUNREACH;
+    }
+
+    if (port) {
+        unsigned val = 0;
+        for (; port < end; port++) {
+            if ((*port < '0') || (*port > '9')) {
+                return -EINVAL;
+            }
+            val = val * 10 + (*port - '0');
+            if (val > UINT16_MAX) {
+                return -EINVAL;
+            }
+        }
+        /* also rejects an empty port, as in "[::1]:" */
+        if (!val) {
+            return -EINVAL;
+        }
+        ep->port = val;
+    }
+
+    return 0;
+}
+
+int nanocoap_session_builder_init(coap_builder_t *b, uint8_t *buf, size_t size,
+        unsigned type, unsigned code)
+{
+    static const uint8_t token[NANOCOAP_SESSION_TKL];
+    return coap_builder_init(b, buf, size, type, token, sizeof(token), code, 0);
+}
+
+int nanocoap_session_request(nanocoap_session_t *session, const uint8_t *msg, size_t len,
+        nanocoap_session_cb_t cb, void *arg)
+{
+    if (!session->open) {
+        return -ENOTCONN;
+    }
+    if ((len < sizeof(coap_hdr_t) + NANOCOAP_SESSION_TKL) ||
+            ((msg[0] & 0xf) != NANOCOAP_SESSION_TKL)) {
+        return -EINVAL;
+    }
+    nanocoap_session_req_t *req = NULL;
+    for (unsigned i = 0; i < NANOCOAP_SESSION_PENDING_MAX; i++) {
+        if (!session->pending[i].msg) {
+            req = &session->pending[i];
+            break;
+        }
+    }
+    if (!req) {
+        return -EAGAIN;
+    }
+
+    req->msg = malloc(len);
+    if (!req->msg) {
+        return -ENOMEM;
+    }
+    memcpy(req->msg, msg, len);
+    req->len = len;
+
+    req->id = session->next_id++;
+    req->token = session->next_token++;
+    coap_hdr_t *hdr = (coap_hdr_t *)req->msg;
+    hdr->id = htons(req->id);
+    memcpy(hdr->data, &req->token, NANOCOAP_SESSION_TKL);
+
+    req->cb = cb;
+    req->arg = arg;
+    req->retries = 0;
+    req->acked = 0;
+
+    if (((msg[0] & 0x30) >> 4) == COAP_TYPE_CON) {
+        /* ACK_TIMEOUT * [1, ACK_RANDOM_FACTOR) */
+        req->timeout = COAP_ACK_TIMEOUT * 1000U;
+        req->timeout += _rand() % (uint32_t)(req->timeout * (COAP_RANDOM_FACTOR - 1));
+    }
+    else {
+        req->acked = 1;
+        req->timeout = MAX_TRANSMIT_WAIT_MS;
+    }
+    req->deadline = nanocoap_session_now() + req->timeout;
+
+    ssize_t res = sock_udp_send(&session->sock, req->msg, len, NULL);
+    if (res < 0) {
+        free(req->msg);
+        req->msg = NULL;
+        return res;
+    }
+
+    session->pending_numof++;
+    return 0;
+}
+
+static nanocoap_session_req_t *_find(nanocoap_session_t *session, coap_pkt_t *pkt)
+{
+    unsigned type = coap_get_type(pkt);
+
+    for (unsigned i = 0; i < NANOCOAP_SESSION_PENDING_MAX; i++) {
+        nanocoap_session_req_t *req = &session->pending[i];
+        if (!req->msg) {
+            continue;
+        }
+        if ((type == COAP_TYPE_ACK) || (type == COAP_TYPE_RST)) {
+            if (req->id == coap_get_id(pkt)) {
+                return req;
+            }
+        }
+        else if ((coap_get_token_len(pkt) == NANOCOAP_SESSION_TKL) &&
+                !memcmp(pkt->token, &req->token, NANOCOAP_SESSION_TKL)) {
+            return req;
+        }
+    }
+
+    return NULL;
+}
+
+static void _handle(nanocoap_session_t *session, coap_pkt_t *pkt)
+{
+    unsigned type = coap_get_type(pkt);
+
+    if (type == COAP_TYPE_CON) {
+        /* acknowledge (separate) responses */
+        uint8_t ack[sizeof(coap_hdr_t)];
+        coap_build_hdr((coap_hdr_t *)ack, COAP_TYPE_ACK, NULL, 0, COAP_CODE_EMPTY,
+                pkt->hdr->id);
+        sock_udp_send(&session->sock, ack, sizeof(ack), NULL);
+    }
+
+    nanocoap_session_req_t *req = _find(session, pkt);
+    if (!req) {
+        DEBUG("nanocoap_session: unexpected message\n");
+        return;
+    }
+
+    if (type == COAP_TYPE_RST) {
+        _finish(session, req, -ECONNRESET, NULL);
+    }
+    else if (pkt->hdr->code == COAP_CODE_EMPTY) {
+        /* the response will follow separately */
+        req->acked = 1;
+        req->deadline = nanocoap_session_now() + NANOCOAP_SESSION_SEPARATE_MS;
+    }
+    else if ((type == COAP_TYPE_ACK) && (coap_get_token_len(pkt) != NANOCOAP_SESSION_TKL ||
+                memcmp(pkt->token, &req->token, NANOCOAP_SESSION_TKL))) {
+        DEBUG("nanocoap_session: token mismatch\n");
+    }
+    else {
+        _finish(session, req, 0, pkt);
+    }
+}
+
+void nanocoap_session_recv(nanocoap_session_t *session, uint8_t *buf, size_t len)
+{
+    ssize_t res;
+
+    while ((res = sock_udp_recv(&session->sock, buf, len, 0, NULL)) > 0) {
+        coap_pkt_t pkt;
+        if (coap_parse(&pkt, buf, res) < 0) {
+            DEBUG("nanocoap_session: error parsing packet\n");
+            continue;
+        }
+        if (coap_get_code_class(&pkt) == COAP_REQ && pkt.hdr->code != COAP_CODE_EMPTY) {
+            continue;
+        }
+        _handle(session, &pkt);
+    }
+
+    if ((res == -1) && (errno == ECONNREFUSED)) {
+        /* ICMP port unreachable, nobody listens at the remote */
+        for (unsigned i = 0; i < NANOCOAP_SESSION_PENDING_MAX; i++) {
+            if (session->pending[i].msg) {
+                _finish(session, &session->pending[i], -ECONNRESET, NULL);
+            }
+        }
+    }
+}
+
+int nanocoap_session_timeouts(nanocoap_session_t *session)
+{
+    uint64_t now = nanocoap_session_now();
+    uint64_t next = UINT64_MAX;
+
+    for (unsigned i = 0; i < NANOCOAP_SESSION_PENDING_MAX; i++) {
+        nanocoap_session_req_t *req = &session->pending[i];
+        if (!req->msg) {
+            continue;
+        }
+
+        if (req->deadline <= now) {
+            if (req->acked || (req->retries == COAP_MAX_RETRANSMIT)) {
+                DEBUG("nanocoap_session: request timed out\n");
+                _finish(session, req, -ETIMEDOUT, NULL);
+                continue;
+            }
+            req->retries++;
+            req->timeout *= 2;
+            req->deadline = now + req->timeout;
+            sock_udp_send(&session->sock, req->msg, req->len, NULL);
+        }
+
+        if (req->deadline < next) {
+            next = req->deadline;
+        }
+    }
+
+    return (next == UINT64_MAX) ? -1 : (int)(next - now);
+}
@@ -0,0 +1,139 @@
+#ifndef NANOCOAP_SESSION_H
+#define NANOCOAP_SESSION_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "net/sock/udp.h"
+
+#include "nanocoap.h"
+
+/**
+ * @brief   Maximum number of outstanding requests per session
+ */
+#ifndef NANOCOAP_SESSION_PENDING_MAX
+#define NANOCOAP_SESSION_PENDING_MAX    (32U)
+#endif
+
+/**
+ * @brief   Token length of requests sent through a session
+ */
+#define NANOCOAP_SESSION_TKL            (4U)
+
+/**
+ * @brief   Time to wait for a separate response after the empty ACK (ms)
+ */
+#define NANOCOAP_SESSION_SEPARATE_MS    (COAP_ACK_TIMEOUT * 1000U * 32U)
+
+/**
+ * @brief   Called once per request with its response, or with
+ *          -ETIMEDOUT / -ECONNRESET (RST) and @p resp == NULL
+ */
+typedef void (*nanocoap_session_cb_t)(void *arg, int res, coap_pkt_t *resp);
+
+typedef struct {
+    uint8_t *msg;               /**< NULL if unused */
+    size_t len;
+    uint32_t token;
+    uint16_t id;
+    uint8_t retries;
+    uint8_t acked;
+    uint32_t timeout;           /**< current retransmission timeout (ms) */
+    uint64_t deadline;          /**< next retransmission or give up (ms) */
+    nanocoap_session_cb_t cb;
+    void *arg;
+} nanocoap_session_req_t;
+
+/**
+ * @brief   Asynchronous client session to one server
+ *
+ * Requests are sent without blocking and matched to their responses by token,
+ * so any number of them (up to NANOCOAP_SESSION_PENDING_MAX) can be in flight.
+ * Confirmable requests are retransmitted, separate responses are acknowledged.
+ * The owner polls nanocoap_session_fd() and calls nanocoap_session_recv() when
+ * it is readable and nanocoap_session_timeouts() when the returned time
+ * elapsed.
+ */
+typedef struct {
+    sock_udp_t sock;
+    sock_udp_ep_t remote;
+    uint8_t open;
+    uint64_t last_used;         /**< ms, maintained by nanocoap_session_pool_get() */
+    uint16_t next_id;
+    uint32_t next_token;
+    unsigned pending_numof;     /**< including requests whose callback runs */
+    nanocoap_session_req_t pending[NANOCOAP_SESSION_PENDING_MAX];
+} nanocoap_session_t;
+
+int nanocoap_session_init(nanocoap_session_t *session, const sock_udp_ep_t *remote);
+
+/**
+ * @brief   Close @p session, failing all outstanding requests with -ECONNRESET
+ *
+ * The session is closed before the callbacks run, requests they send to it
+ * fail with -ENOTCONN.
+ */
+void nanocoap_session_close(nanocoap_session_t *session);
+
+/**
+ * @brief   Start building a request for @p session
+ *
+ * Message id and token are placeholders, they are set when sending.
+ */
+int nanocoap_session_builder_init(coap_builder_t *b, uint8_t *buf, size_t size,
+        unsigned type, unsigned code);
+
+/**
+ * @brief   Send a request built with nanocoap_session_builder_init()
+ *
+ * The message is copied, @p cb is called exactly once unless this fails.
+ *
+ * @returns 0 on success, -EAGAIN if too many requests are outstanding,
+ *          -ENOTCONN if @p session is closed, -ENOMEM or the error of sending
+ */
+int nanocoap_session_request(nanocoap_session_t *session, const uint8_t *msg, size_t len,
+        nanocoap_session_cb_t cb, void *arg);
+
+/**
+ * @brief   Receive and dispatch all pending responses, using @p buf
+ */
+void nanocoap_session_recv(nanocoap_session_t *session, uint8_t *buf, size_t len);
+
+/**
+ * @brief   Retransmit or fail requests that are due
+ *
+ * @returns ms until the next call is needed, -1 if nothing is outstanding
+ */
+int nanocoap_session_timeouts(nanocoap_session_t *session);
+
+/**
+ * @brief   Get the session to @p remote from @p pool, opening it if needed
+ *
+ * A new session takes an unused slot, or replaces the least recently used
+ * session without outstanding requests.
+ *
+ * @returns NULL if all sessions are busy or opening failed
+ */
+nanocoap_session_t *nanocoap_session_pool_get(nanocoap_session_t *pool, unsigned numof,
+        const sock_udp_ep_t *remote);
+
+/**
+ * @brief   Parse "host[:port]" with host an IPv6 (in brackets) or IPv4 literal
+ *
+ * The port defaults to COAP_PORT.
+ *
+ * @returns 0 on success, -EHOSTUNREACH if host is no IP literal, -EINVAL
+ */
+int nanocoap_session_parse_ep(sock_udp_ep_t *ep, const char *host, size_t len);
+
+static inline int nanocoap_session_fd(nanocoap_session_t *session)
+{
+    return session->sock.fd;
+}
+
+/**
+ * @brief   Monotonic time in ms, as used for the session timeouts
+ */
+uint64_t nanocoap_session_now(void);
+
+#endif /* NANOCOAP_SESSION_H */
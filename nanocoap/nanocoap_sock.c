@@ -1,9 +1,19 @@
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <netinet/in.h>
 
 #include "nanocoap.h"
+#include "nanocoap_sock.h"
 #include "net/sock/udp.h"
+#include "net/sock/pktbuf.h"
+#include "net/sock/posix.h"
+
+#if NANOCOAP_STATS
+#include "nanocoap_stats.h"
+#endif
 
 #if NANOCOAP_DEBUG
 #define ENABLE_DEBUG (1)
@@ -26,9 +36,14 @@ ssize_t nanocoap_get(sock_udp_ep_t *remote, const char *path, uint8_t *buf, size
         return res;
     }
 
-    uint8_t *pktpos = buf;
-    pktpos += coap_build_hdr((coap_hdr_t *)pktpos, COAP_REQ, NULL, 0, COAP_METHOD_GET, 1);
-    pktpos += coap_put_option_url(pktpos, 0, path);
+    coap_builder_t b;
+    coap_builder_init(&b, buf, len, COAP_TYPE_CON, NULL, 0, COAP_METHOD_GET, 1);
+    coap_builder_add_path(&b, path);
+    ssize_t pkt_len = coap_builder_finish(&b, NULL, 0);
+    if (pkt_len < 0) {
+        res = pkt_len;
+        goto out;
+    }
 
     /* TODO: timeout random between between ACK_TIMEOUT and (ACK_TIMEOUT *
      * ACK_RANDOM_FACTOR) */
@@ -41,7 +56,7 @@ ssize_t nanocoap_get(sock_udp_ep_t *remote, const char *path, uint8_t *buf, size
             goto out;
         }
 
-        res = sock_udp_send(&sock, buf, pktpos-buf, NULL);
+        res = sock_udp_send(&sock, buf, pkt_len, NULL);
         if (res <= 0) {
             DEBUG("nanocoap: error sending coap request\n");
             goto out;
@@ -85,37 +100,367 @@ out:
     return res;
 }
 
-int nanocoap_server(sock_udp_ep_t *local, uint8_t *buf, size_t bufsize)
-{
-    sock_udp_t sock;
+/* a response to a multicast request, waiting for its random delay */
+typedef struct {
+    sock_pktbuf_t *pb;          /* NULL if unused */
     sock_udp_ep_t remote;
+    uint64_t due;               /* us */
+} _delayed_t;
 
-    if (!local->port) {
-        local->port = COAP_PORT;
+static _Thread_local uint32_t _rand_state;
+
+static uint64_t _now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000U + ts.tv_nsec / 1000U;
+}
+
+static uint32_t _rand(void)
+{
+    if (!_rand_state) {
+        /* servers answering the same request must not pick the same delays */
+        _rand_state = ((uint32_t)_now_us() ^ ((uint32_t)getpid() << 16)) | 1;
     }
+    _rand_state ^= _rand_state << 13;
+    _rand_state ^= _rand_state >> 17;
+    _rand_state ^= _rand_state << 5;
+    return _rand_state;
+}
 
-    ssize_t res = sock_udp_create(&sock, local, NULL, 0);
+/* sends to @p group out of its interface, with a hop limit reaching beyond
+ * the link if its scope does */
+static int _set_multicast_out(sock_udp_t *sock, const sock_udp_ep_t *group)
+{
+    int res;
+
+    if (group->family == AF_INET) {
+        /* 224.0.0.0/24 is never forwarded */
+        const int ttl = (group->addr.ipv4[0] == 224) && !group->addr.ipv4[1] &&
+                        !group->addr.ipv4[2] ? 1 : NANOCOAP_MULTICAST_HOPS;
+        struct ip_mreqn mreq = { .imr_ifindex = group->netif };
+        res = setsockopt(sock->fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+        res |= setsockopt(sock->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    }
+    else {
+        /* scope in the low nibble of the second byte, 2 is link-local */
+        const int hops = ((group->addr.ipv6[1] & 0xf) <= 2) ? 1 : NANOCOAP_MULTICAST_HOPS;
+        const int ifindex = group->netif;
+        res = setsockopt(sock->fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex));
+        res |= setsockopt(sock->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+    }
     if (res == -1) {
+        DEBUG("nanocoap: error setting multicast interface\n");
+        return -errno;
+    }
+    return 0;
+}
+
+ssize_t nanocoap_multicast_get(sock_udp_ep_t *group, const char *path,
+        nanocoap_multicast_resp_t *resps, size_t resps_numof, uint8_t *buf, size_t len)
+{
+    ssize_t res;
+    sock_udp_t sock;
+    sock_udp_ep_t local = { .family = group->family };
+
+    if (!group->port) {
+        group->port = COAP_PORT;
+    }
+
+    /* responses come from the nodes' unicast addresses, so the socket must
+     * not be connected to the group */
+    res = sock_udp_create(&sock, &local, NULL, 0);
+    if (res < 0) {
+        return res;
+    }
+
+    sock_pktbuf_t *pb = sock_pktbuf_alloc();
+    if (!pb) {
+        res = -ENOBUFS;
+        goto out;
+    }
+
+    uint64_t now = _now_us();
+    uint32_t token = (uint32_t)now ^ (uint32_t)getpid();
+
+    /* multicast requests must be non-confirmable (RFC 7252, 8.1) */
+    coap_builder_t b;
+    coap_builder_init(&b, buf, len, COAP_TYPE_NON, (uint8_t *)&token, sizeof(token),
+            COAP_METHOD_GET, (uint16_t)token);
+    coap_builder_add_path(&b, path);
+    ssize_t pkt_len = coap_builder_finish(&b, NULL, 0);
+    if (pkt_len < 0) {
+        res = pkt_len;
+        goto out;
+    }
+
+    res = _set_multicast_out(&sock, group);
+    if (res < 0) {
+        goto out;
+    }
+
+    res = sock_udp_send(&sock, buf, pkt_len, group);
+    if (res < 0) {
+        DEBUG("nanocoap: error sending multicast request\n");
+        res = (res == -1) ? -errno : res;
+        goto out;
+    }
+
+    uint64_t deadline = now + NANOCOAP_MULTICAST_LEISURE_MS * 1000U;
+    size_t numof = 0;
+    size_t used = 0;
+    while ((numof < resps_numof) && ((now = _now_us()) < deadline)) {
+        sock_udp_ep_t remote;
+        res = sock_udp_recv(&sock, pb->data, SOCK_PKTBUF_SIZE, deadline - now, &remote);
+        if (res == -ETIMEDOUT) {
+            break;
+        }
+        else if (res < 0) {
+            res = (res == -1) ? -errno : res;
+            goto out;
+        }
+
+        coap_pkt_t pkt;
+        if (coap_parse(&pkt, pb->data, res) < 0) {
+            DEBUG("nanocoap: error parsing packet\n");
+            continue;
+        }
+        if ((coap_get_code_class(&pkt) == COAP_REQ) ||
+                (coap_get_token_len(&pkt) != sizeof(token)) ||
+                memcmp(pkt.token, &token, sizeof(token))) {
+            continue;
+        }
+
+        if (coap_get_type(&pkt) == COAP_TYPE_CON) {
+            uint8_t ack[sizeof(coap_hdr_t)];
+            coap_build_hdr((coap_hdr_t *)ack, COAP_TYPE_ACK, NULL, 0, COAP_CODE_EMPTY,
+                    pkt.hdr->id);
+            sock_udp_send(&sock, ack, sizeof(ack), &remote);
+        }
+
+        /* a node retransmitting its response counts once. Nodes are told apart
+         * by address and port, one answering from two addresses counts twice */
+        size_t i;
+        for (i = 0; i < numof; i++) {
+            if ((resps[i].remote.family == remote.family) &&
+                    (resps[i].remote.port == remote.port) &&
+                    !memcmp(&resps[i].remote.addr, &remote.addr, sizeof(remote.addr))) {
+                break;
+            }
+        }
+        if (i < numof) {
+            continue;
+        }
+
+        if (pkt.payload_len > len - used) {
+            DEBUG("nanocoap: no space for multicast response\n");
+            continue;
+        }
+
+        nanocoap_multicast_resp_t *resp = &resps[numof++];
+        resp->remote = remote;
+        resp->code = coap_get_code(&pkt);
+        resp->payload = buf + used;
+        resp->payload_len = pkt.payload_len;
+        if (pkt.payload_len) {
+            memcpy(buf + used, pkt.payload, pkt.payload_len);
+        }
+        used += pkt.payload_len;
+    }
+
+    res = numof;
+
+out:
+    if (pb) {
+        sock_pktbuf_release(pb);
+    }
+    sock_udp_close(&sock);
+
+    return res;
+}
+
+static void _join_all_nodes(sock_udp_t *sock, const sock_udp_ep_t *local)
+{
+    static const uint8_t ipv6_groups[][16] = {
+        NANOCOAP_ALL_NODES_IPV6_LINK, NANOCOAP_ALL_NODES_IPV6_SITE
+    };
+    static const uint8_t ipv4_group[] = NANOCOAP_ALL_NODES_IPV4;
+    static const uint8_t unspecified[16];
+    sock_udp_ep_t group = { .netif = local->netif };
+
+    if ((local->family == AF_INET) ? (local->addr.ipv4_u32 != 0) :
+            (memcmp(local->addr.ipv6, unspecified, sizeof(unspecified)) != 0)) {
+        return;
+    }
+
+    /* failing to join only costs multicast discovery, not unicast service */
+    if (local->family != AF_INET) {
+        group.family = AF_INET6;
+        for (unsigned i = 0; i < sizeof(ipv6_groups) / sizeof(ipv6_groups[0]); i++) {
+            memcpy(group.addr.ipv6, ipv6_groups[i], sizeof(ipv6_groups[i]));
+            if (sock_udp_join_group(sock, &group)) {
+                DEBUG("nanocoap: error joining IPv6 All-CoAP-Nodes\n");
+            }
+        }
+    }
+    if (local->family != AF_INET6) {
+        group.family = AF_INET;
+        memcpy(group.addr.ipv4, ipv4_group, sizeof(ipv4_group));
+        if (sock_udp_join_group(sock, &group)) {
+            DEBUG("nanocoap: error joining IPv4 All-CoAP-Nodes\n");
+        }
+    }
+}
+
+/* queues the response to a multicast request for a random delay. Errors are
+ * not sent at all, and neither is anything that finds no room
+ * (RFC 7252, 8.2). */
+static void _delay(_delayed_t *delayed, const uint8_t *msg, size_t len,
+        const sock_udp_ep_t *remote)
+{
+    unsigned code = msg[1];
+    if ((code == COAP_CODE_EMPTY) || ((code >> 5) >= 4) || (len > SOCK_PKTBUF_SIZE)) {
+        return;
+    }
+
+    for (unsigned i = 0; i < NANOCOAP_MULTICAST_DELAYED_MAX; i++) {
+        _delayed_t *d = &delayed[i];
+        if (d->pb) {
+            continue;
+        }
+        if (!(d->pb = sock_pktbuf_alloc())) {
+            return;
+        }
+        memcpy(d->pb->data, msg, len);
+        d->pb->len = len;
+        d->remote = *remote;
+        d->due = _now_us() + _rand() % (NANOCOAP_MULTICAST_DELAY_MS * 1000U + 1);
+        return;
+    }
+}
+
+/* sends the delayed responses that are due, returns the time (us) until the
+ * next one */
+static uint32_t _send_delayed(sock_udp_t *sock, _delayed_t *delayed)
+{
+    uint64_t now = _now_us();
+    uint64_t next = UINT64_MAX;
+
+    for (unsigned i = 0; i < NANOCOAP_MULTICAST_DELAYED_MAX; i++) {
+        _delayed_t *d = &delayed[i];
+        if (!d->pb) {
+            continue;
+        }
+        if (d->due <= now) {
+            sock_udp_send_pktbuf(sock, d->pb, &d->remote);
+            sock_pktbuf_release(d->pb);
+            d->pb = NULL;
+        }
+        else if (d->due < next) {
+            next = d->due;
+        }
+    }
+
+    return (next == UINT64_MAX) ? SOCK_NO_TIMEOUT : (uint32_t)(next - now);
+}
+
+int nanocoap_server_sock(sock_udp_t *sock, uint8_t *buf, size_t bufsize)
+{
+    sock_udp_ep_t remote;
+    coap_arena_t arena;
+    _delayed_t delayed[NANOCOAP_MULTICAST_DELAYED_MAX];
+
+    if (coap_arena_init(&arena)) {
         return -1;
     }
 
+    static const struct sock_filter filter[] = SOCK_FILTER_COAP;
+    if (sock_udp_attach_filter(sock, filter, sizeof(filter) / sizeof(filter[0]))) {
+        DEBUG("nanocoap: error attaching packet filter\n");
+    }
+
+#if NANOCOAP_STATS
+    sock_udp_enable_drop_count(sock);
+#endif
+    memset(delayed, 0, sizeof(delayed));
+    if (sock_udp_enable_multicast_info(sock)) {
+        DEBUG("nanocoap: multicast requests are answered like unicast ones\n");
+    }
+
     while(1) {
-        res = sock_udp_recv(&sock, buf, bufsize, -1, &remote);
-        if (res == -1) {
+        uint32_t timeout = _send_delayed(sock, delayed);
+
+        /* received into a pool buffer, so handlers can keep the request
+         * while the response is built in buf */
+        sock_pktbuf_t *pb = NULL;
+        uint8_t *req = buf;
+        ssize_t res = sock_udp_recv_pktbuf(sock, &pb, timeout, &remote);
+        if (res == -ENOBUFS) {
+            /* all buffers are held, handle in place */
+            res = sock_udp_recv(sock, buf, bufsize, timeout, &remote);
+        }
+        else if (res >= 0) {
+            req = pb->data;
+        }
+
+        if (res == -ETIMEDOUT) {
+            continue;
+        }
+        else if (res < 0) {
             DEBUG("error receiving UDP packet\n");
+            free(arena.buf);
             return -1;
         }
         else {
             coap_pkt_t pkt;
-            if (coap_parse(&pkt, (uint8_t*)buf, res) < 0) {
+#if NANOCOAP_STATS
+            coap_stats_rx_drops(sock_udp_get_drop_count(sock));
+#endif
+            if (coap_parse(&pkt, req, res) < 0) {
                 DEBUG("error parsing packet\n");
-                continue;
+#if NANOCOAP_STATS
+                coap_stats_parse_error();
+#endif
             }
-            if ((res = coap_handle_req(&pkt, buf, bufsize)) > 0) {
-                res = sock_udp_send(&sock, buf, res, &remote);
+            else {
+                pkt.remote = &remote;
+                pkt.arena = &arena;
+                pkt.pktbuf = pb;
+                if ((res = coap_handle_req(&pkt, buf, bufsize)) > 0) {
+                    if (sock_udp_recv_was_multicast(sock)) {
+                        _delay(delayed, buf, res, &remote);
+                    }
+                    else {
+                        res = sock_udp_send(sock, buf, res, &remote);
+                    }
+                }
+                coap_arena_reset(&arena);
+            }
+            if (pb) {
+                sock_pktbuf_release(pb);
             }
         }
     }
 
     return 0;
 }
+
+int nanocoap_server(sock_udp_ep_t *local, uint8_t *buf, size_t bufsize)
+{
+    sock_udp_t sock;
+
+    if (!local->port) {
+        local->port = COAP_PORT;
+    }
+
+    if (sock_udp_create(&sock, local, NULL, 0) < 0) {
+        return -1;
+    }
+
+    _join_all_nodes(&sock, local);
+    coap_well_known_core_init();
+
+    int res = nanocoap_server_sock(&sock, buf, bufsize);
+    sock_udp_close(&sock);
+    return res;
+}
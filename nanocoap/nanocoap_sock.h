@@ -4,9 +4,112 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include "nanocoap.h"
+
 #include "net/sock/udp.h"
 
+/**
+ * @name    All-CoAP-Nodes multicast addresses (RFC 7252, 12.8)
+ * @{
+ */
+#define NANOCOAP_ALL_NODES_IPV4         { 224, 0, 1, 187 }
+#define NANOCOAP_ALL_NODES_IPV6_LINK    { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xfd }
+#define NANOCOAP_ALL_NODES_IPV6_SITE    { 0xff, 0x05, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xfd }
+/** @} */
+
+/**
+ * @brief   Time a multicast request collects responses, in ms
+ */
+#ifndef NANOCOAP_MULTICAST_LEISURE_MS
+#define NANOCOAP_MULTICAST_LEISURE_MS   (COAP_DEFAULT_LEISURE * 1000U)
+#endif
+
+/**
+ * @brief   Longest random delay before a server answers a multicast request,
+ *          in ms (RFC 7252, 8.2)
+ *
+ * Half the leisure, so answers arrive while nanocoap_multicast_get() still
+ * collects them.
+ */
+#ifndef NANOCOAP_MULTICAST_DELAY_MS
+#define NANOCOAP_MULTICAST_DELAY_MS     (NANOCOAP_MULTICAST_LEISURE_MS / 2)
+#endif
+
+/**
+ * @brief   Number of delayed multicast responses a server keeps, further
+ *          ones are dropped
+ */
+#ifndef NANOCOAP_MULTICAST_DELAYED_MAX
+#define NANOCOAP_MULTICAST_DELAYED_MAX  (16U)
+#endif
+
+/**
+ * @brief   Hop limit of multicast requests to groups beyond link-local scope,
+ *          e.g. ff05::fd
+ *
+ * Link-local groups are sent with a hop limit of 1.
+ */
+#ifndef NANOCOAP_MULTICAST_HOPS
+#define NANOCOAP_MULTICAST_HOPS         (16U)
+#endif
+
+/**
+ * @brief   One response to nanocoap_multicast_get()
+ */
+typedef struct {
+    sock_udp_ep_t remote;       /**< responding node */
+    unsigned code;              /**< response code, e.g. 205 */
+    const uint8_t *payload;     /**< points into the caller's buffer */
+    size_t payload_len;
+} nanocoap_multicast_resp_t;
+
+/**
+ * @brief   Serve requests on @p local
+ *
+ * If @p local is the unspecified address, the server also joins the
+ * All-CoAP-Nodes groups of its address family. Requests sent to a group are
+ * answered after a random delay of up to NANOCOAP_MULTICAST_DELAY_MS, error
+ * responses not at all.
+ */
 int nanocoap_server(sock_udp_ep_t *local, uint8_t *buf, size_t bufsize);
+
+/**
+ * @brief   Serve requests on the already created @p sock
+ *
+ * coap_well_known_core_init() must have been called before.
+ */
+int nanocoap_server_sock(sock_udp_t *sock, uint8_t *buf, size_t bufsize);
+
+/**
+ * @brief   Serve requests on @p local with one worker thread per CPU
+ *
+ * Each worker has its own socket in a SO_REUSEPORT group and is pinned to
+ * one of the CPUs in the process' affinity mask. The kernel steers a packet
+ * to the socket of the CPU it was received on, so all packets of a flow are
+ * handled by the same worker. The workers do not join the All-CoAP-Nodes
+ * groups, every one of them would answer a multicast request.
+ *
+ * @param[in]   numof   number of workers, 0 or more than there are allowed
+ *                      CPUs for one per allowed CPU
+ *
+ * @returns only on error, negative errno if not all workers could be started
+ */
+int nanocoap_server_workers(sock_udp_ep_t *local, unsigned numof, size_t bufsize);
 ssize_t nanocoap_get(sock_udp_ep_t *remote, const char *path, uint8_t *buf, size_t len);
 
+/**
+ * @brief   Send a non-confirmable GET for @p path to the multicast @p group
+ *          and collect the responses of all nodes
+ *
+ * The request leaves through @p group->netif, 0 lets the kernel choose, with
+ * a hop limit of NANOCOAP_MULTICAST_HOPS if @p group is not link-local.
+ * Responses are collected for NANOCOAP_MULTICAST_LEISURE_MS, or until
+ * @p resps is full, one per responding address and port. Their payloads are
+ * copied to @p buf, a response whose payload does not fit anymore is dropped.
+ *
+ * @returns number of responses stored in @p resps, or negative errno
+ */
+ssize_t nanocoap_multicast_get(sock_udp_ep_t *group, const char *path,
+        nanocoap_multicast_resp_t *resps, size_t resps_numof, uint8_t *buf, size_t len);
+
 #endif /* NANOCOAP_SOCK_H */
@@ -0,0 +1,390 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nanocoap.h"
+#include "nanocoap_stats.h"
+
+typedef struct {
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t latency[NANOCOAP_STATS_HIST_BUCKETS];
+} _res_stats_t;
+
+typedef struct _stats {
+    struct _stats *next;
+    atomic_uint_fast64_t parse_errors;
+    atomic_uint_fast64_t rx_drops;
+    atomic_uint_fast64_t codes[256];
+    /* coap_resources_numof entries, plus one for requests without match */
+    _res_stats_t res[];
+} _stats_t;
+
+static _Atomic(_stats_t *) _stats_list;
+static _Thread_local _stats_t *_stats;
+
+/* single writer per counter, so a relaxed load and store is enough */
+#define _INC(counter, n) \
+    atomic_store_explicit(&(counter), \
+            atomic_load_explicit(&(counter), memory_order_relaxed) + (n), \
+            memory_order_relaxed)
+
+static _stats_t *_get(void)
+{
+    if (!_stats) {
+        _stats_t *stats = calloc(1, sizeof(_stats_t) +
+                (coap_resources_numof + 1) * sizeof(_res_stats_t));
+        if (!stats) {
+            return NULL;
+        }
+
+        stats->next = atomic_load(&_stats_list);
+        while (!atomic_compare_exchange_weak(&_stats_list, &stats->next, stats)) {}
+        _stats = stats;
+    }
+    return _stats;
+}
+
+void coap_stats_parse_error(void)
+{
+    _stats_t *stats = _get();
+    if (stats) {
+        _INC(stats->parse_errors, 1);
+    }
+}
+
+void coap_stats_rx_drops(uint32_t drops)
+{
+    _stats_t *stats = _get();
+    if (stats) {
+        /* the kernel counter is cumulative per socket */
+        atomic_store_explicit(&stats->rx_drops, drops, memory_order_relaxed);
+    }
+}
+
+void coap_stats_request(unsigned res, unsigned code, uint64_t nsecs)
+{
+    _stats_t *stats = _get();
+    if (!stats) {
+        return;
+    }
+
+    unsigned bucket = 0;
+    while ((bucket < NANOCOAP_STATS_HIST_BUCKETS - 1) &&
+            (nsecs >= (1ULL << (NANOCOAP_STATS_HIST_MIN_LOG2 + bucket)))) {
+        bucket++;
+    }
+
+    _INC(stats->res[res].requests, 1);
+    _INC(stats->res[res].latency[bucket], 1);
+    _INC(stats->codes[code & 0xff], 1);
+}
+
+#define _SUM(sum, field) \
+    for (_stats_t *_s = atomic_load(&_stats_list); _s; _s = _s->next) { \
+        sum += atomic_load_explicit(&_s->field, memory_order_relaxed); \
+    }
+
+/* sums of all threads' counters at one point in time */
+typedef struct {
+    uint64_t parse_errors;
+    uint64_t rx_drops;
+    uint64_t codes[256];
+    struct {
+        uint64_t requests;
+        uint64_t latency[NANOCOAP_STATS_HIST_BUCKETS];
+    } res[];
+} _snapshot_t;
+
+static _snapshot_t *_snapshot(void)
+{
+    _snapshot_t *snap = calloc(1, sizeof(_snapshot_t) +
+            (coap_resources_numof + 1) * sizeof(snap->res[0]));
+    if (!snap) {
+        return NULL;
+    }
+
+    _SUM(snap->parse_errors, parse_errors);
+    _SUM(snap->rx_drops, rx_drops);
+    for (unsigned code = 0; code < 256; code++) {
+        _SUM(snap->codes[code], codes[code]);
+    }
+    for (unsigned i = 0; i <= coap_resources_numof; i++) {
+        _SUM(snap->res[i].requests, res[i].requests);
+        for (unsigned b = 0; b < NANOCOAP_STATS_HIST_BUCKETS; b++) {
+            _SUM(snap->res[i].latency[b], res[i].latency[b]);
+        }
+    }
+    return snap;
+}
+
+/* minimal JSON / CBOR writer. Output goes through a block slicer, with an
+ * empty one it only measures and hashes the document. */
+typedef struct {
+    uint8_t *pos;
+    coap_block_slicer_t slicer;
+    uint32_t hash;              /* FNV-1a of the whole document */
+    int cbor;
+    unsigned depth;
+    uint8_t first[8];
+    uint8_t after_key;
+} _out_t;
+
+static void _put(_out_t *o, const void *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        o->hash = (o->hash ^ ((const uint8_t *)data)[i]) * 16777619U;
+    }
+    o->pos += coap_blockwise_put_bytes(&o->slicer, o->pos, data, len);
+}
+
+static void _cbor_head(_out_t *o, unsigned major, uint64_t val)
+{
+    uint8_t tmp[9];
+    unsigned len = 1;
+
+    if (val < 24) {
+        tmp[0] = (major << 5) | val;
+    }
+    else {
+        unsigned n = (val <= 0xff) ? 1 : (val <= 0xffff) ? 2 : (val <= 0xffffffff) ? 4 : 8;
+        tmp[0] = (major << 5) | ((n == 1) ? 24 : (n == 2) ? 25 : (n == 4) ? 26 : 27);
+        for (unsigned i = n; i; i--) {
+            tmp[len++] = val >> (8 * (i - 1));
+        }
+    }
+    _put(o, tmp, len);
+}
+
+static void _sep(_out_t *o)
+{
+    if (!o->cbor && !o->after_key && !o->first[o->depth]) {
+        _put(o, ",", 1);
+    }
+    o->first[o->depth] = 0;
+    o->after_key = 0;
+}
+
+static void _open(_out_t *o, int map)
+{
+    _sep(o);
+    if (o->cbor) {
+        /* indefinite length map / array */
+        uint8_t c = map ? 0xbf : 0x9f;
+        _put(o, &c, 1);
+    }
+    else {
+        _put(o, map ? "{" : "[", 1);
+    }
+    o->first[++o->depth] = 1;
+}
+
+static void _close(_out_t *o, int map)
+{
+    o->depth--;
+    if (o->cbor) {
+        _put(o, "\xff", 1);
+    }
+    else {
+        _put(o, map ? "}" : "]", 1);
+    }
+}
+
+static void _str(_out_t *o, const char *str)
+{
+    size_t len = strlen(str);
+    _sep(o);
+    if (o->cbor) {
+        _cbor_head(o, 3, len);
+        _put(o, str, len);
+    }
+    else {
+        _put(o, "\"", 1);
+        for (const char *c = str; *c; c++) {
+            if ((*c == '"') || (*c == '\\')) {
+                _put(o, "\\", 1);
+            }
+            else if ((unsigned char)*c < 0x20) {
+                char tmp[7];
+                _put(o, tmp, snprintf(tmp, sizeof(tmp), "\\u%04x", *c));
+                continue;
+            }
+            _put(o, c, 1);
+        }
+        _put(o, "\"", 1);
+    }
+}
+
+static void _key(_out_t *o, const char *key)
+{
+    _str(o, key);
+    if (!o->cbor) {
+        _put(o, ":", 1);
+    }
+    o->after_key = 1;
+}
+
+static void _uint(_out_t *o, uint64_t val)
+{
+    _sep(o);
+    if (o->cbor) {
+        _cbor_head(o, 0, val);
+    }
+    else {
+        char tmp[21];
+        _put(o, tmp, snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)val));
+    }
+}
+
+static void _write_stats(_out_t *o, const _snapshot_t *snap)
+{
+    _open(o, 1);
+
+    _key(o, "parse_errors");
+    _uint(o, snap->parse_errors);
+    _key(o, "rx_drops");
+    _uint(o, snap->rx_drops);
+
+    _key(o, "codes");
+    _open(o, 1);
+    for (unsigned code = 0; code < 256; code++) {
+        if (snap->codes[code]) {
+            char name[8];
+            snprintf(name, sizeof(name), "%u.%02u", code >> 5, code & 0x1f);
+            _key(o, name);
+            _uint(o, snap->codes[code]);
+        }
+    }
+    _close(o, 1);
+
+    _key(o, "hist_min_log2_ns");
+    _uint(o, NANOCOAP_STATS_HIST_MIN_LOG2);
+
+    _key(o, "resources");
+    _open(o, 0);
+    for (unsigned i = 0; i <= coap_resources_numof; i++) {
+        if (!snap->res[i].requests) {
+            continue;
+        }
+        _open(o, 1);
+        _key(o, "path");
+        _str(o, (i < coap_resources_numof) ? coap_resources[i].path : "");
+        _key(o, "requests");
+        _uint(o, snap->res[i].requests);
+        _key(o, "latency");
+        _open(o, 0);
+        for (unsigned b = 0; b < NANOCOAP_STATS_HIST_BUCKETS; b++) {
+            _uint(o, snap->res[i].latency[b]);
+        }
+        _close(o, 0);
+        _close(o, 1);
+    }
+    _close(o, 0);
+
+    _close(o, 1);
+}
+
+/* the last document rendered on this thread. Later blocks of a block-wise
+ * transfer are served from it, so they fit together although the counters
+ * (not least those of the transfer itself) keep changing. */
+static _Thread_local struct {
+    uint8_t *doc;
+    size_t len;
+    uint32_t hash;
+    int cbor;
+} _doc;
+
+static int _render(int cbor)
+{
+    _snapshot_t *snap = _snapshot();
+    if (!snap) {
+        return -ENOMEM;
+    }
+
+    /* measure, then write the whole document */
+    uint8_t dummy;
+    _out_t out = { .pos = &dummy, .cbor = cbor, .first = { 1 }, .hash = 2166136261U };
+    _write_stats(&out, snap);
+
+    uint8_t *doc = malloc(out.slicer.cur);
+    if (doc) {
+        free(_doc.doc);
+        _doc.doc = doc;
+        _doc.len = out.slicer.cur;
+        _doc.hash = out.hash;
+        _doc.cbor = cbor;
+
+        out = (_out_t){ .pos = doc, .slicer = { .end = SIZE_MAX }, .cbor = cbor,
+                        .first = { 1 } };
+        _write_stats(&out, snap);
+    }
+
+    free(snap);
+    return doc ? 0 : -ENOMEM;
+}
+
+ssize_t coap_well_known_stats_handler(coap_pkt_t *pkt, uint8_t *buf, size_t len)
+{
+    unsigned ct = (pkt->accept == COAP_FORMAT_CBOR) ? COAP_FORMAT_CBOR : COAP_FORMAT_JSON;
+    int cbor = (ct == COAP_FORMAT_CBOR);
+
+    if ((pkt->accept != COAP_FORMAT_NONE) && (pkt->accept != ct)) {
+        return coap_build_reply(pkt, COAP_CODE_NOT_ACCEPTABLE, buf, len, 0);
+    }
+
+    /* header, token, Content-Format, ETag, Block2, Size2, payload marker */
+    size_t overhead = coap_get_total_hdr_len(pkt) + 3 + 5 + 4 + 5 + 1;
+    if (len <= overhead + 16) {
+        return -ENOSPC;
+    }
+
+    uint32_t blknum = 0;
+    unsigned szx = 6;
+    int blockwise = (coap_get_block2(pkt, &blknum, &szx) == 0);
+
+    /* a changed ETag tells a client that the document was rendered anew
+     * in the middle of its transfer (RFC 7959, 2.4) */
+    if (!blknum || !_doc.doc || (_doc.cbor != cbor)) {
+        if (_render(cbor)) {
+            return coap_build_reply(pkt, COAP_CODE_INTERNAL_SERVER_ERROR, buf, len, 0);
+        }
+    }
+    uint8_t etag[4] = { _doc.hash >> 24, _doc.hash >> 16, _doc.hash >> 8, _doc.hash };
+
+    if (blockwise || (_doc.len > len - overhead)) {
+        blockwise = 1;
+        /* a smaller block size than asked for starts at the same offset
+         * (RFC 7959, 2.2) */
+        while ((16U << szx) > len - overhead) {
+            szx--;
+            blknum <<= 1;
+        }
+    }
+
+    coap_block_slicer_t slicer = { .start = 0, .end = SIZE_MAX, .cur = 0 };
+    coap_builder_t b;
+    coap_builder_init_reply(&b, buf, len, pkt, COAP_CODE_205);
+    coap_builder_add_ct(&b, ct);
+    coap_builder_add_opt(&b, COAP_OPT_ETAG, etag, sizeof(etag));
+    if (blockwise) {
+        coap_block_slicer_init(&slicer, blknum, szx);
+        if (slicer.start >= _doc.len) {
+            return coap_build_reply(pkt, COAP_CODE_BAD_OPTION, buf, len, 0);
+        }
+        coap_builder_add_uint(&b, COAP_OPT_BLOCK2,
+                coap_block_opt_value(blknum, slicer.end < _doc.len, szx));
+        if (!blknum) {
+            coap_builder_add_uint(&b, COAP_OPT_SIZE2, _doc.len);
+        }
+    }
+
+    size_t avail;
+    uint8_t *payload = coap_builder_payload(&b, &avail);
+    if (!payload) {
+        return b.err;
+    }
+
+    size_t payload_len = coap_blockwise_put_bytes(&slicer, payload, _doc.doc, _doc.len);
+    return coap_builder_finish(&b, payload, payload_len);
+}
@@ -0,0 +1,51 @@
+#ifndef NANOCOAP_STATS_H
+#define NANOCOAP_STATS_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "nanocoap.h"
+
+/**
+ * @name    Handler latency histogram
+ *
+ * Bucket i counts handler runs that took less than
+ * 2^(NANOCOAP_STATS_HIST_MIN_LOG2 + i) ns, the last bucket everything above.
+ * @{
+ */
+#define NANOCOAP_STATS_HIST_BUCKETS     (16U)
+#define NANOCOAP_STATS_HIST_MIN_LOG2    (10U)
+/** @} */
+
+/*
+ * Counters are kept per thread and only ever written by their thread, so
+ * updating them needs neither locks nor atomic read-modify-write operations.
+ * Snapshots sum up the counters of all threads.
+ */
+void coap_stats_parse_error(void);
+void coap_stats_rx_drops(uint32_t drops);
+
+/**
+ * @brief   Count a handled request
+ *
+ * @param[in]   res     index into coap_resources[], coap_resources_numof if
+ *                      no resource matched
+ * @param[in]   code    response code (raw header value)
+ * @param[in]   nsecs   time spent in the handler
+ */
+void coap_stats_request(unsigned res, unsigned code, uint64_t nsecs);
+
+/**
+ * @brief   Returns a snapshot of all counters as JSON (or CBOR, if requested
+ *          using the Accept option)
+ *
+ * Snapshots larger than the response buffer are sent block-wise (Block2).
+ * Later blocks come from the snapshot taken for the first one on the same
+ * thread, its ETag changes when a new snapshot is taken.
+ */
+ssize_t coap_well_known_stats_handler(coap_pkt_t *pkt, uint8_t *buf, size_t len);
+
+#define COAP_WELL_KNOWN_STATS_HANDLER \
+    { "/.well-known/stats", COAP_GET, coap_well_known_stats_handler, ";ct=\"50 60\"", 0 }
+
+#endif /* NANOCOAP_STATS_H */
@@ -0,0 +1,572 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nanocoap.h"
+#include "nanocoap_tcp.h"
+#include "net/sock/posix.h"
+
+#if NANOCOAP_STATS
+#include "nanocoap_stats.h"
+#endif
+
+#if NANOCOAP_DEBUG
+#define ENABLE_DEBUG (1)
+#else
+#define ENABLE_DEBUG (0)
+#endif
+#include "debug.h"
+
+#define CLIENT_TIMEOUT_MS   (COAP_ACK_TIMEOUT * COAP_MAX_RETRANSMIT * 1000U)
+
+typedef struct _conn _conn_t;
+
+struct _conn {
+    int fd;
+    uint32_t peer_max_msg;
+    size_t rx_len;
+    uint8_t *tx;
+    size_t tx_len;
+    size_t tx_pos;
+    uint8_t closing;            /* Abort sent, input is discarded */
+    uint64_t linger_until;      /* closing: closed at this time (ms) at the latest */
+    _conn_t *linger_prev;
+    _conn_t *linger_next;
+    /* COAP_TCP_HEADROOM bytes, then up to NANOCOAP_TCP_MAX_MSG received bytes */
+    uint8_t rx[];
+};
+
+static int _epfd;
+/* closing connections, oldest (first to expire) first */
+static _conn_t *_linger_head;
+static _conn_t *_linger_tail;
+static coap_arena_t _arena;
+static uint8_t _txbuf[COAP_TCP_HEADROOM + NANOCOAP_TCP_MAX_MSG];
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U;
+}
+
+static size_t _build_csm(uint8_t *buf)
+{
+    uint8_t *pos = buf;
+    pos += coap_build_hdr((coap_hdr_t *)pos, COAP_TYPE_NON, NULL, 0, COAP_CODE_CSM, 0);
+    pos += coap_put_option_uint(pos, 0, COAP_OPT_MAX_MESSAGE_SIZE, NANOCOAP_TCP_MAX_MSG);
+    return pos - buf;
+}
+
+static size_t _build_signal(uint8_t *buf, coap_pkt_t *pkt, unsigned code)
+{
+    return coap_build_hdr((coap_hdr_t *)buf, COAP_TYPE_NON, pkt ? pkt->token : NULL,
+            pkt ? coap_get_token_len(pkt) : 0, code, 0);
+}
+
+static void _set_events(_conn_t *conn, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = conn };
+    epoll_ctl(_epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+static void _close(_conn_t *conn)
+{
+    DEBUG("nanocoap_tcp: closing connection %i\n", conn->fd);
+    if (conn->closing) {
+        *(conn->linger_prev ? &conn->linger_prev->linger_next : &_linger_head) =
+            conn->linger_next;
+        *(conn->linger_next ? &conn->linger_next->linger_prev : &_linger_tail) =
+            conn->linger_prev;
+    }
+    close(conn->fd);
+    free(conn->tx);
+    free(conn);
+}
+
+/* sends a message built at _txbuf + COAP_TCP_HEADROOM. Whatever the socket
+ * does not take right away is queued, and reading from the connection pauses
+ * until it has been flushed. */
+static int _send(_conn_t *conn, size_t len)
+{
+    uint8_t *frame;
+    len = coap_tcp_frame(_txbuf + COAP_TCP_HEADROOM, len, &frame);
+
+    ssize_t res = send(conn->fd, frame, len, MSG_NOSIGNAL);
+    if (res < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+            return -errno;
+        }
+        res = 0;
+    }
+
+    if ((size_t)res < len) {
+        uint8_t *tx = malloc(len - res);
+        if (!tx) {
+            return -ENOMEM;
+        }
+        memcpy(tx, frame + res, len - res);
+        conn->tx = tx;
+        conn->tx_len = len - res;
+        conn->tx_pos = 0;
+        _set_events(conn, EPOLLOUT);
+    }
+
+    return 0;
+}
+
+/* sends an Abort. The write side is shut down once it has been flushed, and
+ * the connection closed when the peer closes its side, or after
+ * NANOCOAP_TCP_LINGER_MS if it does not. */
+static int _abort(_conn_t *conn)
+{
+    conn->closing = 1;
+    conn->rx_len = 0;
+    conn->linger_until = _now() + NANOCOAP_TCP_LINGER_MS;
+    conn->linger_next = NULL;
+    conn->linger_prev = _linger_tail;
+    *(_linger_tail ? &_linger_tail->linger_next : &_linger_head) = conn;
+    _linger_tail = conn;
+
+    int res = _send(conn, _build_signal(_txbuf + COAP_TCP_HEADROOM, NULL, COAP_CODE_ABORT));
+    if ((res == 0) && !conn->tx) {
+        shutdown(conn->fd, SHUT_WR);
+    }
+    return res;
+}
+
+static int _flush(_conn_t *conn)
+{
+    ssize_t res = send(conn->fd, conn->tx + conn->tx_pos,
+            conn->tx_len - conn->tx_pos, MSG_NOSIGNAL);
+    if (res < 0) {
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -errno;
+    }
+
+    conn->tx_pos += res;
+    if (conn->tx_pos == conn->tx_len) {
+        free(conn->tx);
+        conn->tx = NULL;
+        _set_events(conn, EPOLLIN);
+        if (conn->closing) {
+            shutdown(conn->fd, SHUT_WR);
+        }
+    }
+
+    return 0;
+}
+
+static int _handle_frame(_conn_t *conn, uint8_t *frame, size_t len)
+{
+    coap_pkt_t pkt;
+    uint8_t *resp = _txbuf + COAP_TCP_HEADROOM;
+
+    if (coap_parse_tcp(&pkt, frame, len) < 0) {
+        DEBUG("nanocoap_tcp: error parsing frame\n");
+#if NANOCOAP_STATS
+        coap_stats_parse_error();
+#endif
+        return _abort(conn);
+    }
+
+    switch (pkt.hdr->code) {
+        case COAP_CODE_EMPTY:
+            return 0;
+        case COAP_CODE_CSM:
+            {
+                uint32_t max_msg;
+                if (coap_opt_get_uint(&pkt, COAP_OPT_MAX_MESSAGE_SIZE, &max_msg) == 0) {
+                    conn->peer_max_msg = max_msg;
+                }
+                return 0;
+            }
+        case COAP_CODE_PING:
+            return _send(conn, _build_signal(resp, &pkt, COAP_CODE_PONG));
+        case COAP_CODE_PONG:
+            return 0;
+        case COAP_CODE_RELEASE:
+        case COAP_CODE_ABORT:
+            return -ECONNRESET;
+    }
+
+    if (coap_get_code_class(&pkt) != COAP_REQ) {
+        return 0;
+    }
+
+    /* Max-Message-Size limits the frame, whose header can be up to 2 bytes
+     * longer than the RFC 7252 one the response is built with */
+    size_t frame_max = NANOCOAP_TCP_MAX_MSG;
+    if (conn->peer_max_msg < frame_max) {
+        frame_max = conn->peer_max_msg;
+    }
+    size_t hdr_extra = COAP_TCP_HDR_MAX - sizeof(coap_hdr_t);
+    size_t resp_max = (frame_max > hdr_extra) ? frame_max - hdr_extra : 0;
+
+    pkt.arena = &_arena;
+    ssize_t res = coap_handle_req(&pkt, resp, resp_max);
+    coap_arena_reset(&_arena);
+    if (res > 0) {
+        return _send(conn, res);
+    }
+
+    return 0;
+}
+
+/* handles all complete frames in the receive buffer */
+static int _process(_conn_t *conn)
+{
+    uint8_t *data = conn->rx + COAP_TCP_HEADROOM;
+    size_t pos = 0;
+
+    while (!conn->tx && !conn->closing) {
+        size_t frame_len = coap_tcp_frame_len(data + pos, conn->rx_len - pos);
+        if (frame_len > NANOCOAP_TCP_MAX_MSG) {
+            DEBUG("nanocoap_tcp: message too large\n");
+            return _abort(conn);
+        }
+        if (!frame_len || (frame_len > (conn->rx_len - pos))) {
+            break;
+        }
+
+        /* parsing rewrites up to COAP_TCP_HEADROOM bytes in front of the
+         * frame, which are either reserved or belong to an already handled
+         * frame. */
+        int res = _handle_frame(conn, data + pos, frame_len);
+        if ((res < 0) || conn->closing) {
+            return res;
+        }
+        pos += frame_len;
+    }
+
+    if (pos) {
+        conn->rx_len -= pos;
+        memmove(data, data + pos, conn->rx_len);
+    }
+
+    return 0;
+}
+
+static int _read(_conn_t *conn)
+{
+    uint8_t *data = conn->rx + COAP_TCP_HEADROOM;
+
+    while (1) {
+        ssize_t res = recv(conn->fd, data + conn->rx_len,
+                NANOCOAP_TCP_MAX_MSG - conn->rx_len, 0);
+        if (res == 0) {
+            return -ECONNRESET;
+        }
+        else if (res < 0) {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -errno;
+        }
+        if (conn->closing) {
+            continue;
+        }
+
+        conn->rx_len += res;
+        if ((res = _process(conn)) < 0) {
+            return res;
+        }
+        if (conn->tx) {
+            /* paused until pending output is flushed */
+            return 0;
+        }
+    }
+}
+
+static void _accept(int listen_fd)
+{
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                perror("accept");
+            }
+            return;
+        }
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        const int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        _conn_t *conn = malloc(sizeof(_conn_t) + COAP_TCP_HEADROOM + NANOCOAP_TCP_MAX_MSG);
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        memset(conn, 0, sizeof(_conn_t));
+        conn->fd = fd;
+        conn->peer_max_msg = COAP_TCP_DEFAULT_MAX_MSG;
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            _close(conn);
+            continue;
+        }
+
+        /* both sides start with a CSM */
+        if (_send(conn, _build_csm(_txbuf + COAP_TCP_HEADROOM)) < 0) {
+            epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL);
+            _close(conn);
+        }
+    }
+}
+
+int nanocoap_tcp_listen(sock_udp_ep_t *local)
+{
+    struct sockaddr_storage addr;
+    int addr_len = sock_ep2sockaddr(&addr, local);
+    if (addr_len < 0) {
+        return addr_len;
+    }
+
+    int fd = socket(addr.ss_family,
+            SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("creating socket");
+        return -1;
+    }
+
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if (bind(fd, (struct sockaddr *)&addr, addr_len) == -1) {
+        perror("bind");
+        goto err;
+    }
+    if (listen(fd, SOMAXCONN) == -1) {
+        perror("listen");
+        goto err;
+    }
+
+    return fd;
+
+err:
+    close(fd);
+    return -1;
+}
+
+int nanocoap_tcp_server(sock_udp_ep_t *local)
+{
+    if (!local->port) {
+        local->port = COAP_PORT;
+    }
+
+    if (coap_arena_init(&_arena)) {
+        return -1;
+    }
+
+    int listen_fd = nanocoap_tcp_listen(local);
+    if (listen_fd < 0) {
+        return -1;
+    }
+
+    coap_well_known_core_init();
+
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd == -1) {
+        close(listen_fd);
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    struct epoll_event events[NANOCOAP_TCP_MAX_EVENTS];
+    while (1) {
+        int timeout = -1;
+        if (_linger_head) {
+            uint64_t now = _now();
+            timeout = (_linger_head->linger_until > now)
+                    ? (int)(_linger_head->linger_until - now) : 0;
+        }
+
+        int n = epoll_wait(_epfd, events, NANOCOAP_TCP_MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            _conn_t *conn = events[i].data.ptr;
+            if (!conn) {
+                _accept(listen_fd);
+                continue;
+            }
+
+            int res = 0;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                res = -ECONNRESET;
+            }
+            else if (conn->tx) {
+                if (((res = _flush(conn)) == 0) && !conn->tx) {
+                    /* catch up on frames received while output was pending */
+                    if ((res = _process(conn)) == 0 && !conn->tx) {
+                        res = _read(conn);
+                    }
+                }
+            }
+            else {
+                res = _read(conn);
+            }
+
+            if (res < 0) {
+                epoll_ctl(_epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+                _close(conn);
+            }
+        }
+
+        /* reap closing connections whose peer did not close in time */
+        uint64_t now = _now();
+        while (_linger_head && (_linger_head->linger_until <= now)) {
+            DEBUG("nanocoap_tcp: peer did not close %i\n", _linger_head->fd);
+            epoll_ctl(_epfd, EPOLL_CTL_DEL, _linger_head->fd, NULL);
+            _close(_linger_head);
+        }
+    }
+
+    close(_epfd);
+    close(listen_fd);
+
+    return -1;
+}
+
+static ssize_t _send_all(int fd, uint8_t *buf, size_t len)
+{
+    uint8_t *frame;
+    len = coap_tcp_frame(buf, len, &frame);
+
+    while (len) {
+        ssize_t res = send(fd, frame, len, MSG_NOSIGNAL);
+        if (res < 0) {
+            return -errno;
+        }
+        frame += res;
+        len -= res;
+    }
+
+    return 0;
+}
+
+ssize_t nanocoap_tcp_get(sock_udp_ep_t *remote, const char *path, uint8_t *buf, size_t len)
+{
+    struct sockaddr_storage addr;
+    uint8_t token[2] = { 0x4e, 0x43 };
+    ssize_t res;
+
+    if (len <= COAP_TCP_HEADROOM + COAP_TCP_HDR_MAX) {
+        return -ENOSPC;
+    }
+
+    if (!remote->port) {
+        remote->port = COAP_PORT;
+    }
+
+    int addr_len = sock_ep2sockaddr(&addr, remote);
+    if (addr_len < 0) {
+        return addr_len;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -errno;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, addr_len) == -1) {
+        res = -errno;
+        goto out;
+    }
+
+    uint8_t *data = buf + COAP_TCP_HEADROOM;
+    size_t data_max = len - COAP_TCP_HEADROOM;
+
+    if ((res = _send_all(fd, data, _build_csm(data))) < 0) {
+        goto out;
+    }
+
+    coap_builder_t b;
+    coap_builder_init(&b, data, data_max, COAP_TYPE_NON, token, sizeof(token), COAP_METHOD_GET, 0);
+    coap_builder_add_path(&b, path);
+    if ((res = coap_builder_finish(&b, NULL, 0)) < 0) {
+        goto out;
+    }
+    if ((res = _send_all(fd, data, res)) < 0) {
+        goto out;
+    }
+
+    size_t rx_len = 0;
+    while (1) {
+        size_t frame_len;
+        while (!(frame_len = coap_tcp_frame_len(data, rx_len)) || (frame_len > rx_len)) {
+            if (frame_len > data_max) {
+                res = -ENOSPC;
+                goto out;
+            }
+
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, CLIENT_TIMEOUT_MS) <= 0) {
+                DEBUG("nanocoap: timeout\n");
+                res = -ETIMEDOUT;
+                goto out;
+            }
+
+            res = recv(fd, data + rx_len, data_max - rx_len, 0);
+            if (res <= 0) {
+                res = res ? -errno : -ECONNRESET;
+                goto out;
+            }
+            rx_len += res;
+        }
+
+        coap_pkt_t pkt;
+        if (coap_parse_tcp(&pkt, data, frame_len) < 0) {
+            res = -EBADMSG;
+            goto out;
+        }
+
+        if (pkt.hdr->code == COAP_CODE_PING) {
+            uint8_t pong[COAP_TCP_HEADROOM + COAP_TCP_HDR_MAX + 8];
+            size_t pong_len = _build_signal(pong + COAP_TCP_HEADROOM, &pkt, COAP_CODE_PONG);
+            _send_all(fd, pong + COAP_TCP_HEADROOM, pong_len);
+        }
+        else if (pkt.hdr->code == COAP_CODE_ABORT) {
+            res = -ECONNRESET;
+            goto out;
+        }
+        else if ((coap_get_code_class(&pkt) != COAP_SIGNAL) &&
+                 (coap_get_token_len(&pkt) == sizeof(token)) &&
+                 (memcmp(pkt.token, token, sizeof(token)) == 0)) {
+            res = coap_get_code(&pkt);
+            if (res != 205) {
+                res = -res;
+            }
+            else {
+                if (pkt.payload_len) {
+                    memmove(buf, pkt.payload, pkt.payload_len);
+                }
+                res = pkt.payload_len;
+            }
+            goto out;
+        }
+
+        rx_len -= frame_len;
+        memmove(data, data + frame_len, rx_len);
+    }
+
+out:
+    close(fd);
+    return res;
+}
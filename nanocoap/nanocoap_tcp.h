@@ -0,0 +1,57 @@
+#ifndef NANOCOAP_TCP_H
+#define NANOCOAP_TCP_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "net/sock/udp.h"
+
+/**
+ * @brief   Largest message the tcp server accepts and announces in its CSM
+ *
+ * Every connection owns a receive buffer of this size, so payloads up to this
+ * size can be transferred in one message, without block-wise round trips.
+ */
+#ifndef NANOCOAP_TCP_MAX_MSG
+#define NANOCOAP_TCP_MAX_MSG        (8192U)
+#endif
+
+/**
+ * @brief   Number of epoll events handled per epoll_wait() call
+ */
+#ifndef NANOCOAP_TCP_MAX_EVENTS
+#define NANOCOAP_TCP_MAX_EVENTS     (64U)
+#endif
+
+/**
+ * @brief   Time a connection is kept after sending an Abort (ms)
+ *
+ * It is closed when the peer closes its side, or when this expires.
+ */
+#ifndef NANOCOAP_TCP_LINGER_MS
+#define NANOCOAP_TCP_LINGER_MS      (5000U)
+#endif
+
+/**
+ * @brief   Serve coap_resources[] over CoAP over TCP (RFC 8323)
+ *
+ * All connections are handled by one epoll loop. Only returns on error.
+ */
+int nanocoap_tcp_server(sock_udp_ep_t *local);
+
+/**
+ * @brief   Open a non-blocking TCP socket listening on @p local
+ *
+ * @returns the socket, or -1 on error
+ */
+int nanocoap_tcp_listen(sock_udp_ep_t *local);
+
+/**
+ * @brief   Send a GET request over CoAP over TCP
+ *
+ * @returns payload length (payload is copied to the start of @p buf),
+ *          negative response code or negative errno
+ */
+ssize_t nanocoap_tcp_get(sock_udp_ep_t *remote, const char *path, uint8_t *buf, size_t len);
+
+#endif /* NANOCOAP_TCP_H */
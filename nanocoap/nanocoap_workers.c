@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "net/sock/udp.h"
+#include "net/sock/posix.h"
+
+#include "nanocoap.h"
+#include "nanocoap_sock.h"
+
+#if NANOCOAP_DEBUG
+#define ENABLE_DEBUG (1)
+#else
+#define ENABLE_DEBUG (0)
+#endif
+#include "debug.h"
+
+/* workers wait until all of them exist, so none reads its socket before the
+ * group is complete */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int state;                  /* 0 waiting, 1 serving, -1 giving up */
+} _start_t;
+
+typedef struct {
+    sock_udp_t *sock;
+    size_t bufsize;
+    _start_t *start;
+    pthread_t thread;
+} _worker_t;
+
+static void *_worker(void *arg)
+{
+    _worker_t *worker = arg;
+    _start_t *start = worker->start;
+
+    pthread_mutex_lock(&start->lock);
+    while (!start->state) {
+        pthread_cond_wait(&start->cond, &start->lock);
+    }
+    int state = start->state;
+    pthread_mutex_unlock(&start->lock);
+    if (state < 0) {
+        return NULL;
+    }
+
+    uint8_t *buf = malloc(worker->bufsize);
+    if (!buf) {
+        return NULL;
+    }
+
+    nanocoap_server_sock(worker->sock, buf, worker->bufsize);
+
+    free(buf);
+    return NULL;
+}
+
+static void _start(_start_t *start, int state)
+{
+    pthread_mutex_lock(&start->lock);
+    start->state = state;
+    pthread_cond_broadcast(&start->cond);
+    pthread_mutex_unlock(&start->lock);
+}
+
+int nanocoap_server_workers(sock_udp_ep_t *local, unsigned numof, size_t bufsize)
+{
+    int res;
+
+    if (!local->port) {
+        local->port = COAP_PORT;
+    }
+
+    /* the CPUs this process may run on, which need not be 0 to n - 1 in a
+     * cpuset or container */
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        return -errno;
+    }
+    unsigned allowed_numof = CPU_COUNT(&allowed);
+    if (!numof || (numof > allowed_numof)) {
+        numof = allowed_numof;
+    }
+
+    unsigned *cpus = calloc(numof, sizeof(unsigned));
+    sock_udp_t *socks = calloc(numof, sizeof(sock_udp_t));
+    _worker_t *workers = calloc(numof, sizeof(_worker_t));
+    if (!cpus || !socks || !workers) {
+        res = -ENOMEM;
+        goto out;
+    }
+
+    /* worker i runs on the i-th allowed CPU */
+    for (unsigned cpu = 0, i = 0; i < numof; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus[i++] = cpu;
+        }
+    }
+
+    if ((res = sock_udp_create_cpu_group(socks, cpus, numof, local))) {
+        goto out;
+    }
+
+    coap_well_known_core_init();
+
+    _start_t start = {
+        .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .state = 0
+    };
+    unsigned started;
+    for (started = 0; started < numof; started++) {
+        _worker_t *worker = &workers[started];
+        pthread_attr_t attr;
+        cpu_set_t cpu;
+
+        CPU_ZERO(&cpu);
+        CPU_SET(cpus[started], &cpu);
+        pthread_attr_init(&attr);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu);
+
+        worker->sock = &socks[started];
+        worker->bufsize = bufsize;
+        worker->start = &start;
+        res = pthread_create(&worker->thread, &attr, _worker, worker);
+        pthread_attr_destroy(&attr);
+        if (res) {
+            DEBUG("nanocoap: error starting worker %u\n", started);
+            res = -res;
+            break;
+        }
+    }
+
+    /* without all workers, some sockets of the group would never be read */
+    _start(&start, (started == numof) ? 1 : -1);
+
+    /* workers only return on error */
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    if (started == numof) {
+        res = -1;
+    }
+
+    for (unsigned i = 0; i < numof; i++) {
+        sock_udp_close(&socks[i]);
+    }
+
+out:
+    free(workers);
+    free(socks);
+    free(cpus);
+    return res;
+}
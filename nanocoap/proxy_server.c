@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "nanocoap.h"
+#include "nanocoap_proxy.h"
+#include "net/sock/udp.h"
+
+#define COAP_INBUF_SIZE (1280U)
+
+int main(int argc, char *argv[])
+{
+    uint8_t buf[COAP_INBUF_SIZE];
+
+    sock_udp_ep_t local = { .port=COAP_PORT };
+    if (argc > 1) {
+        local.port = atoi(argv[1]);
+    }
+
+    nanocoap_proxy_server(&local, buf, sizeof(buf));
+
+    return 0;
+}
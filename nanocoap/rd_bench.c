@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nanocoap.h"
+#include "nanocoap_rd.h"
+#include "net/sock/udp.h"
+
+#define DEFAULT_REGISTRATIONS   (100000UL)
+#define LOOKUP_ITERATIONS       (100000UL)
+
+/* every endpoint registers these, "rt=temp" is shared by all of them */
+static const char _links[] = "</temp>;rt=temp;if=sensor,</hum>;rt=hum;if=sensor,"
+                             "</fw>;rt=firmware;ct=42";
+
+const coap_resource_t coap_resources[] = {
+    COAP_RD_HANDLERS,
+};
+
+const unsigned coap_resources_numof = sizeof(coap_resources) / sizeof(coap_resources[0]);
+
+static volatile ssize_t _sink;
+static sock_udp_ep_t _remote = { .family = AF_INET6, .port = COAP_PORT,
+                                 .addr.ipv6 = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 } };
+
+static uint64_t _nsecs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef struct {
+    uint8_t buf[512];
+    size_t len;
+} _req_t;
+
+static void _build(_req_t *req, unsigned code, const char *path, const char *qs,
+        const char *payload)
+{
+    coap_builder_t b;
+    static const uint8_t token[] = { 0x52, 0x44 };
+
+    coap_builder_init(&b, req->buf, sizeof(req->buf), COAP_TYPE_CON,
+            token, sizeof(token), code, 0x1234);
+    coap_builder_add_path(&b, path);
+    /* one Uri-Query option per parameter */
+    while (qs && *qs) {
+        size_t len = strcspn(qs, "&");
+        coap_builder_add_opt(&b, COAP_OPT_URI_QUERY, qs, len);
+        qs += len + (qs[len] == '&');
+    }
+    if (payload) {
+        coap_builder_add_ct(&b, COAP_CT_LINK_FORMAT);
+    }
+
+    ssize_t res = coap_builder_finish(&b, payload, payload ? strlen(payload) : 0);
+    if (res < 0) {
+        fprintf(stderr, "error building %s?%s: %zi\n", path, qs, res);
+        exit(1);
+    }
+    req->len = res;
+}
+
+/* returns the response code */
+static unsigned _handle(_req_t *req)
+{
+    coap_pkt_t pkt;
+    uint8_t resp[1280];
+
+    coap_parse(&pkt, req->buf, req->len);
+    pkt.remote = &_remote;
+    ssize_t res = coap_handle_req(&pkt, resp, sizeof(resp));
+    if (res < 0) {
+        return 0;
+    }
+    coap_parse(&pkt, resp, res);
+    return coap_get_code(&pkt);
+}
+
+static void _lookup(const char *name, const char *path, const char *qs)
+{
+    _req_t req;
+    _build(&req, COAP_METHOD_GET, path, qs, NULL);
+
+    unsigned code = _handle(&req);
+    if (code != 205) {
+        fprintf(stderr, "%s: %u\n", name, code);
+        exit(1);
+    }
+
+    uint64_t ns = _nsecs();
+    for (unsigned long i = 0; i < LOOKUP_ITERATIONS; i++) {
+        _sink = _handle(&req);
+    }
+    ns = _nsecs() - ns;
+    printf("lookup     %-24s %10.1f ns/op\n", name, (double)ns / LOOKUP_ITERATIONS);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long n = DEFAULT_REGISTRATIONS;
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 0);
+    }
+
+    static _req_t req;
+    uint64_t ns = 0;
+    for (unsigned long i = 0; i < n; i++) {
+        char qs[32];
+        snprintf(qs, sizeof(qs), "ep=node%lu&lt=3600", i);
+        _build(&req, COAP_METHOD_POST, "/rd", qs, _links);
+
+        uint64_t start = _nsecs();
+        unsigned code = _handle(&req);
+        ns += _nsecs() - start;
+        if (code != 201) {
+            fprintf(stderr, "registering node%lu: %u\n", i, code);
+            return 1;
+        }
+    }
+
+    printf("%u registrations, %lu lookups each\n", coap_rd_numof(), LOOKUP_ITERATIONS);
+    printf("register   %-24s %10.1f ns/op\n", "3_links", (double)ns / n);
+
+    char qs[48];
+    snprintf(qs, sizeof(qs), "ep=node%lu", n / 2);
+    _lookup("ep_exact", "/rd-lookup/ep", qs);
+    snprintf(qs, sizeof(qs), "ep=node%lu&rt=temp", n / 2);
+    _lookup("res_two_filters", "/rd-lookup/res", qs);
+    _lookup("res_shared_paged", "/rd-lookup/res", "rt=temp&page=10&count=10");
+    _lookup("res_shared_first_block", "/rd-lookup/res", "rt=firmware");
+    _lookup("ep_prefix_paged", "/rd-lookup/ep", "ep=node9*&count=5");
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+#include <stdint.h>
+
+#include "nanocoap.h"
+#include "nanocoap_rd.h"
+#include "nanocoap_sock.h"
+#include "net/sock/udp.h"
+
+#if NANOCOAP_STATS
+#include "nanocoap_stats.h"
+#endif
+
+#define COAP_INBUF_SIZE (1280U)
+
+const coap_resource_t coap_resources[] = {
+    COAP_WELL_KNOWN_CORE_DEFAULT_HANDLER,
+#if NANOCOAP_STATS
+    COAP_WELL_KNOWN_STATS_HANDLER,
+#endif
+    COAP_RD_HANDLERS,
+};
+
+const unsigned coap_resources_numof = sizeof(coap_resources) / sizeof(coap_resources[0]);
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    uint8_t buf[COAP_INBUF_SIZE];
+
+    sock_udp_ep_t local = { .port=COAP_PORT };
+
+    nanocoap_server(&local, buf, sizeof(buf));
+
+    return 0;
+}
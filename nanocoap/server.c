@@ -1,20 +1,24 @@
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "nanocoap.h"
 #include "nanocoap_sock.h"
 #include "net/sock/udp.h"
 
-#define COAP_INBUF_SIZE (256U)
+#define COAP_INBUF_SIZE (1280U)
 
 int main(int argc, char *argv[])
 {
-    (void)argc;
-    (void)argv;
-
     uint8_t buf[COAP_INBUF_SIZE];
 
     sock_udp_ep_t local = { .port=COAP_PORT };
 
+    /* "nanocoap_server <workers>": one worker per CPU for 0 */
+    if (argc > 1) {
+        nanocoap_server_workers(&local, atoi(argv[1]), COAP_INBUF_SIZE);
+        return 1;
+    }
+
     nanocoap_server(&local, buf, sizeof(buf));
 
     return 0;
@@ -0,0 +1,17 @@
+#include <stdint.h>
+
+#include "nanocoap.h"
+#include "nanocoap_tcp.h"
+#include "net/sock/udp.h"
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    sock_udp_ep_t local = { .port=COAP_PORT };
+
+    nanocoap_tcp_server(&local);
+
+    return 0;
+}
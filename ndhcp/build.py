@@ -1 +1 @@
-Main("ndhcpc", glob.glob("*.c") + ["../src/posix/posix.c"])
+Main("ndhcpc", glob.glob("*.c") + ["../src/posix/posix.c", "../src/pktbuf.c"])
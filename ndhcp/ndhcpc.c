@@ -5,6 +5,8 @@
 
 #include "ndhcpc.h"
 #include "net/sock/udp.h"
+#include "net/sock/pktbuf.h"
+#include "net/sock/posix.h"
 
 #define DHCP_OFFER_MINLEN (48+192+4)
 #define DHCP_MAGIC_COOKIE (0x63825363)
@@ -25,6 +27,11 @@ int ndhcpc_init(ndhcpc_t *n, unsigned iface, uint32_t xid)
         exit(0);
     }
 
+    static const struct sock_filter filter[] = SOCK_FILTER_DHCP_REPLY;
+    if (sock_udp_attach_filter(&n->sock, filter, sizeof(filter) / sizeof(filter[0]))) {
+        fprintf(stderr, "ndhcpc: error attaching packet filter.\n");
+    }
+
     return 0;
 }
 
@@ -175,15 +182,19 @@ static void _handle_ack(uint8_t *buf, size_t res)
 
 int ndhcpc_loop(ndhcpc_t *n)
 {
-    uint8_t buf[512];
+    sock_pktbuf_t *pb = sock_pktbuf_alloc();
+    if (!pb) {
+        return -1;
+    }
+    uint8_t *buf = pb->data;
     int t = 0;
     while(1) {
         switch (n->state) {
             case DHCP_STATE_DISCOVER:
-                _send_discover(n, buf, sizeof(buf), t++);
+                _send_discover(n, buf, SOCK_PKTBUF_SIZE, t++);
                 /* fall through */
             case DHCP_STATE_REQUEST:
-                _receive(n, buf, sizeof(buf));
+                _receive(n, buf, SOCK_PKTBUF_SIZE);
                 break;
             case DHCP_STATE_BOUND:
                 {
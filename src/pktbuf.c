@@ -0,0 +1,143 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "net/sock/udp.h"
+#include "net/sock/pktbuf.h"
+
+/* a thread keeps at most 1/16 of the pool, so it takes 16 threads holding on
+ * to free buffers to starve the others */
+#define LOCAL_MAX   ((SOCK_PKTBUF_LOCAL_MAX < SOCK_PKTBUF_NUMOF / 16) ? \
+                     SOCK_PKTBUF_LOCAL_MAX : SOCK_PKTBUF_NUMOF / 16)
+
+/* buffers move between a thread's own free list and the shared one in
+ * batches, so the lock is only taken every LOCAL_MAX / 2 buffers */
+#define BATCH   (LOCAL_MAX / 2)
+
+static sock_pktbuf_t _pool[SOCK_PKTBUF_NUMOF];
+static sock_pktbuf_t *_free;
+static unsigned _initialized;
+static atomic_flag _lock = ATOMIC_FLAG_INIT;
+
+static _Thread_local sock_pktbuf_t *_local;
+static _Thread_local unsigned _local_numof;
+static _Thread_local unsigned _registered;
+
+/* its destructor returns a thread's buffers when the thread exits */
+static pthread_key_t _key;
+static pthread_once_t _key_once = PTHREAD_ONCE_INIT;
+
+static void _acquire(void)
+{
+    while (atomic_flag_test_and_set_explicit(&_lock, memory_order_acquire)) {}
+}
+
+static void _unlock(void)
+{
+    atomic_flag_clear_explicit(&_lock, memory_order_release);
+}
+
+/* moves up to @p n buffers from @p from to @p to, returns the number moved */
+static unsigned _move(sock_pktbuf_t **from, sock_pktbuf_t **to, unsigned n)
+{
+    unsigned moved = 0;
+    while (*from && (moved < n)) {
+        sock_pktbuf_t *pb = *from;
+        *from = pb->next;
+        pb->next = *to;
+        *to = pb;
+        moved++;
+    }
+    return moved;
+}
+
+static void _thread_exit(void *arg)
+{
+    (void)arg;
+
+    _acquire();
+    _move(&_local, &_free, _local_numof);
+    _unlock();
+    _local_numof = 0;
+    _registered = 0;
+}
+
+static void _key_create(void)
+{
+    pthread_key_create(&_key, _thread_exit);
+}
+
+static void _register(void)
+{
+    if (!_registered) {
+        pthread_once(&_key_once, _key_create);
+        /* any non-NULL value has the destructor run */
+        pthread_setspecific(_key, &_local);
+        _registered = 1;
+    }
+}
+
+sock_pktbuf_t *sock_pktbuf_alloc(void)
+{
+    if (!_local) {
+        _register();
+        _acquire();
+        if (!_initialized) {
+            for (unsigned i = 0; i < SOCK_PKTBUF_NUMOF; i++) {
+                _pool[i].next = _free;
+                _free = &_pool[i];
+            }
+            _initialized = 1;
+        }
+        _local_numof += _move(&_free, &_local, BATCH ? BATCH : 1);
+        _unlock();
+
+        if (!_local) {
+            return NULL;
+        }
+    }
+
+    sock_pktbuf_t *pb = _local;
+    _local = pb->next;
+    _local_numof--;
+
+    pb->next = NULL;
+    pb->len = 0;
+    atomic_store_explicit(&pb->refs, 1, memory_order_relaxed);
+    return pb;
+}
+
+void sock_pktbuf_release(sock_pktbuf_t *pb)
+{
+    if (atomic_fetch_sub_explicit(&pb->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    _register();
+    pb->next = _local;
+    _local = pb;
+    if (++_local_numof > LOCAL_MAX) {
+        _acquire();
+        _local_numof -= _move(&_local, &_free, BATCH ? BATCH : 1);
+        _unlock();
+    }
+}
+
+ssize_t sock_udp_recv_pktbuf(sock_udp_t *sock, sock_pktbuf_t **pb, uint32_t timeout,
+        sock_udp_ep_t *remote)
+{
+    sock_pktbuf_t *buf = sock_pktbuf_alloc();
+    if (!buf) {
+        return -ENOBUFS;
+    }
+
+    ssize_t res = sock_udp_recv(sock, buf->data, sizeof(buf->data), timeout, remote);
+    if (res < 0) {
+        sock_pktbuf_release(buf);
+        return res;
+    }
+
+    buf->len = res;
+    *pb = buf;
+    return res;
+}
@@ -1,15 +1,18 @@
 #include <assert.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 #include <sys/select.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <net/if.h>
 #include <unistd.h>
 
 #include <stdio.h>
 
 #include "net/sock/udp.h"
+#include "net/sock/posix.h"
 
 #define SOCK_UDP_LOCAL (0x1)
 #define SOCK_UDP_REMOTE (0x2)
@@ -110,6 +113,22 @@ static int _sockaddr_to_endpoint(sock_udp_ep_t *endpoint, void *_sockaddr)
     }
 }
 
+int sock_ep2sockaddr(void *sockaddr, const sock_udp_ep_t *endpoint)
+{
+    memset(sockaddr, '\0', sizeof(sockaddr_t));
+    int res = _endpoint_to_sockaddr(sockaddr, endpoint);
+    if (res) {
+        return res;
+    }
+    return _addrlen(endpoint->family);
+}
+
+int sock_sockaddr2ep(sock_udp_ep_t *endpoint, const void *sockaddr)
+{
+    memset(endpoint, '\0', sizeof(*endpoint));
+    return _sockaddr_to_endpoint(endpoint, (void *)sockaddr);
+}
+
 int _udp_connect_possible(const sock_udp_ep_t *remote)
 {
     if (remote->family == AF_INET) {
@@ -122,7 +141,6 @@ int _udp_connect_possible(const sock_udp_ep_t *remote)
 
 int sock_udp_create(sock_udp_t *sock, const sock_udp_ep_t *local, const sock_udp_ep_t *remote, uint16_t flags)
 {
-    (void)flags;
     memset(sock, 0, sizeof(sock_udp_t));
 
     int res;
@@ -168,6 +186,9 @@ int sock_udp_create(sock_udp_t *sock, const sock_udp_ep_t *local, const sock_udp
             const int on=1;
             setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
             setsockopt(sock->fd, SOL_IP, IP_TRANSPARENT, &on, sizeof(on));
+            if (flags & SOCK_FLAGS_REUSE_EP) {
+                setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+            }
 
 #if defined(SOCK_HAS_IPV6)
             int ipv6_v6only = 0;
@@ -331,7 +352,9 @@ ssize_t sock_udp_recv(sock_udp_t *sock, void* buf, size_t len, unsigned timeout,
     fd_set _select_fds;
     if (timeout != SOCK_NO_TIMEOUT) {
         int activity;
-        struct timeval _timeout = { .tv_usec=timeout };
+        struct timeval _timeout = {
+            .tv_sec = timeout / 1000000U, .tv_usec = timeout % 1000000U
+        };
 
         FD_ZERO(&_select_fds);
         FD_SET(sock->fd, &_select_fds);
@@ -343,10 +366,174 @@ ssize_t sock_udp_recv(sock_udp_t *sock, void* buf, size_t len, unsigned timeout,
     }
 
     sockaddr_t sockaddr_remote = {0};
-    unsigned socklen = sizeof(sockaddr_remote);
-    ssize_t res = recvfrom(sock->fd, buf, len, 0, (struct sockaddr *)&sockaddr_remote, &socklen);
-    if (remote && (res != -1)) {
+    /* SO_RXQ_OVFL, IP_PKTINFO and IPV6_PKTINFO, which starts with the
+     * destination address */
+    uint8_t control[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct in_pktinfo)) +
+                    CMSG_SPACE(sizeof(struct in6_addr) + sizeof(int))];
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    struct msghdr msg = {
+        .msg_name = &sockaddr_remote, .msg_namelen = sizeof(sockaddr_remote),
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control, .msg_controllen = sizeof(control),
+    };
+
+    ssize_t res = recvmsg(sock->fd, &msg, 0);
+    if (res == -1) {
+        return res;
+    }
+
+    sock->multicast = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL)) {
+            memcpy(&sock->drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+        }
+        else if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO)) {
+            struct in_pktinfo info;
+            memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+            sock->multicast = IN_MULTICAST(ntohl(info.ipi_addr.s_addr));
+        }
+        else if ((cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_PKTINFO)) {
+            struct in6_addr dst;
+            memcpy(&dst, CMSG_DATA(cmsg), sizeof(dst));
+            sock->multicast = IN6_IS_ADDR_MULTICAST(&dst) ||
+                (IN6_IS_ADDR_V4MAPPED(&dst) && (dst.s6_addr[12] >= 224) &&
+                 (dst.s6_addr[12] < 240));
+        }
+    }
+
+    if (remote) {
         _sockaddr_to_endpoint(remote, &sockaddr_remote);
     }
     return res;
 }
+
+int sock_udp_enable_drop_count(sock_udp_t *sock)
+{
+    const int on = 1;
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == -1) {
+        return -errno;
+    }
+    return 0;
+}
+
+int sock_udp_enable_multicast_info(sock_udp_t *sock)
+{
+    const int on = 1;
+    int res = 0;
+
+    if (sock->family != AF_INET) {
+        res = setsockopt(sock->fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on));
+    }
+    /* also for IPv4 packets on a dual-stack socket */
+    if (sock->family != AF_INET6) {
+        res |= setsockopt(sock->fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on));
+    }
+    if (res == -1) {
+        return -errno;
+    }
+    return 0;
+}
+
+static int _set_group(sock_udp_t *sock, const sock_udp_ep_t *group, int join)
+{
+    int res;
+
+    switch (group->family) {
+#if defined(SOCK_HAS_IPV4)
+        case AF_INET:
+            {
+                struct ip_mreqn mreq = { .imr_ifindex = group->netif };
+                memcpy(&mreq.imr_multiaddr, group->addr.ipv4, 4);
+                res = setsockopt(sock->fd, IPPROTO_IP,
+                        join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+                break;
+            }
+#endif
+#if defined(SOCK_HAS_IPV6)
+        case AF_INET6:
+            {
+                struct ipv6_mreq mreq = { .ipv6mr_interface = group->netif };
+                memcpy(&mreq.ipv6mr_multiaddr, group->addr.ipv6, 16);
+                res = setsockopt(sock->fd, IPPROTO_IPV6,
+                        join ? IPV6_JOIN_GROUP : IPV6_LEAVE_GROUP, &mreq, sizeof(mreq));
+                break;
+            }
+#endif
+        default:
+            return -EINVAL;
+    }
+
+    if (res == -1) {
+        return -errno;
+    }
+    return 0;
+}
+
+int sock_udp_join_group(sock_udp_t *sock, const sock_udp_ep_t *group)
+{
+    return _set_group(sock, group, 1);
+}
+
+int sock_udp_leave_group(sock_udp_t *sock, const sock_udp_ep_t *group)
+{
+    return _set_group(sock, group, 0);
+}
+
+int sock_udp_attach_filter(sock_udp_t *sock, const struct sock_filter *filter, size_t numof)
+{
+    struct sock_fprog prog = { .len = numof, .filter = (struct sock_filter *)filter };
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1) {
+        return -errno;
+    }
+    return 0;
+}
+
+int sock_udp_create_cpu_group(sock_udp_t *socks, const unsigned *cpus, unsigned numof,
+        const sock_udp_ep_t *local)
+{
+    int res;
+
+    /* two instructions per socket, and a BPF program is limited to 4096 */
+    if (!numof || (numof > 2000)) {
+        return -EINVAL;
+    }
+
+    /* the index into the group is that of the receiving CPU in cpus, other
+     * CPUs are folded onto the group */
+    size_t len = 1 + (cpus ? 2 * numof : 0) + 2;
+    struct sock_filter *filter = malloc(len * sizeof(struct sock_filter));
+    if (!filter) {
+        return -ENOMEM;
+    }
+    struct sock_filter *pos = filter;
+    *pos++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    for (unsigned i = 0; cpus && (i < numof); i++) {
+        *pos++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpus[i], 0, 1);
+        *pos++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+    }
+    *pos++ = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, numof);
+    *pos++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+    struct sock_fprog prog = { .len = len, .filter = filter };
+
+    /* sockets join the group in the order they are bound */
+    for (unsigned i = 0; i < numof; i++) {
+        if ((res = sock_udp_create(&socks[i], local, NULL, SOCK_FLAGS_REUSE_EP)) < 0) {
+            while (i--) {
+                sock_udp_close(&socks[i]);
+            }
+            free(filter);
+            return res;
+        }
+    }
+
+    res = 0;
+    if (setsockopt(socks[0].fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+        res = -errno;
+        for (unsigned i = 0; i < numof; i++) {
+            sock_udp_close(&socks[i]);
+        }
+    }
+
+    free(filter);
+    return res;
+}
@@ -11,4 +11,6 @@ struct sock_udp {
     unsigned flags;
     int family;
     sockaddr_t peer;
+    uint32_t drops;
+    uint8_t multicast;          /* last packet was sent to a group */
 };